@@ -0,0 +1,134 @@
+#include <block_allocator.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Allocation throughput with 1..N threads, each allocating a batch of single
+// blocks and releasing it again, with one allocation group per CPU against a
+// single group (one lock for the whole data region).
+//   usage: allocation_benchmark [max threads] [seconds per step]
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t data_blocks = 64 * ALLOCATION_GROUP_MIN_BLOCKS;
+constexpr uint64_t bitmap_blocks = data_blocks / (block_size * 8);
+constexpr uint64_t batch = 16;
+
+static simplesnapfs_filesystem_head_t make_layout()
+{
+    simplesnapfs_filesystem_head_t head { };
+    auto & info = head.static_information;
+    info.fs_block_size = block_size;
+    info.checksum_algorithm = CHECKSUM_XXH3;
+    info.data_blocks = data_blocks;
+    info.data_block_bitmap_blk_index = 1;
+    info.data_block_bitmap_blocks = bitmap_blocks;
+    info.redundancy_data_block_bitmap_blk_index = 1 + bitmap_blocks;
+    info.redundancy_data_block_bitmap_blocks = bitmap_blocks;
+    info.data_block_bitmap_checksum_blk_index = 1 + 2 * bitmap_blocks;
+    info.data_block_bitmap_checksum_blocks = 1;
+    info.redundancy_data_block_bitmap_checksum_blk_index = 2 + 2 * bitmap_blocks;
+    info.redundancy_data_block_bitmap_checksum_blocks = 1;
+    info.fs_total_blocks = 3 + 2 * bitmap_blocks;
+    return head;
+}
+
+// operations per second with this many threads
+static double run(block_allocator & allocator, const uint32_t threads, const double seconds)
+{
+    std::atomic < bool > stop = false;
+    std::atomic < uint64_t > operations = 0;
+    std::vector < std::thread > workers;
+    for (uint32_t thread = 0; thread < threads; thread++)
+    {
+        workers.emplace_back([&]
+        {
+            uint64_t blocks[batch];
+            uint64_t local = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                uint64_t allocated = 0;
+                while (allocated < batch && allocator.allocate(blocks[allocated])) {
+                    allocated++;
+                }
+                for (uint64_t i = 0; i < allocated; i++) {
+                    allocator.release(blocks[i]);
+                }
+                local += 2 * allocated;
+            }
+            operations += local;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration < double > (seconds));
+    stop = true;
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    return static_cast<double>(operations) / seconds;
+}
+
+int main(int argc, char ** argv)
+{
+    const uint32_t max_threads = argc > 1 ? std::stoul(argv[1]) : 64;
+    const double seconds = argc > 2 ? std::stod(argv[2]) : 1.0;
+
+    const auto head = make_layout();
+    const std::string path = CMAKE_BINARY_DIR "/allocation_benchmark.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, static_cast<off_t>(head.static_information.fs_total_blocks * block_size)) == -1)
+    {
+        std::cerr << "Cannot create " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    try {
+        block_io io(path, block_size);
+
+        // an empty bitmap with valid checksums
+        const std::vector < char > empty(block_size);
+        char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+        checksum(CHECKSUM_XXH3, empty.data(), block_size, digest);
+        for (const uint64_t region : { head.static_information.data_block_bitmap_checksum_blk_index,
+                                       head.static_information.redundancy_data_block_bitmap_checksum_blk_index })
+        {
+            for (uint64_t block = 0; block < bitmap_blocks; block++) {
+                io.write_range(region * block_size + block * 8, 8, digest);
+            }
+        }
+
+        block_allocator grouped(io, head);
+        block_allocator single(io, head, 1);
+        std::cout << "groups: " << grouped.get_group_count() << ", CPUs: " << std::thread::hardware_concurrency() << std::endl;
+        std::cout << "threads  grouped ops/sec  speedup    single group ops/sec  speedup" << std::endl;
+
+        double grouped_base = 0, single_base = 0;
+        for (uint32_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            const double grouped_rate = run(grouped, threads, seconds);
+            const double single_rate = run(single, threads, seconds);
+            if (threads == 1)
+            {
+                grouped_base = grouped_rate;
+                single_base = single_rate;
+            }
+            std::cout << threads << "\t " << static_cast<uint64_t>(grouped_rate) << "\t" << grouped_rate / grouped_base << "x"
+                      << "\t   " << static_cast<uint64_t>(single_rate) << "\t\t" << single_rate / single_base << "x" << std::endl;
+        }
+        std::cout << "stolen allocations: " << grouped.get_stolen_allocations() << std::endl;
+    } catch (fs_error_t & e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        unlink(path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    unlink(path.c_str());
+    return EXIT_SUCCESS;
+}
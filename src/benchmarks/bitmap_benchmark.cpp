@@ -0,0 +1,117 @@
+#include <bitmap.h>
+#include <debug.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// The hierarchical bitmap against a bit-at-a-time scan of the same on-disk
+// bytes: counting free blocks, and finding free blocks and free runs in a
+// bitmap that is mostly full.
+//   usage: bitmap_benchmark [blocks, millions] [fill percentage]
+
+static bool naive_is_allocated(const std::vector < char > & bytes, const uint64_t block)
+{
+    return (bytes[block / 8] >> (block % 8)) & 1;
+}
+
+static uint64_t naive_count_free(const std::vector < char > & bytes, const uint64_t blocks)
+{
+    uint64_t free_blocks = 0;
+    for (uint64_t block = 0; block < blocks; block++) {
+        free_blocks += !naive_is_allocated(bytes, block);
+    }
+    return free_blocks;
+}
+
+static uint64_t naive_find_run(const std::vector < char > & bytes, const uint64_t blocks, const uint64_t count, const uint64_t hint)
+{
+    for (uint64_t position = hint, length = 0; position < blocks; position++)
+    {
+        length = naive_is_allocated(bytes, position) ? 0 : length + 1;
+        if (length == count) {
+            return position + 1 - count;
+        }
+    }
+    return blocks;
+}
+
+template < typename function_t >
+static double seconds_of(function_t function)
+{
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration < double > (std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char ** argv)
+{
+    const uint64_t blocks = (argc > 1 ? std::stoull(argv[1]) : 64) * 1000 * 1000;
+    const uint64_t fill = argc > 2 ? std::stoull(argv[2]) : 99;
+    constexpr uint64_t lookups = 1000;
+
+    // allocated in runs of random length, a few free blocks and runs in between
+    std::mt19937_64 random(1);
+    bitmap map(blocks);
+    for (uint64_t block = 0; block < blocks;)
+    {
+        const uint64_t run = 1 + random() % 4096;
+        if (random() % 100 < fill) {
+            map.set(block, std::min(run, blocks - block));
+        }
+        block += run;
+    }
+
+    std::vector < char > bytes((blocks + 7) / 8);
+    map.store(bytes.data());
+    std::cout << "blocks: " << blocks << ", free: " << map.get_free_blocks()
+              << ", AVX2: " << (bitmap_is_simd_accelerated() ? "yes" : "no") << std::endl;
+    std::cout << "operation            naive (s)     bitmap (s)    speedup" << std::endl;
+
+    const auto report = [](const std::string & name, const double naive, const double fast) {
+        std::cout << name << "\t" << naive << "\t" << fast << "\t" << naive / fast << "x" << std::endl;
+    };
+
+    uint64_t naive_result = 0, fast_result = 0;
+    report("count free         ",
+        seconds_of([&] { naive_result = naive_count_free(bytes, blocks); }),
+        seconds_of([&] { bitmap copy(blocks); copy.load(bytes.data()); fast_result = copy.get_free_blocks(); }));
+    if (naive_result != fast_result) {
+        log(_log::LOG_ERROR, "Free block counts differ: ", naive_result, " and ", fast_result, "\n");
+        return EXIT_FAILURE;
+    }
+
+    for (const uint64_t run : { 1, 64, 1024 })
+    {
+        std::vector < uint64_t > hints(lookups);
+        for (auto & hint : hints) {
+            hint = random() % blocks;
+        }
+
+        uint64_t naive_sum = 0, fast_sum = 0;
+        const double naive = seconds_of([&] {
+            for (const auto hint : hints) {
+                naive_sum += naive_find_run(bytes, blocks, run, hint);
+            }
+        });
+        const double fast = seconds_of([&] {
+            for (const auto hint : hints)
+            {
+                uint64_t first = blocks;
+                if (!map.find_free_run(run, first, hint) || first < hint) {
+                    first = blocks; // the naive scan does not wrap around
+                }
+                fast_sum += first;
+            }
+        });
+
+        if (naive_sum != fast_sum) {
+            log(_log::LOG_ERROR, "Runs of ", run, " found differ\n");
+            return EXIT_FAILURE;
+        }
+        report("find run of " + std::to_string(run) + (run < 10 ? "      " : run < 1000 ? "     " : "    "), naive, fast);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+#include <block_io.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Cached-hit throughput of block_io::get_block() with 1..N threads,
+// the working set stays resident so this measures the cache alone.
+//   usage: block_io_scaling_benchmark [max threads] [seconds per step]
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t block_count = 4096;
+
+int main(int argc, char ** argv)
+{
+    const uint32_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    const double seconds = argc > 2 ? std::stod(argv[2]) : 1.0;
+
+    const std::string path = CMAKE_BINARY_DIR "/block_io_scaling_benchmark.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, block_size * block_count) == -1)
+    {
+        std::cerr << "Cannot create " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    try {
+        block_io io(path, block_size, { .cache_size = 2 * block_count * block_size });
+
+        // warm up, every block resident afterwards
+        for (uint64_t block = 0; block < block_count; block++) {
+            io.get_block(block);
+        }
+
+        std::cout << "threads  ops/sec        speedup" << std::endl;
+        double single_thread = 0;
+        for (uint32_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            std::atomic < bool > stop = false;
+            std::atomic < uint64_t > operations = 0;
+            std::vector < std::thread > workers;
+            for (uint32_t thread = 0; thread < threads; thread++)
+            {
+                workers.emplace_back([&, thread]
+                {
+                    std::mt19937_64 random(thread);
+                    uint64_t local = 0;
+                    char byte;
+                    while (!stop.load(std::memory_order_relaxed))
+                    {
+                        io.get_block(random() % block_count).read(&byte, 1, 0);
+                        local++;
+                    }
+                    operations += local;
+                });
+            }
+
+            std::this_thread::sleep_for(std::chrono::duration < double > (seconds));
+            stop = true;
+            for (auto & worker : workers) {
+                worker.join();
+            }
+
+            const double rate = static_cast<double>(operations) / seconds;
+            if (threads == 1) {
+                single_thread = rate;
+            }
+            std::cout << threads << "\t " << static_cast<uint64_t>(rate) << "\t" << rate / single_thread << "x" << std::endl;
+        }
+    } catch (fs_error_t & e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        unlink(path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    unlink(path.c_str());
+    return EXIT_SUCCESS;
+}
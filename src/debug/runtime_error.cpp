@@ -6,6 +6,15 @@ const char * sysdarft_errors[] = {
     "Success",
     "Sha512sum checksum error",
     "File operation error",
+    "I/O engine error",
+    "Unknown checksum algorithm",
+    "Invalid filesystem head",
+    "Incompatible checksum trees",
+    "Corrupted data block bitmap",
+    "No valid filesystem layout",
+    "Journal error",
+    "Snapshot error",
+    "Lazy initialization error",
 };
 
 inline std::string init_error_msg(const fs_error_t::error_types_t types)
@@ -0,0 +1,34 @@
+#ifndef ALIGNED_BUFFER_POOL_H
+#define ALIGNED_BUFFER_POOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Recycling allocator for block sized buffers with a fixed alignment
+// (posix_memalign). Released buffers are kept for reuse and only freed
+// when the pool goes away.
+class aligned_buffer_pool
+{
+private:
+    const size_t buffer_size;
+    const size_t alignment;
+    std::vector < char * > free_buffers;
+    uint64_t allocated_buffers = 0;
+
+public:
+    explicit aligned_buffer_pool(size_t _buffer_size, size_t _alignment);
+    ~aligned_buffer_pool();
+
+    aligned_buffer_pool(const aligned_buffer_pool &) = delete;
+    aligned_buffer_pool & operator=(const aligned_buffer_pool &) = delete;
+
+    [[nodiscard]] char * acquire();
+    void release(char * buffer);
+
+    [[nodiscard]] size_t get_alignment() const { return alignment; }
+    [[nodiscard]] uint64_t get_allocated_buffers() const { return allocated_buffers; }
+    [[nodiscard]] uint64_t get_free_buffers() const { return free_buffers.size(); }
+};
+
+#endif //ALIGNED_BUFFER_POOL_H
@@ -1,6 +1,62 @@
 #ifndef BITMAP_H
 #define BITMAP_H
 
+#include <vector>
+#include <functional>
+#include <cstdint>
 
+// In-memory allocation bitmap, one bit per block, set while allocated. Bit j is
+// bit j % 8 of byte j / 8, as in the on-disk data block bitmap. Above it sit
+// summary levels with one bit per 64 bit word of the level below, set when
+// that word is full, so the next free block from any position is found by
+// climbing to the first level with a clear bit and descending again, reading
+// one word per level instead of scanning.
+class bitmap
+{
+private:
+    uint64_t blocks;
+    uint64_t free_blocks = 0;
+    // levels[0] is the bitmap itself. Padding past the end of a level reads as full
+    std::vector < std::vector < uint64_t > > levels;
+
+    // propagate a change of a bitmap word up the summary levels
+    void update_summary(uint64_t word);
+    // summary levels from the bitmap, padding included
+    void build_summary();
+    // first free block at or after position, blocks when there is none
+    [[nodiscard]] uint64_t next_free(uint64_t position) const;
+    // free blocks from block on, counting no further than limit
+    [[nodiscard]] uint64_t free_run_length(uint64_t block, uint64_t limit) const;
+
+public:
+    // all blocks free
+    explicit bitmap(uint64_t _blocks);
+
+    // from and to the on-disk form, (blocks + 7) / 8 bytes
+    void load(const char * data);
+    void store(char * data) const;
+    // length bytes of the on-disk form from byte offset on, zero past the end
+    void store(char * data, uint64_t offset, uint64_t length) const;
+
+    [[nodiscard]] uint64_t size() const { return blocks; }
+    [[nodiscard]] uint64_t get_free_blocks() const { return free_blocks; }
+    // blocks have to lie within the bitmap
+    [[nodiscard]] bool is_allocated(uint64_t block) const;
+    void set(uint64_t first, uint64_t count = 1);
+    void clear(uint64_t first, uint64_t count = 1);
+
+    // first free block at or after hint, wrapping around at the end. False when full
+    [[nodiscard]] bool find_free(uint64_t & block, uint64_t hint = 0) const;
+    // first run of count free blocks starting at or after hint, wrapping around
+    [[nodiscard]] bool find_free_run(uint64_t count, uint64_t & first, uint64_t hint = 0) const;
+    // call function(first, length) for every maximal run of free blocks in [first, end),
+    // runs are clipped at both ends
+    void for_each_free_run(uint64_t first, uint64_t end, const std::function < void (uint64_t, uint64_t) > & function) const;
+};
+
+// clear bits in count words, AVX2 accelerated where the CPU has it
+uint64_t count_free_bits(const uint64_t * words, uint64_t count);
+// whether bitmap scanning runs on AVX2
+bool bitmap_is_simd_accelerated();
 
 #endif //BITMAP_H
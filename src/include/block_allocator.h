@@ -0,0 +1,92 @@
+#ifndef BLOCK_ALLOCATOR_H
+#define BLOCK_ALLOCATOR_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <bitmap.h>
+#include <free_extent_tree.h>
+#include <block_io.h>
+#include <simplesnapfs.h>
+
+#define ALLOCATION_GROUP_MIN_BLOCKS (32768)
+
+// Allocator of the data region. The data block bitmap is loaded from whichever
+// copy its checksums vouch for; flush() writes the bitmap blocks that changed
+// back to both copies, with fresh checksums, so its cost follows the changes
+// made since the previous flush and not the size of the bitmap. Block numbers
+// are relative to the data region, and every member may be called from any
+// thread. Besides the bitmap, free extents are indexed for placing multi-block
+// extents contiguously.
+//
+// The region is split into allocation groups, each with its own slice of the
+// bitmap, free extent index, free counter and lock. A thread allocates from
+// the group of the CPU it runs on (or of the hint) and only moves on to other
+// groups when that one cannot satisfy the request. Groups cover whole bitmap
+// blocks, and runs and extents never cross a group boundary.
+class block_allocator
+{
+private:
+    struct alignas(64) group_t {
+        std::mutex mutex;
+        uint64_t first_block;   // data block number of its first block, the start of a bitmap block
+        bitmap map;
+        free_extent_tree extents;
+        std::atomic < uint64_t > free_blocks;
+        std::vector < bool > dirty;     // per bitmap block of the group, changed since the last flush
+        uint64_t dirty_blocks = 0;
+
+        group_t(uint64_t _first_block, uint64_t blocks, uint64_t segment_blocks);
+    };
+
+    block_io & io;
+    const simplesnapfs_filesystem_head_t & head;
+    checksum_algorithm_t algorithm;
+    uint32_t block_size;
+    uint32_t digest_length;
+    uint64_t group_blocks;
+    std::vector < std::unique_ptr < group_t > > groups;
+    std::atomic < uint64_t > stolen_allocations = 0;
+    std::mutex flush_mutex;
+
+    void load();
+    // the group's bitmap blocks covering these blocks (relative to the group) need writing
+    void mark_dirty(group_t & group, uint64_t first, uint64_t count) const;
+    [[nodiscard]] uint64_t group_of(uint64_t block) const { return block / group_blocks; }
+    // the group of the CPU the calling thread runs on
+    [[nodiscard]] uint64_t local_group() const;
+    // find(group, hint within the group, first) in the preferred group, then in
+    // the others, and allocate count blocks from what it found
+    bool allocate_in_groups(uint64_t count, uint64_t & first, uint64_t hint,
+        const std::function < bool (group_t &, uint64_t, uint64_t &) > & find);
+
+public:
+    // 0 groups means one per CPU, there are never more than one per ALLOCATION_GROUP_MIN_BLOCKS
+    block_allocator(block_io & _io, const simplesnapfs_filesystem_head_t & _head, unsigned int group_count = 0);
+
+    // hint 0 lets the calling thread's group decide
+    bool allocate(uint64_t & block, uint64_t hint = 0);
+    // count contiguous blocks, the first run at or after hint
+    bool allocate_run(uint64_t count, uint64_t & first, uint64_t hint = 0);
+    // count contiguous blocks placed by the free extent index of the calling thread's group
+    bool allocate_extent(uint64_t count, uint64_t & first, free_extent_tree::fit_t fit = free_extent_tree::BEST_FIT);
+    // both throw BlockOutOfRange for blocks beyond the data region
+    void release(uint64_t first, uint64_t count = 1);
+    [[nodiscard]] bool is_allocated(uint64_t block) const;
+    [[nodiscard]] uint64_t get_free_blocks() const;
+    [[nodiscard]] uint64_t get_total_blocks() const { return head.static_information.data_blocks; }
+    [[nodiscard]] uint64_t get_largest_free_extent();
+    [[nodiscard]] uint64_t get_group_count() const { return groups.size(); }
+    // allocations served by another group than the preferred one
+    [[nodiscard]] uint64_t get_stolen_allocations() const { return stolen_allocations; }
+    // bitmap blocks flush() would write
+    [[nodiscard]] uint64_t get_dirty_bitmap_blocks() const;
+    // store the bitmap blocks changed since they were loaded or last flushed,
+    // to both copies and with both copies of their checksums
+    void flush();
+};
+
+#endif //BLOCK_ALLOCATOR_H
@@ -3,44 +3,263 @@
 
 #define _FILE_OFFSET_BITS 64
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
-#include <map>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+#include <buffer_cache.h>
+#include <io_engine.h>
+#include <mapped_file.h>
+#include <readahead.h>
 #include <debug.h>
 
+#define BLOCK_IO_DEFAULT_CACHE_SIZE (128ULL * 1024 * 1024)
+#define BLOCK_IO_DEFAULT_MAX_IO_SIZE (8ULL * 1024 * 1024)
+#define BLOCK_IO_DEFAULT_CACHE_SHARDS (64)
+#define BLOCK_IO_DEFAULT_QUEUE_DEPTH (64)
+#define BLOCK_IO_DEFAULT_READAHEAD_SIZE (2ULL * 1024 * 1024)
+#define BLOCK_IO_DEFAULT_READAHEAD_INITIAL_SIZE (64ULL * 1024)
+#define BLOCK_IO_DEFAULT_READAHEAD_MAX_STRIDE (64)
+#define BLOCK_IO_DEFAULT_DIRTY_BACKGROUND_RATIO (10)
+#define BLOCK_IO_DEFAULT_DIRTY_RATIO (20)
+#define BLOCK_IO_DEFAULT_DIRTY_EXPIRE_MS (30000)
+#define BLOCK_IO_DEFAULT_WRITEBACK_INTERVAL_MS (5000)
+#define BLOCK_IO_DEFAULT_MMAP_CHUNK_SIZE (1ULL * 1024 * 1024 * 1024)
+#define BLOCK_IO_DEFAULT_MMAP_WINDOW_SIZE (16ULL * 1024 * 1024 * 1024)
+
+struct block_io_configuration_t
+{
+    uint64_t cache_size = BLOCK_IO_DEFAULT_CACHE_SIZE; // memory budget of the buffer cache, in bytes
+    uint32_t cache_shards = BLOCK_IO_DEFAULT_CACHE_SHARDS; // upper bound, small caches get fewer shards
+    uint64_t max_io_size = BLOCK_IO_DEFAULT_MAX_IO_SIZE; // largest coalesced write issued by sync(), in bytes
+    io_engine_type_t io_engine = IO_ENGINE_AUTO;
+    uint32_t queue_depth = BLOCK_IO_DEFAULT_QUEUE_DEPTH; // requests in flight at once (io_uring only)
+    bool direct_io = false; // open with O_DIRECT, bypassing the kernel page cache
+
+    // prefetching of sequential and strided scans into the buffer cache
+    uint64_t readahead_size = BLOCK_IO_DEFAULT_READAHEAD_SIZE; // largest window, in bytes, 0 disables readahead
+    uint64_t readahead_initial_size = BLOCK_IO_DEFAULT_READAHEAD_INITIAL_SIZE; // first window of a new stream, in bytes
+    uint32_t readahead_max_stride = BLOCK_IO_DEFAULT_READAHEAD_MAX_STRIDE; // largest stride still detected, in blocks
+
+    // background flusher for the buffer cache, thresholds work like vm.dirty_*:
+    // the *_bytes variants take precedence over the ratios (percent of the cache) when non-zero
+    bool background_writeback = true;
+    uint32_t dirty_background_ratio = BLOCK_IO_DEFAULT_DIRTY_BACKGROUND_RATIO; // flusher writes everything above this
+    uint64_t dirty_background_bytes = 0;
+    uint32_t dirty_ratio = BLOCK_IO_DEFAULT_DIRTY_RATIO; // writers are throttled above this
+    uint64_t dirty_bytes = 0;
+    uint32_t dirty_expire_ms = BLOCK_IO_DEFAULT_DIRTY_EXPIRE_MS; // flusher writes blocks dirty for longer than this
+    uint32_t writeback_interval_ms = BLOCK_IO_DEFAULT_WRITEBACK_INTERVAL_MS; // flusher wakeup period
+
+    // map the device instead of caching it, get_block() then points straight into the mapping
+    bool memory_mapped = false;
+    uint64_t mmap_chunk_size = BLOCK_IO_DEFAULT_MMAP_CHUNK_SIZE; // granularity of (re)mapping, in bytes
+    uint64_t mmap_window_size = BLOCK_IO_DEFAULT_MMAP_WINDOW_SIZE; // address space mapped at once, in bytes
+    access_pattern_t access_pattern = ACCESS_NORMAL; // madvise hint for newly mapped chunks
+};
+
+// Block device access through a buffer cache (or a memory mapping).
+// One block_io can be shared by many threads; handles and views of the same
+// block are not synchronized against each other, that is up to the callers.
 class block_io
 {
 private:
     int fd;
     uint32_t block_size;
     uint64_t total_blocks;
-    std::map < uint64_t /* block number */, std::vector < char > > cache;
+    uint64_t max_io_size;
+    bool direct_io;
+    bool block_device = false;
+    uint32_t logical_sector_size = 0;
+    // created once the device is open, buffer alignment depends on it.
+    // exactly one of cache and mapping exists
+    std::unique_ptr < buffer_cache > cache;
+    std::unique_ptr < mapped_file > mapping;
+    std::unique_ptr < io_engine > engine;
+    // cache mode only, absent when readahead is disabled
+    std::unique_ptr < readahead_tracker > readahead;
+
+    // background writeback, cache mode only. Thresholds are in buffers
+    uint64_t dirty_background_threshold = 0;
+    uint64_t dirty_limit = 0;
+    std::chrono::nanoseconds dirty_expire { };
+    std::chrono::nanoseconds writeback_interval { };
+    std::mutex writeback_mutex;                 // one writeback pass at a time, sync() or flusher
+    std::mutex flusher_mutex;                   // guards the flusher state below
+    std::condition_variable flusher_wakeup;
+    std::condition_variable flusher_pass_done;
+    std::atomic < bool > flusher_kicked = false;
+    bool flusher_stop = false;
+    uint64_t flusher_passes = 0;
+    std::thread flusher;
+
+public:
+    struct io_statistics_t {
+        uint64_t writeback_blocks;      // blocks written by sync()
+        uint64_t writeback_syscalls;    // vectored write requests issued by sync()
+        uint64_t syscalls_saved;        // compared to one write per block
+        uint64_t background_blocks;     // blocks written by the flusher
+        uint64_t background_syscalls;   // vectored write requests issued by the flusher
+        uint64_t throttled_writes;      // writers held back at the dirty limit
+        uint64_t range_read_blocks;     // blocks read from the device by read_range()
+        uint64_t range_read_syscalls;   // vectored read requests issued by read_range()
+    };
+
+    struct readahead_statistics_t {
+        uint64_t windows;               // prefetch windows issued
+        uint64_t blocks_requested;      // blocks in those windows, cached ones included
+        uint64_t blocks_loaded;         // blocks actually read ahead
+        uint64_t hits;                  // read ahead blocks accessed later on
+        uint64_t wasted;                // read ahead blocks evicted unused
+    };
+
+private:
+    struct {
+        std::atomic < uint64_t > writeback_blocks;
+        std::atomic < uint64_t > writeback_syscalls;
+        std::atomic < uint64_t > syscalls_saved;
+        std::atomic < uint64_t > background_blocks;
+        std::atomic < uint64_t > background_syscalls;
+        std::atomic < uint64_t > throttled_writes;
+        std::atomic < uint64_t > range_read_blocks;
+        std::atomic < uint64_t > range_read_syscalls;
+    } io_statistics { };
+
+    void read_block_from_device(buffer_cache::buffer_t & buffer) const;
+    void write_block_to_device(const buffer_cache::buffer_t & buffer) const;
+    // queue a run of buffers with consecutive block numbers as one vectored write
+    std::future < int64_t > submit_run_to_device(const std::vector < buffer_cache::writeback_t > & run);
+    // write the buffers out (caller holds writeback_mutex), returns the number of write requests
+    uint64_t write_back(const std::vector < buffer_cache::writeback_t > & dirty);
+    void flusher_main();
+    void stop_flusher();
+    // after a block got dirty: wake the flusher, hold the writer back at the dirty limit
+    void balance_dirty();
+    // read a window of blocks into the cache in the background
+    void prefetch(const readahead_tracker::window_t & window);
+    // queue a run of reserved buffers with consecutive block numbers as one vectored read
+    void submit_prefetch_run(std::vector < buffer_cache::buffer_t * > & run);
+    // read a run of reserved buffers with consecutive block numbers as one vectored
+    // read, hand each one to consume while it is still pinned, then publish them
+    void read_run_from_device(std::vector < buffer_cache::buffer_t * > & run,
+        const std::function < void (const buffer_cache::buffer_t &) > & consume);
 
+public:
+    // Handle to a cache-resident (or mapped) block. The buffer, or the mapped
+    // chunk, stays pinned for as long as any copy of the handle is alive, so
+    // views into it are stable and accessing it neither allocates nor copies.
     class block_t {
     private:
-        std::vector < char > buffer;
-        std::map < uint64_t /* block number */, std::vector < char > > & cache;
-        const uint64_t block_number;
-        const uint32_t block_size;
+        block_io * io;
+        char * data = nullptr;
+        buffer_cache::buffer_t * buffer = nullptr;
+        mapped_file::chunk_t * chunk = nullptr;
+        uint64_t offset_in_chunk = 0;
 
-        explicit block_t(uint32_t _block_size, uint64_t _block_number, int fd,
-            std::map < uint64_t /* block number */, std::vector < char > > & _cache);
+        // load == false skips reading a block that is not cached, for callers overwriting all of it
+        explicit block_t(block_io & _io, uint64_t _block_number, bool load = true);
+        void pin() const;
+        void unpin() const;
 
     public:
+        block_t(const block_t &);
+        block_t(block_t &&) noexcept;
+        block_t & operator=(const block_t &);
+        block_t & operator=(block_t &&) noexcept;
+        ~block_t();
+
         uint64_t read(char * _buf, uint64_t len, uint64_t off) const;
         uint64_t write(const char * _src, uint64_t len, uint64_t off);
-        ~block_t();
 
-        block_t & operator=(const block_t&) = delete;
+        // read-only view of the cached block
+        [[nodiscard]] std::span < const char > view() const;
+        // writable view, marks the block dirty
+        [[nodiscard]] std::span < char > writable_view();
+
         friend block_io;
     };
 
-public:
-    explicit block_io(const std::string & device_path, uint32_t block_size);
+    // Contiguous view of a run of blocks. Zero-copy when the run lies inside one
+    // mapped chunk (which stays pinned), otherwise the blocks are staged in a
+    // private copy and changes made through writable_view() are stored back by
+    // flush(), or on destruction at the latest.
+    class block_range_t {
+    private:
+        block_io * io;
+        uint64_t first_block;
+        uint64_t count;
+        char * data = nullptr;
+        mapped_file::chunk_t * chunk = nullptr;
+        uint64_t offset_in_chunk = 0;
+        std::vector < char > staging;
+        bool modified = false;
+
+        explicit block_range_t(block_io & _io, uint64_t _first_block, uint64_t _count);
+
+    public:
+        block_range_t(const block_range_t &) = delete;
+        block_range_t & operator=(const block_range_t &) = delete;
+        block_range_t(block_range_t &&) noexcept;
+        block_range_t & operator=(block_range_t &&) = delete;
+        ~block_range_t();
+
+        [[nodiscard]] std::span < const char > view() const { return { data, count * io->block_size }; }
+        // writable view, marks the whole range dirty
+        [[nodiscard]] std::span < char > writable_view();
+        // store changes made to a staged copy, no-op for zero-copy ranges
+        void flush();
+        [[nodiscard]] bool is_zero_copy() const { return chunk != nullptr; }
+
+        friend block_io;
+    };
+
+    explicit block_io(const std::string & device_path, uint32_t block_size,
+        const block_io_configuration_t & configuration = { });
     [[nodiscard]] uint64_t get_total_blocks() const { return total_blocks; }
+    [[nodiscard]] uint32_t get_block_size() const { return block_size; }
+    [[nodiscard]] bool is_direct_io() const { return direct_io; }
+    // smallest unit the device accepts for direct I/O, 0 when not in direct mode
+    [[nodiscard]] uint32_t get_logical_sector_size() const { return logical_sector_size; }
+    [[nodiscard]] bool is_memory_mapped() const { return mapping != nullptr; }
+    // only meaningful for the respective mode
+    [[nodiscard]] buffer_cache::statistics_t get_cache_statistics() const { return cache ? cache->get_statistics() : buffer_cache::statistics_t { }; }
+    [[nodiscard]] mapped_file::statistics_t get_mapping_statistics() const { return mapping ? mapping->get_statistics() : mapped_file::statistics_t { }; }
+    [[nodiscard]] io_statistics_t get_io_statistics() const {
+        return { io_statistics.writeback_blocks, io_statistics.writeback_syscalls, io_statistics.syscalls_saved,
+            io_statistics.background_blocks, io_statistics.background_syscalls, io_statistics.throttled_writes,
+            io_statistics.range_read_blocks, io_statistics.range_read_syscalls };
+    }
+    [[nodiscard]] readahead_statistics_t get_readahead_statistics() const;
+    // buffers waiting for writeback, 0 for mapped I/O
+    [[nodiscard]] uint64_t get_dirty_blocks() const { return cache ? cache->get_dirty_buffers() : 0; }
+    // the engine requests are sent through, usable for asynchronous raw I/O on the device
+    [[nodiscard]] io_engine & get_io_engine() { return *engine; }
     ~block_io();
     void sync();
     block_t get_block(uint64_t /* block number */);
+    // count blocks from first_block on as one contiguous buffer
+    block_range_t get_blocks(uint64_t first_block, uint64_t count);
+    // byte ranges spanning any number of blocks, clipped at the end of the device.
+    // Runs of uncached blocks are read with single large requests, blocks
+    // overwritten entirely are never read. Return the bytes transferred
+    uint64_t read_range(uint64_t offset, uint64_t len, char * buf);
+    uint64_t write_range(uint64_t offset, uint64_t len, const char * buf);
+    // zero a run of blocks without sending them over: BLKZEROOUT on block devices,
+    // fallocate() on files. Where neither works the zeros are written, false then.
+    // Cached copies of the blocks are dropped
+    bool zero_blocks(uint64_t first_block, uint64_t count);
+    // tell the device the blocks are unused (BLKDISCARD, or holes punched into
+    // files), their contents are undefined afterwards. False when not supported
+    bool discard_blocks(uint64_t first_block, uint64_t count);
+    // access pattern hint for a range of blocks (madvise/posix_fadvise)
+    void advise(uint64_t first_block, uint64_t blocks, access_pattern_t pattern);
 };
 
 #endif //BLOCK_IO_H
@@ -0,0 +1,162 @@
+#ifndef BUFFER_CACHE_H
+#define BUFFER_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <aligned_buffer_pool.h>
+
+// Fixed-budget LRU cache of device blocks with per-buffer dirty tracking.
+// Clean buffers are dropped on eviction, dirty buffers are handed to the
+// writeback handler first, without the shard lock: lookups of the block wait
+// until it reached the device and is gone. Pinned buffers are never evicted; while everything
+// is pinned the cache temporarily grows past its budget.
+//
+// The cache is split into shards by block number, each with its own lock,
+// LRU list and share of the budget, so concurrent users only contend when
+// they hit the same shard. Neither misses nor readahead read the device under
+// the shard lock: the buffer goes into the index marked as loading, and
+// lookups of that block wait for it while the rest of the shard is served.
+class buffer_cache
+{
+public:
+    struct buffer_t {
+        const uint64_t block_number;
+        char * const data;                      // block_size bytes from the aligned buffer pool
+        std::atomic < uint32_t > pin_count { 0 };
+
+        // dirty while modifications != written. modifications only grows,
+        // writeback records the generation it wrote out
+        std::atomic < uint64_t > modifications { 0 };
+        std::atomic < uint64_t > written { 0 };
+        // whether the buffer is in the dirty count, and since when (steady clock, ns).
+        // may lag behind is_dirty() for a moment while a write races with writeback
+        std::atomic < bool > accounted { false };
+        std::atomic < uint64_t > dirtied_at { 0 };
+
+        // guarded by the shard lock
+        bool loading = false;       // being read from the device, data not there yet
+        bool writing_back = false;  // dirty victim of an eviction being written out, pinned meanwhile
+        bool prefetched = false;    // brought in by readahead and not accessed since
+        bool orphaned = false;      // invalidated while in use, out of the index until released
+
+        buffer_t(const uint64_t _block_number, char * _data) : block_number(_block_number), data(_data) { }
+
+        [[nodiscard]] bool is_dirty() const { return modifications.load(std::memory_order_acquire) != written.load(std::memory_order_acquire); }
+    };
+
+    struct statistics_t {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t dirty_evictions;
+        uint64_t prefetched;        // blocks loaded by readahead
+        uint64_t prefetch_hits;     // of those, accessed before being evicted
+        uint64_t prefetch_wasted;   // of those, evicted without ever being accessed
+    };
+
+    // one buffer picked up for writeback, pinned until finish_writeback()
+    struct writeback_t {
+        buffer_t * buffer;
+        uint64_t generation;    // modification count when it was picked up
+        bool exclusive;         // nobody else held the buffer at that time
+    };
+
+    // flush one dirty buffer to the device
+    using writeback_handler_t = std::function < void (const buffer_t &) >;
+    // fill a freshly allocated buffer from the device
+    using load_handler_t = std::function < void (buffer_t &) >;
+
+private:
+    struct shard_t {
+        std::mutex mutex;
+        std::condition_variable loaded;     // a reserved buffer finished loading
+        // most recently used at the front
+        std::list < buffer_t > lru_list;
+        std::unordered_map < uint64_t /* block number */, std::list < buffer_t >::iterator > index;
+        // invalidated buffers still pinned or loading, never looked up or written back
+        std::list < buffer_t > orphans;
+        aligned_buffer_pool pool;
+        statistics_t statistics { };
+
+        shard_t(const uint32_t block_size, const size_t alignment) : pool(block_size, alignment) { }
+    };
+
+    const uint32_t block_size;
+    uint64_t capacity_in_blocks;
+    uint64_t capacity_per_shard;
+    uint32_t shard_shift;
+    std::vector < std::unique_ptr < shard_t > > shards;
+    writeback_handler_t writeback_handler;
+    std::atomic < uint64_t > dirty_buffers { 0 };
+
+    // record a writeback of the given generation, the buffer is clean unless modified since
+    void mark_written(buffer_t & buffer, uint64_t generation);
+    [[nodiscard]] shard_t & shard_of(uint64_t block_number) const;
+    // make room for one more buffer, returns the storage of the victim for reuse
+    // (nullptr when every buffer is pinned). shard lock must be held through lock,
+    // it is let go while a dirty victim is written back
+    char * evict_one(shard_t & shard, std::unique_lock < std::mutex > & lock);
+    // room for one more buffer in the shard, recycled or freshly allocated.
+    // Lets go of the lock like evict_one(), the index may have changed on return
+    char * make_room(shard_t & shard, std::unique_lock < std::mutex > & lock);
+    void shrink_to_capacity(shard_t & shard, std::unique_lock < std::mutex > & lock);
+    // free the orphans nobody holds any more. shard lock must be held
+    void release_orphans(shard_t & shard);
+
+public:
+    explicit buffer_cache(uint32_t _block_size, uint64_t capacity /* in bytes */, uint32_t shard_count,
+        size_t alignment, writeback_handler_t _writeback_handler);
+    ~buffer_cache();
+
+    buffer_cache(const buffer_cache &) = delete;
+    buffer_cache & operator=(const buffer_cache &) = delete;
+
+    // lookup a block and pin it, loading it through the loader on miss.
+    // a null loader leaves the new buffer uninitialized (caller overwrites the whole block)
+    buffer_t & get_pinned(uint64_t block_number, const load_handler_t & loader);
+
+    // reserve a buffer for a block that is about to be read asynchronously, pinned
+    // and invisible to lookups (they wait) until complete_reservation().
+    // nullptr when the block is cached already
+    buffer_t * reserve(uint64_t block_number);
+    // publish a reserved buffer, or drop it when loading failed. Buffers loaded
+    // on demand rather than by readahead do not count as prefetched
+    void complete_reservation(buffer_t & buffer, bool loaded, bool prefetched = true);
+
+    // pinned buffers stay resident (and keep their address) until unpinned.
+    // pin() only adds to an existing pin, the first one comes from get_pinned()
+    static void pin(buffer_t & buffer) { buffer.pin_count.fetch_add(1, std::memory_order_acq_rel); }
+    static void unpin(buffer_t & buffer) { buffer.pin_count.fetch_sub(1, std::memory_order_acq_rel); }
+
+    // to be called by whoever modifies a pinned buffer
+    void mark_dirty(buffer_t & buffer);
+    [[nodiscard]] uint64_t get_dirty_buffers() const { return dirty_buffers.load(std::memory_order_relaxed); }
+
+    // pin every dirty buffer (dirtied no later than dirtied_before, steady clock ns)
+    // for writeback, in ascending block order
+    [[nodiscard]] std::vector < writeback_t > collect_dirty(uint64_t dirtied_before = UINT64_MAX);
+    // release what collect_dirty() picked up. Buffers that were written and
+    // not held by anyone else at pickup time become clean, unless modified since
+    void finish_writeback(const std::vector < writeback_t > & buffers, bool written);
+
+    // the device range was overwritten behind the cache's back: drop the buffers
+    // of these blocks, dirty ones included. Buffers in use leave the index but
+    // keep their contents for their holders, and whatever a load still in
+    // flight brings in is discarded; the next lookup reads the device again
+    void invalidate(uint64_t first_block, uint64_t count);
+
+    [[nodiscard]] statistics_t get_statistics() const;
+    [[nodiscard]] uint64_t get_capacity_in_blocks() const { return capacity_in_blocks; }
+    [[nodiscard]] uint32_t get_shard_count() const { return static_cast<uint32_t>(shards.size()); }
+    [[nodiscard]] uint64_t size() const;
+};
+
+#endif //BUFFER_CACHE_H
@@ -1,9 +1,70 @@
 #ifndef CHECKSUM_H
 #define CHECKSUM_H
 
+#include <span>
 #include <array>
+#include <string>
+#include <vector>
 #include <cstdint>
 
+struct evp_md_ctx_st;
+
+// digest stored per data block (and bitmap block) on disk, selected at mkfs time.
+// The numeric values are part of the on-disk format
+enum checksum_algorithm_t : uint32_t {
+    CHECKSUM_SHA512 = 0,    // 64 bytes, cryptographic, slowest
+    CHECKSUM_CRC32C = 1,    // 4 bytes, SSE4.2 accelerated where available
+    CHECKSUM_XXH3 = 2,      // 8 bytes, XXH3 64 bit
+    CHECKSUM_BLAKE3 = 3,    // 32 bytes, cryptographic
+};
+
+#define CHECKSUM_MAX_DIGEST_LENGTH (64)
+
 std::array<char, 64> sha512sum(const char* _data, uint64_t _dt_len);
 
+// Incremental SHA-512, for data that is not in one piece. OpenSSL contexts are
+// kept in a per-thread cache, so creating hashers allocates nothing once warm
+class sha512_hasher
+{
+private:
+    evp_md_ctx_st * ctx;
+
+public:
+    sha512_hasher();
+    sha512_hasher(const sha512_hasher &) = delete;
+    sha512_hasher & operator=(const sha512_hasher &) = delete;
+    sha512_hasher(sha512_hasher && other) noexcept : ctx(other.ctx) { other.ctx = nullptr; }
+    sha512_hasher & operator=(sha512_hasher &&) = delete;
+    ~sha512_hasher();
+
+    sha512_hasher & update(const char* _data, uint64_t _dt_len);
+    // digest of everything since construction (or the last final()), then starts over
+    std::array<char, 64> final();
+};
+
+// digests of many independent buffers, in order. Large batches are spread over
+// all CPUs, each thread hashing its share with a single reused context
+std::vector < std::array<char, 64> > sha512sum_batch(std::span < const std::span < const char > > buffers);
+
+// continue a running checksum by passing the previous result as crc
+uint32_t crc32c(const char* _data, uint64_t _dt_len, uint32_t crc = 0);
+uint64_t xxh3_64(const char* _data, uint64_t _dt_len);
+std::array<char, 32> blake3sum(const char* _data, uint64_t _dt_len);
+
+// digest length of an algorithm, 0 when unknown
+uint32_t checksum_digest_length(checksum_algorithm_t algorithm);
+const char * checksum_algorithm_name(checksum_algorithm_t algorithm);
+// parse a name as printed by checksum_algorithm_name(), false when unknown
+bool checksum_algorithm_from_name(const std::string & name, checksum_algorithm_t & algorithm);
+// whether crc32c() runs on the CPU's CRC32 instruction
+bool crc32c_is_hardware_accelerated();
+
+// store the digest of the data in its on-disk form (integers little endian),
+// checksum_digest_length(algorithm) bytes
+void checksum(checksum_algorithm_t algorithm, const char* _data, uint64_t _dt_len, char* _digest);
+
+// digest of a block of zeros, computed once per algorithm and block size and
+// kept for the life of the process
+const char * zero_block_checksum(checksum_algorithm_t algorithm, uint32_t block_size);
+
 #endif //CHECKSUM_H
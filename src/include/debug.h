@@ -30,7 +30,16 @@ public:
     enum error_types_t {
         SUCCESS,
         SHA512SUM_CHECKSUM_ERROR,
-        FILE_OPERATION_ERROR
+        FILE_OPERATION_ERROR,
+        IO_ENGINE_ERROR,
+        CHECKSUM_ALGORITHM_ERROR,
+        FILESYSTEM_HEAD_ERROR,
+        CHECKSUM_TREE_ERROR,
+        BITMAP_ERROR,
+        LAYOUT_ERROR,
+        JOURNAL_ERROR,
+        SNAPSHOT_ERROR,
+        LAZY_INITIALIZATION_ERROR
     };
 
     explicit fs_error_t(error_types_t);
@@ -43,6 +52,71 @@ public:
     explicit Sha512sumChecksumError() : fs_error_t(SHA512SUM_CHECKSUM_ERROR) { }
 };
 
+class UnknownChecksumAlgorithm final : public fs_error_t {
+public:
+    explicit UnknownChecksumAlgorithm() : fs_error_t(CHECKSUM_ALGORITHM_ERROR) { }
+};
+
+class InvalidFilesystemHead final : public fs_error_t {
+public:
+    explicit InvalidFilesystemHead() : fs_error_t(FILESYSTEM_HEAD_ERROR) { }
+};
+
+class IncompatibleChecksumTree final : public fs_error_t {
+public:
+    explicit IncompatibleChecksumTree() : fs_error_t(CHECKSUM_TREE_ERROR) { }
+};
+
+class CorruptedBitmap final : public fs_error_t {
+public:
+    explicit CorruptedBitmap() : fs_error_t(BITMAP_ERROR) { }
+};
+
+class BlockOutOfRange final : public fs_error_t {
+public:
+    explicit BlockOutOfRange() : fs_error_t(BITMAP_ERROR) { }
+};
+
+class InvalidLayout final : public fs_error_t {
+public:
+    explicit InvalidLayout() : fs_error_t(LAYOUT_ERROR) { }
+};
+
+class CorruptedJournal final : public fs_error_t {
+public:
+    explicit CorruptedJournal() : fs_error_t(JOURNAL_ERROR) { }
+};
+
+class TransactionTooLarge final : public fs_error_t {
+public:
+    explicit TransactionTooLarge() : fs_error_t(JOURNAL_ERROR) { }
+};
+
+class InvalidSnapshotVolume final : public fs_error_t {
+public:
+    explicit InvalidSnapshotVolume() : fs_error_t(SNAPSHOT_ERROR) { }
+};
+
+class NoSuchSnapshot final : public fs_error_t {
+public:
+    explicit NoSuchSnapshot() : fs_error_t(SNAPSHOT_ERROR) { }
+};
+
+class VolumeFull final : public fs_error_t {
+public:
+    explicit VolumeFull() : fs_error_t(SNAPSHOT_ERROR) { }
+};
+
+class InvalidSnapshotStream final : public fs_error_t {
+public:
+    explicit InvalidSnapshotStream() : fs_error_t(SNAPSHOT_ERROR) { }
+};
+
+class LazyInitializationConflict final : public fs_error_t {
+public:
+    explicit LazyInitializationConflict() : fs_error_t(LAZY_INITIALIZATION_ERROR) { }
+};
+
 class CannotOpenFile final : public fs_error_t {
 public:
     explicit CannotOpenFile() : fs_error_t(FILE_OPERATION_ERROR) { }
@@ -68,6 +142,26 @@ public:
     explicit WriteFailed() : fs_error_t(FILE_OPERATION_ERROR) { }
 };
 
+class MappingFailed final : public fs_error_t {
+public:
+    explicit MappingFailed() : fs_error_t(FILE_OPERATION_ERROR) { }
+};
+
+class UnalignedBlockSize final : public fs_error_t {
+public:
+    explicit UnalignedBlockSize() : fs_error_t(FILE_OPERATION_ERROR) { }
+};
+
+class IoEngineSetupFailed final : public fs_error_t {
+public:
+    explicit IoEngineSetupFailed() : fs_error_t(IO_ENGINE_ERROR) { }
+};
+
+class IoEngineSubmissionFailed final : public fs_error_t {
+public:
+    explicit IoEngineSubmissionFailed() : fs_error_t(IO_ENGINE_ERROR) { }
+};
+
 namespace _log
 {
     enum console_color_t { RED, GREEN, BLUE, PURPLE, YELLOW, CYAN, CLEAR, BOLD };
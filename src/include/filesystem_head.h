@@ -0,0 +1,14 @@
+#ifndef FILESYSTEM_HEAD_H
+#define FILESYSTEM_HEAD_H
+
+#include <block_io.h>
+#include <simplesnapfs.h>
+
+// read the head at the start of the device and check it describes a layout this
+// device and block size can hold. Damaged dynamic information is taken from its
+// backup when that is intact. Throws InvalidFilesystemHead otherwise
+simplesnapfs_filesystem_head_t load_filesystem_head(block_io & io);
+// rewrite the head and the dynamic information backup after the dynamic information changed
+void store_dynamic_information(block_io & io, simplesnapfs_filesystem_head_t & head);
+
+#endif //FILESYSTEM_HEAD_H
@@ -0,0 +1,60 @@
+#ifndef FREE_EXTENT_TREE_H
+#define FREE_EXTENT_TREE_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <cstdint>
+#include <bitmap.h>
+
+// Index of the free extents of a bitmap, every maximal run of free blocks
+// kept twice: ordered by offset, for next-fit and for merging neighbours, and
+// by (length, offset), for best-fit. The bitmap stays the authority: the
+// owner reports every change it makes to it, and parts of the index can be
+// dropped and are rebuilt from the bitmap on the next lookup, one segment
+// (the blocks of one on-disk bitmap block) at a time.
+class free_extent_tree
+{
+public:
+    enum fit_t {
+        BEST_FIT,   // the smallest extent large enough, lowest offset first
+        NEXT_FIT,   // the first extent large enough after the previous allocation
+    };
+
+private:
+    const bitmap & map;
+    uint64_t segment_blocks;
+    std::vector < bool > stale;     // segments whose extents are not in the index
+    uint64_t stale_segments;
+    std::map < uint64_t, uint64_t > by_offset;              // first block, length
+    std::set < std::pair < uint64_t, uint64_t > > by_length; // length, first block
+    uint64_t cursor = 0;            // where next-fit continues
+
+    void add(uint64_t first, uint64_t length);
+    void erase(std::map < uint64_t, uint64_t >::iterator extent);
+    // add a free run, merged with the extents it touches
+    void insert(uint64_t first, uint64_t length);
+    // take a run of blocks out of the extents overlapping it
+    void remove(uint64_t first, uint64_t count);
+    void rebuild_stale_segments();
+
+public:
+    // nothing is indexed until the first lookup
+    free_extent_tree(const bitmap & _map, uint64_t _segment_blocks);
+
+    // the owner set or cleared these bits in the bitmap
+    void allocated(uint64_t first, uint64_t count);
+    void released(uint64_t first, uint64_t count);
+    // the bitmap changed behind the index's back, rebuild the segments covering these blocks
+    void invalidate(uint64_t first, uint64_t count);
+
+    // an extent of count free blocks, false when there is none. The index is
+    // left as it is, report the allocation with allocated()
+    [[nodiscard]] bool find(uint64_t count, uint64_t & first, fit_t fit = BEST_FIT);
+    [[nodiscard]] uint64_t get_extents();
+    [[nodiscard]] uint64_t get_largest_extent();
+    // every extent in offset order, first block and length
+    [[nodiscard]] std::vector < std::pair < uint64_t, uint64_t > > get_all_extents();
+};
+
+#endif //FREE_EXTENT_TREE_H
@@ -0,0 +1,78 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#define _FILE_OFFSET_BITS 64
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <future>
+#include <functional>
+#include <sys/uio.h>
+
+enum io_engine_type_t {
+    IO_ENGINE_AUTO,         // io_uring when the kernel supports it, synchronous otherwise
+    IO_ENGINE_SYNC,
+    IO_ENGINE_IO_URING
+};
+
+// Request submission interface used by block_io, safe to share between threads.
+// Requests are queued by submit_*() and handed to the kernel by flush().
+// Completion handlers receive the transferred byte count or -errno; the
+// synchronous engine runs them inline, io_uring on its completion thread.
+// The buffers an iovec points to must stay valid until the request completes.
+class io_engine
+{
+public:
+    using completion_handler_t = std::function < void (int64_t /* result */) >;
+
+protected:
+    const int fd;
+
+public:
+    explicit io_engine(const int _fd) : fd(_fd) { }
+    virtual ~io_engine() = default;
+
+    virtual void submit_readv(uint64_t offset, std::vector < iovec > iov, completion_handler_t handler) = 0;
+    virtual void submit_writev(uint64_t offset, std::vector < iovec > iov, completion_handler_t handler) = 0;
+    virtual void submit_fsync(completion_handler_t handler) = 0;
+
+    // hand every queued request to the kernel
+    virtual void flush() = 0;
+    // wait until nothing is in flight anymore (from any thread)
+    virtual void wait_all() = 0;
+    [[nodiscard]] virtual uint64_t in_flight() const = 0;
+    [[nodiscard]] virtual const char * name() const = 0;
+
+    // future flavored submission, flushed right away
+    std::future < int64_t > readv_async(uint64_t offset, std::vector < iovec > iov);
+    std::future < int64_t > writev_async(uint64_t offset, std::vector < iovec > iov);
+    std::future < int64_t > fsync_async();
+
+    // blocking single requests. These go straight to preadv/pwritev/fsync:
+    // a lone request gains nothing from a queue
+    int64_t readv(uint64_t offset, std::vector < iovec > iov);
+    int64_t writev(uint64_t offset, std::vector < iovec > iov);
+    int64_t fsync();
+};
+
+// Plain preadv/pwritev/fsync, carried out (and completed) at submission time.
+class sync_io_engine final : public io_engine
+{
+public:
+    explicit sync_io_engine(int _fd) : io_engine(_fd) { }
+
+    void submit_readv(uint64_t offset, std::vector < iovec > iov, completion_handler_t handler) override;
+    void submit_writev(uint64_t offset, std::vector < iovec > iov, completion_handler_t handler) override;
+    void submit_fsync(completion_handler_t handler) override;
+
+    void flush() override { }
+    void wait_all() override { }
+    [[nodiscard]] uint64_t in_flight() const override { return 0; }
+    [[nodiscard]] const char * name() const override { return "sync"; }
+};
+
+// create the requested engine, falling back to the synchronous one when
+// io_uring is unavailable and the choice was IO_ENGINE_AUTO
+std::unique_ptr < io_engine > make_io_engine(int fd, io_engine_type_t type, uint32_t queue_depth);
+
+#endif //IO_ENGINE_H
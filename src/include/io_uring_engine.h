@@ -0,0 +1,90 @@
+#ifndef IO_URING_ENGINE_H
+#define IO_URING_ENGINE_H
+
+#include <io_engine.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <linux/io_uring.h>
+
+// io_uring backend talking to the kernel through the raw syscalls.
+// Up to queue_depth requests are in flight at once; submission is batched
+// until flush() (or until the submission queue runs full). A dedicated
+// thread reaps completions and runs the handlers. Should waiting for
+// completions fail, every outstanding request completes with that error
+// and later submissions throw IoEngineSubmissionFailed. Should submitting
+// fail, the requests the kernel did not take complete with that error
+// before IoEngineSubmissionFailed is thrown, and the ring stays usable.
+class io_uring_engine final : public io_engine
+{
+private:
+    struct request_t {
+        std::vector < iovec > iov;
+        completion_handler_t handler;
+    };
+
+    int ring_fd = -1;
+    uint32_t queue_depth;
+
+    void * sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void * cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    io_uring_sqe * sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned * sq_head = nullptr;
+    unsigned * sq_tail = nullptr;
+    unsigned * sq_mask = nullptr;
+    unsigned * sq_array = nullptr;
+    unsigned * cq_head = nullptr;
+    unsigned * cq_tail = nullptr;
+    unsigned * cq_mask = nullptr;
+    io_uring_cqe * cqes = nullptr;
+
+    // request slots, indexed by sqe user_data.
+    // everything below is guarded by ring_mutex, except the completion
+    // ring which only the reaper thread touches
+    mutable std::mutex ring_mutex;
+    std::condition_variable state_changed;     // a slot got released or a request finished
+    std::vector < request_t > requests;
+    std::vector < uint32_t > free_slots;
+    uint32_t pending_submissions = 0;
+    uint64_t requests_in_flight = 0;
+    int failed_errno = 0;                   // set once the reaper gave up, the ring is unusable
+
+    std::thread reaper;
+
+    void release_rings();
+    // submit what is queued, with ring_mutex held through lock
+    void flush_locked(std::unique_lock < std::mutex > & lock);
+    // take back the queued entries the kernel refused and complete their requests with -error
+    void fail_unsubmitted(std::unique_lock < std::mutex > & lock, int error);
+    void reap_completions();
+    // complete every outstanding request with -error, called by the reaper as it gives up
+    void fail_outstanding(int error);
+    // queue one sqe and publish it, returns with ring_mutex still held by the caller
+    void queue_sqe(std::unique_lock < std::mutex > & lock, uint8_t opcode, uint64_t offset, request_t request);
+
+public:
+    // throws IoEngineSetupFailed when the kernel refuses to create the ring
+    explicit io_uring_engine(int _fd, uint32_t _queue_depth);
+    ~io_uring_engine() override;
+
+    // probe once whether the running kernel lets us create a ring
+    static bool is_supported();
+
+    io_uring_engine(const io_uring_engine &) = delete;
+    io_uring_engine & operator=(const io_uring_engine &) = delete;
+
+    void submit_readv(uint64_t offset, std::vector < iovec > iov, completion_handler_t handler) override;
+    void submit_writev(uint64_t offset, std::vector < iovec > iov, completion_handler_t handler) override;
+    void submit_fsync(completion_handler_t handler) override;
+
+    void flush() override;
+    void wait_all() override;
+    [[nodiscard]] uint64_t in_flight() const override;
+    [[nodiscard]] const char * name() const override { return "io_uring"; }
+};
+
+#endif //IO_URING_ENGINE_H
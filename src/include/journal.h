@@ -0,0 +1,203 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <exception>
+#include <condition_variable>
+#include <block_io.h>
+#include <simplesnapfs.h>
+#include <lazy_initializer.h>
+
+#define JOURNAL_SUPERBLOCK_MAGIC (0x9CDA317F6B00A001ULL)
+#define JOURNAL_RECORD_MAGIC (0x9CDA317F6B00A002ULL)
+#define JOURNAL_RECOVERY_READ_SIZE (8ULL * 1024 * 1024)
+
+// first block of the journaling buffer, the log is every block after it
+struct journal_superblock_t {
+    uint64_t magic;
+    uint64_t log_id;            // random, set when the log is created, carried by every record
+    uint64_t log_blocks;
+    // the first record not checkpointed yet and where it starts. Positions count
+    // blocks written since the log was created, the block on disk is position % log_blocks
+    uint64_t tail_sequence;
+    uint64_t tail_position;
+    char checksum[64];          // SHA-512 of the above
+};
+
+// starts every record, followed by the block numbers of its targets (spilling over
+// into descriptor_blocks - 1 more blocks), then a copy of every target block.
+// A record is committed when its checksum matches, a torn one never does
+struct journal_record_header_t {
+    uint64_t magic;
+    uint64_t log_id;
+    uint64_t sequence;
+    uint64_t position;
+    uint64_t targets;
+    uint64_t descriptor_blocks;
+    uint64_t transactions;      // merged into this record by group commit
+    // the whole record with this field zeroed, in the filesystem's checksum algorithm
+    char checksum[CHECKSUM_MAX_DIGEST_LENGTH];
+};
+
+struct journal_configuration_t
+{
+    // how long the first waiting transaction may wait for others to join its commit
+    std::chrono::microseconds commit_interval = std::chrono::milliseconds(5);
+    // commit early once this many blocks are waiting, 0 means a quarter of the log
+    uint64_t max_group_blocks = 0;
+    // replay reads the log in pieces of up to this many bytes
+    uint64_t recovery_read_size = JOURNAL_RECOVERY_READ_SIZE;
+    unsigned int recovery_threads = 0; // verifying record checksums, 0 means one per CPU
+};
+
+struct journal_statistics_t {
+    uint64_t transactions;      // committed
+    uint64_t records;           // written to the log, one per group commit
+    uint64_t flushes;           // device flushes for records and checkpoints
+    uint64_t journaled_blocks;  // target blocks written to the log
+    uint64_t checkpoints;
+    uint64_t replayed_records;  // found committed in the log when opened
+    uint64_t replayed_blocks;   // written home by replay, each once however many records held it
+    uint64_t replay_read_bytes; // of the log, while looking for committed records
+    double replay_seconds;
+};
+
+// Write-ahead journal over the journaling buffer region. A transaction collects
+// whole block images; commit() returns once they are safely in the log, and
+// only then are they written to their home locations (through block_io, which
+// writes them back whenever it likes). Transactions committed while the log is
+// busy, or within commit_interval of each other, are merged into one record
+// written with one request and made durable with one flush, a block changed by
+// several of them going in once with its latest contents. So the flush rate
+// stays bounded by the commit interval however many transactions come in.
+//
+// The log is circular. When a record does not fit in what is left, the journal
+// checkpoints: block_io is synced so every home location is on the device, and
+// the superblock moves the tail up to the head. Closing the journal checkpoints,
+// so a cleanly closed log is empty.
+//
+// Opening it recovers from a crash. The log is read from the tail in pieces
+// growing up to recovery_read_size, a piece's records are checksummed side by
+// side on a pool, and the committed ones, up to the first that is not, are
+// noted down: which log block holds the newest image of each home block. Those
+// images alone are then read, in log order, and written home, so a block
+// journaled many times is written once, and an empty log costs one block read.
+// The time taken follows what was not checkpointed, not the size of the log.
+// With lazy initialization pending, open the journal before starting the
+// initializer: replay has to see the log as it was.
+class journal
+{
+public:
+    class transaction_t
+    {
+    private:
+        journal * owner;
+        std::map < uint64_t, std::vector < char > > blocks;   // device block number, new contents
+
+        explicit transaction_t(journal & _owner) : owner(&_owner) { }
+
+    public:
+        // change part of a block, clipped at its end. The rest of the block is
+        // read when the transaction first touches it. Returns the bytes written
+        uint64_t write(uint64_t block, const char * data, uint64_t len, uint64_t offset = 0);
+        [[nodiscard]] uint64_t size() const { return blocks.size(); }
+
+        friend journal;
+    };
+
+private:
+    using buffer_t = std::unique_ptr < char, decltype(&free) >;
+
+    struct pending_t {
+        uint64_t ticket;
+        std::chrono::steady_clock::time_point queued;
+        transaction_t transaction;
+    };
+
+    block_io & io;
+    lazy_initializer * initializer;
+    journal_configuration_t configuration;
+    uint32_t block_size;
+    checksum_algorithm_t algorithm;
+    uint64_t superblock_index;
+    uint64_t log_blocks;
+    uint64_t max_group_blocks;
+    uint64_t header_targets;        // block numbers fitting behind the record header
+    uint64_t descriptor_targets;    // block numbers fitting in a following descriptor block
+
+    // the log, guarded by log_mutex
+    std::mutex log_mutex;
+    uint64_t log_id = 0;
+    uint64_t tail_sequence = 1;
+    uint64_t tail_position = 0;
+    uint64_t head_sequence = 1;     // of the next record
+    uint64_t head_position = 0;
+
+    // waiting transactions, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable committed;
+    std::deque < pending_t > pending;
+    uint64_t pending_blocks = 0;
+    uint64_t next_ticket = 1;
+    uint64_t committed_ticket = 0;
+    bool stopping = false;
+    std::exception_ptr error;       // the journal is unusable once set
+    journal_statistics_t statistics { };
+    std::thread committer;
+
+    // zeroed, aligned for direct I/O
+    [[nodiscard]] buffer_t allocate_buffer(uint64_t blocks) const;
+    [[nodiscard]] uint64_t record_blocks(uint64_t targets) const;
+    // zero what lazy initialization has not yet, before the log is written there
+    void prepare_log(uint64_t position, uint64_t blocks);
+    // the log is circular, a request at its end is continued at its start
+    void read_log(uint64_t position, uint64_t blocks, char * buffer);
+    void write_log(uint64_t position, uint64_t blocks, const char * buffer);
+    void flush_device();
+    void store_superblock();
+    void load_superblock();
+    // the header of a record that may be committed at this position, false if there is none
+    [[nodiscard]] bool parse_header(const char * block, uint64_t sequence, uint64_t position, journal_record_header_t & header) const;
+    // the record's checksum matches, its checksum field is zeroed on the way
+    [[nodiscard]] bool verify_record(char * record, uint64_t blocks) const;
+    void replay();
+    void checkpoint_locked();
+    void write_record(const std::map < uint64_t, const std::vector < char > * > & targets, uint64_t transactions);
+    void committer_main();
+
+public:
+    // replays what a crash left in the log. A lazily initialized journal region is
+    // zeroed through the initializer as the log reaches it
+    journal(block_io & _io, const simplesnapfs_filesystem_head_t & head,
+        const journal_configuration_t & _configuration = { }, lazy_initializer * _initializer = nullptr);
+    // commits what is waiting, then checkpoints
+    ~journal();
+
+    journal(const journal &) = delete;
+    journal & operator=(const journal &) = delete;
+
+    // write an empty log with a new identity, for mkfs
+    static void format(block_io & io, const simplesnapfs_filesystem_head_t & head);
+
+    [[nodiscard]] transaction_t begin() { return transaction_t(*this); }
+    // once it returns the transaction survives a crash. Throws TransactionTooLarge
+    // if the log cannot hold it, or whatever stopped the journal
+    void commit(transaction_t && transaction);
+    // write every committed block home and empty the log
+    void checkpoint();
+
+    [[nodiscard]] journal_statistics_t get_statistics();
+    [[nodiscard]] uint64_t get_log_blocks() const { return log_blocks; }
+    // blocks of the log in use, between the tail and the head
+    [[nodiscard]] uint64_t get_used_blocks();
+};
+
+#endif //JOURNAL_H
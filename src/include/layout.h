@@ -0,0 +1,30 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <string>
+#include <cstdint>
+#include <checksum.h>
+#include <simplesnapfs.h>
+
+#define LAYOUT_DEFAULT_JOURNAL_RATIO (50)
+
+struct layout_configuration_t
+{
+    uint32_t block_size = 4096;
+    checksum_algorithm_t checksum_algorithm = CHECKSUM_SHA512;
+    uint64_t journal_ratio = LAYOUT_DEFAULT_JOURNAL_RATIO; // data blocks per journal block
+    uint32_t reserved_percent = 0; // of the device, kept out of the layout at its end
+    uint64_t alignment = 1; // in blocks, every region starts on a multiple of it (stripe or erase block)
+};
+
+// blocks from the start of the device to the end of the layout holding this many data blocks
+uint64_t layout_blocks_needed(uint64_t data_blocks, const layout_configuration_t & configuration);
+
+// The layout with the most data blocks whose bitmap, checksums, checksum tree
+// and journal still fit into the device. The space needed only grows with the
+// data blocks, so their number is found by bisection, in about 64 steps for
+// any device size. Throws InvalidLayout when not even one data block fits.
+simplesnapfs_filesystem_head_t plan_layout(uint64_t block_count, const layout_configuration_t & configuration,
+    const std::string & label = "");
+
+#endif //LAYOUT_H
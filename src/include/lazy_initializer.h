@@ -0,0 +1,77 @@
+#ifndef LAZY_INITIALIZER_H
+#define LAZY_INITIALIZER_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <exception>
+#include <block_io.h>
+#include <simplesnapfs.h>
+
+#define LAZY_INITIALIZATION_PIECE_SIZE (16ULL * 1024 * 1024)
+
+// Finishes what mkfs --lazy left out, meant to run in the background once the
+// filesystem is mounted: zeroes the data block checksum regions, the checksum
+// tree and the journal piece by piece, then builds the tree and clears
+// lazy_initialization in the head. The journal, about to write its log, first
+// calls ensure_initialized(), which zeroes the piece right away if the
+// background has not got there yet, so nothing written is zeroed afterwards.
+//
+// Interrupted, the next run starts over and zeroes everything again. That is
+// only harmless because nothing kept in these regions has to outlive a run:
+// the journal is replayed before the initializer starts, and nothing may write
+// the checksum regions or the tree until the head says they are done, which is
+// why snapshot_volume refuses to open before. ensure_initialized() throws
+// LazyInitializationConflict for a block outside the journal, and so does the
+// constructor for a filesystem that has a snapshot volume already.
+class lazy_initializer
+{
+private:
+    struct piece_t {
+        uint64_t first_block;
+        uint64_t blocks;
+        bool journal;           // the only region written before initialization is done
+    };
+
+    block_io & io;
+    simplesnapfs_filesystem_head_t & head;
+    std::vector < piece_t > pieces;         // ascending, device block numbers
+    std::vector < bool > initialized;       // per piece, guarded by mutex
+    std::mutex mutex;
+    std::atomic < uint64_t > zeroed_blocks = 0;
+    uint64_t total_blocks = 0;
+    std::atomic < bool > stop_requested = false;
+    std::atomic < bool > done = false;
+    std::exception_ptr error;
+    std::thread worker;
+
+    void initialize_piece(uint64_t piece);
+    void run();
+
+public:
+    // the head is kept by reference and rewritten when done; until then its
+    // dynamic information belongs to the initializer
+    lazy_initializer(block_io & _io, simplesnapfs_filesystem_head_t & _head);
+    // stops the background work, unfinished it is picked up by the next run
+    ~lazy_initializer();
+
+    lazy_initializer(const lazy_initializer &) = delete;
+    lazy_initializer & operator=(const lazy_initializer &) = delete;
+
+    [[nodiscard]] static bool is_needed(const simplesnapfs_filesystem_head_t & head) {
+        return head.dynamic_information.fs_dynamically_set_flags.lazy_initialization;
+    }
+
+    void start();
+    // until the started work is done, rethrows whatever stopped it
+    void wait();
+    // zero the piece holding this device block now, unless done already
+    void ensure_initialized(uint64_t block);
+    [[nodiscard]] bool is_done() const { return done; }
+    [[nodiscard]] uint64_t get_zeroed_blocks() const { return zeroed_blocks; }
+    [[nodiscard]] uint64_t get_total_blocks() const { return total_blocks; }
+};
+
+#endif //LAZY_INITIALIZER_H
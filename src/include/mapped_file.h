@@ -0,0 +1,87 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#define _FILE_OFFSET_BITS 64
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+enum access_pattern_t {
+    ACCESS_NORMAL,
+    ACCESS_SEQUENTIAL,
+    ACCESS_RANDOM,
+    ACCESS_WILLNEED         // one-shot prefetch, not remembered as a pattern
+};
+
+// Shared mapping of a device or image file, mapped in fixed size chunks so
+// images bigger than the address space budget can be worked on. At most
+// max_mapped_chunks are mapped at once, least recently used unpinned chunks
+// are unmapped first. Dirty byte ranges are tracked per chunk for msync.
+// Safe for concurrent use; the chunk table is small, so one lock guards it.
+class mapped_file
+{
+public:
+    struct chunk_t {
+        const uint64_t index;
+        char * const base;
+        const uint64_t length;
+        std::atomic < uint32_t > pin_count { 0 };
+        uint64_t dirty_begin = 0;   // dirty byte range inside the chunk, empty when begin == end
+        uint64_t dirty_end = 0;
+
+        chunk_t(const uint64_t _index, char * _base, const uint64_t _length) : index(_index), base(_base), length(_length) { }
+    };
+
+    struct statistics_t {
+        uint64_t maps;
+        uint64_t unmaps;
+        uint64_t msyncs;
+    };
+
+private:
+    const int fd;
+    const uint64_t file_size;
+    const uint64_t chunk_size;
+    const uint64_t max_mapped_chunks;
+    access_pattern_t access_pattern;
+
+    std::mutex mutex;
+    // most recently used at the front
+    std::list < chunk_t > lru_list;
+    std::unordered_map < uint64_t /* chunk index */, std::list < chunk_t >::iterator > index;
+    statistics_t statistics { };
+
+    void unmap(std::list < chunk_t >::iterator chunk);
+    void msync_dirty_range(chunk_t & chunk);
+
+public:
+    // chunk_size is rounded up to a multiple of both the page size and the block size
+    explicit mapped_file(int _fd, uint64_t _file_size, uint32_t block_size,
+        uint64_t _chunk_size, uint64_t window_size, access_pattern_t _access_pattern);
+    ~mapped_file();
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+
+    // pin the chunk holding the byte at offset, mapping it if necessary
+    chunk_t & get_pinned_chunk(uint64_t offset);
+    [[nodiscard]] uint64_t get_chunk_size() const { return chunk_size; }
+
+    // pin() only adds to an existing pin, the first one comes from get_pinned_chunk()
+    static void pin(chunk_t & chunk) { chunk.pin_count.fetch_add(1, std::memory_order_acq_rel); }
+    static void unpin(chunk_t & chunk) { chunk.pin_count.fetch_sub(1, std::memory_order_acq_rel); }
+    void mark_dirty(chunk_t & chunk, uint64_t begin, uint64_t end);
+
+    // apply a hint to a byte range; sequential/random/normal also become
+    // the default for chunks mapped later
+    void advise(uint64_t offset, uint64_t length, access_pattern_t pattern);
+
+    // msync every dirty range
+    void sync();
+
+    [[nodiscard]] statistics_t get_statistics();
+};
+
+#endif //MAPPED_FILE_H
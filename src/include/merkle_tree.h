@@ -0,0 +1,87 @@
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <block_io.h>
+#include <simplesnapfs.h>
+
+// build_empty() writes the repeated blocks of a level this much at a time
+#define MERKLE_TREE_WRITE_SIZE (8ULL * 1024 * 1024)
+
+// Merkle tree layered on the data block checksum region. Level 0 holds the
+// digest of every checksum block, each level above the digest of every block
+// of the level below, up to a level fitting in one block whose digest is the
+// root kept in the dynamic part of the head. Nodes use the filesystem's
+// checksum algorithm and are packed block_size / digest_length to a block.
+//
+// Changing one checksum slot updates one node per level, the whole region is
+// vouched for by the root, and two trees of the same geometry are compared by
+// descending only into subtrees whose digests differ.
+class merkle_tree
+{
+public:
+    // a run of data blocks, relative to the data region
+    struct range_t {
+        uint64_t first_block;
+        uint64_t blocks;
+        bool operator==(const range_t &) const = default;
+    };
+
+private:
+    struct level_t {
+        uint64_t first_block;   // absolute block number of its first node block
+        uint64_t entries;
+        uint64_t blocks;
+    };
+
+    block_io & io;
+    simplesnapfs_filesystem_head_t & head;
+    checksum_algorithm_t algorithm;
+    uint32_t block_size;
+    uint32_t digest_length;
+    uint64_t fanout;
+    std::vector < level_t > levels;
+
+    // the block the entries of level are digests of
+    [[nodiscard]] uint64_t child_block(uint64_t level, uint64_t entry) const;
+    // recompute every level from the checksum region into expected, counting
+    // the stored nodes (and the root) which differ from it
+    uint64_t compute(std::vector < std::vector < char > > & expected, char * expected_root);
+    void diff_block(merkle_tree & other, uint64_t level, uint64_t block, std::vector < range_t > & ranges);
+    void diff_checksum_block(merkle_tree & other, uint64_t checksum_block, std::vector < range_t > & ranges);
+
+public:
+    // blocks taken by the tree over a checksum region of checksum_blocks blocks
+    static uint64_t blocks_needed(uint64_t checksum_blocks, uint32_t block_size, uint32_t digest_length);
+
+    // the head is kept by reference, the root is updated in it and storing it is up to the owner
+    merkle_tree(block_io & _io, simplesnapfs_filesystem_head_t & _head);
+
+    // rewrite the whole tree from the checksum region
+    void build();
+    // the tree over a checksum region of zeros, as mkfs leaves it, without reading
+    // it. Every level holds copies of one digest but for its last node, so this
+    // takes two hashes per level however large the region is
+    void build_empty();
+    // after checksum slots of count data blocks from first_block on changed,
+    // rehashes only the nodes on their paths to the root
+    void update(uint64_t first_block, uint64_t count = 1);
+    // whether the checksum block holding the slot of a data block is vouched for
+    // by the root, reading one node block per level
+    [[nodiscard]] bool verify_block(uint64_t data_block);
+    // check every node against the checksum region, returns the number of bad
+    // nodes (the root included). repair rewrites the tree from the region
+    uint64_t verify(bool repair = false);
+    [[nodiscard]] std::span < const char > root() const {
+        return { head.dynamic_information.data_block_checksum_tree_root, digest_length };
+    }
+    [[nodiscard]] uint64_t get_levels() const { return levels.size(); }
+
+    // data blocks whose checksums differ between the two trees, merged into runs.
+    // Both have to describe the same geometry, or IncompatibleChecksumTree is thrown
+    std::vector < range_t > diff(merkle_tree & other);
+};
+
+#endif //MERKLE_TREE_H
@@ -0,0 +1,70 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <cstdint>
+#include <mutex>
+#include <array>
+
+// Access pattern detector deciding what block_io should prefetch.
+// A handful of streams are tracked at once, so interleaved scans (data and
+// checksum regions walked side by side) are each recognized. A stream is
+// sequential or strided once two accesses in a row moved by the same stride;
+// its window then starts small and doubles every time the reader catches up
+// with the prefetched blocks, up to max_window. Accesses that continue no
+// stream take over the least recently used one, so random access never
+// prefetches anything.
+class readahead_tracker
+{
+public:
+    // blocks first, first + stride, ..., count of them
+    struct window_t {
+        uint64_t first;
+        int64_t stride;
+        uint64_t count;
+    };
+
+    struct statistics_t {
+        uint64_t stream_accesses;   // accesses continuing a detected stream
+        uint64_t random_accesses;   // accesses matching no stream
+        uint64_t windows;           // prefetch windows handed out
+        uint64_t blocks;            // blocks in those windows
+    };
+
+private:
+    static constexpr uint32_t max_streams = 8;
+
+    struct stream_t {
+        int64_t last_block = 0;
+        int64_t stride = 0;             // 0 until the second access
+        uint32_t confirmations = 0;     // accesses in a row moving by stride
+        uint64_t window = 0;            // 0 until the stream is confirmed
+        int64_t next_prefetch = 0;      // first block (in stride steps) not requested yet
+        uint64_t last_used = 0;
+        bool valid = false;
+    };
+
+    const uint64_t total_blocks;
+    const uint64_t initial_window;
+    const uint64_t max_window;
+    const int64_t max_stride;
+
+    mutable std::mutex mutex;
+    std::array < stream_t, max_streams > streams { };
+    uint64_t clock = 0;
+    statistics_t statistics { };
+
+    [[nodiscard]] stream_t & least_recently_used();
+    // next window of a confirmed stream, if the reader came close enough to the prefetched blocks
+    window_t advance(stream_t & stream);
+
+public:
+    // max_window == 0 disables readahead altogether
+    explicit readahead_tracker(uint64_t _total_blocks, uint64_t _initial_window, uint64_t _max_window, int64_t _max_stride);
+
+    // record an access, returns the window to prefetch (count == 0 for none)
+    window_t access(uint64_t block);
+
+    [[nodiscard]] statistics_t get_statistics() const;
+};
+
+#endif //READAHEAD_H
@@ -0,0 +1,82 @@
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <block_io.h>
+#include <simplesnapfs.h>
+#include <thread_pool.h>
+#include <merkle_tree.h>
+
+#define SCRUB_DEFAULT_READ_SIZE (8ULL * 1024 * 1024)
+
+struct scrub_statistics_t {
+    uint64_t bitmap_blocks_checked;
+    uint64_t data_blocks_checked;   // allocated data blocks verified so far
+    uint64_t data_blocks_total;     // allocated data blocks to verify
+    uint64_t bytes_read;
+    uint64_t bitmap_errors;         // bitmap copies not matching the good one
+    uint64_t checksum_errors;       // checksum slots not matching their (good) data
+    uint64_t unrecoverable_blocks;  // bitmap or data blocks without any good copy
+    uint64_t tree_errors;           // checksum tree nodes not matching what lies beneath them
+    uint64_t repaired;              // copies rewritten from the good one
+    double elapsed_seconds;
+};
+
+struct scrub_configuration_t
+{
+    bool repair = false; // rewrite bad copies from the good ones, otherwise only report
+    unsigned int hashing_threads = 0; // 0 means one per CPU
+    uint64_t read_size = SCRUB_DEFAULT_READ_SIZE; // the data region is read in pieces of this size, in bytes
+    uint64_t rate_limit = 0; // bytes read per second, 0 for unlimited
+    std::function < void (const scrub_statistics_t &) > progress = nullptr; // called after every piece, if set
+};
+
+// Reads back the data block bitmap and every allocated data block and verifies
+// them against both copies of their checksum regions. Bitmap blocks have a
+// redundancy copy of their own; data blocks only have their checksum stored
+// twice, so a data block matching neither checksum cannot be repaired.
+// Last, the checksum tree is checked against the (repaired) checksum region.
+// Until a lazily formatted filesystem is initialized only the bitmap is checked.
+// Reads go through block_io, so a scrub sees the same data as anyone else
+// using it and can run while the filesystem is in use.
+class scrubber
+{
+private:
+    block_io & io;
+    scrub_configuration_t configuration;
+    simplesnapfs_filesystem_head_t head { };
+    uint32_t block_size;
+    uint32_t digest_length = 0;
+    thread_pool pool;
+    scrub_statistics_t statistics { };
+    std::chrono::steady_clock::time_point started;
+    std::vector < char > bitmap;    // the good copy
+    std::unique_ptr < merkle_tree > tree;
+
+    // a piece of the data region, read and handed to the pool
+    struct piece_t;
+
+    void load_head();
+    void scrub_bitmap();
+    void scrub_data();
+    [[nodiscard]] std::unique_ptr < piece_t > read_piece(uint64_t first_block, uint64_t blocks);
+    void verify_piece(piece_t & piece);
+    void scrub_tree();
+    [[nodiscard]] bool is_allocated(uint64_t data_block) const;
+    // read_range() within the rate limit
+    void read(uint64_t offset, uint64_t len, char * buf);
+    void rewrite(uint64_t offset, uint64_t len, const char * buf);
+    void report_progress();
+
+public:
+    // the filesystem head is read and validated right away
+    explicit scrubber(block_io & _io, const scrub_configuration_t & _configuration = { });
+    scrub_statistics_t run();
+    [[nodiscard]] const simplesnapfs_filesystem_head_t & get_head() const { return head; }
+};
+
+#endif //SCRUB_H
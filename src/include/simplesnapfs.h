@@ -1,9 +1,13 @@
 #ifndef SIMPLESNAPFS_H
 #define SIMPLESNAPFS_H
 
+#include <cstddef>
 #include <cstdint>
+#include <checksum.h>
 
-#define FILESYSTEM_MAGIC_NUMBER (0x9CDA317F6B000001ULL)
+// the low digits count revisions of the on-disk format, fields are only ever appended
+#define FILESYSTEM_MAGIC_NUMBER (0x9CDA317F6B000002ULL)
+#define FILESYSTEM_MAGIC_REVISION_MASK (0xFFFFULL)
 
 struct simplesnapfs_filesystem_head_t
 {
@@ -59,14 +63,29 @@ struct simplesnapfs_filesystem_head_t
         } inode_configuration_flag { };
 
         uint64_t redundancy_fs_identification_number { };
+
+        // checksum_algorithm_t of the data block and bitmap checksum regions,
+        // the head itself is always protected by SHA-512
+        uint32_t checksum_algorithm = CHECKSUM_SHA512;
+
+        // merkle tree over the data block checksum region, see merkle_tree.h
+        uint64_t data_block_checksum_tree_blk_index { };
+        uint64_t data_block_checksum_tree_blocks { };
     } static_information { };
 
     struct _dynamic_information {
         uint64_t filesystem_last_mount_unix_timestamp;
         struct _fs_dynamically_set_flags {
             uint64_t is_mounted:1;
-            uint64_t reserved:63;
+            // mkfs --lazy left the data block checksum regions, the checksum
+            // tree and the journal as they were, lazy_initializer zeroes them
+            uint64_t lazy_initialization:1;
+            uint64_t reserved:62;
         } fs_dynamically_set_flags;
+        // root of the data block checksum tree, digest length of checksum_algorithm
+        char data_block_checksum_tree_root[CHECKSUM_MAX_DIGEST_LENGTH];
+        // data block number + 1 of the snapshot volume descriptor, 0 without a volume, see snapshot_volume.h
+        uint64_t snapshot_volume_descriptor;
     } dynamic_information { };
 
     struct _checksum_filed {
@@ -75,6 +94,9 @@ struct simplesnapfs_filesystem_head_t
     } checksum_filed { };
 };
 
-static_assert(sizeof(simplesnapfs_filesystem_head_t) < 512, "Header size is too big!");
+// block 0 holds nothing else, and the smallest block size is 512 bytes
+static_assert(sizeof(simplesnapfs_filesystem_head_t) <= 512, "Header size is too big!");
+static_assert(offsetof(simplesnapfs_filesystem_head_t::_static_information, redundancy_fs_identification_number) == 264,
+    "Fields of the first on-disk format moved, append new ones at the end instead");
 
 #endif //SIMPLESNAPFS_H
@@ -0,0 +1,69 @@
+#ifndef SNAPSHOT_STREAM_H
+#define SNAPSHOT_STREAM_H
+
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <block_io.h>
+#include <checksum.h>
+#include <snapshot_volume.h>
+
+#define SNAPSHOT_STREAM_MAGIC (0x9CDA317F6B00C001ULL)
+
+// starts a stream
+struct snapshot_stream_header_t {
+    uint64_t magic;
+    uint32_t block_size;
+    uint32_t checksum_algorithm;    // of the block checksums in the records
+    uint64_t logical_blocks;
+    uint64_t from_epoch;            // the snapshot the receiver has to hold already, 0 for a full stream
+    uint64_t to_epoch;              // the snapshot sent, 0 for the live volume
+    char checksum[64];              // SHA-512 of the above
+};
+
+enum snapshot_stream_record_kind_t : uint64_t {
+    SNAPSHOT_STREAM_BLOCK = 1,      // followed by the block
+    SNAPSHOT_STREAM_ZEROS = 2,      // a block of zeros, sent without it
+    SNAPSHOT_STREAM_END = 3,
+};
+
+// one per changed block, in ascending block order, then an end record
+struct snapshot_stream_record_t {
+    uint64_t kind;
+    uint64_t block;                 // the end record holds the number of records before it
+    // the block's checksum, as stored by the sender. The end record holds the
+    // SHA-512 of the stream before it, header included
+    char checksum[CHECKSUM_MAX_DIGEST_LENGTH];
+    uint64_t header_checksum;       // CRC32C of the above, checked before the block number is used
+};
+
+struct snapshot_stream_statistics_t {
+    uint64_t changed_blocks;        // pointers that differ between the two snapshots
+    uint64_t sent_blocks;           // records with a block
+    uint64_t zero_blocks;           // records without one
+    uint64_t unchanged_blocks;      // moved, but with the same contents, not sent
+    uint64_t stream_bytes;
+};
+
+// Write the blocks that differ between two snapshots of the volume (from nullptr
+// for everything, to nullptr for the live volume) to the stream. Only map
+// subtrees whose pointers differ are read, and the blocks found are read in
+// ascending order. The receiver holds the from snapshot already, so a block
+// whose stored checksum is the same on both sides is left out, and a block of
+// zeros is sent without its contents. Checksums are only trusted to decide that
+// when the algorithm is cryptographic (SHA-512, BLAKE3), otherwise the contents
+// are compared. The volume is synced first, so the checksums sent are those of
+// what is sent, live writes included.
+snapshot_stream_statistics_t send_snapshot_stream(snapshot_volume & volume, const snapshot_t * from, const snapshot_t * to,
+    std::ostream & stream);
+
+// Apply a stream to the filesystem on io, creating its snapshot volume if it has
+// none, then snapshot it. A full stream needs a volume without snapshots or
+// writes, an incremental one a newest snapshot received as its from_epoch with
+// nothing written since. Every block is checked against its checksum as it
+// comes in, but nothing is stored before the end record checks out: a damaged or
+// cut stream throws InvalidSnapshotStream and leaves the volume as it was, or
+// the filesystem without one when the stream was to create it.
+snapshot_stream_statistics_t receive_snapshot_stream(block_io & io, std::istream & stream);
+
+#endif //SNAPSHOT_STREAM_H
@@ -0,0 +1,167 @@
+#ifndef SNAPSHOT_VOLUME_H
+#define SNAPSHOT_VOLUME_H
+
+#include <set>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <block_io.h>
+#include <simplesnapfs.h>
+#include <merkle_tree.h>
+#include <block_allocator.h>
+
+#define SNAPSHOT_VOLUME_MAGIC (0x9CDA317F6B00B001ULL)
+
+// where a block of the volume is kept, and in which epoch it was written there
+struct block_pointer_t {
+    uint64_t block;         // data block number + 1, 0 for a hole reading as zeros
+    uint64_t birth_epoch;
+    bool operator==(const block_pointer_t &) const = default;
+};
+
+struct snapshot_t {
+    uint64_t epoch;         // the last epoch whose writes it holds
+    block_pointer_t root;   // of the block map as it was then
+    uint64_t creation_unix_timestamp;
+    uint64_t received_from;         // the sender's epoch of a received snapshot, 0 for one taken here
+};
+
+// the first bytes of the descriptor block
+struct snapshot_descriptor_t {
+    uint64_t magic;
+    uint64_t logical_blocks;
+    uint64_t map_levels;
+    uint64_t current_epoch;         // live writes are born in it
+    block_pointer_t live_root;
+    uint64_t snapshots;
+    // the snapshots are kept in a chain of table blocks linked from the newest back.
+    // Data block number + 1 of its last block, 0 before the first snapshot
+    uint64_t last_table_block;
+};
+
+// starts every snapshot table block, followed by its snapshot_t entries
+struct snapshot_table_header_t {
+    uint64_t previous;      // data block number + 1 of the previous table block, 0 for the first one
+    uint64_t entries;
+};
+
+struct snapshot_volume_statistics_t {
+    uint64_t writes;
+    uint64_t in_place_writes;       // to blocks allocated since the last sync
+    uint64_t copied_blocks;         // data blocks moved on their first overwrite after a snapshot or sync
+    uint64_t copied_map_blocks;     // block map blocks likewise
+    uint64_t allocated_blocks;      // data, map and table blocks taken from the allocator
+};
+
+// A volume of logical blocks kept in the data region, with snapshots. A block
+// map, a radix tree of block_size / 16 pointers per block, leads from each
+// logical block to the data block holding it, and every pointer carries the
+// epoch its block was written in. Taking a snapshot records the map's root and
+// the current epoch, then starts the next epoch; nothing is copied, so it takes
+// the same time whatever the size of the volume.
+//
+// A write to a block allocated since the last sync() goes where the block is.
+// Any other block belongs to a snapshot or to the volume as last stored, so the
+// write goes to a newly allocated block instead, and the map blocks on its path
+// are copied the same way, once per sync each. Appending to the snapshot table
+// copies its last block likewise. Snapshots are read through their own root and
+// never change.
+//
+// Nothing the stored descriptor refers to is written over, so sync() is the
+// only commit point. It checksums every block written since the previous one,
+// in both checksum regions and the checksum tree, flushes the allocator and
+// syncs the device, and only then stores the descriptor and the head. Blocks
+// the live volume moved away from, and no snapshot holds, are released after
+// that: a crash in between leaks them instead of freeing blocks still in use.
+// Every member takes one lock. The filesystem has to be past lazy
+// initialization.
+class snapshot_volume
+{
+private:
+    block_io & io;
+    simplesnapfs_filesystem_head_t & head;
+    block_allocator & allocator;
+    merkle_tree tree;
+    uint32_t block_size;
+    checksum_algorithm_t algorithm;
+    uint32_t digest_length;
+    uint64_t fanout;                // pointers per map block
+    uint64_t descriptor_block;      // data block number
+    snapshot_descriptor_t descriptor { };
+    std::vector < snapshot_t > snapshots;   // oldest first
+    // data blocks allocated since the last sync, the only ones written in place. Their checksums are stale
+    std::set < uint64_t > dirty;
+    // data blocks the stored volume refers to and the live one no longer does, released by sync()
+    std::vector < uint64_t > superseded;
+    snapshot_volume_statistics_t statistics { };
+    std::mutex mutex;
+
+    [[nodiscard]] uint64_t device_offset(uint64_t pointer_block) const;
+    // an unused data block, as a pointer block number. Zeroed if asked to
+    uint64_t allocate_block(bool zero);
+    // the pointer, made writable in place: holes get a block of zeros, blocks
+    // allocated before the last sync a copy (map blocks) or a new block (data
+    // blocks, overwritten whole). Returns whether the pointer changed
+    bool make_writable(block_pointer_t & pointer, bool map_block);
+    // index into a map block of the given level on the way to a logical block
+    [[nodiscard]] uint64_t map_index(uint64_t block, uint64_t level) const;
+    [[nodiscard]] block_pointer_t lookup(const block_pointer_t & root, uint64_t block);
+    void read_map(const block_pointer_t & pointer, std::vector < char > & buffer);
+    void diff_map(const block_pointer_t & from, const block_pointer_t & to, uint64_t level, uint64_t first_block,
+        const std::function < void (uint64_t, const block_pointer_t &, const block_pointer_t &) > & changed);
+    void read_block(const block_pointer_t & pointer, char * buffer);
+    // into both checksum regions and the checksum tree
+    void store_checksums(const std::set < uint64_t > & blocks);
+
+public:
+    // a volume of logical_blocks blocks, all holes, in a filesystem that has none.
+    // Unless stored, only head and allocator know of it until the first sync() of
+    // a volume opened on them, and dropping both leaves the filesystem without it
+    static void create(block_io & io, simplesnapfs_filesystem_head_t & head, block_allocator & allocator, uint64_t logical_blocks,
+        bool stored = true);
+
+    // the head is kept by reference, sync() stores it
+    snapshot_volume(block_io & _io, simplesnapfs_filesystem_head_t & _head, block_allocator & _allocator);
+
+    snapshot_volume(const snapshot_volume &) = delete;
+    snapshot_volume & operator=(const snapshot_volume &) = delete;
+
+    // a whole logical block, live or as a snapshot holds it
+    void read(uint64_t block, char * buffer);
+    void read(const snapshot_t & snapshot, uint64_t block, char * buffer);
+    void write(uint64_t block, const char * data);
+    // where a logical block is kept, live or in a snapshot
+    [[nodiscard]] block_pointer_t locate(uint64_t block);
+    [[nodiscard]] block_pointer_t locate(const snapshot_t & snapshot, uint64_t block);
+    // a block where locate() found it
+    void read_located(const block_pointer_t & pointer, char * buffer);
+    // the checksum stored for a located block as of the last sync(), that of zeros for a hole
+    void stored_checksum(const block_pointer_t & pointer, char * digest);
+
+    // every logical block whose pointer differs between from (nullptr for the empty
+    // volume) and to (nullptr for the live volume), in ascending order. Map subtrees
+    // behind equal pointers are the same and skipped unread. Called without the lock,
+    // the live volume is only seen consistently if nothing writes to it meanwhile
+    void diff(const snapshot_t * from, const snapshot_t * to,
+        const std::function < void (uint64_t block, const block_pointer_t & from, const block_pointer_t & to) > & changed);
+    // nothing was written since the snapshot (nullptr: since the volume was created)
+    [[nodiscard]] bool is_unchanged_since(const snapshot_t * snapshot);
+
+    // returns the snapshot's epoch
+    uint64_t create_snapshot(uint64_t received_from = 0);
+    // throws NoSuchSnapshot
+    [[nodiscard]] snapshot_t find_snapshot(uint64_t epoch);
+    [[nodiscard]] std::vector < snapshot_t > get_snapshots();
+    // make everything written so far durable, checksummed, with the allocator and head
+    void sync();
+
+    [[nodiscard]] uint32_t get_block_size() const { return block_size; }
+    [[nodiscard]] checksum_algorithm_t get_checksum_algorithm() const { return algorithm; }
+    [[nodiscard]] uint64_t get_logical_blocks() const { return descriptor.logical_blocks; }
+    [[nodiscard]] uint64_t get_map_levels() const { return descriptor.map_levels; }
+    [[nodiscard]] uint64_t get_current_epoch();
+    [[nodiscard]] snapshot_volume_statistics_t get_statistics();
+};
+
+#endif //SNAPSHOT_VOLUME_H
@@ -0,0 +1,38 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <mutex>
+#include <deque>
+#include <future>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of worker threads running queued tasks in submission order.
+// The destructor finishes whatever is still queued before joining.
+class thread_pool
+{
+private:
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::deque < std::packaged_task < void () > > tasks;
+    bool stopping = false;
+    std::vector < std::thread > workers;
+
+    void worker_main();
+
+public:
+    // 0 threads means one per CPU
+    explicit thread_pool(unsigned int threads = 0);
+    ~thread_pool();
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool & operator=(const thread_pool &) = delete;
+
+    // the future rethrows whatever the task threw
+    std::future < void > submit(std::function < void () > task);
+    [[nodiscard]] unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+};
+
+#endif //THREAD_POOL_H
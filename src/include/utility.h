@@ -3,8 +3,12 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
 #include <getopt.h>
 
 std::vector<std::string> parse_arguments(int argc, char** argv, const option long_options[], const char* short_options);
 
+// the block size is recorded in the head, which has to be read before block_io can be opened
+uint32_t read_block_size(const std::string & device);
+
 #endif //UTILITY_H
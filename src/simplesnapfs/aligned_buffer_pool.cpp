@@ -0,0 +1,43 @@
+#include <aligned_buffer_pool.h>
+#include <debug.h>
+#include <cstdlib>
+#include <algorithm>
+
+aligned_buffer_pool::aligned_buffer_pool(const size_t _buffer_size, const size_t _alignment)
+    :   buffer_size(_buffer_size),
+        // posix_memalign wants at least pointer alignment
+        alignment(std::max(_alignment, sizeof(void *)))
+{
+}
+
+aligned_buffer_pool::~aligned_buffer_pool()
+{
+    for (const auto buffer : free_buffers) {
+        free(buffer);
+    }
+}
+
+char * aligned_buffer_pool::acquire()
+{
+    if (!free_buffers.empty())
+    {
+        char * buffer = free_buffers.back();
+        free_buffers.pop_back();
+        return buffer;
+    }
+
+    void * buffer = nullptr;
+    if (posix_memalign(&buffer, alignment, buffer_size) != 0)
+    {
+        log(_log::LOG_ERROR, "Error allocating aligned buffer of ", buffer_size, " bytes\n");
+        throw std::bad_alloc();
+    }
+
+    allocated_buffers++;
+    return static_cast<char *>(buffer);
+}
+
+void aligned_buffer_pool::release(char * buffer)
+{
+    free_buffers.push_back(buffer);
+}
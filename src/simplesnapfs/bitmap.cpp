@@ -0,0 +1,359 @@
+#include <bitmap.h>
+#include <bit>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__)
+# include <immintrin.h>
+# include <cpuid.h>
+#endif
+
+// bitmap words are loaded straight from the on-disk bytes
+static_assert(std::endian::native == std::endian::little, "The bitmap assumes a little endian host");
+
+static uint64_t count_set_bits_portable(const uint64_t * words, const uint64_t count)
+{
+    uint64_t bits = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        bits += std::popcount(words[i]);
+    }
+    return bits;
+}
+
+static uint64_t leading_empty_words_portable(const uint64_t * words, const uint64_t count)
+{
+    uint64_t i = 0;
+    while (i < count && words[i] == 0) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__)
+// nibble lookup popcount of 32 bytes at a time, summed per 64 bit lane
+__attribute__((target("avx2,popcnt")))
+static uint64_t count_set_bits_avx2(const uint64_t * words, const uint64_t count)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0F);
+    __m256i total = _mm256_setzero_si256();
+
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+        const __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(value, low_nibbles));
+        const __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(value, 4), low_nibbles));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+    }
+
+    uint64_t bits = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1)
+        + _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+    for (; i < count; i++) {
+        bits += _mm_popcnt_u64(words[i]);
+    }
+    return bits;
+}
+
+__attribute__((target("avx2")))
+static uint64_t leading_empty_words_avx2(const uint64_t * words, const uint64_t count)
+{
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+        if (!_mm256_testz_si256(value, value)) {
+            break;
+        }
+    }
+
+    while (i < count && words[i] == 0) {
+        i++;
+    }
+    return i;
+}
+#endif
+
+#if defined(__x86_64__)
+// asked of cpuid directly, __builtin_cpu_supports() needs libgcc's __cpu_model which
+// the -z defs link of the sanitizer build does not see. AVX2 also needs the kernel
+// to save the ymm registers, which xgetbv reports once OSXSAVE is set
+static bool cpu_supports_avx2_and_popcnt()
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0
+        || (ecx & bit_POPCNT) == 0 || (ecx & bit_OSXSAVE) == 0 || (ecx & bit_AVX) == 0)
+    {
+        return false;
+    }
+
+    uint32_t xcr0_low, xcr0_high;
+    __asm__ ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+    if ((xcr0_low & 0x6) != 0x6) {
+        return false;
+    }
+
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0 && (ebx & bit_AVX2) != 0;
+}
+#endif
+
+struct bitmap_scanner_t {
+    uint64_t (*count_set_bits)(const uint64_t *, uint64_t);
+    uint64_t (*leading_empty_words)(const uint64_t *, uint64_t);
+};
+
+// picked once, on first use
+static const bitmap_scanner_t & scanner()
+{
+    static const bitmap_scanner_t implementation = []() -> bitmap_scanner_t
+    {
+#if defined(__x86_64__)
+        if (cpu_supports_avx2_and_popcnt()) {
+            return { count_set_bits_avx2, leading_empty_words_avx2 };
+        }
+#endif
+        return { count_set_bits_portable, leading_empty_words_portable };
+    }();
+
+    return implementation;
+}
+
+uint64_t count_free_bits(const uint64_t * words, const uint64_t count)
+{
+    return count * 64 - scanner().count_set_bits(words, count);
+}
+
+bool bitmap_is_simd_accelerated()
+{
+    return scanner().count_set_bits != count_set_bits_portable;
+}
+
+// call operation(word, mask) for every word touched by a run of bits
+template < typename operation_t >
+static void for_each_word(const uint64_t first, const uint64_t count, operation_t operation)
+{
+    const uint64_t end = first + count;
+    for (uint64_t position = first; position < end;)
+    {
+        const uint64_t bit = position % 64;
+        const uint64_t bits = std::min < uint64_t > (64 - bit, end - position);
+        const uint64_t mask = (bits == 64 ? ~0ULL : (1ULL << bits) - 1) << bit;
+        operation(position / 64, mask);
+        position += bits;
+    }
+}
+
+bitmap::bitmap(const uint64_t _blocks) : blocks(_blocks), free_blocks(_blocks)
+{
+    levels.emplace_back((blocks + 63) / 64, 0);
+    while (levels.back().size() > 1)
+    {
+        const uint64_t words = (levels.back().size() + 63) / 64;
+        levels.emplace_back(words, 0);
+    }
+
+    build_summary();
+}
+
+void bitmap::build_summary()
+{
+    // entries of level 0 are blocks, those of the levels above words of the one below
+    for (uint64_t level = 0; level < levels.size(); level++)
+    {
+        const uint64_t entries = level == 0 ? blocks : levels[level - 1].size();
+        if (level != 0)
+        {
+            std::ranges::fill(levels[level], 0);
+            for (uint64_t word = 0; word < entries; word++) {
+                if (levels[level - 1][word] == ~0ULL) {
+                    levels[level][word / 64] |= 1ULL << (word % 64);
+                }
+            }
+        }
+
+        if (entries % 64 != 0) {
+            levels[level].back() |= ~0ULL << (entries % 64);
+        }
+    }
+}
+
+void bitmap::update_summary(const uint64_t word)
+{
+    uint64_t index = word;
+    for (uint64_t level = 1; level < levels.size(); level++, index /= 64)
+    {
+        const bool full = levels[level - 1][index] == ~0ULL;
+        uint64_t & summary = levels[level][index / 64];
+        const uint64_t bit = 1ULL << (index % 64);
+        const uint64_t updated = full ? summary | bit : summary & ~bit;
+        if (updated == summary) {
+            return;
+        }
+        summary = updated;
+    }
+}
+
+void bitmap::load(const char * data)
+{
+    std::ranges::fill(levels[0], 0);
+    std::memcpy(levels[0].data(), data, (blocks + 7) / 8);
+    build_summary();
+    free_blocks = count_free_bits(levels[0].data(), levels[0].size());
+}
+
+void bitmap::store(char * data) const
+{
+    std::memcpy(data, levels[0].data(), (blocks + 7) / 8);
+    if (blocks % 8 != 0) {
+        data[blocks / 8] = static_cast<char>(data[blocks / 8] & ((1 << (blocks % 8)) - 1));
+    }
+}
+
+void bitmap::store(char * data, const uint64_t offset, const uint64_t length) const
+{
+    const uint64_t bytes = (blocks + 7) / 8;
+    const uint64_t copied = offset < bytes ? std::min(length, bytes - offset) : 0;
+    std::memcpy(data, reinterpret_cast<const char *>(levels[0].data()) + offset, copied);
+    std::memset(data + copied, 0, length - copied);
+    if (blocks % 8 != 0 && offset <= blocks / 8 && blocks / 8 < offset + length) {
+        data[blocks / 8 - offset] = static_cast<char>(data[blocks / 8 - offset] & ((1 << (blocks % 8)) - 1));
+    }
+}
+
+bool bitmap::is_allocated(const uint64_t block) const
+{
+    return (levels[0][block / 64] >> (block % 64)) & 1;
+}
+
+void bitmap::set(const uint64_t first, const uint64_t count)
+{
+    for_each_word(first, count, [&](const uint64_t word, const uint64_t mask)
+    {
+        const uint64_t previous = levels[0][word];
+        levels[0][word] |= mask;
+        if (levels[0][word] != previous)
+        {
+            free_blocks -= std::popcount(levels[0][word] ^ previous);
+            update_summary(word);
+        }
+    });
+}
+
+void bitmap::clear(const uint64_t first, const uint64_t count)
+{
+    for_each_word(first, count, [&](const uint64_t word, const uint64_t mask)
+    {
+        const uint64_t previous = levels[0][word];
+        levels[0][word] &= ~mask;
+        if (levels[0][word] != previous)
+        {
+            free_blocks += std::popcount(levels[0][word] ^ previous);
+            update_summary(word);
+        }
+    });
+}
+
+uint64_t bitmap::next_free(uint64_t position) const
+{
+    // climb until a level has a clear bit at or after the position, which is
+    // an index into that level: moving up turns it into the next word's index
+    uint64_t level = 0;
+    for (;; level++)
+    {
+        if (level == levels.size() || position / 64 >= levels[level].size()) {
+            return blocks;
+        }
+
+        const uint64_t word = position / 64;
+        const uint64_t clear = ~levels[level][word] & (~0ULL << (position % 64));
+        if (clear != 0)
+        {
+            position = word * 64 + std::countr_zero(clear);
+            break;
+        }
+        position = word + 1;
+    }
+
+    // every word below a clear summary bit has a clear bit itself
+    while (level-- > 0) {
+        position = position * 64 + std::countr_zero(~levels[level][position]);
+    }
+    return position;
+}
+
+uint64_t bitmap::free_run_length(const uint64_t block, const uint64_t limit) const
+{
+    const auto & words = levels[0];
+    uint64_t word = block / 64;
+    const uint64_t allocated = words[word] >> (block % 64);
+    if (allocated != 0) {
+        return std::min < uint64_t > (std::countr_zero(allocated), limit);
+    }
+
+    // whole empty words next, several at a time, then the free bits of the one after them
+    uint64_t length = 64 - block % 64;
+    word++;
+    if (length < limit && word < words.size())
+    {
+        const uint64_t empty = scanner().leading_empty_words(words.data() + word,
+            std::min < uint64_t > (words.size() - word, (limit - length + 63) / 64));
+        length += empty * 64;
+        word += empty;
+        if (length < limit && word < words.size()) {
+            length += std::countr_zero(words[word]);
+        }
+    }
+
+    return std::min(length, limit);
+}
+
+bool bitmap::find_free(uint64_t & block, const uint64_t hint) const
+{
+    uint64_t position = next_free(hint);
+    if (position == blocks && hint != 0) {
+        position = next_free(0);
+    }
+
+    if (position >= blocks) {
+        return false;
+    }
+    block = position;
+    return true;
+}
+
+bool bitmap::find_free_run(const uint64_t count, uint64_t & first, const uint64_t hint) const
+{
+    if (count == 0 || count > free_blocks) {
+        return false;
+    }
+
+    // jump from free run to free run, the summary skips everything full in between
+    const auto search = [&](const uint64_t from, const uint64_t to) -> bool
+    {
+        for (uint64_t position = next_free(from); position < to;)
+        {
+            const uint64_t length = free_run_length(position, count);
+            if (length >= count)
+            {
+                first = position;
+                return true;
+            }
+            position = next_free(position + length);
+        }
+        return false;
+    };
+
+    return search(hint, blocks) || (hint != 0 && search(0, hint));
+}
+
+void bitmap::for_each_free_run(const uint64_t first, const uint64_t end,
+    const std::function < void (uint64_t, uint64_t) > & function) const
+{
+    for (uint64_t position = next_free(first); position < end;)
+    {
+        const uint64_t length = free_run_length(position, end - position);
+        function(position, length);
+        position = next_free(position + length);
+    }
+}
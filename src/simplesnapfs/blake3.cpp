@@ -0,0 +1,173 @@
+#include <checksum.h>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// BLAKE3 in hash mode with a 32 byte digest, one-shot. Portable compression
+// function; the input is split into 1 KiB chunks whose chaining values are
+// merged into the usual binary tree, so digests match the reference implementation.
+
+constexpr uint32_t chunk_length = 1024;
+constexpr uint32_t block_length = 64;
+
+constexpr uint32_t CHUNK_START = 1 << 0;
+constexpr uint32_t CHUNK_END = 1 << 1;
+constexpr uint32_t PARENT = 1 << 2;
+constexpr uint32_t ROOT = 1 << 3;
+
+static constexpr uint32_t iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+// message word order of each of the seven rounds (the permutation applied repeatedly)
+static constexpr uint8_t schedule[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+using chaining_value_t = std::array < uint32_t, 8 >;
+
+static uint32_t rotr32(const uint32_t value, const int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void g(uint32_t * state, const int a, const int b, const int c, const int d, const uint32_t x, const uint32_t y)
+{
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotr32(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotr32(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+// the first 8 words of the compression output, which is all hash mode needs
+static chaining_value_t compress(const chaining_value_t & cv, const uint8_t * block,
+    const uint64_t counter, const uint32_t length, const uint32_t flags)
+{
+    uint32_t message[16];
+    for (int i = 0; i < 16; i++) {
+        message[i] = block[4 * i] | block[4 * i + 1] << 8 | block[4 * i + 2] << 16 | static_cast<uint32_t>(block[4 * i + 3]) << 24;
+    }
+
+    uint32_t state[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        iv[0], iv[1], iv[2], iv[3],
+        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), length, flags,
+    };
+
+    for (const auto & order : schedule)
+    {
+        g(state, 0, 4, 8, 12, message[order[0]], message[order[1]]);
+        g(state, 1, 5, 9, 13, message[order[2]], message[order[3]]);
+        g(state, 2, 6, 10, 14, message[order[4]], message[order[5]]);
+        g(state, 3, 7, 11, 15, message[order[6]], message[order[7]]);
+        g(state, 0, 5, 10, 15, message[order[8]], message[order[9]]);
+        g(state, 1, 6, 11, 12, message[order[10]], message[order[11]]);
+        g(state, 2, 7, 8, 13, message[order[12]], message[order[13]]);
+        g(state, 3, 4, 9, 14, message[order[14]], message[order[15]]);
+    }
+
+    chaining_value_t out;
+    for (int i = 0; i < 8; i++) {
+        out[i] = state[i] ^ state[i + 8];
+    }
+    return out;
+}
+
+// the node whose compression is still pending: the last block of a chunk, or a parent
+struct output_t {
+    chaining_value_t cv;
+    uint8_t block[block_length];
+    uint64_t counter;
+    uint32_t length;
+    uint32_t flags;
+
+    [[nodiscard]] chaining_value_t chaining_value(const uint32_t extra_flags = 0) const {
+        return compress(cv, block, counter, length, flags | extra_flags);
+    }
+};
+
+// every block but the last is compressed right away
+static output_t chunk_output(const uint8_t * input, const uint64_t length, const uint64_t chunk_counter)
+{
+    output_t output { };
+    std::memcpy(output.cv.data(), iv, sizeof(iv));
+    output.counter = chunk_counter;
+
+    const uint64_t blocks = length == 0 ? 1 : (length + block_length - 1) / block_length;
+    for (uint64_t block = 0; block + 1 < blocks; block++) {
+        output.cv = compress(output.cv, input + block * block_length, chunk_counter, block_length,
+            block == 0 ? CHUNK_START : 0);
+    }
+
+    const uint64_t last_offset = (blocks - 1) * block_length;
+    output.length = static_cast<uint32_t>(length - last_offset);
+    std::memcpy(output.block, input + last_offset, output.length);
+    output.flags = CHUNK_END | (blocks == 1 ? CHUNK_START : 0);
+    return output;
+}
+
+static output_t parent_output(const chaining_value_t & left, const chaining_value_t & right)
+{
+    output_t output { };
+    std::memcpy(output.cv.data(), iv, sizeof(iv));
+    for (int i = 0; i < 8; i++)
+    {
+        for (int byte = 0; byte < 4; byte++)
+        {
+            output.block[4 * i + byte] = static_cast<uint8_t>(left[i] >> (8 * byte));
+            output.block[32 + 4 * i + byte] = static_cast<uint8_t>(right[i] >> (8 * byte));
+        }
+    }
+    output.counter = 0;
+    output.length = block_length;
+    output.flags = PARENT;
+    return output;
+}
+
+std::array<char, 32> blake3sum(const char* _data, const uint64_t _dt_len)
+{
+    const auto * input = reinterpret_cast<const uint8_t *>(_data);
+    const uint64_t chunks = _dt_len == 0 ? 1 : (_dt_len + chunk_length - 1) / chunk_length;
+
+    // chaining values of complete subtrees, one per set bit of the chunk count
+    std::vector < chaining_value_t > stack;
+    for (uint64_t chunk = 0; chunk + 1 < chunks; chunk++)
+    {
+        auto cv = chunk_output(input + chunk * chunk_length, chunk_length, chunk).chaining_value();
+        for (uint64_t total = chunk + 1; (total & 1) == 0; total >>= 1)
+        {
+            cv = parent_output(stack.back(), cv).chaining_value();
+            stack.pop_back();
+        }
+        stack.push_back(cv);
+    }
+
+    const uint64_t last_offset = (chunks - 1) * chunk_length;
+    auto output = chunk_output(input + last_offset, _dt_len - last_offset, chunks - 1);
+    while (!stack.empty())
+    {
+        output = parent_output(stack.back(), output.chaining_value());
+        stack.pop_back();
+    }
+
+    const auto root = output.chaining_value(ROOT);
+    std::array<char, 32> hash { };
+    for (int i = 0; i < 8; i++) {
+        for (int byte = 0; byte < 4; byte++) {
+            hash[4 * i + byte] = static_cast<char>(root[i] >> (8 * byte));
+        }
+    }
+
+    return hash;
+}
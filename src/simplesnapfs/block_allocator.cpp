@@ -0,0 +1,303 @@
+#include <block_allocator.h>
+#include <checksum.h>
+#include <debug.h>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <sched.h>
+
+block_allocator::group_t::group_t(const uint64_t _first_block, const uint64_t blocks, const uint64_t segment_blocks)
+    :   first_block(_first_block),
+        map(blocks),
+        extents(map, segment_blocks),
+        free_blocks(blocks),
+        dirty((blocks + segment_blocks - 1) / segment_blocks, false)
+{
+}
+
+block_allocator::block_allocator(block_io & _io, const simplesnapfs_filesystem_head_t & _head, unsigned int group_count)
+    :   io(_io),
+        head(_head),
+        algorithm(static_cast<checksum_algorithm_t>(_head.static_information.checksum_algorithm)),
+        block_size(_head.static_information.fs_block_size),
+        digest_length(checksum_digest_length(algorithm))
+{
+    const uint64_t data_blocks = head.static_information.data_blocks;
+    const uint64_t bitmap_block_bits = static_cast<uint64_t>(block_size) * 8;
+    if (group_count == 0) {
+        group_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    group_count = static_cast<unsigned int>(std::clamp < uint64_t > (data_blocks / ALLOCATION_GROUP_MIN_BLOCKS, 1, group_count));
+
+    // whole bitmap blocks per group, the last one takes what is left
+    group_blocks = (data_blocks + group_count - 1) / group_count;
+    group_blocks = std::max < uint64_t > ((group_blocks + bitmap_block_bits - 1) / bitmap_block_bits * bitmap_block_bits, 1);
+    for (uint64_t first = 0; first < data_blocks || groups.empty(); first += group_blocks) {
+        groups.emplace_back(std::make_unique < group_t > (first, std::min(group_blocks, data_blocks - first), bitmap_block_bits));
+    }
+
+    load();
+}
+
+void block_allocator::load()
+{
+    const auto & info = head.static_information;
+    const uint64_t bytes = info.data_block_bitmap_blocks * block_size;
+    std::vector < char > primary(bytes), redundancy(bytes);
+    std::vector < char > primary_checksums(info.data_block_bitmap_blocks * digest_length);
+    std::vector < char > redundancy_checksums(primary_checksums.size());
+    io.read_range(info.data_block_bitmap_blk_index * block_size, bytes, primary.data());
+    io.read_range(info.redundancy_data_block_bitmap_blk_index * block_size, bytes, redundancy.data());
+    io.read_range(info.data_block_bitmap_checksum_blk_index * block_size, primary_checksums.size(), primary_checksums.data());
+    io.read_range(info.redundancy_data_block_bitmap_checksum_blk_index * block_size,
+        redundancy_checksums.size(), redundancy_checksums.data());
+
+    // per bitmap block, the first copy either checksum copy vouches for
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    const auto vouched = [&](const char * copy, const uint64_t block) {
+        checksum(algorithm, copy, block_size, digest);
+        return std::memcmp(digest, primary_checksums.data() + block * digest_length, digest_length) == 0
+            || std::memcmp(digest, redundancy_checksums.data() + block * digest_length, digest_length) == 0;
+    };
+
+    // blocks with a damaged or outdated copy of either are written again on the next flush
+    std::vector < bool > damaged(info.data_block_bitmap_blocks, false);
+    for (uint64_t block = 0; block < info.data_block_bitmap_blocks; block++)
+    {
+        char * primary_block = primary.data() + block * block_size;
+        const char * redundancy_block = redundancy.data() + block * block_size;
+        if (!vouched(primary_block, block))
+        {
+            if (!vouched(redundancy_block, block))
+            {
+                log(_log::LOG_ERROR, "Data block bitmap block ", block, " has no good copy\n");
+                throw CorruptedBitmap();
+            }
+            std::memcpy(primary_block, redundancy_block, block_size);
+            damaged[block] = true;
+            continue;
+        }
+
+        damaged[block] = std::memcmp(primary_block, redundancy_block, block_size) != 0
+            || std::memcmp(digest, primary_checksums.data() + block * digest_length, digest_length) != 0
+            || std::memcmp(digest, redundancy_checksums.data() + block * digest_length, digest_length) != 0;
+    }
+
+    const uint64_t bitmap_block_bits = static_cast<uint64_t>(block_size) * 8;
+    for (const auto & group : groups)
+    {
+        group->map.load(primary.data() + group->first_block / 8);
+        group->free_blocks = group->map.get_free_blocks();
+        for (uint64_t block = 0; block < group->dirty.size(); block++)
+        {
+            if (damaged[group->first_block / bitmap_block_bits + block])
+            {
+                group->dirty[block] = true;
+                group->dirty_blocks++;
+            }
+        }
+    }
+}
+
+void block_allocator::mark_dirty(group_t & group, const uint64_t first, const uint64_t count) const
+{
+    const uint64_t bitmap_block_bits = static_cast<uint64_t>(block_size) * 8;
+    for (uint64_t block = first / bitmap_block_bits; count != 0 && block <= (first + count - 1) / bitmap_block_bits; block++)
+    {
+        if (!group.dirty[block])
+        {
+            group.dirty[block] = true;
+            group.dirty_blocks++;
+        }
+    }
+}
+
+uint64_t block_allocator::local_group() const
+{
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return static_cast<uint64_t>(cpu) % groups.size();
+    }
+    return std::hash < std::thread::id > { } (std::this_thread::get_id()) % groups.size();
+}
+
+bool block_allocator::allocate_in_groups(const uint64_t count, uint64_t & first, const uint64_t hint,
+    const std::function < bool (group_t &, uint64_t, uint64_t &) > & find)
+{
+    const bool hinted = hint != 0 && hint < head.static_information.data_blocks;
+    const uint64_t preferred = hinted ? group_of(hint) : local_group();
+    for (uint64_t i = 0; i < groups.size(); i++)
+    {
+        auto & group = *groups[(preferred + i) % groups.size()];
+        // without the lock: a group that cannot have enough is not worth waiting for
+        if (group.free_blocks.load(std::memory_order_relaxed) < count) {
+            continue;
+        }
+
+        std::lock_guard lock(group.mutex);
+        uint64_t found;
+        if (!find(group, i == 0 && hinted ? hint - group.first_block : 0, found)) {
+            continue;
+        }
+
+        group.map.set(found, count);
+        group.extents.allocated(found, count);
+        group.free_blocks.store(group.map.get_free_blocks(), std::memory_order_relaxed);
+        mark_dirty(group, found, count);
+        if (i != 0) {
+            stolen_allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        first = group.first_block + found;
+        return true;
+    }
+
+    return false;
+}
+
+bool block_allocator::allocate(uint64_t & block, const uint64_t hint)
+{
+    return allocate_in_groups(1, block, hint, [](group_t & group, const uint64_t group_hint, uint64_t & found) {
+        return group.map.find_free(found, group_hint);
+    });
+}
+
+bool block_allocator::allocate_run(const uint64_t count, uint64_t & first, const uint64_t hint)
+{
+    return allocate_in_groups(count, first, hint, [count](group_t & group, const uint64_t group_hint, uint64_t & found) {
+        return group.map.find_free_run(count, found, group_hint);
+    });
+}
+
+bool block_allocator::allocate_extent(const uint64_t count, uint64_t & first, const free_extent_tree::fit_t fit)
+{
+    return allocate_in_groups(count, first, 0, [count, fit](group_t & group, uint64_t, uint64_t & found) {
+        return group.extents.find(count, found, fit);
+    });
+}
+
+void block_allocator::release(const uint64_t first, const uint64_t count)
+{
+    const uint64_t data_blocks = head.static_information.data_blocks;
+    if (first >= data_blocks || count > data_blocks - first)
+    {
+        log(_log::LOG_ERROR, "Releasing ", count, " blocks from block ", first, " beyond the ", data_blocks, " data blocks\n");
+        throw BlockOutOfRange();
+    }
+
+    // split at the group boundaries
+    const uint64_t end = first + count;
+    for (uint64_t position = first; position < end;)
+    {
+        auto & group = *groups[group_of(position)];
+        const uint64_t part_end = std::min(group.first_block + group.map.size(), end);
+        std::lock_guard lock(group.mutex);
+        group.map.clear(position - group.first_block, part_end - position);
+        group.extents.released(position - group.first_block, part_end - position);
+        group.free_blocks.store(group.map.get_free_blocks(), std::memory_order_relaxed);
+        mark_dirty(group, position - group.first_block, part_end - position);
+        position = part_end;
+    }
+}
+
+bool block_allocator::is_allocated(const uint64_t block) const
+{
+    if (block >= head.static_information.data_blocks)
+    {
+        log(_log::LOG_ERROR, "Block ", block, " is beyond the ", head.static_information.data_blocks, " data blocks\n");
+        throw BlockOutOfRange();
+    }
+
+    auto & group = *groups[group_of(block)];
+    std::lock_guard lock(group.mutex);
+    return group.map.is_allocated(block - group.first_block);
+}
+
+uint64_t block_allocator::get_free_blocks() const
+{
+    uint64_t free_blocks = 0;
+    for (const auto & group : groups) {
+        free_blocks += group->free_blocks.load(std::memory_order_relaxed);
+    }
+    return free_blocks;
+}
+
+uint64_t block_allocator::get_largest_free_extent()
+{
+    uint64_t largest = 0;
+    for (const auto & group : groups)
+    {
+        std::lock_guard lock(group->mutex);
+        largest = std::max(largest, group->extents.get_largest_extent());
+    }
+    return largest;
+}
+
+uint64_t block_allocator::get_dirty_bitmap_blocks() const
+{
+    uint64_t dirty_blocks = 0;
+    for (const auto & group : groups)
+    {
+        std::lock_guard lock(group->mutex);
+        dirty_blocks += group->dirty_blocks;
+    }
+    return dirty_blocks;
+}
+
+void block_allocator::flush()
+{
+    const auto & info = head.static_information;
+    const uint64_t bitmap_block_bits = static_cast<uint64_t>(block_size) * 8;
+    std::lock_guard flush_lock(flush_mutex);
+    std::vector < char > bytes, checksums;
+
+    // each run of dirty bitmap blocks as it was when the group's lock was held,
+    // both copies and both checksum copies written per run
+    for (const auto & group : groups)
+    {
+        std::vector < std::pair < uint64_t, uint64_t > > runs; // first block in the bitmap, blocks
+        {
+            std::lock_guard lock(group->mutex);
+            if (group->dirty_blocks == 0) {
+                continue;
+            }
+
+            for (uint64_t block = 0; block < group->dirty.size(); block++)
+            {
+                if (!group->dirty[block]) {
+                    continue;
+                }
+
+                const uint64_t bitmap_block = group->first_block / bitmap_block_bits + block;
+                if (!runs.empty() && runs.back().first + runs.back().second == bitmap_block) {
+                    runs.back().second++;
+                } else {
+                    runs.emplace_back(bitmap_block, 1);
+                }
+                group->dirty[block] = false;
+            }
+            group->dirty_blocks = 0;
+
+            bytes.resize(group->dirty.size() * block_size);
+            for (const auto & [first, count] : runs) {
+                group->map.store(bytes.data() + (first * bitmap_block_bits - group->first_block) / 8,
+                    (first * bitmap_block_bits - group->first_block) / 8, count * block_size);
+            }
+        }
+
+        for (const auto & [first, count] : runs)
+        {
+            const char * data = bytes.data() + (first * bitmap_block_bits - group->first_block) / 8;
+            checksums.resize(count * digest_length);
+            for (uint64_t block = 0; block < count; block++) {
+                checksum(algorithm, data + block * block_size, block_size, checksums.data() + block * digest_length);
+            }
+
+            io.write_range((info.data_block_bitmap_blk_index + first) * block_size, count * block_size, data);
+            io.write_range((info.redundancy_data_block_bitmap_blk_index + first) * block_size, count * block_size, data);
+            io.write_range(info.data_block_bitmap_checksum_blk_index * block_size + first * digest_length,
+                checksums.size(), checksums.data());
+            io.write_range(info.redundancy_data_block_bitmap_checksum_blk_index * block_size + first * digest_length,
+                checksums.size(), checksums.data());
+        }
+    }
+}
@@ -2,14 +2,64 @@
 #include <debug.h>
 #include <fcntl.h>
 #include <cstring>
+#include <climits>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+
+// logical sector size of a block device, or the smallest direct read a
+// regular file accepts (depends on the filesystem and the disk below it)
+static uint32_t determine_logical_sector_size(const int fd)
+{
+    struct stat st { };
+    if (fstat(fd, &st) == -1) {
+        return 0;
+    }
+
+    if (S_ISBLK(st.st_mode))
+    {
+        int sector_size = 0;
+        if (ioctl(fd, BLKSSZGET, &sector_size) == -1) {
+            return 0;
+        }
+        return static_cast<uint32_t>(sector_size);
+    }
+
+    constexpr uint32_t largest_probe = 4096;
+    void * probe = nullptr;
+    if (posix_memalign(&probe, largest_probe, largest_probe) != 0) {
+        return 0;
+    }
+
+    uint32_t sector_size = 0;
+    for (uint32_t size = 512; size <= largest_probe; size *= 2)
+    {
+        // EINVAL means misaligned, anything else (including an empty file) settles it
+        if (pread(fd, probe, size, 0) != -1 || errno != EINVAL) {
+            sector_size = size;
+            break;
+        }
+    }
+
+    free(probe);
+    return sector_size;
+}
 
 block_io::block_io(
     const std::string &device_path,
-    const uint32_t _block_size)
-    :   block_size(_block_size)
+    const uint32_t _block_size,
+    const block_io_configuration_t & configuration)
+    :   block_size(_block_size),
+        max_io_size(std::max < uint64_t > (configuration.max_io_size, _block_size)),
+        // page cache bypass means nothing for a mapping
+        direct_io(configuration.direct_io && !configuration.memory_mapped)
 {
-    fd = open(device_path.c_str(), O_RDWR);
+    fd = open(device_path.c_str(), O_RDWR | (direct_io ? O_DIRECT : 0));
     if (fd == -1)
     {
         log(_log::LOG_ERROR, "Error opening file: ", device_path, "\n");
@@ -26,40 +76,333 @@ block_io::block_io(
     }
 
     total_blocks = file_size / _block_size;
+
+    struct stat st { };
+    block_device = fstat(fd, &st) == 0 && S_ISBLK(st.st_mode);
+
+    // direct I/O needs offsets, lengths and memory aligned to the logical sector size
+    size_t buffer_alignment = alignof(std::max_align_t);
+    if (direct_io)
+    {
+        logical_sector_size = determine_logical_sector_size(fd);
+        if (logical_sector_size == 0 || _block_size % logical_sector_size != 0)
+        {
+            log(_log::LOG_ERROR, "Block size ", _block_size, " is not a multiple of the logical sector size (",
+                logical_sector_size, ") of ", device_path, ", cannot use direct I/O\n");
+            close(fd);
+            throw UnalignedBlockSize();
+        }
+        buffer_alignment = logical_sector_size;
+    }
+
+    try {
+        if (configuration.memory_mapped) {
+            mapping = std::make_unique < mapped_file > (fd, total_blocks * _block_size, _block_size,
+                configuration.mmap_chunk_size, configuration.mmap_window_size, configuration.access_pattern);
+        } else {
+            cache = std::make_unique < buffer_cache > (_block_size, configuration.cache_size,
+                configuration.cache_shards, buffer_alignment,
+                [this](const buffer_cache::buffer_t & buffer) { write_block_to_device(buffer); });
+
+            // never let readahead claim more than a quarter of the cache
+            const uint64_t readahead_window = std::min(configuration.readahead_size / _block_size,
+                cache->get_capacity_in_blocks() / 4);
+            if (readahead_window != 0) {
+                readahead = std::make_unique < readahead_tracker > (total_blocks,
+                    configuration.readahead_initial_size / _block_size, readahead_window,
+                    configuration.readahead_max_stride);
+            }
+        }
+        engine = make_io_engine(fd, configuration.io_engine, configuration.queue_depth);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+
+    if (cache && configuration.background_writeback)
+    {
+        const uint64_t capacity = cache->get_capacity_in_blocks();
+        dirty_background_threshold = std::max < uint64_t > (configuration.dirty_background_bytes != 0
+            ? configuration.dirty_background_bytes / _block_size
+            : capacity * configuration.dirty_background_ratio / 100, 1);
+        dirty_limit = std::max < uint64_t > (configuration.dirty_bytes != 0
+            ? configuration.dirty_bytes / _block_size
+            : capacity * configuration.dirty_ratio / 100, dirty_background_threshold);
+        dirty_expire = std::chrono::milliseconds(configuration.dirty_expire_ms);
+        writeback_interval = std::chrono::milliseconds(std::max < uint32_t > (configuration.writeback_interval_ms, 1));
+        flusher = std::thread([this] { flusher_main(); });
+    }
 }
 
-block_io::block_t::block_t(
-    const uint32_t _block_size,
-    const uint64_t _block_number,
-    const int fd,
-    std::map < uint64_t /* block number */, std::vector < char > > & _cache)
-    :   buffer(_block_size),
-        cache(_cache),
-        block_number(_block_number),
-        block_size(_block_size)
+void block_io::read_block_from_device(buffer_cache::buffer_t & buffer) const
 {
-    auto it = _cache.find(_block_number);
+    const int64_t bytes_read = engine->readv(buffer.block_number * block_size,
+        { { .iov_base = buffer.data, .iov_len = block_size } });
+    if (bytes_read != block_size)
+    {
+        log(_log::LOG_ERROR, "Error reading file\n");
+        throw ReadFailed();
+    }
+}
 
-    // not cached, read from disk
-    if (it == _cache.end())
+void block_io::write_block_to_device(const buffer_cache::buffer_t & buffer) const
+{
+    const int64_t bytes_written = engine->writev(buffer.block_number * block_size,
+        { { .iov_base = buffer.data, .iov_len = block_size } });
+    if (bytes_written != block_size)
     {
-        if (lseek(fd, static_cast<off64_t>(_block_number * _block_size), SEEK_SET) == -1)
+        log(_log::LOG_ERROR, "Error writing to file\n");
+        throw WriteFailed();
+    }
+}
+
+std::future < int64_t > block_io::submit_run_to_device(const std::vector < buffer_cache::writeback_t > & run)
+{
+    std::vector < iovec > iov;
+    iov.reserve(run.size());
+    for (const auto & entry : run) {
+        iov.push_back({ .iov_base = entry.buffer->data, .iov_len = block_size });
+    }
+
+    auto promise = std::make_shared < std::promise < int64_t > >();
+    auto future = promise->get_future();
+    engine->submit_writev(run.front().buffer->block_number * block_size, std::move(iov),
+        [promise](const int64_t bytes_written) { promise->set_value(bytes_written); });
+    return future;
+}
+
+void block_io::submit_prefetch_run(std::vector < buffer_cache::buffer_t * > & run)
+{
+    std::vector < iovec > iov;
+    iov.reserve(run.size());
+    for (const auto * buffer : run) {
+        iov.push_back({ .iov_base = buffer->data, .iov_len = block_size });
+    }
+
+    const auto expected = static_cast<int64_t>(run.size() * block_size);
+    const uint64_t offset = run.front()->block_number * block_size;
+    // the run is handed over to the completion handler, which may run before this returns
+    engine->submit_readv(offset, std::move(iov),
+        [this, buffers = run, expected](const int64_t bytes_read)
         {
-            log(_log::LOG_ERROR, "Error using lseek\n");
-            throw SeekingFailed();
+            for (auto * buffer : buffers) {
+                cache->complete_reservation(*buffer, bytes_read == expected);
+            }
+        });
+    run.clear();
+}
+
+void block_io::prefetch(const readahead_tracker::window_t & window)
+{
+    const uint64_t max_blocks_per_io = std::min < uint64_t > (max_io_size / block_size, IOV_MAX);
+    std::vector < buffer_cache::buffer_t * > run;
+
+    try {
+        for (uint64_t i = 0; i < window.count; i++)
+        {
+            const uint64_t block_number = window.first + i * window.stride;
+            auto * buffer = cache->reserve(block_number);
+
+            // cached blocks and stride gaps break the run
+            if (!run.empty() && (buffer == nullptr || run.back()->block_number + 1 != block_number
+                || run.size() == max_blocks_per_io))
+            {
+                submit_prefetch_run(run);
+            }
+
+            if (buffer != nullptr) {
+                run.push_back(buffer);
+            }
+        }
+
+        if (!run.empty()) {
+            submit_prefetch_run(run);
         }
 
-        ssize_t bytes_read = ::read(fd, buffer.data(), _block_size);
-        if (bytes_read != _block_size)
+        engine->flush();
+    } catch (std::exception &) {
+        // readahead is best effort, the blocks are read again on access
+        for (auto * buffer : run) {
+            cache->complete_reservation(*buffer, false);
+        }
+        log(_log::LOG_ERROR, "Readahead of ", window.count, " blocks from block ", window.first, " failed\n");
+    }
+}
+
+void block_io::read_run_from_device(std::vector < buffer_cache::buffer_t * > & run,
+    const std::function < void (const buffer_cache::buffer_t &) > & consume)
+{
+    std::vector < iovec > iov;
+    iov.reserve(run.size());
+    for (const auto * buffer : run) {
+        iov.push_back({ .iov_base = buffer->data, .iov_len = block_size });
+    }
+
+    const auto expected = static_cast<int64_t>(run.size() * block_size);
+    const bool loaded = engine->readv(run.front()->block_number * block_size, std::move(iov)) == expected;
+    io_statistics.range_read_syscalls++;
+    if (loaded)
+    {
+        io_statistics.range_read_blocks += run.size();
+        for (const auto * buffer : run) {
+            consume(*buffer);
+        }
+    }
+
+    for (auto * buffer : run) {
+        cache->complete_reservation(*buffer, loaded, false);
+    }
+    run.clear();
+
+    if (!loaded)
+    {
+        log(_log::LOG_ERROR, "Error reading file\n");
+        throw ReadFailed();
+    }
+}
+
+block_io::readahead_statistics_t block_io::get_readahead_statistics() const
+{
+    if (!readahead) {
+        return { };
+    }
+
+    const auto tracker = readahead->get_statistics();
+    const auto cached = cache->get_statistics();
+    return {
+        .windows = tracker.windows,
+        .blocks_requested = tracker.blocks,
+        .blocks_loaded = cached.prefetched,
+        .hits = cached.prefetch_hits,
+        .wasted = cached.prefetch_wasted,
+    };
+}
+
+block_io::block_t::block_t(
+    block_io & _io,
+    const uint64_t _block_number,
+    const bool load)
+    :   io(&_io)
+{
+    if (io->mapping)
+    {
+        if (_block_number >= io->total_blocks)
         {
-            log(_log::LOG_ERROR, "Error reading file\n");
+            log(_log::LOG_ERROR, "Block ", _block_number, " is beyond the end of the device\n");
             throw ReadFailed();
         }
+
+        const uint64_t offset = _block_number * io->block_size;
+        chunk = &io->mapping->get_pinned_chunk(offset);
+        offset_in_chunk = offset - chunk->index * io->mapping->get_chunk_size();
+        data = chunk->base + offset_in_chunk;
+    }
+    else
+    {
+        buffer_cache::load_handler_t loader;
+        if (load) {
+            loader = [&](buffer_cache::buffer_t & fresh) { io->read_block_from_device(fresh); };
+        }
+        buffer = &io->cache->get_pinned(_block_number, loader);
+        data = buffer->data;
+    }
+}
+
+void block_io::block_t::pin() const
+{
+    if (buffer) {
+        buffer_cache::pin(*buffer);
+    } else if (chunk) {
+        mapped_file::pin(*chunk);
+    }
+}
+
+void block_io::block_t::unpin() const
+{
+    if (buffer) {
+        buffer_cache::unpin(*buffer);
+    } else if (chunk) {
+        mapped_file::unpin(*chunk);
+    }
+}
+
+block_io::block_t::block_t(const block_t & other)
+    :   io(other.io),
+        data(other.data),
+        buffer(other.buffer),
+        chunk(other.chunk),
+        offset_in_chunk(other.offset_in_chunk)
+{
+    pin();
+}
+
+block_io::block_t::block_t(block_t && other) noexcept
+    :   io(other.io),
+        data(other.data),
+        buffer(other.buffer),
+        chunk(other.chunk),
+        offset_in_chunk(other.offset_in_chunk)
+{
+    other.buffer = nullptr;
+    other.chunk = nullptr;
+}
+
+block_io::block_t & block_io::block_t::operator=(const block_t & other)
+{
+    if (this != &other)
+    {
+        other.pin();
+        unpin();
+        io = other.io;
+        data = other.data;
+        buffer = other.buffer;
+        chunk = other.chunk;
+        offset_in_chunk = other.offset_in_chunk;
+    }
+    return *this;
+}
+
+block_io::block_t & block_io::block_t::operator=(block_t && other) noexcept
+{
+    if (this != &other)
+    {
+        unpin();
+        io = other.io;
+        data = other.data;
+        buffer = other.buffer;
+        chunk = other.chunk;
+        offset_in_chunk = other.offset_in_chunk;
+        other.buffer = nullptr;
+        other.chunk = nullptr;
+    }
+    return *this;
+}
+
+block_io::block_t::~block_t()
+{
+    unpin();
+}
+
+std::span < const char > block_io::block_t::view() const
+{
+    return { data, io->block_size };
+}
+
+std::span < char > block_io::block_t::writable_view()
+{
+    if (buffer)
+    {
+        io->cache->mark_dirty(*buffer);
+        if (io->flusher.joinable()) {
+            io->balance_dirty();
+        }
     }
     else
     {
-        buffer = it->second;
+        io->mapping->mark_dirty(*chunk, offset_in_chunk, offset_in_chunk + io->block_size);
     }
+
+    return { data, io->block_size };
 }
 
 uint64_t actual_ops_len(const uint64_t block_size, const uint64_t len, const uint64_t off)
@@ -78,52 +421,467 @@ uint64_t actual_ops_len(const uint64_t block_size, const uint64_t len, const uin
 
 uint64_t block_io::block_t::read(char * _buf, const uint64_t len, const uint64_t off) const
 {
-    auto actual_read_len = actual_ops_len(block_size, len, off);
-    std::memcpy(_buf, buffer.data(), actual_read_len);
+    auto actual_read_len = actual_ops_len(io->block_size, len, off);
+    std::memcpy(_buf, data + off, actual_read_len);
     return actual_read_len;
 }
 
 uint64_t block_io::block_t::write(const char * _src, const uint64_t len, const uint64_t off)
 {
-    auto actual_write_len = actual_ops_len(block_size, len, off);
-    std::memcpy(buffer.data(), _src, actual_write_len);
+    auto actual_write_len = actual_ops_len(io->block_size, len, off);
+    if (actual_write_len != 0) {
+        std::memcpy(writable_view().data() + off, _src, actual_write_len);
+    }
     return actual_write_len;
 }
 
-block_io::block_t::~block_t()
+void block_io::sync()
 {
-    cache.insert_or_assign(block_number, buffer);
+    if (mapping)
+    {
+        mapping->sync();
+
+        // chunks unmapped since the last sync left their dirty pages in the page cache
+        if (engine->fsync() != 0)
+        {
+            log(_log::LOG_ERROR, "Error synchronizing file\n");
+            throw WriteFailed();
+        }
+        return;
+    }
+
+    {
+        std::lock_guard lock(writeback_mutex);
+        const auto dirty = cache->collect_dirty();
+        const uint64_t requests = write_back(dirty);
+        io_statistics.writeback_blocks += dirty.size();
+        io_statistics.writeback_syscalls += requests;
+        io_statistics.syscalls_saved += dirty.size() - requests;
+    }
+
+    if (engine->fsync() != 0)
+    {
+        log(_log::LOG_ERROR, "Error synchronizing file\n");
+        throw WriteFailed();
+    }
 }
 
-void block_io::sync()
+uint64_t block_io::write_back(const std::vector < buffer_cache::writeback_t > & dirty)
 {
-    for (const auto& block : cache)
-    {
-        if (lseek(fd, static_cast<off64_t>(block_size * block.first), SEEK_SET) == -1)
+    const uint64_t max_blocks_per_io = std::min < uint64_t > (max_io_size / block_size, IOV_MAX);
+
+    // merge runs of consecutive dirty blocks into single large writes,
+    // all of them are queued before waiting for any
+    std::vector < std::pair < std::future < int64_t >, int64_t /* expected */ > > writes;
+    try {
+        std::vector < buffer_cache::writeback_t > run;
+        run.reserve(max_blocks_per_io);
+        for (const auto & entry : dirty)
         {
-            log(_log::LOG_ERROR, "Error using lseek\n");
-            throw SeekingFailed();
+            if (!run.empty() && (run.back().buffer->block_number + 1 != entry.buffer->block_number || run.size() == max_blocks_per_io))
+            {
+                writes.emplace_back(submit_run_to_device(run), static_cast<int64_t>(run.size() * block_size));
+                run.clear();
+            }
+            run.push_back(entry);
+        }
+
+        if (!run.empty()) {
+            writes.emplace_back(submit_run_to_device(run), static_cast<int64_t>(run.size() * block_size));
+        }
+
+        engine->flush();
+    } catch (...) {
+        // the buffers must stay put until whatever got submitted is done
+        for (auto & [future, expected] : writes) {
+            future.wait();
+        }
+        cache->finish_writeback(dirty, false);
+        throw;
+    }
+
+    uint64_t failed = 0;
+    for (auto & [future, expected] : writes)
+    {
+        if (future.get() != expected) {
+            failed++;
         }
+    }
 
-        // Write data from the buffer to the file at the specified offset
-        ssize_t bytes_written = ::write(fd, block.second.data(), block_size);
-        if (bytes_written == -1)
+    cache->finish_writeback(dirty, failed == 0);
+    if (failed != 0)
+    {
+        log(_log::LOG_ERROR, "Error writing to file\n");
+        throw WriteFailed();
+    }
+
+    return writes.size();
+}
+
+void block_io::flusher_main()
+{
+    std::unique_lock lock(flusher_mutex);
+    while (true)
+    {
+        flusher_wakeup.wait_for(lock, writeback_interval, [this] { return flusher_stop || flusher_kicked; });
+        if (flusher_stop) {
+            return;
+        }
+        flusher_kicked = false;
+        lock.unlock();
+
+        // above the background threshold everything goes, otherwise only what expired
+        uint64_t dirtied_before = UINT64_MAX;
+        if (cache->get_dirty_buffers() < dirty_background_threshold)
         {
-            log(_log::LOG_ERROR, "Error writing to file\n");
-            throw WriteFailed();
+            const auto now = std::chrono::steady_clock::now().time_since_epoch();
+            dirtied_before = now > dirty_expire
+                ? std::chrono::duration_cast < std::chrono::nanoseconds > (now - dirty_expire).count() : 0;
         }
+
+        try {
+            std::lock_guard writeback_lock(writeback_mutex);
+            const auto dirty = cache->collect_dirty(dirtied_before);
+            if (!dirty.empty())
+            {
+                const uint64_t requests = write_back(dirty);
+                io_statistics.background_blocks += dirty.size();
+                io_statistics.background_syscalls += requests;
+            }
+        } catch (std::exception &) {
+            // buffers that failed stay dirty, the next pass (or sync()) retries them
+            log(_log::LOG_ERROR, "Background writeback failed\n");
+        }
+
+        lock.lock();
+        flusher_passes++;
+        flusher_pass_done.notify_all();
+    }
+}
+
+void block_io::stop_flusher()
+{
+    if (!flusher.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(flusher_mutex);
+        flusher_stop = true;
+    }
+    flusher_wakeup.notify_all();
+    flusher_pass_done.notify_all();
+    flusher.join();
+}
+
+void block_io::balance_dirty()
+{
+    // writers are never held back longer than this, the flusher cannot clean
+    // buffers somebody else keeps pinned
+    constexpr auto max_throttle_delay = std::chrono::milliseconds(100);
+
+    const uint64_t dirty = cache->get_dirty_buffers();
+    if (dirty < dirty_background_threshold) {
+        return;
+    }
+
+    std::unique_lock lock(flusher_mutex);
+    if (!flusher_kicked)
+    {
+        flusher_kicked = true;
+        flusher_wakeup.notify_one();
     }
 
-    cache.clear();
-    fsync(fd);
+    if (dirty < dirty_limit) {
+        return;
+    }
+
+    // writers outrunning the device wait for one flusher pass
+    io_statistics.throttled_writes++;
+    const uint64_t pass = flusher_passes;
+    flusher_pass_done.wait_for(lock, max_throttle_delay, [&] { return flusher_passes != pass || flusher_stop; });
 }
 
 block_io::~block_io()
 {
+    stop_flusher();
     sync();
+    engine.reset();
+    cache.reset();
+    mapping.reset();
+    close(fd);
 }
 
 block_io::block_t block_io::get_block(const uint64_t _block_number)
 {
-    return block_t(block_size, _block_number, fd, cache);
+    block_t block(*this, _block_number);
+
+    // the block itself was read synchronously, what follows it goes in the background
+    if (readahead)
+    {
+        if (const auto window = readahead->access(_block_number); window.count != 0) {
+            prefetch(window);
+        }
+    }
+
+    return block;
+}
+
+uint64_t block_io::read_range(const uint64_t offset, const uint64_t len, char * buf)
+{
+    const uint64_t device_size = total_blocks * block_size;
+    if (offset >= device_size || len == 0) {
+        return 0;
+    }
+
+    const uint64_t end = offset + std::min(len, device_size - offset);
+    // the part of a block that falls into the range
+    const auto copy_out = [&](const uint64_t block_number, const char * data)
+    {
+        const uint64_t block_begin = block_number * block_size;
+        const uint64_t begin = std::max(offset, block_begin);
+        std::memcpy(buf + (begin - offset), data + (begin - block_begin),
+            std::min(end, block_begin + block_size) - begin);
+    };
+
+    const uint64_t first_block = offset / block_size;
+    const uint64_t last_block = (end - 1) / block_size;
+    if (mapping)
+    {
+        for (uint64_t block_number = first_block; block_number <= last_block; block_number++) {
+            copy_out(block_number, block_t(*this, block_number).data);
+        }
+        return end - offset;
+    }
+
+    // uncached blocks are reserved and read in runs, cached ones copied as they are
+    const uint64_t max_blocks_per_io = std::min < uint64_t > (max_io_size / block_size, IOV_MAX);
+    const auto consume = [&](const buffer_cache::buffer_t & buffer) { copy_out(buffer.block_number, buffer.data); };
+    std::vector < buffer_cache::buffer_t * > run;
+    try {
+        for (uint64_t block_number = first_block; block_number <= last_block; block_number++)
+        {
+            auto * buffer = cache->reserve(block_number);
+            if (!run.empty() && (buffer == nullptr || run.size() == max_blocks_per_io)) {
+                read_run_from_device(run, consume);
+            }
+
+            if (buffer != nullptr) {
+                run.push_back(buffer);
+            } else {
+                copy_out(block_number, block_t(*this, block_number).data);
+            }
+        }
+
+        if (!run.empty()) {
+            read_run_from_device(run, consume);
+        }
+    } catch (...) {
+        for (auto * buffer : run) {
+            cache->complete_reservation(*buffer, false);
+        }
+        throw;
+    }
+
+    return end - offset;
+}
+
+uint64_t block_io::write_range(const uint64_t offset, const uint64_t len, const char * buf)
+{
+    const uint64_t device_size = total_blocks * block_size;
+    if (offset >= device_size || len == 0) {
+        return 0;
+    }
+
+    const uint64_t end = offset + std::min(len, device_size - offset);
+    for (uint64_t block_number = offset / block_size; block_number <= (end - 1) / block_size; block_number++)
+    {
+        const uint64_t block_begin = block_number * block_size;
+        const uint64_t begin = std::max(offset, block_begin);
+        const uint64_t length = std::min(end, block_begin + block_size) - begin;
+        block_t(*this, block_number, length != block_size).write(buf + (begin - offset), length, begin - block_begin);
+    }
+
+    return end - offset;
+}
+
+block_io::block_range_t block_io::get_blocks(const uint64_t first_block, const uint64_t count)
+{
+    return block_range_t(*this, first_block, count);
+}
+
+block_io::block_range_t::block_range_t(
+    block_io & _io,
+    const uint64_t _first_block,
+    const uint64_t _count)
+    :   io(&_io),
+        first_block(_first_block),
+        count(_count)
+{
+    if (count == 0 || first_block >= io->total_blocks || io->total_blocks - first_block < count)
+    {
+        log(_log::LOG_ERROR, "Blocks ", first_block, "+", count, " are beyond the end of the device\n");
+        throw ReadFailed();
+    }
+
+    const uint64_t offset = first_block * io->block_size;
+    const uint64_t length = count * io->block_size;
+    if (io->mapping && offset / io->mapping->get_chunk_size() == (offset + length - 1) / io->mapping->get_chunk_size())
+    {
+        chunk = &io->mapping->get_pinned_chunk(offset);
+        offset_in_chunk = offset - chunk->index * io->mapping->get_chunk_size();
+        data = chunk->base + offset_in_chunk;
+        return;
+    }
+
+    staging.resize(length);
+    io->read_range(offset, length, staging.data());
+    data = staging.data();
+}
+
+block_io::block_range_t::block_range_t(block_range_t && other) noexcept
+    :   io(other.io),
+        first_block(other.first_block),
+        count(other.count),
+        data(other.data),
+        chunk(other.chunk),
+        offset_in_chunk(other.offset_in_chunk),
+        staging(std::move(other.staging)),
+        modified(other.modified)
+{
+    other.chunk = nullptr;
+    other.modified = false;
+}
+
+block_io::block_range_t::~block_range_t()
+{
+    if (chunk)
+    {
+        mapped_file::unpin(*chunk);
+        return;
+    }
+
+    try {
+        flush();
+    } catch (std::exception &) {
+        log(_log::LOG_ERROR, "Storing blocks ", first_block, "+", count, " failed, changes are lost\n");
+    }
+}
+
+std::span < char > block_io::block_range_t::writable_view()
+{
+    if (chunk) {
+        io->mapping->mark_dirty(*chunk, offset_in_chunk, offset_in_chunk + count * io->block_size);
+    } else {
+        modified = true;
+    }
+
+    return { data, count * io->block_size };
+}
+
+void block_io::block_range_t::flush()
+{
+    if (modified)
+    {
+        io->write_range(first_block * io->block_size, staging.size(), staging.data());
+        modified = false;
+    }
+}
+
+bool block_io::zero_blocks(const uint64_t first_block, uint64_t count)
+{
+    count = first_block < total_blocks ? std::min(count, total_blocks - first_block) : 0;
+    if (count == 0) {
+        return true;
+    }
+
+    // dirty copies must not be written over the zeros later, so they go first,
+    // and whatever was read in the meantime goes afterwards
+    if (cache) {
+        cache->invalidate(first_block, count);
+    }
+
+    const uint64_t offset = first_block * block_size;
+    const uint64_t length = count * block_size;
+    bool offloaded;
+    if (block_device)
+    {
+        uint64_t range[2] = { offset, length };
+        offloaded = ioctl(fd, BLKZEROOUT, range) == 0;
+    } else {
+        offloaded = fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, static_cast<off64_t>(offset), static_cast<off64_t>(length)) == 0
+            || fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off64_t>(offset), static_cast<off64_t>(length)) == 0;
+    }
+
+    if (!offloaded)
+    {
+        // write them out then, in requests of up to max_io_size, bypassing the cache
+        const uint64_t piece = std::min(std::max < uint64_t > (max_io_size / block_size, 1) * block_size, length);
+        void * zeros = nullptr;
+        if (posix_memalign(&zeros, std::max < size_t > (logical_sector_size, alignof(std::max_align_t)), piece) != 0) {
+            throw std::bad_alloc();
+        }
+        std::memset(zeros, 0, piece);
+        const std::unique_ptr < void, decltype(&free) > zeros_owner(zeros, &free);
+
+        for (uint64_t position = offset; position < offset + length; position += piece)
+        {
+            const uint64_t size = std::min(piece, offset + length - position);
+            if (engine->writev(position, { { .iov_base = zeros, .iov_len = size } }) != static_cast<int64_t>(size))
+            {
+                log(_log::LOG_ERROR, "Error writing to file\n");
+                throw WriteFailed();
+            }
+        }
+    }
+
+    if (cache) {
+        cache->invalidate(first_block, count);
+    }
+    return offloaded;
+}
+
+bool block_io::discard_blocks(const uint64_t first_block, uint64_t count)
+{
+    count = first_block < total_blocks ? std::min(count, total_blocks - first_block) : 0;
+    if (count == 0) {
+        return true;
+    }
+
+    const uint64_t offset = first_block * block_size;
+    const uint64_t length = count * block_size;
+    bool discarded;
+    if (block_device)
+    {
+        uint64_t range[2] = { offset, length };
+        discarded = ioctl(fd, BLKDISCARD, range) == 0;
+    } else {
+        discarded = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            static_cast<off64_t>(offset), static_cast<off64_t>(length)) == 0;
+    }
+
+    // whatever the device holds now, the cached copies are no better
+    if (discarded && cache) {
+        cache->invalidate(first_block, count);
+    }
+    return discarded;
+}
+
+void block_io::advise(const uint64_t first_block, const uint64_t blocks, const access_pattern_t pattern)
+{
+    if (mapping) {
+        mapping->advise(first_block * block_size, blocks * block_size, pattern);
+        return;
+    }
+
+    // the buffer cache sits on top of the page cache unless it is bypassed
+    if (!direct_io)
+    {
+        const int advice = pattern == ACCESS_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL
+                         : pattern == ACCESS_RANDOM ? POSIX_FADV_RANDOM
+                         : pattern == ACCESS_WILLNEED ? POSIX_FADV_WILLNEED
+                         : POSIX_FADV_NORMAL;
+        posix_fadvise(fd, static_cast<off64_t>(first_block * block_size),
+            static_cast<off64_t>(blocks * block_size), advice);
+    }
 }
@@ -0,0 +1,435 @@
+#include <buffer_cache.h>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+
+// never shrink the cache below a handful of blocks, even for 64 MiB block sizes
+constexpr uint64_t minimum_cached_blocks = 4;
+// a shard needs some room of its own for LRU to mean anything
+constexpr uint64_t minimum_blocks_per_shard = 8;
+
+static uint64_t steady_clock_ns()
+{
+    return std::chrono::duration_cast < std::chrono::nanoseconds > (
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void buffer_cache::mark_dirty(buffer_t & buffer)
+{
+    buffer.modifications.fetch_add(1, std::memory_order_acq_rel);
+    // the counter always matches the accounted flags, whatever the interleaving
+    if (!buffer.accounted.exchange(true, std::memory_order_acq_rel))
+    {
+        buffer.dirtied_at.store(steady_clock_ns(), std::memory_order_release);
+        dirty_buffers.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void buffer_cache::mark_written(buffer_t & buffer, const uint64_t generation)
+{
+    uint64_t current = buffer.written.load(std::memory_order_acquire);
+    while (current < generation &&
+        !buffer.written.compare_exchange_weak(current, generation, std::memory_order_acq_rel)) { }
+
+    if (buffer.modifications.load(std::memory_order_acquire) == generation
+        && buffer.accounted.exchange(false, std::memory_order_acq_rel))
+    {
+        dirty_buffers.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+buffer_cache::buffer_cache(
+    const uint32_t _block_size,
+    const uint64_t capacity,
+    const uint32_t shard_count,
+    const size_t alignment,
+    writeback_handler_t _writeback_handler)
+    :   block_size(_block_size),
+        capacity_in_blocks(std::max(capacity / _block_size, minimum_cached_blocks)),
+        writeback_handler(std::move(_writeback_handler))
+{
+    // power of two shards, as many as asked for while each keeps a useful share
+    uint64_t shards_wanted = std::min < uint64_t > (std::max < uint32_t > (shard_count, 1),
+        std::max < uint64_t > (capacity_in_blocks / minimum_blocks_per_shard, 1));
+    shards_wanted = std::bit_floor(shards_wanted);
+
+    shard_shift = 64 - std::countr_zero(shards_wanted);
+    capacity_per_shard = std::max < uint64_t > (capacity_in_blocks / shards_wanted, 1);
+
+    for (uint64_t i = 0; i < shards_wanted; i++)
+    {
+        shards.push_back(std::make_unique < shard_t > (_block_size, alignment));
+        shards.back()->index.reserve(capacity_per_shard);
+    }
+}
+
+buffer_cache::~buffer_cache()
+{
+    for (const auto & shard : shards)
+    {
+        for (const auto & buffer : shard->lru_list) {
+            shard->pool.release(buffer.data);
+        }
+        for (const auto & buffer : shard->orphans) {
+            shard->pool.release(buffer.data);
+        }
+    }
+}
+
+buffer_cache::shard_t & buffer_cache::shard_of(const uint64_t block_number) const
+{
+    // fibonacci hashing, neighbouring blocks land on different shards
+    if (shards.size() == 1) {
+        return *shards.front();
+    }
+    return *shards[(block_number * 0x9E3779B97F4A7C15ULL) >> shard_shift];
+}
+
+char * buffer_cache::evict_one(shard_t & shard, std::unique_lock < std::mutex > & lock)
+{
+    for (;;)
+    {
+        // least recently used buffer that nobody holds
+        const auto victim = std::find_if(shard.lru_list.rbegin(), shard.lru_list.rend(),
+            [](const buffer_t & buffer) { return buffer.pin_count.load(std::memory_order_acquire) == 0; });
+        if (victim == shard.lru_list.rend()) {
+            return nullptr;
+        }
+        const auto it = std::next(victim).base();
+        auto & buffer = *it;
+
+        // written out without the lock, so the rest of the shard is served meanwhile. Pinned,
+        // nobody else evicts or collects it, and lookups of the block wait until it is gone
+        if (buffer.is_dirty())
+        {
+            const uint64_t generation = buffer.modifications.load(std::memory_order_acquire);
+            buffer.writing_back = true;
+            pin(buffer);
+            lock.unlock();
+            try {
+                writeback_handler(buffer);
+            } catch (...) {
+                lock.lock();
+                buffer.writing_back = false;
+                unpin(buffer);
+                release_orphans(shard);
+                shard.loaded.notify_all();
+                throw;
+            }
+
+            lock.lock();
+            buffer.writing_back = false;
+            mark_written(buffer, generation);
+            unpin(buffer);
+            shard.statistics.dirty_evictions++;
+            shard.loaded.notify_all();
+
+            // invalidated meanwhile, the orphans are freed on their own
+            if (buffer.orphaned)
+            {
+                release_orphans(shard);
+                continue;
+            }
+        }
+
+        if (buffer.prefetched) {
+            shard.statistics.prefetch_wasted++;
+        }
+
+        // the buffer goes away, and its share of the dirty count with it
+        if (buffer.accounted.exchange(false, std::memory_order_acq_rel)) {
+            dirty_buffers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        char * storage = buffer.data;
+        shard.index.erase(buffer.block_number);
+        shard.lru_list.erase(it);
+        shard.statistics.evictions++;
+
+        return storage;
+    }
+}
+
+void buffer_cache::shrink_to_capacity(shard_t & shard, std::unique_lock < std::mutex > & lock)
+{
+    // give back what was over-committed while buffers were pinned
+    while (shard.lru_list.size() > capacity_per_shard)
+    {
+        char * storage = evict_one(shard, lock);
+        if (storage == nullptr) {
+            return;
+        }
+        shard.pool.release(storage);
+    }
+}
+
+void buffer_cache::release_orphans(shard_t & shard)
+{
+    for (auto buffer = shard.orphans.begin(); buffer != shard.orphans.end();)
+    {
+        if (buffer->pin_count.load(std::memory_order_acquire) != 0 || buffer->loading)
+        {
+            ++buffer;
+            continue;
+        }
+
+        // modified after it was dropped, the changes go with it
+        if (buffer->accounted.exchange(false, std::memory_order_acq_rel)) {
+            dirty_buffers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        shard.pool.release(buffer->data);
+        buffer = shard.orphans.erase(buffer);
+    }
+}
+
+char * buffer_cache::make_room(shard_t & shard, std::unique_lock < std::mutex > & lock)
+{
+    release_orphans(shard);
+
+    // recycle the storage of the evicted buffer so a full cache does not allocate
+    char * storage = nullptr;
+    if (shard.lru_list.size() >= capacity_per_shard) {
+        shrink_to_capacity(shard, lock);
+        storage = evict_one(shard, lock);
+    }
+
+    if (storage == nullptr) {
+        storage = shard.pool.acquire();
+    }
+
+    return storage;
+}
+
+buffer_cache::buffer_t & buffer_cache::get_pinned(const uint64_t block_number, const load_handler_t & loader)
+{
+    auto & shard = shard_of(block_number);
+    std::unique_lock lock(shard.mutex);
+
+    for (;;)
+    {
+        const auto it = shard.index.find(block_number);
+        if (it != shard.index.end())
+        {
+            auto & buffer = *it->second;
+            if (buffer.loading || buffer.writing_back)
+            {
+                // readahead is on it, the buffer may be gone when it failed,
+                // or it is evicted and gone once on the device
+                shard.loaded.wait(lock);
+                continue;
+            }
+
+            shard.statistics.hits++;
+            if (buffer.prefetched) {
+                buffer.prefetched = false;
+                shard.statistics.prefetch_hits++;
+            }
+            shard.lru_list.splice(shard.lru_list.begin(), shard.lru_list, it->second);
+            pin(buffer);
+            return buffer;
+        }
+
+        // in the index right away, so others wait for this load rather than start their own.
+        // Unless someone brought the block in while an eviction let go of the lock
+        char * storage = make_room(shard, lock);
+        if (shard.index.contains(block_number))
+        {
+            shard.pool.release(storage);
+            continue;
+        }
+
+        shard.statistics.misses++;
+        auto & buffer = shard.lru_list.emplace_front(block_number, storage);
+        shard.index.emplace(block_number, shard.lru_list.begin());
+        pin(buffer);
+        if (!loader) {
+            return buffer;
+        }
+
+        // the device is read without the shard lock, hits on the shard go on meanwhile
+        buffer.loading = true;
+        lock.unlock();
+        try {
+            loader(buffer);
+        } catch (...) {
+            complete_reservation(buffer, false);
+            throw;
+        }
+
+        lock.lock();
+        buffer.loading = false;
+        if (!buffer.orphaned)
+        {
+            lock.unlock();
+            shard.loaded.notify_all();
+            return buffer;
+        }
+
+        // invalidated while being read, what came in may predate the change
+        unpin(buffer);
+        release_orphans(shard);
+    }
+}
+
+buffer_cache::buffer_t * buffer_cache::reserve(const uint64_t block_number)
+{
+    auto & shard = shard_of(block_number);
+    std::unique_lock lock(shard.mutex);
+
+    if (shard.index.contains(block_number)) {
+        return nullptr;
+    }
+
+    // looked up again, an eviction may have let go of the lock
+    char * storage = make_room(shard, lock);
+    if (shard.index.contains(block_number))
+    {
+        shard.pool.release(storage);
+        return nullptr;
+    }
+
+    auto & buffer = shard.lru_list.emplace_front(block_number, storage);
+    buffer.loading = true;
+    shard.index.emplace(block_number, shard.lru_list.begin());
+    pin(buffer);
+    return &buffer;
+}
+
+void buffer_cache::complete_reservation(buffer_t & buffer, const bool loaded, const bool prefetched)
+{
+    auto & shard = shard_of(buffer.block_number);
+    {
+        std::lock_guard lock(shard.mutex);
+        buffer.loading = false;
+        if (buffer.orphaned)
+        {
+            // invalidated while being read, what came in is of no use
+            unpin(buffer);
+            release_orphans(shard);
+        }
+        else if (loaded)
+        {
+            if (prefetched) {
+                buffer.prefetched = true;
+                shard.statistics.prefetched++;
+            }
+            unpin(buffer);
+        }
+        else
+        {
+            // nobody else can hold a buffer that is still loading
+            const auto it = shard.index.find(buffer.block_number);
+            shard.pool.release(buffer.data);
+            shard.lru_list.erase(it->second);
+            shard.index.erase(it);
+        }
+    }
+    shard.loaded.notify_all();
+}
+
+std::vector < buffer_cache::writeback_t > buffer_cache::collect_dirty(const uint64_t dirtied_before)
+{
+    std::vector < writeback_t > ret;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        for (auto & buffer : shard->lru_list)
+        {
+            // buffers not (yet) accounted have an unknown age and always qualify.
+            // One being evicted is written out already
+            if (!buffer.is_dirty() || buffer.writing_back || (buffer.accounted.load(std::memory_order_acquire)
+                && buffer.dirtied_at.load(std::memory_order_acquire) > dirtied_before))
+            {
+                continue;
+            }
+
+            // new holders only come in through get_pinned(), under this lock
+            const uint64_t generation = buffer.modifications.load(std::memory_order_acquire);
+            const bool exclusive = buffer.pin_count.fetch_add(1, std::memory_order_acq_rel) == 0;
+            ret.push_back({ .buffer = &buffer, .generation = generation, .exclusive = exclusive });
+        }
+    }
+
+    std::ranges::sort(ret, [](const writeback_t & a, const writeback_t & b) {
+        return a.buffer->block_number < b.buffer->block_number;
+    });
+
+    return ret;
+}
+
+void buffer_cache::finish_writeback(const std::vector < writeback_t > & buffers, const bool written)
+{
+    for (const auto & [buffer, generation, exclusive] : buffers)
+    {
+        // a buffer held elsewhere may still be modified through a view handed out earlier
+        if (written && exclusive) {
+            mark_written(*buffer, generation);
+        }
+        unpin(*buffer);
+    }
+}
+
+void buffer_cache::invalidate(const uint64_t first_block, const uint64_t count)
+{
+    // the range can be far larger than the cache, so walk the cache instead
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        for (auto buffer = shard->lru_list.begin(); buffer != shard->lru_list.end();)
+        {
+            if (buffer->block_number < first_block || buffer->block_number - first_block >= count)
+            {
+                ++buffer;
+                continue;
+            }
+
+            if (buffer->accounted.exchange(false, std::memory_order_acq_rel)) {
+                dirty_buffers.fetch_sub(1, std::memory_order_relaxed);
+            }
+            shard->index.erase(buffer->block_number);
+
+            // whoever holds it keeps the buffer until released, a load still
+            // in flight finds it orphaned when it completes
+            if (buffer->pin_count.load(std::memory_order_acquire) != 0 || buffer->loading)
+            {
+                buffer->orphaned = true;
+                const auto next = std::next(buffer);
+                shard->orphans.splice(shard->orphans.end(), shard->lru_list, buffer);
+                buffer = next;
+                continue;
+            }
+
+            shard->pool.release(buffer->data);
+            buffer = shard->lru_list.erase(buffer);
+        }
+        release_orphans(*shard);
+    }
+}
+
+buffer_cache::statistics_t buffer_cache::get_statistics() const
+{
+    statistics_t ret { };
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        ret.hits += shard->statistics.hits;
+        ret.misses += shard->statistics.misses;
+        ret.evictions += shard->statistics.evictions;
+        ret.dirty_evictions += shard->statistics.dirty_evictions;
+        ret.prefetched += shard->statistics.prefetched;
+        ret.prefetch_hits += shard->statistics.prefetch_hits;
+        ret.prefetch_wasted += shard->statistics.prefetch_wasted;
+    }
+    return ret;
+}
+
+uint64_t buffer_cache::size() const
+{
+    uint64_t ret = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        ret += shard->lru_list.size();
+    }
+    return ret;
+}
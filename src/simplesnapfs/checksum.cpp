@@ -4,53 +4,356 @@
 #include <cstdint>
 #include <cstring>
 #include <debug.h>
+#include <future>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <mutex>
 
-std::array<char, 64> sha512sum(const char* _data, uint64_t _dt_len)
+#if defined(__x86_64__)
+# include <nmmintrin.h>
+# include <cpuid.h>
+#endif
+
+// resolved once, EVP_sha512() would be looked up again on every initialization
+static const EVP_MD * sha512_method()
 {
-    std::array<char, 64> hash{};  // Array to hold the raw SHA-512 hash
+    static const EVP_MD * method = []
+    {
+        const EVP_MD * fetched = EVP_MD_fetch(nullptr, "SHA512", nullptr);
+        return fetched != nullptr ? fetched : EVP_sha512();
+    }();
 
-    // Create and initialize a message digest context
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (ctx == nullptr) {
-        log(_log::LOG_ERROR, "Failed to create OpenSSL context\n");
-        throw Sha512sumChecksumError();
+    return method;
+}
+
+// contexts of finished hashers, reused by the next ones on the same thread
+struct context_cache_t {
+    std::vector < EVP_MD_CTX * > contexts;
+
+    ~context_cache_t() {
+        for (auto * ctx : contexts) {
+            EVP_MD_CTX_free(ctx);
+        }
+    }
+};
+
+static thread_local context_cache_t context_cache;
+
+sha512_hasher::sha512_hasher()
+{
+    if (context_cache.contexts.empty())
+    {
+        ctx = EVP_MD_CTX_new();
+        if (ctx == nullptr) {
+            log(_log::LOG_ERROR, "Failed to create OpenSSL context\n");
+            throw Sha512sumChecksumError();
+        }
+    }
+    else
+    {
+        ctx = context_cache.contexts.back();
+        context_cache.contexts.pop_back();
     }
 
-    // Initialize the context for SHA-512
-    if (EVP_DigestInit_ex(ctx, EVP_sha512(), nullptr) != 1) {
+    if (EVP_DigestInit_ex(ctx, sha512_method(), nullptr) != 1) {
         EVP_MD_CTX_free(ctx);
         log(_log::LOG_ERROR, "Failed to initialize SHA-512 digest\n");
         throw Sha512sumChecksumError();
     }
+}
+
+sha512_hasher::~sha512_hasher()
+{
+    if (ctx != nullptr) {
+        context_cache.contexts.push_back(ctx);
+    }
+}
 
-    // Update the context with the data
+sha512_hasher & sha512_hasher::update(const char* _data, const uint64_t _dt_len)
+{
     if (EVP_DigestUpdate(ctx, _data, _dt_len) != 1) {
-        EVP_MD_CTX_free(ctx);
         log(_log::LOG_ERROR, "Failed to update SHA-512 digest\n");
         throw Sha512sumChecksumError();
     }
 
-    // Finalize the digest
-    unsigned char temp_hash[64];
+    return *this;
+}
+
+std::array<char, 64> sha512_hasher::final()
+{
+    std::array<char, 64> hash{};  // Array to hold the raw SHA-512 hash
+
     unsigned int length = 0;
-    if (EVP_DigestFinal_ex(ctx, temp_hash, &length) != 1) {
-        EVP_MD_CTX_free(ctx);
+    if (EVP_DigestFinal_ex(ctx, reinterpret_cast<unsigned char *>(hash.data()), &length) != 1) {
         log(_log::LOG_ERROR, "Failed to finalize SHA-512 digest\n");
         throw Sha512sumChecksumError();
     }
 
     // Ensure the length is correct
     if (length != 64) {
-        EVP_MD_CTX_free(ctx);
         log(_log::LOG_ERROR, "SHA-512 digest has incorrect length\n");
         throw Sha512sumChecksumError();
     }
 
-    // Copy the resulting hash to the std::array<char, 64>
-    std::memcpy(hash.data(), temp_hash, 64);
-
-    // Clean up
-    EVP_MD_CTX_free(ctx);
+    // ready for the next message
+    if (EVP_DigestInit_ex(ctx, nullptr, nullptr) != 1) {
+        log(_log::LOG_ERROR, "Failed to initialize SHA-512 digest\n");
+        throw Sha512sumChecksumError();
+    }
 
     return hash;
 }
+
+std::array<char, 64> sha512sum(const char* _data, const uint64_t _dt_len)
+{
+    return sha512_hasher().update(_data, _dt_len).final();
+}
+
+std::vector < std::array<char, 64> > sha512sum_batch(const std::span < const std::span < const char > > buffers)
+{
+    // below this, starting threads costs more than it saves
+    constexpr uint64_t parallel_threshold = 4ULL * 1024 * 1024;
+
+    std::vector < std::array<char, 64> > digests(buffers.size());
+    const auto hash_share = [&](const size_t begin, const size_t end)
+    {
+        sha512_hasher hasher;
+        for (size_t i = begin; i < end; i++) {
+            digests[i] = hasher.update(buffers[i].data(), buffers[i].size()).final();
+        }
+    };
+
+    uint64_t total_bytes = 0;
+    for (const auto & buffer : buffers) {
+        total_bytes += buffer.size();
+    }
+
+    const size_t threads = std::min < size_t > ({ std::max(std::thread::hardware_concurrency(), 1U),
+        buffers.size(), total_bytes / parallel_threshold + 1 });
+    if (threads <= 1)
+    {
+        hash_share(0, buffers.size());
+        return digests;
+    }
+
+    // one share per thread, the calling thread takes the first
+    std::vector < std::future < void > > workers;
+    const size_t share = (buffers.size() + threads - 1) / threads;
+    for (size_t begin = share; begin < buffers.size(); begin += share) {
+        workers.push_back(std::async(std::launch::async, hash_share, begin, std::min(begin + share, buffers.size())));
+    }
+
+    hash_share(0, share);
+    for (auto & worker : workers) {
+        worker.get();
+    }
+
+    return digests;
+}
+
+// Castagnoli polynomial, reflected
+constexpr uint32_t crc32c_polynomial = 0x82F63B78;
+
+// slicing-by-8 lookup tables, table[k][b] is the CRC of byte b followed by k zero bytes
+static constexpr std::array < std::array < uint32_t, 256 >, 8 > crc32c_tables = []
+{
+    std::array < std::array < uint32_t, 256 >, 8 > tables { };
+    for (uint32_t byte = 0; byte < 256; byte++)
+    {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? crc32c_polynomial : 0);
+        }
+        tables[0][byte] = crc;
+    }
+
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        for (int k = 1; k < 8; k++) {
+            tables[k][byte] = (tables[k - 1][byte] >> 8) ^ tables[0][tables[k - 1][byte] & 0xFF];
+        }
+    }
+
+    return tables;
+}();
+
+static uint32_t crc32c_software(const char* _data, uint64_t _dt_len, const uint32_t crc)
+{
+    const auto * data = reinterpret_cast<const uint8_t *>(_data);
+    uint32_t state = ~crc;
+
+    while (_dt_len >= 8)
+    {
+        const uint32_t low = state ^ (data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24);
+        state = crc32c_tables[7][low & 0xFF] ^ crc32c_tables[6][(low >> 8) & 0xFF]
+              ^ crc32c_tables[5][(low >> 16) & 0xFF] ^ crc32c_tables[4][low >> 24]
+              ^ crc32c_tables[3][data[4]] ^ crc32c_tables[2][data[5]]
+              ^ crc32c_tables[1][data[6]] ^ crc32c_tables[0][data[7]];
+        data += 8;
+        _dt_len -= 8;
+    }
+
+    while (_dt_len-- != 0) {
+        state = (state >> 8) ^ crc32c_tables[0][(state ^ *data++) & 0xFF];
+    }
+
+    return ~state;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const char* _data, uint64_t _dt_len, const uint32_t crc)
+{
+    uint64_t state = ~crc;
+
+    while (_dt_len >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, _data, 8);
+        state = _mm_crc32_u64(state, word);
+        _data += 8;
+        _dt_len -= 8;
+    }
+
+    auto state32 = static_cast<uint32_t>(state);
+    while (_dt_len-- != 0) {
+        state32 = _mm_crc32_u8(state32, static_cast<uint8_t>(*_data++));
+    }
+
+    return ~state32;
+}
+#endif
+
+using crc32c_function_t = uint32_t (*)(const char*, uint64_t, uint32_t);
+
+// picked once, on first use
+static crc32c_function_t crc32c_implementation()
+{
+    static const crc32c_function_t implementation = []() -> crc32c_function_t
+    {
+#if defined(__x86_64__)
+        // asked of cpuid directly, __builtin_cpu_supports() needs libgcc's __cpu_model
+        // which the -z defs link of the sanitizer build does not see
+        uint32_t eax, ebx, ecx, edx;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0 && (ecx & bit_SSE4_2) != 0) {
+            return crc32c_sse42;
+        }
+#endif
+        return crc32c_software;
+    }();
+
+    return implementation;
+}
+
+bool crc32c_is_hardware_accelerated()
+{
+    return crc32c_implementation() != crc32c_software;
+}
+
+uint32_t crc32c(const char* _data, const uint64_t _dt_len, const uint32_t crc)
+{
+    return crc32c_implementation()(_data, _dt_len, crc);
+}
+
+static constexpr struct {
+    checksum_algorithm_t algorithm;
+    const char * name;
+    uint32_t digest_length;
+} checksum_algorithms[] = {
+    { CHECKSUM_SHA512, "sha512", 64 },
+    { CHECKSUM_CRC32C, "crc32c", 4 },
+    { CHECKSUM_XXH3, "xxh3", 8 },
+    { CHECKSUM_BLAKE3, "blake3", 32 },
+};
+
+uint32_t checksum_digest_length(const checksum_algorithm_t algorithm)
+{
+    for (const auto & entry : checksum_algorithms) {
+        if (entry.algorithm == algorithm) {
+            return entry.digest_length;
+        }
+    }
+
+    return 0;
+}
+
+const char * checksum_algorithm_name(const checksum_algorithm_t algorithm)
+{
+    for (const auto & entry : checksum_algorithms) {
+        if (entry.algorithm == algorithm) {
+            return entry.name;
+        }
+    }
+
+    return "unknown";
+}
+
+bool checksum_algorithm_from_name(const std::string & name, checksum_algorithm_t & algorithm)
+{
+    for (const auto & entry : checksum_algorithms)
+    {
+        if (name == entry.name)
+        {
+            algorithm = entry.algorithm;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template < typename Type >
+static void store_little_endian(Type value, char* _digest)
+{
+    for (size_t i = 0; i < sizeof(Type); i++, value >>= 8) {
+        _digest[i] = static_cast<char>(value & 0xFF);
+    }
+}
+
+void checksum(const checksum_algorithm_t algorithm, const char* _data, const uint64_t _dt_len, char* _digest)
+{
+    switch (algorithm)
+    {
+    case CHECKSUM_SHA512: {
+        const auto digest = sha512sum(_data, _dt_len);
+        std::memcpy(_digest, digest.data(), digest.size());
+        return;
+    }
+    case CHECKSUM_CRC32C:
+        store_little_endian(crc32c(_data, _dt_len), _digest);
+        return;
+    case CHECKSUM_XXH3:
+        store_little_endian(xxh3_64(_data, _dt_len), _digest);
+        return;
+    case CHECKSUM_BLAKE3: {
+        const auto digest = blake3sum(_data, _dt_len);
+        std::memcpy(_digest, digest.data(), digest.size());
+        return;
+    }
+    }
+
+    log(_log::LOG_ERROR, "Unknown checksum algorithm ", static_cast<uint32_t>(algorithm), "\n");
+    throw UnknownChecksumAlgorithm();
+}
+
+const char * zero_block_checksum(const checksum_algorithm_t algorithm, const uint32_t block_size)
+{
+    // map nodes never move, handed out pointers stay valid
+    static std::mutex mutex;
+    static std::map < std::pair < checksum_algorithm_t, uint32_t >, std::array < char, CHECKSUM_MAX_DIGEST_LENGTH > > digests;
+
+    std::lock_guard lock(mutex);
+    const auto [entry, inserted] = digests.try_emplace({ algorithm, block_size });
+    if (inserted)
+    {
+        try {
+            const std::vector < char > zeros(block_size);
+            checksum(algorithm, zeros.data(), block_size, entry->second.data());
+        } catch (...) {
+            digests.erase(entry);
+            throw;
+        }
+    }
+    return entry->second.data();
+}
@@ -0,0 +1,83 @@
+#include <filesystem_head.h>
+#include <checksum.h>
+#include <debug.h>
+#include <array>
+#include <cstring>
+#include <vector>
+
+simplesnapfs_filesystem_head_t load_filesystem_head(block_io & io)
+{
+    // the head sits at the very start of the device
+    simplesnapfs_filesystem_head_t head { };
+    io.read_range(0, sizeof(head), reinterpret_cast<char *>(&head));
+    const auto & info = head.static_information;
+    const auto checksum = sha512sum(reinterpret_cast<const char *>(&info), sizeof(info));
+
+    // another revision keeps its checksums elsewhere, it is not damaged but cannot be read
+    if ((info.fs_identification_number & ~FILESYSTEM_MAGIC_REVISION_MASK) == (FILESYSTEM_MAGIC_NUMBER & ~FILESYSTEM_MAGIC_REVISION_MASK)
+        && info.fs_identification_number != FILESYSTEM_MAGIC_NUMBER)
+    {
+        log(_log::LOG_ERROR, "SimpleSnapFS head of on-disk format revision ", info.fs_identification_number & FILESYSTEM_MAGIC_REVISION_MASK,
+            " found, only revision ", FILESYSTEM_MAGIC_NUMBER & FILESYSTEM_MAGIC_REVISION_MASK, " is supported\n");
+        throw InvalidFilesystemHead();
+    }
+
+    if (info.fs_identification_number != FILESYSTEM_MAGIC_NUMBER
+        || info.redundancy_fs_identification_number != FILESYSTEM_MAGIC_NUMBER
+        || std::memcmp(checksum.data(), head.checksum_filed.static_information_checksum, checksum.size()) != 0)
+    {
+        log(_log::LOG_ERROR, "No valid SimpleSnapFS head found\n");
+        throw InvalidFilesystemHead();
+    }
+
+    const uint32_t digest_length = checksum_digest_length(static_cast<checksum_algorithm_t>(info.checksum_algorithm));
+    if (info.fs_block_size != io.get_block_size() || digest_length == 0 || info.fs_block_size % digest_length != 0
+        || info.utilized_blocks > io.get_total_blocks())
+    {
+        log(_log::LOG_ERROR, "Filesystem head describes an unsupported layout\n");
+        throw InvalidFilesystemHead();
+    }
+
+    // the dynamic part changes after mkfs, a write torn or gone bad leaves it to its backup
+    const auto dynamic_checksum = sha512sum(reinterpret_cast<const char *>(&head.dynamic_information), sizeof(head.dynamic_information));
+    if (std::memcmp(dynamic_checksum.data(), head.checksum_filed.dynamic_information_checksum, dynamic_checksum.size()) == 0) {
+        return head;
+    }
+
+    const uint32_t block_size = info.fs_block_size;
+    if (info.fs_dynamic_data_backup_blk_index < info.utilized_blocks && info.fs_dynamic_data_backup_checksum_blk_index < info.utilized_blocks)
+    {
+        std::vector < char > backup(block_size);
+        std::array < char, 64 > backup_checksum { };
+        io.read_range(info.fs_dynamic_data_backup_blk_index * block_size, block_size, backup.data());
+        io.read_range(info.fs_dynamic_data_backup_checksum_blk_index * block_size, backup_checksum.size(), backup_checksum.data());
+        if (sha512sum(backup.data(), block_size) == backup_checksum)
+        {
+            log(_log::LOG_ERROR, "Dynamic filesystem information is damaged, using its backup\n");
+            std::memcpy(&head.dynamic_information, backup.data(), sizeof(head.dynamic_information));
+            std::memcpy(head.checksum_filed.dynamic_information_checksum,
+                sha512sum(backup.data(), sizeof(head.dynamic_information)).data(), dynamic_checksum.size());
+            return head;
+        }
+    }
+
+    log(_log::LOG_ERROR, "Dynamic filesystem information and its backup are damaged\n");
+    throw InvalidFilesystemHead();
+}
+
+void store_dynamic_information(block_io & io, simplesnapfs_filesystem_head_t & head)
+{
+    const auto & info = head.static_information;
+    const uint32_t block_size = info.fs_block_size;
+    const auto dynamic_checksum = sha512sum(reinterpret_cast<const char *>(&head.dynamic_information), sizeof(head.dynamic_information));
+    std::memcpy(head.checksum_filed.dynamic_information_checksum, dynamic_checksum.data(), dynamic_checksum.size());
+    io.write_range(0, sizeof(head), reinterpret_cast<const char *>(&head));
+
+    // the backup block holds the dynamic information, the block after it the backup's digest
+    std::vector < char > backup(block_size), backup_checksum(block_size);
+    std::memcpy(backup.data(), &head.dynamic_information, sizeof(head.dynamic_information));
+    const auto digest = sha512sum(backup.data(), block_size);
+    std::memcpy(backup_checksum.data(), digest.data(), digest.size());
+    io.write_range(info.fs_dynamic_data_backup_blk_index * block_size, block_size, backup.data());
+    io.write_range(info.fs_dynamic_data_backup_checksum_blk_index * block_size, block_size, backup_checksum.data());
+}
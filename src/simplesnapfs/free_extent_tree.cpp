@@ -0,0 +1,183 @@
+#include <free_extent_tree.h>
+#include <algorithm>
+#include <iterator>
+
+free_extent_tree::free_extent_tree(const bitmap & _map, const uint64_t _segment_blocks)
+    :   map(_map),
+        segment_blocks(_segment_blocks),
+        stale((_map.size() + _segment_blocks - 1) / _segment_blocks, true),
+        stale_segments(stale.size())
+{
+}
+
+void free_extent_tree::add(const uint64_t first, const uint64_t length)
+{
+    by_offset.emplace(first, length);
+    by_length.emplace(length, first);
+}
+
+void free_extent_tree::erase(const std::map < uint64_t, uint64_t >::iterator extent)
+{
+    by_length.erase({ extent->second, extent->first });
+    by_offset.erase(extent);
+}
+
+void free_extent_tree::insert(uint64_t first, uint64_t length)
+{
+    const auto next = by_offset.lower_bound(first);
+    if (next != by_offset.end() && next->first == first + length)
+    {
+        length += next->second;
+        erase(next);
+    }
+
+    const auto following = by_offset.lower_bound(first);
+    if (following != by_offset.begin())
+    {
+        const auto previous = std::prev(following);
+        if (previous->first + previous->second == first)
+        {
+            first = previous->first;
+            length += previous->second;
+            erase(previous);
+        }
+    }
+
+    add(first, length);
+}
+
+void free_extent_tree::remove(const uint64_t first, const uint64_t count)
+{
+    const uint64_t end = first + count;
+    auto extent = by_offset.upper_bound(first);
+    if (extent != by_offset.begin() && std::prev(extent)->first + std::prev(extent)->second > first) {
+        --extent;
+    }
+
+    // whatever sticks out on either side stays free
+    while (extent != by_offset.end() && extent->first < end)
+    {
+        const uint64_t extent_first = extent->first;
+        const uint64_t extent_end = extent->first + extent->second;
+        const auto next = std::next(extent);
+        erase(extent);
+
+        if (extent_first < first) {
+            add(extent_first, first - extent_first);
+        }
+        if (extent_end > end) {
+            add(end, extent_end - end);
+        }
+        extent = next;
+    }
+}
+
+void free_extent_tree::rebuild_stale_segments()
+{
+    for (uint64_t segment = 0; stale_segments != 0 && segment < stale.size(); segment++)
+    {
+        if (!stale[segment]) {
+            continue;
+        }
+
+        const uint64_t first = segment * segment_blocks;
+        map.for_each_free_run(first, std::min(first + segment_blocks, map.size()),
+            [&](const uint64_t run, const uint64_t length) { insert(run, length); });
+        stale[segment] = false;
+        stale_segments--;
+    }
+}
+
+void free_extent_tree::allocated(const uint64_t first, const uint64_t count)
+{
+    remove(first, count);
+}
+
+void free_extent_tree::released(const uint64_t first, const uint64_t count)
+{
+    // stale segments pick the blocks up from the bitmap when they are rebuilt
+    const uint64_t end = first + count;
+    for (uint64_t position = first; position < end;)
+    {
+        const uint64_t segment = position / segment_blocks;
+        const uint64_t part_end = std::min((segment + 1) * segment_blocks, end);
+        if (!stale[segment])
+        {
+            // blocks released twice must not show up twice
+            remove(position, part_end - position);
+            insert(position, part_end - position);
+        }
+        position = part_end;
+    }
+}
+
+void free_extent_tree::invalidate(const uint64_t first, const uint64_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    for (uint64_t segment = first / segment_blocks; segment <= (first + count - 1) / segment_blocks; segment++)
+    {
+        if (stale[segment]) {
+            continue;
+        }
+
+        stale[segment] = true;
+        stale_segments++;
+        remove(segment * segment_blocks, segment_blocks);
+    }
+}
+
+bool free_extent_tree::find(const uint64_t count, uint64_t & first, const fit_t fit)
+{
+    rebuild_stale_segments();
+    if (count == 0) {
+        return false;
+    }
+
+    if (fit == BEST_FIT)
+    {
+        const auto extent = by_length.lower_bound({ count, 0 });
+        if (extent == by_length.end()) {
+            return false;
+        }
+        first = extent->second;
+        return true;
+    }
+
+    // from the cursor to the end, then from the start to the cursor
+    const auto search = [&](std::map < uint64_t, uint64_t >::iterator extent, const uint64_t end) {
+        for (; extent != by_offset.end() && extent->first < end; ++extent) {
+            if (extent->second >= count) {
+                first = extent->first;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if (!search(by_offset.lower_bound(cursor), UINT64_MAX) && !search(by_offset.begin(), cursor)) {
+        return false;
+    }
+    cursor = first + count;
+    return true;
+}
+
+uint64_t free_extent_tree::get_extents()
+{
+    rebuild_stale_segments();
+    return by_offset.size();
+}
+
+uint64_t free_extent_tree::get_largest_extent()
+{
+    rebuild_stale_segments();
+    return by_length.empty() ? 0 : by_length.rbegin()->first;
+}
+
+std::vector < std::pair < uint64_t, uint64_t > > free_extent_tree::get_all_extents()
+{
+    rebuild_stale_segments();
+    return { by_offset.begin(), by_offset.end() };
+}
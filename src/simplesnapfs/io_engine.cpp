@@ -0,0 +1,115 @@
+#include <io_engine.h>
+#include <io_uring_engine.h>
+#include <debug.h>
+#include <cerrno>
+#include <unistd.h>
+
+std::future < int64_t > io_engine::readv_async(const uint64_t offset, std::vector < iovec > iov)
+{
+    auto promise = std::make_shared < std::promise < int64_t > >();
+    auto future = promise->get_future();
+    submit_readv(offset, std::move(iov), [promise](const int64_t result) { promise->set_value(result); });
+    flush();
+    return future;
+}
+
+std::future < int64_t > io_engine::writev_async(const uint64_t offset, std::vector < iovec > iov)
+{
+    auto promise = std::make_shared < std::promise < int64_t > >();
+    auto future = promise->get_future();
+    submit_writev(offset, std::move(iov), [promise](const int64_t result) { promise->set_value(result); });
+    flush();
+    return future;
+}
+
+std::future < int64_t > io_engine::fsync_async()
+{
+    auto promise = std::make_shared < std::promise < int64_t > >();
+    auto future = promise->get_future();
+    submit_fsync([promise](const int64_t result) { promise->set_value(result); });
+    flush();
+    return future;
+}
+
+// transfer the whole iovec, resuming after short reads/writes
+template < typename Operation >
+int64_t transfer_fully(Operation operation, const int fd, uint64_t offset, std::vector < iovec > & iov)
+{
+    int64_t total = 0;
+    auto current = iov.begin();
+
+    while (current != iov.end())
+    {
+        const ssize_t transferred = operation(fd, &*current, static_cast<int>(iov.end() - current), static_cast<off64_t>(offset));
+        if (transferred == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (transferred == -1) {
+            return -errno;
+        }
+
+        // end of file
+        if (transferred == 0) {
+            return total;
+        }
+
+        total += transferred;
+        offset += transferred;
+
+        auto remaining = static_cast<uint64_t>(transferred);
+        while (current != iov.end() && remaining >= current->iov_len) {
+            remaining -= current->iov_len;
+            ++current;
+        }
+        if (remaining != 0) {
+            current->iov_base = static_cast<char *>(current->iov_base) + remaining;
+            current->iov_len -= remaining;
+        }
+    }
+
+    return total;
+}
+
+int64_t io_engine::readv(const uint64_t offset, std::vector < iovec > iov)
+{
+    return transfer_fully(::preadv, fd, offset, iov);
+}
+
+int64_t io_engine::writev(const uint64_t offset, std::vector < iovec > iov)
+{
+    return transfer_fully(::pwritev, fd, offset, iov);
+}
+
+int64_t io_engine::fsync()
+{
+    return ::fsync(fd) == 0 ? 0 : -errno;
+}
+
+void sync_io_engine::submit_readv(const uint64_t offset, std::vector < iovec > iov, completion_handler_t handler)
+{
+    handler(readv(offset, std::move(iov)));
+}
+
+void sync_io_engine::submit_writev(const uint64_t offset, std::vector < iovec > iov, completion_handler_t handler)
+{
+    handler(writev(offset, std::move(iov)));
+}
+
+void sync_io_engine::submit_fsync(completion_handler_t handler)
+{
+    handler(fsync());
+}
+
+std::unique_ptr < io_engine > make_io_engine(const int fd, const io_engine_type_t type, const uint32_t queue_depth)
+{
+    if (type == IO_ENGINE_IO_URING) {
+        return std::make_unique < io_uring_engine > (fd, queue_depth);
+    }
+
+    if (type == IO_ENGINE_AUTO && io_uring_engine::is_supported()) {
+        return std::make_unique < io_uring_engine > (fd, queue_depth);
+    }
+
+    return std::make_unique < sync_io_engine > (fd);
+}
@@ -0,0 +1,409 @@
+#include <io_uring_engine.h>
+#include <debug.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// user_data of the no-op that tells the reaper to quit
+constexpr uint64_t stop_marker = UINT64_MAX;
+
+static int io_uring_setup(const unsigned entries, io_uring_params * params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(const int ring_fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+bool io_uring_engine::is_supported()
+{
+    static const bool supported = [] {
+        io_uring_params params { };
+        const int probe = io_uring_setup(1, &params);
+        if (probe == -1) {
+            return false;
+        }
+        close(probe);
+        return true;
+    }();
+
+    return supported;
+}
+
+io_uring_engine::io_uring_engine(const int _fd, const uint32_t _queue_depth)
+    :   io_engine(_fd),
+        queue_depth(_queue_depth == 0 ? 1 : _queue_depth)
+{
+    io_uring_params params { };
+    ring_fd = io_uring_setup(queue_depth, &params);
+    if (ring_fd == -1)
+    {
+        log(_log::LOG_ERROR, "Error setting up io_uring\n");
+        throw IoEngineSetupFailed();
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        sq_ring = nullptr;
+        release_rings();
+        log(_log::LOG_ERROR, "Error mapping io_uring submission ring\n");
+        throw IoEngineSetupFailed();
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            cq_ring = nullptr;
+            release_rings();
+            log(_log::LOG_ERROR, "Error mapping io_uring completion ring\n");
+            throw IoEngineSetupFailed();
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED)
+    {
+        sqes = nullptr;
+        release_rings();
+        log(_log::LOG_ERROR, "Error mapping io_uring submission entries\n");
+        throw IoEngineSetupFailed();
+    }
+
+    auto * sq = static_cast<char *>(sq_ring);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    auto * cq = static_cast<char *>(cq_ring);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // the kernel may round the ring up, but we never keep more than queue_depth requests around
+    queue_depth = std::min(queue_depth, params.sq_entries);
+    requests.resize(queue_depth);
+    free_slots.reserve(queue_depth);
+    for (uint32_t slot = queue_depth; slot > 0; slot--) {
+        free_slots.push_back(slot - 1);
+    }
+
+    reaper = std::thread([this] { reap_completions(); });
+}
+
+void io_uring_engine::release_rings()
+{
+    if (sqes) {
+        munmap(sqes, sqes_size);
+    }
+
+    if (cq_ring && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+
+    if (sq_ring) {
+        munmap(sq_ring, sq_ring_size);
+    }
+
+    if (ring_fd != -1) {
+        close(ring_fd);
+    }
+}
+
+io_uring_engine::~io_uring_engine()
+{
+    try {
+        wait_all();
+    } catch (...) {
+        log(_log::LOG_ERROR, "Error draining io_uring on shutdown\n");
+    }
+
+    // wake the reaper with a no-op it recognizes as the stop marker, unless it gave up already
+    bool stop_submitted = true;
+    {
+        std::unique_lock lock(ring_mutex);
+        if (failed_errno == 0)
+        {
+            const unsigned tail = *sq_tail;
+            const unsigned index = tail & *sq_mask;
+            std::memset(&sqes[index], 0, sizeof(io_uring_sqe));
+            sqes[index].opcode = IORING_OP_NOP;
+            sqes[index].user_data = stop_marker;
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            pending_submissions++;
+            try {
+                flush_locked(lock);
+            } catch (...) {
+                stop_submitted = false;
+            }
+        }
+    }
+
+    if (!stop_submitted)
+    {
+        // the reaper cannot be told to stop, and keeps waiting on the rings
+        log(_log::LOG_ERROR, "Cannot stop the io_uring reaper, leaving it behind\n");
+        reaper.detach();
+        return;
+    }
+
+    reaper.join();
+    release_rings();
+}
+
+void io_uring_engine::queue_sqe(
+    std::unique_lock < std::mutex > & lock,
+    const uint8_t opcode,
+    const uint64_t offset,
+    request_t request)
+{
+    // queue depth reached, hand what we have to the kernel and wait for room
+    while (free_slots.empty() && failed_errno == 0)
+    {
+        flush_locked(lock);
+        state_changed.wait(lock);
+    }
+
+    if (failed_errno != 0)
+    {
+        log(_log::LOG_ERROR, "io_uring stopped after an error: ", strerror(failed_errno), "\n");
+        throw IoEngineSubmissionFailed();
+    }
+
+    const uint32_t slot = free_slots.back();
+    free_slots.pop_back();
+    requests[slot] = std::move(request);
+    requests_in_flight++;
+
+    const unsigned tail = *sq_tail;
+    const unsigned index = tail & *sq_mask;
+    io_uring_sqe & sqe = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.user_data = slot;
+    sqe.off = offset;
+    if (!requests[slot].iov.empty()) {
+        sqe.addr = reinterpret_cast<uint64_t>(requests[slot].iov.data());
+        sqe.len = static_cast<uint32_t>(requests[slot].iov.size());
+    }
+    sq_array[index] = index;
+
+    // the entry must be fully written before the kernel can see the new tail
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    pending_submissions++;
+}
+
+void io_uring_engine::submit_readv(const uint64_t offset, std::vector < iovec > iov, completion_handler_t handler)
+{
+    std::unique_lock lock(ring_mutex);
+    queue_sqe(lock, IORING_OP_READV, offset, { .iov = std::move(iov), .handler = std::move(handler) });
+}
+
+void io_uring_engine::submit_writev(const uint64_t offset, std::vector < iovec > iov, completion_handler_t handler)
+{
+    std::unique_lock lock(ring_mutex);
+    queue_sqe(lock, IORING_OP_WRITEV, offset, { .iov = std::move(iov), .handler = std::move(handler) });
+}
+
+void io_uring_engine::submit_fsync(completion_handler_t handler)
+{
+    std::unique_lock lock(ring_mutex);
+    queue_sqe(lock, IORING_OP_FSYNC, 0, { .iov = { }, .handler = std::move(handler) });
+}
+
+void io_uring_engine::flush_locked(std::unique_lock < std::mutex > & lock)
+{
+    while (pending_submissions != 0 && failed_errno == 0)
+    {
+        const int submitted = io_uring_enter(ring_fd, pending_submissions, 0, 0);
+        if (submitted == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        {
+            // completion queue is backed up, the reaper drains it without the lock
+            std::this_thread::yield();
+            continue;
+        }
+
+        if (submitted == -1)
+        {
+            const int error = errno;
+            log(_log::LOG_ERROR, "Error submitting to io_uring: ", strerror(error), "\n");
+            fail_unsubmitted(lock, error);
+            throw IoEngineSubmissionFailed();
+        }
+
+        pending_submissions -= submitted;
+    }
+}
+
+void io_uring_engine::fail_unsubmitted(std::unique_lock < std::mutex > & lock, const int error)
+{
+    // the kernel never saw the entries past the ones it took, so nothing would complete them
+    std::vector < completion_handler_t > handlers;
+    const unsigned tail = *sq_tail;
+    for (unsigned entry = tail - pending_submissions; entry != tail; entry++)
+    {
+        const uint64_t user_data = sqes[sq_array[entry & *sq_mask]].user_data;
+        if (user_data == stop_marker) {
+            continue;
+        }
+
+        const auto slot = static_cast<uint32_t>(user_data);
+        handlers.push_back(std::move(requests[slot].handler));
+        requests[slot] = { };
+        free_slots.push_back(slot);
+    }
+    __atomic_store_n(sq_tail, tail - pending_submissions, __ATOMIC_RELEASE);
+    pending_submissions = 0;
+
+    // handlers run without the lock, as they do on the reaper
+    lock.unlock();
+    state_changed.notify_all();
+    for (auto & handler : handlers)
+    {
+        try {
+            handler(-error);
+        } catch (std::exception & e) {
+            log(_log::LOG_ERROR, "Uncaught exception in io_uring completion handler: ", e.what(), "\n");
+        }
+    }
+
+    lock.lock();
+    requests_in_flight -= handlers.size();
+    state_changed.notify_all();
+}
+
+void io_uring_engine::flush()
+{
+    std::unique_lock lock(ring_mutex);
+    flush_locked(lock);
+}
+
+void io_uring_engine::wait_all()
+{
+    std::unique_lock lock(ring_mutex);
+    flush_locked(lock);
+    state_changed.wait(lock, [this] { return requests_in_flight == 0; });
+}
+
+uint64_t io_uring_engine::in_flight() const
+{
+    std::lock_guard lock(ring_mutex);
+    return requests_in_flight;
+}
+
+void io_uring_engine::reap_completions()
+{
+    std::vector < std::pair < uint64_t /* user data */, int64_t /* result */ > > done;
+
+    while (true)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) &&
+            io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR)
+        {
+            const int error = errno;
+            log(_log::LOG_ERROR, "Error waiting for io_uring completions: ", strerror(error), "\n");
+            fail_outstanding(error);
+            return;
+        }
+
+        // take completions off the ring first, so the kernel can reuse the entries
+        done.clear();
+        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe & cqe = cqes[head & *cq_mask];
+            done.emplace_back(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        bool stop = false;
+        for (const auto & [user_data, result] : done)
+        {
+            if (user_data == stop_marker) {
+                stop = true;
+                continue;
+            }
+
+            completion_handler_t handler;
+            {
+                std::lock_guard lock(ring_mutex);
+                const auto slot = static_cast<uint32_t>(user_data);
+                handler = std::move(requests[slot].handler);
+                requests[slot] = { };
+                free_slots.push_back(slot);
+            }
+            state_changed.notify_all();
+
+            try {
+                handler(result);
+            } catch (std::exception & e) {
+                log(_log::LOG_ERROR, "Uncaught exception in io_uring completion handler: ", e.what(), "\n");
+            }
+
+            {
+                std::lock_guard lock(ring_mutex);
+                requests_in_flight--;
+            }
+            state_changed.notify_all();
+        }
+
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void io_uring_engine::fail_outstanding(const int error)
+{
+    // nobody reaps from here on, so whoever waits on a request is told now
+    std::vector < completion_handler_t > handlers;
+    {
+        std::lock_guard lock(ring_mutex);
+        failed_errno = error;
+        pending_submissions = 0;
+        for (uint32_t slot = 0; slot < requests.size(); slot++)
+        {
+            if (!requests[slot].handler) {
+                continue;
+            }
+            handlers.push_back(std::move(requests[slot].handler));
+            requests[slot] = { };
+            free_slots.push_back(slot);
+        }
+    }
+    state_changed.notify_all();
+
+    for (auto & handler : handlers)
+    {
+        try {
+            handler(-error);
+        } catch (std::exception & e) {
+            log(_log::LOG_ERROR, "Uncaught exception in io_uring completion handler: ", e.what(), "\n");
+        }
+
+        {
+            std::lock_guard lock(ring_mutex);
+            requests_in_flight--;
+        }
+        state_changed.notify_all();
+    }
+}
@@ -0,0 +1,567 @@
+#include <journal.h>
+#include <checksum.h>
+#include <debug.h>
+#include <thread_pool.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <random>
+
+// where the index-th target's block number is kept in a record
+static char * target_slot(char * record, const uint64_t index, const uint32_t block_size, const uint64_t header_targets)
+{
+    if (index < header_targets) {
+        return record + sizeof(journal_record_header_t) + index * sizeof(uint64_t);
+    }
+
+    const uint64_t descriptor_targets = block_size / sizeof(uint64_t);
+    const uint64_t spilled = index - header_targets;
+    return record + (1 + spilled / descriptor_targets) * block_size + (spilled % descriptor_targets) * sizeof(uint64_t);
+}
+
+static void write_superblock(block_io & io, const uint64_t superblock_index, journal_superblock_t superblock)
+{
+    const auto digest = sha512sum(reinterpret_cast<const char *>(&superblock), offsetof(journal_superblock_t, checksum));
+    std::memcpy(superblock.checksum, digest.data(), digest.size());
+
+    const uint32_t block_size = io.get_block_size();
+    void * block = nullptr;
+    if (posix_memalign(&block, std::max < size_t > (io.get_logical_sector_size(), alignof(std::max_align_t)), block_size) != 0) {
+        throw std::bad_alloc();
+    }
+    const std::unique_ptr < void, decltype(&free) > block_owner(block, &free);
+    std::memset(block, 0, block_size);
+    std::memcpy(block, &superblock, sizeof(superblock));
+
+    // the journal region bypasses the cache, the log is written the same way
+    if (io.get_io_engine().writev(superblock_index * block_size, { { .iov_base = block, .iov_len = block_size } }) != static_cast<int64_t>(block_size))
+    {
+        log(_log::LOG_ERROR, "Error writing journal superblock\n");
+        throw WriteFailed();
+    }
+}
+
+uint64_t journal::transaction_t::write(const uint64_t block, const char * data, uint64_t len, const uint64_t offset)
+{
+    const uint32_t block_size = owner->block_size;
+    if (offset >= block_size) {
+        return 0;
+    }
+    len = std::min < uint64_t > (len, block_size - offset);
+
+    auto [contents, inserted] = blocks.try_emplace(block);
+    if (inserted)
+    {
+        contents->second.resize(block_size);
+        if (offset != 0 || len != block_size) {
+            owner->io.read_range(block * block_size, block_size, contents->second.data());
+        }
+    }
+    std::memcpy(contents->second.data() + offset, data, len);
+    return len;
+}
+
+journal::journal(block_io & _io, const simplesnapfs_filesystem_head_t & head,
+    const journal_configuration_t & _configuration, lazy_initializer * _initializer)
+    :   io(_io),
+        initializer(_initializer),
+        configuration(_configuration),
+        block_size(head.static_information.fs_block_size),
+        algorithm(static_cast<checksum_algorithm_t>(head.static_information.checksum_algorithm)),
+        superblock_index(head.static_information.journaling_buffer_blk_index),
+        log_blocks(std::max < uint64_t > (head.static_information.journaling_buffer_blocks, 1) - 1),
+        header_targets((block_size - sizeof(journal_record_header_t)) / sizeof(uint64_t)),
+        descriptor_targets(block_size / sizeof(uint64_t))
+{
+    // the smallest record is a header and one block
+    if (log_blocks < 2)
+    {
+        log(_log::LOG_ERROR, "Journaling buffer of ", head.static_information.journaling_buffer_blocks, " block(s) is too small for a journal\n");
+        throw CorruptedJournal();
+    }
+
+    max_group_blocks = configuration.max_group_blocks == 0
+        ? std::max < uint64_t > (log_blocks / 4, 2)
+        : std::min(configuration.max_group_blocks, log_blocks);
+
+    load_superblock();
+    replay();
+
+    // the log was read as it was, lazy initialization may zero what is left of it now
+    if (initializer)
+    {
+        std::lock_guard lock(log_mutex);
+        initializer->ensure_initialized(superblock_index);
+        store_superblock();
+    }
+
+    committer = std::thread([this] { committer_main(); });
+}
+
+journal::~journal()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    if (committer.joinable()) {
+        committer.join();
+    }
+
+    try {
+        if (!error) {
+            checkpoint();
+        }
+    } catch (fs_error_t &) {
+        log(_log::LOG_ERROR, "Journal left without a checkpoint, it is replayed on the next open\n");
+    }
+}
+
+void journal::format(block_io & io, const simplesnapfs_filesystem_head_t & head)
+{
+    std::random_device random;
+    write_superblock(io, head.static_information.journaling_buffer_blk_index, {
+        .magic = JOURNAL_SUPERBLOCK_MAGIC,
+        .log_id = (static_cast<uint64_t>(random()) << 32) | random(),
+        .log_blocks = std::max < uint64_t > (head.static_information.journaling_buffer_blocks, 1) - 1,
+        .tail_sequence = 1,
+        .tail_position = 0,
+        .checksum = { },
+    });
+}
+
+journal::buffer_t journal::allocate_buffer(const uint64_t blocks) const
+{
+    void * buffer = nullptr;
+    if (posix_memalign(&buffer, std::max < size_t > (io.get_logical_sector_size(), alignof(std::max_align_t)), blocks * block_size) != 0) {
+        throw std::bad_alloc();
+    }
+    std::memset(buffer, 0, blocks * block_size);
+    return { static_cast<char *>(buffer), &free };
+}
+
+uint64_t journal::record_blocks(const uint64_t targets) const
+{
+    const uint64_t spilled = targets > header_targets ? targets - header_targets : 0;
+    return 1 + (spilled + descriptor_targets - 1) / descriptor_targets + targets;
+}
+
+void journal::prepare_log(const uint64_t position, const uint64_t blocks)
+{
+    if (!initializer) {
+        return;
+    }
+
+    for (uint64_t block = 0; block < blocks; block++) {
+        initializer->ensure_initialized(superblock_index + 1 + (position + block) % log_blocks);
+    }
+}
+
+void journal::read_log(const uint64_t position, const uint64_t blocks, char * buffer)
+{
+    const uint64_t start = position % log_blocks;
+    const uint64_t before_end = std::min(blocks, log_blocks - start);
+    const std::pair < uint64_t, uint64_t > pieces[] = { { start, before_end }, { 0, blocks - before_end } };
+    for (const auto & [first, count] : pieces)
+    {
+        if (count == 0) {
+            continue;
+        }
+        const int64_t length = static_cast<int64_t>(count * block_size);
+        if (io.get_io_engine().readv((superblock_index + 1 + first) * block_size, { { .iov_base = buffer, .iov_len = static_cast<size_t>(length) } }) != length)
+        {
+            log(_log::LOG_ERROR, "Error reading journal\n");
+            throw ReadFailed();
+        }
+        buffer += length;
+    }
+}
+
+void journal::write_log(const uint64_t position, const uint64_t blocks, const char * buffer)
+{
+    const uint64_t start = position % log_blocks;
+    const uint64_t before_end = std::min(blocks, log_blocks - start);
+    const std::pair < uint64_t, uint64_t > pieces[] = { { start, before_end }, { 0, blocks - before_end } };
+    for (const auto & [first, count] : pieces)
+    {
+        if (count == 0) {
+            continue;
+        }
+        const int64_t length = static_cast<int64_t>(count * block_size);
+        if (io.get_io_engine().writev((superblock_index + 1 + first) * block_size,
+                { { .iov_base = const_cast<char *>(buffer), .iov_len = static_cast<size_t>(length) } }) != length)
+        {
+            log(_log::LOG_ERROR, "Error writing journal\n");
+            throw WriteFailed();
+        }
+        buffer += length;
+    }
+}
+
+void journal::flush_device()
+{
+    if (io.get_io_engine().fsync() != 0)
+    {
+        log(_log::LOG_ERROR, "Error synchronizing journal\n");
+        throw WriteFailed();
+    }
+
+    std::lock_guard lock(mutex);
+    statistics.flushes++;
+}
+
+void journal::store_superblock()
+{
+    write_superblock(io, superblock_index, {
+        .magic = JOURNAL_SUPERBLOCK_MAGIC,
+        .log_id = log_id,
+        .log_blocks = log_blocks,
+        .tail_sequence = tail_sequence,
+        .tail_position = tail_position,
+        .checksum = { },
+    });
+    flush_device();
+}
+
+void journal::load_superblock()
+{
+    const auto block = allocate_buffer(1);
+    if (io.get_io_engine().readv(superblock_index * block_size, { { .iov_base = block.get(), .iov_len = block_size } }) != static_cast<int64_t>(block_size))
+    {
+        log(_log::LOG_ERROR, "Error reading journal superblock\n");
+        throw ReadFailed();
+    }
+
+    // a zeroed region has never held a log, start one
+    if (std::all_of(block.get(), block.get() + block_size, [](const char byte) { return byte == 0; }))
+    {
+        std::random_device random;
+        log_id = (static_cast<uint64_t>(random()) << 32) | random();
+        store_superblock();
+        return;
+    }
+
+    journal_superblock_t superblock { };
+    std::memcpy(&superblock, block.get(), sizeof(superblock));
+    const auto digest = sha512sum(reinterpret_cast<const char *>(&superblock), offsetof(journal_superblock_t, checksum));
+    if (superblock.magic != JOURNAL_SUPERBLOCK_MAGIC || superblock.log_blocks != log_blocks
+        || std::memcmp(digest.data(), superblock.checksum, digest.size()) != 0)
+    {
+        log(_log::LOG_ERROR, "Journal superblock is damaged\n");
+        throw CorruptedJournal();
+    }
+
+    log_id = superblock.log_id;
+    tail_sequence = head_sequence = superblock.tail_sequence;
+    tail_position = head_position = superblock.tail_position;
+}
+
+bool journal::parse_header(const char * block, const uint64_t sequence, const uint64_t position, journal_record_header_t & header) const
+{
+    std::memcpy(&header, block, sizeof(header));
+
+    // what a previous lap, an older log or a torn write left behind stops here
+    return header.magic == JOURNAL_RECORD_MAGIC && header.log_id == log_id && header.sequence == sequence
+        && header.position == position && header.targets != 0 && header.targets <= log_blocks
+        && header.descriptor_blocks == record_blocks(header.targets) - header.targets
+        && position - tail_position + record_blocks(header.targets) <= log_blocks;
+}
+
+bool journal::verify_record(char * record, const uint64_t blocks) const
+{
+    char expected[CHECKSUM_MAX_DIGEST_LENGTH], digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    const uint32_t digest_length = checksum_digest_length(algorithm);
+    char * checksum_field = record + offsetof(journal_record_header_t, checksum);
+    std::memcpy(expected, checksum_field, digest_length);
+    std::memset(checksum_field, 0, sizeof(journal_record_header_t::checksum));
+    checksum(algorithm, record, blocks * block_size, digest);
+    return std::memcmp(expected, digest, digest_length) == 0;
+}
+
+void journal::replay()
+{
+    std::lock_guard lock(log_mutex);
+    const auto started = std::chrono::steady_clock::now();
+    const uint64_t read_blocks = std::max < uint64_t > (configuration.recovery_read_size / block_size, 1);
+
+    struct found_t {
+        journal_record_header_t header;
+        char * record;
+        bool committed;
+        std::future < void > verified;
+    };
+
+    // home block, log position of its newest image
+    std::map < uint64_t, uint64_t > newest;
+    std::unique_ptr < thread_pool > pool;
+    buffer_t window(nullptr, &free);
+    uint64_t next_read = 1, records = 0, read_bytes = 0;
+    bool end = false;
+    while (!end)
+    {
+        // the next piece starts at the first record not yet seen, never beyond one lap
+        const uint64_t window_position = head_position;
+        const uint64_t window_blocks = std::min(next_read, log_blocks - (head_position - tail_position));
+        if (window_blocks == 0) {
+            break;
+        }
+        window = allocate_buffer(window_blocks);
+        read_log(window_position, window_blocks, window.get());
+        read_bytes += window_blocks * block_size;
+        next_read = std::min(std::max(window_blocks * 2, next_read), std::max(read_blocks, next_read));
+
+        // every record lying wholly in the piece, checksummed side by side
+        std::deque < found_t > found;
+        uint64_t cursor = window_position, sequence = head_sequence;
+        while (cursor < window_position + window_blocks)
+        {
+            journal_record_header_t header { };
+            char * record = window.get() + (cursor - window_position) * block_size;
+            if (!parse_header(record, sequence, cursor, header))
+            {
+                end = true;
+                break;
+            }
+
+            const uint64_t blocks = record_blocks(header.targets);
+            if (cursor + blocks > window_position + window_blocks)
+            {
+                // read again from its start, with room for all of it
+                next_read = std::max(next_read, blocks);
+                break;
+            }
+
+            if (!pool) {
+                pool = std::make_unique < thread_pool > (configuration.recovery_threads);
+            }
+            auto & entry = found.emplace_back(header, record, false);
+            entry.verified = pool->submit([this, &entry, blocks] { entry.committed = verify_record(entry.record, blocks); });
+            cursor += blocks;
+            sequence++;
+        }
+
+        for (auto & entry : found) {
+            entry.verified.get();
+        }
+
+        // committed up to the first record that is not
+        for (const auto & entry : found)
+        {
+            if (!entry.committed)
+            {
+                end = true;
+                break;
+            }
+            for (uint64_t target = 0; target < entry.header.targets; target++)
+            {
+                uint64_t block;
+                std::memcpy(&block, target_slot(entry.record, target, block_size, header_targets), sizeof(block));
+                newest[block] = head_position + entry.header.descriptor_blocks + target;
+            }
+            head_position += record_blocks(entry.header.targets);
+            head_sequence++;
+            records++;
+        }
+    }
+    window.reset();
+
+    // the newest images in log order, runs of adjacent ones read at once
+    std::vector < std::pair < uint64_t, uint64_t > > images;    // log position, home block
+    images.reserve(newest.size());
+    for (const auto & [block, position] : newest) {
+        images.emplace_back(position, block);
+    }
+    std::ranges::sort(images);
+
+    buffer_t run = allocate_buffer(std::min < uint64_t > (read_blocks, std::max < uint64_t > (images.size(), 1)));
+    for (uint64_t first = 0; first < images.size();)
+    {
+        uint64_t count = 1;
+        while (first + count < images.size() && count < read_blocks
+               && images[first + count].first == images[first].first + count) {
+            count++;
+        }
+
+        read_log(images[first].first, count, run.get());
+        read_bytes += count * block_size;
+        for (uint64_t image = 0; image < count; image++) {
+            io.write_range(images[first + image].second * block_size, block_size, run.get() + image * block_size);
+        }
+        first += count;
+    }
+
+    const double seconds = std::chrono::duration < double > (std::chrono::steady_clock::now() - started).count();
+    if (records != 0)
+    {
+        log(_log::LOG_NORMAL, "Replayed ", records, " journal record(s), ", images.size(), " block(s) in ", seconds, " s\n");
+        checkpoint_locked();
+    }
+
+    std::lock_guard statistics_lock(mutex);
+    statistics.replayed_records = records;
+    statistics.replayed_blocks = images.size();
+    statistics.replay_read_bytes = read_bytes;
+    statistics.replay_seconds = seconds;
+}
+
+void journal::checkpoint_locked()
+{
+    if (head_position == tail_position) {
+        return;
+    }
+
+    // every home location is on the device, nothing in the log is needed anymore
+    io.sync();
+    tail_sequence = head_sequence;
+    tail_position = head_position;
+    store_superblock();
+
+    std::lock_guard lock(mutex);
+    statistics.flushes++;
+    statistics.checkpoints++;
+}
+
+void journal::write_record(const std::map < uint64_t, const std::vector < char > * > & targets, const uint64_t transactions)
+{
+    const uint64_t blocks = record_blocks(targets.size());
+    if (head_position - tail_position + blocks > log_blocks) {
+        checkpoint_locked();
+    }
+
+    journal_record_header_t header {
+        .magic = JOURNAL_RECORD_MAGIC,
+        .log_id = log_id,
+        .sequence = head_sequence,
+        .position = head_position,
+        .targets = targets.size(),
+        .descriptor_blocks = blocks - targets.size(),
+        .transactions = transactions,
+        .checksum = { },
+    };
+
+    const auto record = allocate_buffer(blocks);
+    std::memcpy(record.get(), &header, sizeof(header));
+    uint64_t target = 0;
+    for (const auto & [block, contents] : targets)
+    {
+        std::memcpy(target_slot(record.get(), target, block_size, header_targets), &block, sizeof(block));
+        std::memcpy(record.get() + (header.descriptor_blocks + target) * block_size, contents->data(), block_size);
+        target++;
+    }
+    checksum(algorithm, record.get(), blocks * block_size, header.checksum);
+    std::memcpy(record.get() + offsetof(journal_record_header_t, checksum), header.checksum, sizeof(header.checksum));
+
+    prepare_log(head_position, blocks);
+    write_log(head_position, blocks, record.get());
+    flush_device();
+
+    // safe in the log, the home locations may follow at block_io's pace
+    for (const auto & [block, contents] : targets) {
+        io.write_range(block * block_size, block_size, contents->data());
+    }
+    head_sequence++;
+    head_position += blocks;
+
+    std::lock_guard lock(mutex);
+    statistics.records++;
+    statistics.journaled_blocks += targets.size();
+}
+
+void journal::committer_main()
+{
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        work_available.wait(lock, [&] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            return;
+        }
+
+        // the oldest transaction waits commit_interval for company, unless enough came already
+        work_available.wait_until(lock, pending.front().queued + configuration.commit_interval,
+            [&] { return stopping || pending_blocks >= max_group_blocks; });
+
+        // as many transactions as fit in one record of max_group_blocks, but at least one
+        std::deque < pending_t > group;
+        std::map < uint64_t, const std::vector < char > * > targets;
+        while (!pending.empty())
+        {
+            const auto & next = pending.front().transaction.blocks;
+            const uint64_t added = std::ranges::count_if(next, [&](const auto & block) { return !targets.contains(block.first); });
+            if (!group.empty() && record_blocks(targets.size() + added) > max_group_blocks) {
+                break;
+            }
+
+            pending_blocks -= next.size();
+            group.push_back(std::move(pending.front()));
+            pending.pop_front();
+            // later transactions overwrite what earlier ones wrote to the same block
+            for (const auto & [block, contents] : group.back().transaction.blocks) {
+                targets[block] = &contents;
+            }
+        }
+
+        lock.unlock();
+        try {
+            std::lock_guard log_lock(log_mutex);
+            write_record(targets, group.size());
+        } catch (...) {
+            lock.lock();
+            error = std::current_exception();
+            committed.notify_all();
+            return;
+        }
+        lock.lock();
+
+        committed_ticket = group.back().ticket;
+        statistics.transactions += group.size();
+        committed.notify_all();
+    }
+}
+
+void journal::commit(transaction_t && transaction)
+{
+    if (transaction.blocks.empty()) {
+        return;
+    }
+
+    if (record_blocks(transaction.size()) > log_blocks)
+    {
+        log(_log::LOG_ERROR, "Transaction of ", transaction.size(), " blocks does not fit in a journal of ", log_blocks, " blocks\n");
+        throw TransactionTooLarge();
+    }
+
+    std::unique_lock lock(mutex);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    const uint64_t ticket = next_ticket++;
+    pending_blocks += transaction.size();
+    pending.push_back({ ticket, std::chrono::steady_clock::now(), std::move(transaction) });
+    work_available.notify_one();
+
+    committed.wait(lock, [&] { return committed_ticket >= ticket || error; });
+    if (committed_ticket < ticket) {
+        std::rethrow_exception(error);
+    }
+}
+
+void journal::checkpoint()
+{
+    std::lock_guard lock(log_mutex);
+    checkpoint_locked();
+}
+
+journal_statistics_t journal::get_statistics()
+{
+    std::lock_guard lock(mutex);
+    return statistics;
+}
+
+uint64_t journal::get_used_blocks()
+{
+    std::lock_guard lock(log_mutex);
+    return head_position - tail_position;
+}
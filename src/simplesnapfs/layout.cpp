@@ -0,0 +1,161 @@
+#include <layout.h>
+#include <merkle_tree.h>
+#include <debug.h>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+uint64_t blocks_for(const uint64_t elements, const uint64_t elements_per_block) {
+    return (elements + elements_per_block - 1) / elements_per_block;
+}
+
+uint64_t align(const uint64_t block, const uint64_t alignment) {
+    return (block + alignment - 1) / alignment * alignment;
+}
+
+// region sizes and starts for a number of data blocks
+struct plan_t
+{
+    uint64_t bitmap_blocks, bitmap_checksum_blocks, checksum_blocks, tree_blocks, journal_blocks;
+    uint64_t bitmap, redundancy_bitmap, bitmap_checksum, redundancy_bitmap_checksum;
+    uint64_t data, checksum, redundancy_checksum, tree, journal, backup;
+    uint64_t end;
+
+    plan_t(const uint64_t data_blocks, const layout_configuration_t & configuration)
+    {
+        const uint64_t block_size = configuration.block_size;
+        const uint64_t per_block = block_size / checksum_digest_length(configuration.checksum_algorithm);
+        const uint64_t alignment = std::max < uint64_t > (configuration.alignment, 1);
+
+        bitmap_blocks = blocks_for(data_blocks, 8 * block_size);
+        bitmap_checksum_blocks = blocks_for(bitmap_blocks, per_block);
+        checksum_blocks = blocks_for(data_blocks, per_block);
+        tree_blocks = merkle_tree::blocks_needed(checksum_blocks, configuration.block_size, block_size / per_block);
+        journal_blocks = std::max < uint64_t > (blocks_for(data_blocks, configuration.journal_ratio), 1);
+
+        // the head takes block 0, every region starts on the alignment
+        bitmap = align(1, alignment);
+        redundancy_bitmap = align(bitmap + bitmap_blocks, alignment);
+        bitmap_checksum = align(redundancy_bitmap + bitmap_blocks, alignment);
+        redundancy_bitmap_checksum = align(bitmap_checksum + bitmap_checksum_blocks, alignment);
+        data = align(redundancy_bitmap_checksum + bitmap_checksum_blocks, alignment);
+        checksum = align(data + data_blocks, alignment);
+        redundancy_checksum = align(checksum + checksum_blocks, alignment);
+        tree = align(redundancy_checksum + checksum_blocks, alignment);
+        journal = align(tree + tree_blocks, alignment);
+        // static backup, its checksum, dynamic backup, its checksum
+        backup = align(journal + journal_blocks, alignment);
+        end = backup + 4;
+    }
+};
+
+}
+
+uint64_t layout_blocks_needed(const uint64_t data_blocks, const layout_configuration_t & configuration)
+{
+    return plan_t(data_blocks, configuration).end;
+}
+
+simplesnapfs_filesystem_head_t plan_layout(const uint64_t block_count, const layout_configuration_t & configuration,
+    const std::string & label)
+{
+    const uint32_t digest_length = checksum_digest_length(configuration.checksum_algorithm);
+    if (configuration.journal_ratio == 0 || configuration.reserved_percent >= 100
+        || digest_length == 0 || configuration.block_size % digest_length != 0)
+    {
+        log(_log::LOG_ERROR, "Invalid layout configuration\n");
+        throw InvalidLayout();
+    }
+
+    const uint64_t available = block_count - block_count / 100 * configuration.reserved_percent
+        - block_count % 100 * configuration.reserved_percent / 100;
+    if (layout_blocks_needed(1, configuration) > available)
+    {
+        log(_log::LOG_ERROR, "Provided blocks are too few (", block_count, " blocks, ", available,
+            " usable), at least ", layout_blocks_needed(1, configuration), " are needed\n");
+        throw InvalidLayout();
+    }
+
+    // the largest data block count still fitting lies in [low, high)
+    uint64_t low = 1, high = available;
+    while (high - low > 1)
+    {
+        const uint64_t middle = low + (high - low) / 2;
+        if (layout_blocks_needed(middle, configuration) <= available) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    const plan_t plan(low, configuration);
+    const uint64_t logic_blocks = 2 * (plan.bitmap_blocks + plan.bitmap_checksum_blocks + plan.checksum_blocks)
+        + plan.tree_blocks + low;
+    const uint64_t utility_blocks = plan.journal_blocks + 5;
+    const uint32_t block_size = configuration.block_size;
+
+    simplesnapfs_filesystem_head_t head = {
+        .static_information = {
+            .fs_identification_number = FILESYSTEM_MAGIC_NUMBER,
+
+            .fs_total_blocks = block_count,
+            .fs_block_size = block_size,
+            .logic_blocks = logic_blocks,
+            .utility_blocks = utility_blocks,
+            .utilized_blocks = plan.end,
+
+            .filesystem_head_blk_index = 0,
+
+            .data_block_bitmap_blk_index = plan.bitmap,
+            .data_block_bitmap_blocks = plan.bitmap_blocks,
+
+            .redundancy_data_block_bitmap_blk_index = plan.redundancy_bitmap,
+            .redundancy_data_block_bitmap_blocks = plan.bitmap_blocks,
+
+            .data_block_bitmap_checksum_blk_index = plan.bitmap_checksum,
+            .data_block_bitmap_checksum_blocks = plan.bitmap_checksum_blocks,
+
+            .redundancy_data_block_bitmap_checksum_blk_index = plan.redundancy_bitmap_checksum,
+            .redundancy_data_block_bitmap_checksum_blocks = plan.bitmap_checksum_blocks,
+
+            .data_block_index = plan.data,
+            .data_blocks = low,
+
+            .data_block_checksum_blk_index = plan.checksum,
+            .data_block_checksum_blocks = plan.checksum_blocks,
+
+            .redundancy_data_block_checksum_blk_index = plan.redundancy_checksum,
+            .redundancy_data_block_checksum_blocks = plan.checksum_blocks,
+
+            .journaling_buffer_blk_index = plan.journal,
+            .journaling_buffer_blocks = plan.journal_blocks,
+
+            .fs_static_data_backup_blk_index = plan.backup,
+            .fs_static_data_backup_checksum_blk_index = plan.backup + 1,
+            .fs_dynamic_data_backup_blk_index = plan.backup + 2,
+            .fs_dynamic_data_backup_checksum_blk_index = plan.backup + 3,
+
+            .fs_creation_unix_timestamp = static_cast<uint64_t>(std::chrono::duration_cast < std::chrono::seconds > (
+                std::chrono::system_clock::now().time_since_epoch()).count()),
+
+            .inode_configuration_flag = {
+                .inode_info_level = block_size == 512 ? 0u : block_size <= 2048 ? 1u : 3u,
+            },
+
+            .redundancy_fs_identification_number = FILESYSTEM_MAGIC_NUMBER,
+
+            .checksum_algorithm = configuration.checksum_algorithm,
+
+            .data_block_checksum_tree_blk_index = plan.tree,
+            .data_block_checksum_tree_blocks = plan.tree_blocks
+        },
+
+        .dynamic_information = { }
+    };
+
+    std::strncpy(head.static_information.fs_label, label.c_str(),
+        std::min(sizeof(head.static_information.fs_label), label.size()));
+    return head;
+}
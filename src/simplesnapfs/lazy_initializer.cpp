@@ -0,0 +1,123 @@
+#include <lazy_initializer.h>
+#include <filesystem_head.h>
+#include <merkle_tree.h>
+#include <debug.h>
+#include <algorithm>
+
+lazy_initializer::lazy_initializer(block_io & _io, simplesnapfs_filesystem_head_t & _head)
+    :   io(_io),
+        head(_head)
+{
+    const auto & info = head.static_information;
+    const uint64_t piece_blocks = std::max < uint64_t > (LAZY_INITIALIZATION_PIECE_SIZE / info.fs_block_size, 1);
+    std::vector < piece_t > regions = {
+        { info.data_block_checksum_blk_index, info.data_block_checksum_blocks, false },
+        { info.redundancy_data_block_checksum_blk_index, info.redundancy_data_block_checksum_blocks, false },
+        { info.data_block_checksum_tree_blk_index, info.data_block_checksum_tree_blocks, false },
+        { info.journaling_buffer_blk_index, info.journaling_buffer_blocks, true },
+    };
+    std::ranges::sort(regions, { }, &piece_t::first_block);
+
+    for (const auto & [first_block, blocks, journal] : regions)
+    {
+        for (uint64_t block = 0; block < blocks; block += piece_blocks) {
+            pieces.push_back({ first_block + block, std::min(piece_blocks, blocks - block), journal });
+        }
+        total_blocks += blocks;
+    }
+    initialized.resize(pieces.size(), false);
+    done = !is_needed(head);
+
+    // its checksums would be zeroed under it
+    if (!done && head.dynamic_information.snapshot_volume_descriptor != 0)
+    {
+        log(_log::LOG_ERROR, "Filesystem has a snapshot volume, but its checksum regions were never initialized\n");
+        throw LazyInitializationConflict();
+    }
+}
+
+lazy_initializer::~lazy_initializer()
+{
+    stop_requested = true;
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void lazy_initializer::initialize_piece(const uint64_t piece)
+{
+    // under the lock, so a writer never sees its piece zeroed after it got the go-ahead
+    std::lock_guard lock(mutex);
+    if (initialized[piece]) {
+        return;
+    }
+
+    io.zero_blocks(pieces[piece].first_block, pieces[piece].blocks);
+    initialized[piece] = true;
+    zeroed_blocks += pieces[piece].blocks;
+}
+
+void lazy_initializer::run()
+{
+    try {
+        for (uint64_t piece = 0; piece < pieces.size(); piece++)
+        {
+            if (stop_requested) {
+                return;
+            }
+            initialize_piece(piece);
+        }
+
+        // the zeroed checksum region gets its tree, then the head says it is all there
+        merkle_tree(io, head).build();
+        head.dynamic_information.fs_dynamically_set_flags.lazy_initialization = 0;
+        store_dynamic_information(io, head);
+        io.sync();
+        done = true;
+    } catch (...) {
+        error = std::current_exception();
+    }
+}
+
+void lazy_initializer::start()
+{
+    if (!done && !worker.joinable()) {
+        worker = std::thread([this] { run(); });
+    }
+}
+
+void lazy_initializer::wait()
+{
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void lazy_initializer::ensure_initialized(const uint64_t block)
+{
+    if (done) {
+        return;
+    }
+
+    // the last piece starting at or before the block
+    const auto piece = std::ranges::upper_bound(pieces, block, { }, &piece_t::first_block);
+    if (piece == pieces.begin()) {
+        return;
+    }
+
+    const uint64_t index = std::prev(piece) - pieces.begin();
+    if (block - pieces[index].first_block >= pieces[index].blocks) {
+        return;
+    }
+
+    // a later run would zero it again
+    if (!pieces[index].journal)
+    {
+        log(_log::LOG_ERROR, "Block ", block, " is written before lazy initialization finished, only the journal may be\n");
+        throw LazyInitializationConflict();
+    }
+    initialize_piece(index);
+}
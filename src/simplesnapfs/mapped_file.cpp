@@ -0,0 +1,190 @@
+#include <mapped_file.h>
+#include <debug.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static uint64_t round_up(const uint64_t value, const uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static int to_madvise(const access_pattern_t pattern)
+{
+    switch (pattern)
+    {
+        case ACCESS_SEQUENTIAL: return MADV_SEQUENTIAL;
+        case ACCESS_RANDOM:     return MADV_RANDOM;
+        case ACCESS_WILLNEED:   return MADV_WILLNEED;
+        default:                return MADV_NORMAL;
+    }
+}
+
+static int to_fadvise(const access_pattern_t pattern)
+{
+    switch (pattern)
+    {
+        case ACCESS_SEQUENTIAL: return POSIX_FADV_SEQUENTIAL;
+        case ACCESS_RANDOM:     return POSIX_FADV_RANDOM;
+        case ACCESS_WILLNEED:   return POSIX_FADV_WILLNEED;
+        default:                return POSIX_FADV_NORMAL;
+    }
+}
+
+mapped_file::mapped_file(
+    const int _fd,
+    const uint64_t _file_size,
+    const uint32_t block_size,
+    const uint64_t _chunk_size,
+    const uint64_t window_size,
+    const access_pattern_t _access_pattern)
+    :   fd(_fd),
+        file_size(_file_size),
+        // block sizes and page sizes are both powers of two, so a multiple
+        // of the bigger one is a multiple of both
+        chunk_size(round_up(std::max < uint64_t > (_chunk_size, block_size),
+            std::max < uint64_t > (sysconf(_SC_PAGESIZE), block_size))),
+        max_mapped_chunks(std::max < uint64_t > (window_size / chunk_size, 1)),
+        access_pattern(_access_pattern == ACCESS_WILLNEED ? ACCESS_NORMAL : _access_pattern)
+{
+}
+
+mapped_file::~mapped_file()
+{
+    try {
+        sync();
+    } catch (...) {
+        log(_log::LOG_ERROR, "Error flushing mapped file on shutdown\n");
+    }
+
+    while (!lru_list.empty()) {
+        unmap(lru_list.begin());
+    }
+}
+
+mapped_file::statistics_t mapped_file::get_statistics()
+{
+    std::lock_guard lock(mutex);
+    return statistics;
+}
+
+void mapped_file::unmap(const std::list < chunk_t >::iterator chunk)
+{
+    // dirty pages of a shared mapping stay in the page cache after munmap,
+    // sync() catches them with the final fsync
+    munmap(chunk->base, chunk->length);
+    index.erase(chunk->index);
+    lru_list.erase(chunk);
+    statistics.unmaps++;
+}
+
+mapped_file::chunk_t & mapped_file::get_pinned_chunk(const uint64_t offset)
+{
+    std::lock_guard lock(mutex);
+
+    const uint64_t chunk_index = offset / chunk_size;
+    if (const auto it = index.find(chunk_index); it != index.end())
+    {
+        lru_list.splice(lru_list.begin(), lru_list, it->second);
+        pin(*it->second);
+        return *it->second;
+    }
+
+    // drop the least recently used chunks nobody holds, the window may be
+    // exceeded while everything is pinned
+    for (auto it = lru_list.end(); lru_list.size() >= max_mapped_chunks && it != lru_list.begin(); )
+    {
+        const auto victim = std::prev(it);
+        if (victim->pin_count.load(std::memory_order_acquire) == 0) {
+            unmap(victim);
+        } else {
+            it = victim;
+        }
+    }
+
+    const uint64_t chunk_offset = chunk_index * chunk_size;
+    const uint64_t length = std::min(chunk_size, file_size - chunk_offset);
+    void * base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off64_t>(chunk_offset));
+    if (base == MAP_FAILED)
+    {
+        log(_log::LOG_ERROR, "Error mapping ", length, " bytes at offset ", chunk_offset, "\n");
+        throw MappingFailed();
+    }
+
+    madvise(base, length, to_madvise(access_pattern));
+    statistics.maps++;
+
+    lru_list.emplace_front(chunk_index, static_cast<char *>(base), length);
+    index.emplace(chunk_index, lru_list.begin());
+    pin(lru_list.front());
+    return lru_list.front();
+}
+
+void mapped_file::mark_dirty(chunk_t & chunk, const uint64_t begin, const uint64_t end)
+{
+    std::lock_guard lock(mutex);
+    if (chunk.dirty_begin == chunk.dirty_end) {
+        chunk.dirty_begin = begin;
+        chunk.dirty_end = end;
+        return;
+    }
+
+    chunk.dirty_begin = std::min(chunk.dirty_begin, begin);
+    chunk.dirty_end = std::max(chunk.dirty_end, end);
+}
+
+void mapped_file::advise(const uint64_t offset, const uint64_t length, const access_pattern_t pattern)
+{
+    std::lock_guard lock(mutex);
+    if (pattern != ACCESS_WILLNEED) {
+        access_pattern = pattern;
+    }
+
+    // the page cache below the mapping, covers chunks that are not mapped yet
+    posix_fadvise(fd, static_cast<off64_t>(offset), static_cast<off64_t>(length), to_fadvise(pattern));
+
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    for (auto & chunk : lru_list)
+    {
+        const uint64_t chunk_offset = chunk.index * chunk_size;
+        const uint64_t begin = std::max(offset, chunk_offset);
+        const uint64_t end = std::min(offset + length, chunk_offset + chunk.length);
+        if (begin >= end) {
+            continue;
+        }
+
+        const uint64_t aligned_begin = (begin - chunk_offset) / page_size * page_size;
+        madvise(chunk.base + aligned_begin, end - chunk_offset - aligned_begin, to_madvise(pattern));
+    }
+}
+
+void mapped_file::msync_dirty_range(chunk_t & chunk)
+{
+    if (chunk.dirty_begin == chunk.dirty_end) {
+        return;
+    }
+
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    const uint64_t aligned_begin = chunk.dirty_begin / page_size * page_size;
+    if (msync(chunk.base + aligned_begin, chunk.dirty_end - aligned_begin, MS_SYNC) == -1)
+    {
+        log(_log::LOG_ERROR, "Error synchronizing mapped range\n");
+        throw WriteFailed();
+    }
+
+    statistics.msyncs++;
+
+    // a pinned chunk may still be written through a view handed out earlier
+    if (chunk.pin_count.load(std::memory_order_acquire) == 0) {
+        chunk.dirty_begin = chunk.dirty_end = 0;
+    }
+}
+
+void mapped_file::sync()
+{
+    std::lock_guard lock(mutex);
+    for (auto & chunk : lru_list) {
+        msync_dirty_range(chunk);
+    }
+}
@@ -0,0 +1,251 @@
+#include <merkle_tree.h>
+#include <checksum.h>
+#include <debug.h>
+#include <cstring>
+#include <algorithm>
+
+uint64_t merkle_tree::blocks_needed(const uint64_t checksum_blocks, const uint32_t block_size, const uint32_t digest_length)
+{
+    const uint64_t per_block = block_size / digest_length;
+    uint64_t total = 0;
+    for (uint64_t entries = checksum_blocks; entries != 0;)
+    {
+        const uint64_t blocks = (entries + per_block - 1) / per_block;
+        total += blocks;
+        entries = blocks == 1 ? 0 : blocks;
+    }
+    return total;
+}
+
+merkle_tree::merkle_tree(block_io & _io, simplesnapfs_filesystem_head_t & _head)
+    :   io(_io),
+        head(_head)
+{
+    const auto & info = head.static_information;
+    algorithm = static_cast<checksum_algorithm_t>(info.checksum_algorithm);
+    block_size = info.fs_block_size;
+    digest_length = checksum_digest_length(algorithm);
+
+    if (digest_length == 0 || info.data_block_checksum_blocks == 0
+        || info.data_block_checksum_tree_blocks != blocks_needed(info.data_block_checksum_blocks, block_size, digest_length))
+    {
+        log(_log::LOG_ERROR, "Filesystem head describes no valid data block checksum tree\n");
+        throw InvalidFilesystemHead();
+    }
+
+    fanout = block_size / digest_length;
+    uint64_t first_block = info.data_block_checksum_tree_blk_index;
+    for (uint64_t entries = info.data_block_checksum_blocks; entries != 0;)
+    {
+        const uint64_t blocks = (entries + fanout - 1) / fanout;
+        levels.push_back({ first_block, entries, blocks });
+        first_block += blocks;
+        entries = blocks == 1 ? 0 : blocks;
+    }
+}
+
+uint64_t merkle_tree::child_block(const uint64_t level, const uint64_t entry) const
+{
+    return level == 0 ? head.static_information.data_block_checksum_blk_index + entry : levels[level - 1].first_block + entry;
+}
+
+uint64_t merkle_tree::compute(std::vector < std::vector < char > > & expected, char * expected_root)
+{
+    uint64_t bad_nodes = 0;
+    std::vector < char > stored;
+    expected.assign(levels.size(), { });
+
+    for (uint64_t level = 0; level < levels.size(); level++)
+    {
+        expected[level].assign(levels[level].blocks * block_size, 0);
+        stored.resize(levels[level].blocks * block_size);
+        io.read_range(levels[level].first_block * block_size, stored.size(), stored.data());
+
+        for (uint64_t entry = 0; entry < levels[level].entries; entry++)
+        {
+            // what the node should be, given the checksum region
+            char * node = expected[level].data() + entry * digest_length;
+            if (level == 0) {
+                checksum(algorithm, io.get_block(child_block(0, entry)).view().data(), block_size, node);
+            } else {
+                checksum(algorithm, expected[level - 1].data() + entry * block_size, block_size, node);
+            }
+            bad_nodes += std::memcmp(node, stored.data() + entry * digest_length, digest_length) != 0;
+        }
+    }
+
+    checksum(algorithm, expected.back().data(), block_size, expected_root);
+    bad_nodes += std::memcmp(expected_root, head.dynamic_information.data_block_checksum_tree_root, digest_length) != 0;
+    return bad_nodes;
+}
+
+void merkle_tree::build()
+{
+    std::vector < std::vector < char > > expected;
+    compute(expected, head.dynamic_information.data_block_checksum_tree_root);
+    for (uint64_t level = 0; level < levels.size(); level++) {
+        io.write_range(levels[level].first_block * block_size, expected[level].size(), expected[level].data());
+    }
+}
+
+void merkle_tree::build_empty()
+{
+    // every node of a level is full, the last one is last
+    char full[CHECKSUM_MAX_DIGEST_LENGTH], last[CHECKSUM_MAX_DIGEST_LENGTH];
+    std::memcpy(full, zero_block_checksum(algorithm, block_size), digest_length);
+    std::memcpy(last, full, digest_length);
+
+    std::vector < char > full_block(block_size), last_block(block_size), pattern;
+    for (const auto & level : levels)
+    {
+        const uint64_t full_blocks = level.blocks - 1;
+        const uint64_t last_entries = level.entries - full_blocks * fanout;
+        for (uint64_t entry = 0; entry < fanout; entry++) {
+            std::memcpy(full_block.data() + entry * digest_length, full, digest_length);
+        }
+        std::ranges::fill(last_block, 0);
+        std::memcpy(last_block.data(), full_block.data(), (last_entries - 1) * digest_length);
+        std::memcpy(last_block.data() + (last_entries - 1) * digest_length, last, digest_length);
+
+        // the full blocks are all alike, written MERKLE_TREE_WRITE_SIZE at a time
+        const uint64_t per_write = std::min < uint64_t > (full_blocks, std::max < uint64_t > (MERKLE_TREE_WRITE_SIZE / block_size, 1));
+        pattern.resize(per_write * block_size);
+        for (uint64_t block = 0; block < per_write; block++) {
+            std::memcpy(pattern.data() + block * block_size, full_block.data(), block_size);
+        }
+        for (uint64_t written = 0; written < full_blocks; written += per_write) {
+            io.write_range((level.first_block + written) * block_size,
+                std::min(per_write, full_blocks - written) * block_size, pattern.data());
+        }
+        io.write_range((level.first_block + full_blocks) * block_size, block_size, last_block.data());
+
+        checksum(algorithm, full_block.data(), block_size, full);
+        checksum(algorithm, last_block.data(), block_size, last);
+    }
+
+    // the digest of the top level's only block
+    std::memcpy(head.dynamic_information.data_block_checksum_tree_root, last, digest_length);
+}
+
+uint64_t merkle_tree::verify(const bool repair)
+{
+    std::vector < std::vector < char > > expected;
+    char expected_root[CHECKSUM_MAX_DIGEST_LENGTH];
+    const uint64_t bad_nodes = compute(expected, expected_root);
+
+    // the tree is small next to the region it covers, rewrite all of it
+    if (repair && bad_nodes != 0)
+    {
+        for (uint64_t level = 0; level < levels.size(); level++) {
+            io.write_range(levels[level].first_block * block_size, expected[level].size(), expected[level].data());
+        }
+        std::memcpy(head.dynamic_information.data_block_checksum_tree_root, expected_root, digest_length);
+    }
+
+    return bad_nodes;
+}
+
+void merkle_tree::update(const uint64_t first_block, const uint64_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // checksum blocks holding the changed slots, then the nodes above them, level by level
+    uint64_t first_entry = first_block * digest_length / block_size;
+    uint64_t last_entry = ((first_block + count) * digest_length - 1) / block_size;
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    for (uint64_t level = 0; level < levels.size(); level++)
+    {
+        for (uint64_t entry = first_entry; entry <= last_entry; entry++)
+        {
+            checksum(algorithm, io.get_block(child_block(level, entry)).view().data(), block_size, digest);
+            io.get_block(levels[level].first_block + entry / fanout).write(digest, digest_length, entry % fanout * digest_length);
+        }
+
+        first_entry /= fanout;
+        last_entry /= fanout;
+    }
+
+    checksum(algorithm, io.get_block(levels.back().first_block).view().data(), block_size,
+        head.dynamic_information.data_block_checksum_tree_root);
+}
+
+bool merkle_tree::verify_block(const uint64_t data_block)
+{
+    uint64_t entry = data_block * digest_length / block_size;
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    for (uint64_t level = 0; level < levels.size(); level++)
+    {
+        checksum(algorithm, io.get_block(child_block(level, entry)).view().data(), block_size, digest);
+        const auto node = io.get_block(levels[level].first_block + entry / fanout);
+        if (std::memcmp(digest, node.view().data() + entry % fanout * digest_length, digest_length) != 0) {
+            return false;
+        }
+        entry /= fanout;
+    }
+
+    checksum(algorithm, io.get_block(levels.back().first_block).view().data(), block_size, digest);
+    return std::memcmp(digest, head.dynamic_information.data_block_checksum_tree_root, digest_length) == 0;
+}
+
+void merkle_tree::diff_checksum_block(merkle_tree & other, const uint64_t checksum_block, std::vector < range_t > & ranges)
+{
+    const auto mine = io.get_block(child_block(0, checksum_block));
+    const auto theirs = other.io.get_block(other.child_block(0, checksum_block));
+    const uint64_t first_block = checksum_block * fanout;
+    const uint64_t end_block = std::min < uint64_t > (first_block + fanout, head.static_information.data_blocks);
+
+    for (uint64_t block = first_block; block < end_block; block++)
+    {
+        const uint64_t offset = (block - first_block) * digest_length;
+        if (std::memcmp(mine.view().data() + offset, theirs.view().data() + offset, digest_length) == 0) {
+            continue;
+        }
+
+        if (!ranges.empty() && ranges.back().first_block + ranges.back().blocks == block) {
+            ranges.back().blocks++;
+        } else {
+            ranges.push_back({ block, 1 });
+        }
+    }
+}
+
+void merkle_tree::diff_block(merkle_tree & other, const uint64_t level, const uint64_t block, std::vector < range_t > & ranges)
+{
+    const auto mine = io.get_block(levels[level].first_block + block);
+    const auto theirs = other.io.get_block(other.levels[level].first_block + block);
+    const uint64_t first_entry = block * fanout;
+    const uint64_t end_entry = std::min < uint64_t > (first_entry + fanout, levels[level].entries);
+
+    // entries in ascending order, so the ranges come out sorted
+    for (uint64_t entry = first_entry; entry < end_entry; entry++)
+    {
+        const uint64_t offset = (entry - first_entry) * digest_length;
+        if (std::memcmp(mine.view().data() + offset, theirs.view().data() + offset, digest_length) == 0) {
+            continue;
+        }
+
+        if (level == 0) {
+            diff_checksum_block(other, entry, ranges);
+        } else {
+            diff_block(other, level - 1, entry, ranges);
+        }
+    }
+}
+
+std::vector < merkle_tree::range_t > merkle_tree::diff(merkle_tree & other)
+{
+    if (algorithm != other.algorithm || block_size != other.block_size
+        || head.static_information.data_blocks != other.head.static_information.data_blocks)
+    {
+        log(_log::LOG_ERROR, "Checksum trees of different geometry cannot be compared\n");
+        throw IncompatibleChecksumTree();
+    }
+
+    std::vector < range_t > ranges;
+    if (std::memcmp(root().data(), other.root().data(), digest_length) != 0) {
+        diff_block(other, levels.size() - 1, 0, ranges);
+    }
+    return ranges;
+}
@@ -0,0 +1,138 @@
+#include <readahead.h>
+#include <algorithm>
+
+// accesses in a row moving by the same stride before a stream is trusted
+constexpr uint32_t confirmations_needed = 2;
+
+readahead_tracker::readahead_tracker(
+    const uint64_t _total_blocks,
+    const uint64_t _initial_window,
+    const uint64_t _max_window,
+    const int64_t _max_stride)
+    :   total_blocks(_total_blocks),
+        initial_window(std::max < uint64_t > (std::min(_initial_window, _max_window), 1)),
+        max_window(_max_window),
+        max_stride(std::max < int64_t > (_max_stride, 1))
+{
+}
+
+readahead_tracker::stream_t & readahead_tracker::least_recently_used()
+{
+    return *std::ranges::min_element(streams, [](const stream_t & a, const stream_t & b) {
+        // unused slots first
+        return a.valid != b.valid ? !a.valid : a.last_used < b.last_used;
+    });
+}
+
+readahead_tracker::window_t readahead_tracker::advance(stream_t & stream)
+{
+    const int64_t block = stream.last_block;
+    const int64_t stride = stream.stride;
+
+    if (stream.window == 0)
+    {
+        stream.window = initial_window;
+        stream.next_prefetch = block + stride;
+    }
+    else
+    {
+        // blocks requested beyond the current one, prefetch the next window
+        // once the reader is through half of the previous one
+        const int64_t ahead = (stream.next_prefetch - block) / stride - 1;
+        if (ahead < 0) {
+            // reader overtook readahead, restart right in front of it
+            stream.next_prefetch = block + stride;
+        } else if (static_cast<uint64_t>(ahead) > stream.window / 2) {
+            return { };
+        }
+        stream.window = std::min(stream.window * 2, max_window);
+    }
+
+    // stay on the device
+    const int64_t first = stream.next_prefetch;
+    if (first < 0 || first >= static_cast<int64_t>(total_blocks)) {
+        return { };
+    }
+
+    const auto steps_left = static_cast<uint64_t>(stride > 0
+        ? (static_cast<int64_t>(total_blocks) - 1 - first) / stride + 1
+        : first / -stride + 1);
+    const uint64_t count = std::min(stream.window, steps_left);
+
+    stream.next_prefetch = first + static_cast<int64_t>(count) * stride;
+    statistics.windows++;
+    statistics.blocks += count;
+    return { .first = static_cast<uint64_t>(first), .stride = stride, .count = count };
+}
+
+readahead_tracker::window_t readahead_tracker::access(const uint64_t _block)
+{
+    if (max_window == 0) {
+        return { };
+    }
+
+    const auto block = static_cast<int64_t>(_block);
+    std::lock_guard lock(mutex);
+    clock++;
+
+    // continuation of a stream, or a repeated access to its last block
+    for (auto & stream : streams)
+    {
+        if (!stream.valid) {
+            continue;
+        }
+
+        if (stream.last_block == block)
+        {
+            stream.last_used = clock;
+            return { };
+        }
+
+        if (stream.stride != 0 && stream.last_block + stream.stride == block)
+        {
+            stream.last_block = block;
+            stream.last_used = clock;
+            stream.confirmations++;
+            statistics.stream_accesses++;
+            return stream.confirmations >= confirmations_needed ? advance(stream) : window_t { };
+        }
+    }
+
+    // second access close to an unconfirmed stream fixes its stride
+    stream_t * nearest = nullptr;
+    int64_t nearest_distance = max_stride + 1;
+    for (auto & stream : streams)
+    {
+        if (!stream.valid || stream.confirmations >= confirmations_needed) {
+            continue;
+        }
+
+        const int64_t distance = block > stream.last_block ? block - stream.last_block : stream.last_block - block;
+        if (distance < nearest_distance) {
+            nearest = &stream;
+            nearest_distance = distance;
+        }
+    }
+
+    if (nearest != nullptr)
+    {
+        nearest->stride = block - nearest->last_block;
+        nearest->last_block = block;
+        nearest->confirmations = 1;
+        nearest->window = 0;
+        nearest->last_used = clock;
+        statistics.stream_accesses++;
+        return { };
+    }
+
+    // nothing matches, this may start a new stream
+    statistics.random_accesses++;
+    least_recently_used() = { .last_block = block, .last_used = clock, .valid = true };
+    return { };
+}
+
+readahead_tracker::statistics_t readahead_tracker::get_statistics() const
+{
+    std::lock_guard lock(mutex);
+    return statistics;
+}
@@ -0,0 +1,306 @@
+#include <scrub.h>
+#include <filesystem_head.h>
+#include <checksum.h>
+#include <debug.h>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+struct scrubber::piece_t
+{
+    uint64_t first_block = 0;           // data block numbers, relative to the data region
+    uint64_t blocks = 0;                // blocks read, from the first to the last allocated one
+    std::vector < uint64_t > allocated; // allocated blocks among them
+    std::vector < char > data;
+    std::vector < char > primary_checksums;
+    std::vector < char > redundancy_checksums;
+    std::vector < char > digests;       // of the allocated blocks, in order
+    std::vector < std::future < void > > hashing;
+
+    // the pool may still be working on the buffers
+    ~piece_t() {
+        for (auto & share : hashing) {
+            if (share.valid()) {
+                share.wait();
+            }
+        }
+    }
+};
+
+scrubber::scrubber(block_io & _io, const scrub_configuration_t & _configuration)
+    :   io(_io),
+        configuration(_configuration),
+        pool(_configuration.hashing_threads)
+{
+    load_head();
+}
+
+void scrubber::load_head()
+{
+    head = load_filesystem_head(io);
+    block_size = head.static_information.fs_block_size;
+    digest_length = checksum_digest_length(static_cast<checksum_algorithm_t>(head.static_information.checksum_algorithm));
+    tree = std::make_unique < merkle_tree > (io, head);
+}
+
+bool scrubber::is_allocated(const uint64_t data_block) const
+{
+    return (bitmap[data_block / 8] >> (data_block % 8)) & 1;
+}
+
+void scrubber::read(const uint64_t offset, const uint64_t len, char * buf)
+{
+    io.read_range(offset, len, buf);
+    statistics.bytes_read += len;
+
+    // stay behind the schedule the rate limit allows
+    if (configuration.rate_limit != 0)
+    {
+        const auto due = started + std::chrono::duration_cast < std::chrono::steady_clock::duration > (
+            std::chrono::duration < double > (static_cast<double>(statistics.bytes_read) / static_cast<double>(configuration.rate_limit)));
+        std::this_thread::sleep_until(due);
+    }
+}
+
+void scrubber::rewrite(const uint64_t offset, const uint64_t len, const char * buf)
+{
+    if (configuration.repair)
+    {
+        io.write_range(offset, len, buf);
+        statistics.repaired++;
+    }
+}
+
+void scrubber::report_progress()
+{
+    statistics.elapsed_seconds = std::chrono::duration < double > (std::chrono::steady_clock::now() - started).count();
+    if (configuration.progress) {
+        configuration.progress(statistics);
+    }
+}
+
+void scrubber::scrub_bitmap()
+{
+    const auto & info = head.static_information;
+    const uint64_t blocks = info.data_block_bitmap_blocks;
+    std::vector < char > redundancy(blocks * block_size);
+    std::vector < char > primary_checksums(blocks * digest_length), redundancy_checksums(blocks * digest_length);
+
+    bitmap.resize(blocks * block_size);
+    read(info.data_block_bitmap_blk_index * block_size, bitmap.size(), bitmap.data());
+    read(info.redundancy_data_block_bitmap_blk_index * block_size, redundancy.size(), redundancy.data());
+    read(info.data_block_bitmap_checksum_blk_index * block_size, primary_checksums.size(), primary_checksums.data());
+    read(info.redundancy_data_block_bitmap_checksum_blk_index * block_size, redundancy_checksums.size(), redundancy_checksums.data());
+
+    const auto algorithm = static_cast<checksum_algorithm_t>(info.checksum_algorithm);
+    char primary_digest[CHECKSUM_MAX_DIGEST_LENGTH], redundancy_digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    for (uint64_t block = 0; block < blocks; block++)
+    {
+        char * primary_block = bitmap.data() + block * block_size;
+        char * redundancy_block = redundancy.data() + block * block_size;
+        char * primary_checksum = primary_checksums.data() + block * digest_length;
+        char * redundancy_checksum = redundancy_checksums.data() + block * digest_length;
+        checksum(algorithm, primary_block, block_size, primary_digest);
+        checksum(algorithm, redundancy_block, block_size, redundancy_digest);
+        statistics.bitmap_blocks_checked++;
+
+        // a copy is good when either checksum copy vouches for it
+        const auto vouched = [&](const char * digest) {
+            return std::memcmp(digest, primary_checksum, digest_length) == 0
+                || std::memcmp(digest, redundancy_checksum, digest_length) == 0;
+        };
+
+        const char * good = vouched(primary_digest) ? primary_block : vouched(redundancy_digest) ? redundancy_block : nullptr;
+        if (good == nullptr)
+        {
+            // keep every block either copy calls allocated, so all of them are verified
+            log(_log::LOG_ERROR, "Bitmap block ", block, " has no good copy\n");
+            statistics.unrecoverable_blocks++;
+            for (uint64_t byte = 0; byte < block_size; byte++) {
+                primary_block[byte] |= redundancy_block[byte];
+            }
+            continue;
+        }
+
+        const char * good_digest = good == primary_block ? primary_digest : redundancy_digest;
+        if (good != primary_block)
+        {
+            statistics.bitmap_errors++;
+            std::memcpy(primary_block, good, block_size);
+            rewrite((info.data_block_bitmap_blk_index + block) * block_size, block_size, good);
+        }
+        else if (std::memcmp(redundancy_block, good, block_size) != 0)
+        {
+            statistics.bitmap_errors++;
+            rewrite((info.redundancy_data_block_bitmap_blk_index + block) * block_size, block_size, good);
+        }
+
+        if (std::memcmp(primary_checksum, good_digest, digest_length) != 0)
+        {
+            statistics.checksum_errors++;
+            rewrite(info.data_block_bitmap_checksum_blk_index * block_size + block * digest_length, digest_length, good_digest);
+        }
+        if (std::memcmp(redundancy_checksum, good_digest, digest_length) != 0)
+        {
+            statistics.checksum_errors++;
+            rewrite(info.redundancy_data_block_bitmap_checksum_blk_index * block_size + block * digest_length, digest_length, good_digest);
+        }
+    }
+}
+
+std::unique_ptr < scrubber::piece_t > scrubber::read_piece(const uint64_t first_block, const uint64_t blocks)
+{
+    const auto & info = head.static_information;
+    auto piece = std::make_unique < piece_t > ();
+    for (uint64_t block = first_block; block < first_block + blocks; block++) {
+        if (is_allocated(block)) {
+            piece->allocated.push_back(block);
+        }
+    }
+
+    if (piece->allocated.empty()) {
+        return piece;
+    }
+
+    // one sequential read from the first to the last allocated block, free ones in between included
+    piece->first_block = piece->allocated.front();
+    piece->blocks = piece->allocated.back() - piece->first_block + 1;
+    piece->data.resize(piece->blocks * block_size);
+    piece->primary_checksums.resize(piece->blocks * digest_length);
+    piece->redundancy_checksums.resize(piece->blocks * digest_length);
+    piece->digests.resize(piece->allocated.size() * digest_length);
+
+    read((info.data_block_index + piece->first_block) * block_size, piece->data.size(), piece->data.data());
+    read(info.data_block_checksum_blk_index * block_size + piece->first_block * digest_length,
+        piece->primary_checksums.size(), piece->primary_checksums.data());
+    read(info.redundancy_data_block_checksum_blk_index * block_size + piece->first_block * digest_length,
+        piece->redundancy_checksums.size(), piece->redundancy_checksums.data());
+
+    // an equal share of the allocated blocks for every hashing thread
+    const auto algorithm = static_cast<checksum_algorithm_t>(info.checksum_algorithm);
+    const uint64_t share = (piece->allocated.size() + pool.size() - 1) / pool.size();
+    for (uint64_t begin = 0; begin < piece->allocated.size(); begin += share)
+    {
+        const uint64_t end = std::min < uint64_t > (begin + share, piece->allocated.size());
+        piece->hashing.push_back(pool.submit([this, piece = piece.get(), algorithm, begin, end]
+        {
+            for (uint64_t i = begin; i < end; i++) {
+                checksum(algorithm, piece->data.data() + (piece->allocated[i] - piece->first_block) * block_size,
+                    block_size, piece->digests.data() + i * digest_length);
+            }
+        }));
+    }
+
+    return piece;
+}
+
+void scrubber::verify_piece(piece_t & piece)
+{
+    const auto & info = head.static_information;
+    for (auto & share : piece.hashing) {
+        share.get();
+    }
+
+    for (uint64_t i = 0; i < piece.allocated.size(); i++)
+    {
+        const uint64_t block = piece.allocated[i];
+        const char * digest = piece.digests.data() + i * digest_length;
+        const bool primary_matches = std::memcmp(digest,
+            piece.primary_checksums.data() + (block - piece.first_block) * digest_length, digest_length) == 0;
+        const bool redundancy_matches = std::memcmp(digest,
+            piece.redundancy_checksums.data() + (block - piece.first_block) * digest_length, digest_length) == 0;
+        statistics.data_blocks_checked++;
+
+        if (!primary_matches && !redundancy_matches)
+        {
+            log(_log::LOG_ERROR, "Data block ", block, " matches none of its checksums\n");
+            statistics.unrecoverable_blocks++;
+            continue;
+        }
+
+        // the block agrees with one checksum copy, which makes the other one the bad one
+        if (!primary_matches)
+        {
+            statistics.checksum_errors++;
+            rewrite(info.data_block_checksum_blk_index * block_size + block * digest_length, digest_length, digest);
+        }
+        if (!redundancy_matches)
+        {
+            statistics.checksum_errors++;
+            rewrite(info.redundancy_data_block_checksum_blk_index * block_size + block * digest_length, digest_length, digest);
+        }
+    }
+}
+
+void scrubber::scrub_data()
+{
+    const uint64_t data_blocks = head.static_information.data_blocks;
+    for (uint64_t block = 0; block < data_blocks; block++) {
+        statistics.data_blocks_total += is_allocated(block);
+    }
+
+    // the next piece is read while the pool hashes the current one
+    const uint64_t blocks_per_piece = std::max < uint64_t > (configuration.read_size / block_size, 1);
+    uint64_t next_block = 0;
+    std::unique_ptr < piece_t > current;
+    while (next_block < data_blocks || current)
+    {
+        std::unique_ptr < piece_t > next;
+        if (next_block < data_blocks)
+        {
+            const uint64_t blocks = std::min(blocks_per_piece, data_blocks - next_block);
+            next = read_piece(next_block, blocks);
+            next_block += blocks;
+        }
+
+        if (current)
+        {
+            verify_piece(*current);
+            report_progress();
+        }
+        current = std::move(next);
+    }
+}
+
+void scrubber::scrub_tree()
+{
+    // the tree can only be judged against a good checksum region
+    if (!configuration.repair && statistics.checksum_errors != 0) {
+        return;
+    }
+
+    statistics.tree_errors = tree->verify(configuration.repair);
+    if (statistics.tree_errors != 0)
+    {
+        log(_log::LOG_ERROR, statistics.tree_errors, " checksum tree node(s) disagree with the checksum region\n");
+        if (configuration.repair)
+        {
+            statistics.repaired += statistics.tree_errors;
+            store_dynamic_information(io, head);
+        }
+    }
+}
+
+scrub_statistics_t scrubber::run()
+{
+    statistics = { };
+    started = std::chrono::steady_clock::now();
+
+    scrub_bitmap();
+    report_progress();
+
+    // mkfs --lazy left the checksum regions and the tree for later
+    if (head.dynamic_information.fs_dynamically_set_flags.lazy_initialization) {
+        log(_log::LOG_NORMAL, "Data block checksums are not initialized yet, only the bitmap was checked\n");
+    } else {
+        scrub_data();
+        scrub_tree();
+    }
+
+    if (statistics.repaired != 0) {
+        io.sync();
+    }
+
+    report_progress();
+    return statistics;
+}
@@ -0,0 +1,244 @@
+#include <snapshot_stream.h>
+#include <filesystem_head.h>
+#include <block_allocator.h>
+#include <debug.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// equal checksums mean equal blocks only when nobody can make them collide
+static bool is_cryptographic(const checksum_algorithm_t algorithm)
+{
+    return algorithm == CHECKSUM_SHA512 || algorithm == CHECKSUM_BLAKE3;
+}
+
+static uint64_t record_header_checksum(const snapshot_stream_record_t & record)
+{
+    return crc32c(reinterpret_cast<const char *>(&record), offsetof(snapshot_stream_record_t, header_checksum));
+}
+
+snapshot_stream_statistics_t send_snapshot_stream(snapshot_volume & volume, const snapshot_t * from, const snapshot_t * to,
+    std::ostream & stream)
+{
+    const uint32_t block_size = volume.get_block_size();
+    const auto algorithm = volume.get_checksum_algorithm();
+    const uint32_t digest_length = checksum_digest_length(algorithm);
+    const char * zero_digest = zero_block_checksum(algorithm, block_size);
+    const bool trust_checksums = is_cryptographic(algorithm);
+    snapshot_stream_statistics_t statistics { };
+    sha512_hasher hasher;
+
+    // the checksums stored as of the last sync are all the records carry, so
+    // live writes and snapshots taken since then get theirs first
+    volume.sync();
+
+    const auto emit = [&](const char * data, const uint64_t len)
+    {
+        stream.write(data, static_cast<std::streamsize>(len));
+        if (!stream)
+        {
+            log(_log::LOG_ERROR, "Cannot write the snapshot stream\n");
+            throw WriteFailed();
+        }
+        hasher.update(data, len);
+        statistics.stream_bytes += len;
+    };
+
+    snapshot_stream_header_t header {
+        .magic = SNAPSHOT_STREAM_MAGIC,
+        .block_size = block_size,
+        .checksum_algorithm = algorithm,
+        .logical_blocks = volume.get_logical_blocks(),
+        .from_epoch = from == nullptr ? 0 : from->epoch,
+        .to_epoch = to == nullptr ? 0 : to->epoch,
+        .checksum = { },
+    };
+    const auto header_digest = sha512sum(reinterpret_cast<const char *>(&header), offsetof(snapshot_stream_header_t, checksum));
+    std::memcpy(header.checksum, header_digest.data(), header_digest.size());
+    emit(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    std::vector < char > contents(block_size), base(block_size);
+    const std::vector < char > zeros(block_size);
+    char base_digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    uint64_t records = 0;
+    volume.diff(from, to, [&](const uint64_t block, const block_pointer_t & from_pointer, const block_pointer_t & to_pointer)
+    {
+        statistics.changed_blocks++;
+        snapshot_stream_record_t record { };
+        record.kind = SNAPSHOT_STREAM_BLOCK;
+        record.block = block;
+        volume.stored_checksum(to_pointer, record.checksum);
+
+        // the receiver has the from side already
+        bool unchanged, is_zeros;
+        if (trust_checksums)
+        {
+            volume.stored_checksum(from_pointer, base_digest);
+            unchanged = std::memcmp(record.checksum, base_digest, digest_length) == 0;
+            is_zeros = std::memcmp(record.checksum, zero_digest, digest_length) == 0;
+        }
+        else
+        {
+            volume.read_located(to_pointer, contents.data());
+            volume.read_located(from_pointer, base.data());
+            unchanged = contents == base;
+            is_zeros = contents == zeros;
+        }
+        if (unchanged)
+        {
+            statistics.unchanged_blocks++;
+            return;
+        }
+
+        if (is_zeros) {
+            record.kind = SNAPSHOT_STREAM_ZEROS;
+        }
+        record.header_checksum = record_header_checksum(record);
+        emit(reinterpret_cast<const char *>(&record), sizeof(record));
+        records++;
+
+        if (is_zeros)
+        {
+            statistics.zero_blocks++;
+            return;
+        }
+        if (trust_checksums) {
+            volume.read_located(to_pointer, contents.data());
+        }
+        emit(contents.data(), block_size);
+        statistics.sent_blocks++;
+    });
+
+    snapshot_stream_record_t end { };
+    end.kind = SNAPSHOT_STREAM_END;
+    end.block = records;
+    const auto stream_digest = hasher.final();
+    std::memcpy(end.checksum, stream_digest.data(), stream_digest.size());
+    end.header_checksum = record_header_checksum(end);
+    emit(reinterpret_cast<const char *>(&end), sizeof(end));
+    stream.flush();
+    return statistics;
+}
+
+snapshot_stream_statistics_t receive_snapshot_stream(block_io & io, std::istream & stream)
+{
+    snapshot_stream_statistics_t statistics { };
+    sha512_hasher hasher;
+    const auto take = [&](char * data, const uint64_t len, const bool hashed)
+    {
+        stream.read(data, static_cast<std::streamsize>(len));
+        if (static_cast<uint64_t>(stream.gcount()) != len)
+        {
+            log(_log::LOG_ERROR, "Snapshot stream ends early\n");
+            throw InvalidSnapshotStream();
+        }
+        if (hashed) {
+            hasher.update(data, len);
+        }
+        statistics.stream_bytes += len;
+    };
+
+    auto head = load_filesystem_head(io);
+    const uint32_t block_size = head.static_information.fs_block_size;
+
+    snapshot_stream_header_t header { };
+    take(reinterpret_cast<char *>(&header), sizeof(header), true);
+    const auto header_digest = sha512sum(reinterpret_cast<const char *>(&header), offsetof(snapshot_stream_header_t, checksum));
+    const auto algorithm = static_cast<checksum_algorithm_t>(header.checksum_algorithm);
+    const uint32_t digest_length = checksum_digest_length(algorithm);
+    if (header.magic != SNAPSHOT_STREAM_MAGIC || std::memcmp(header.checksum, header_digest.data(), header_digest.size()) != 0
+        || digest_length == 0 || header.logical_blocks == 0)
+    {
+        log(_log::LOG_ERROR, "Not a snapshot stream\n");
+        throw InvalidSnapshotStream();
+    }
+    if (header.block_size != block_size)
+    {
+        log(_log::LOG_ERROR, "Snapshot stream of ", header.block_size, " byte blocks for a filesystem of ", block_size, " byte blocks\n");
+        throw InvalidSnapshotStream();
+    }
+
+    // a volume made for a full stream is stored by the sync() below, with what the
+    // stream brings: a stream failing before then leaves the filesystem without one
+    block_allocator allocator(io, head);
+    if (head.dynamic_information.snapshot_volume_descriptor == 0 && header.from_epoch == 0) {
+        snapshot_volume::create(io, head, allocator, header.logical_blocks, false);
+    }
+    if (head.dynamic_information.snapshot_volume_descriptor == 0)
+    {
+        log(_log::LOG_ERROR, "Incremental snapshot stream from epoch ", header.from_epoch, " for a filesystem without a snapshot volume\n");
+        throw InvalidSnapshotStream();
+    }
+
+    // the stream goes on top of what it was made against, exactly
+    snapshot_volume volume(io, head, allocator);
+    const auto snapshots = volume.get_snapshots();
+    const bool matching_base = header.from_epoch == 0
+        ? snapshots.empty() && volume.is_unchanged_since(nullptr)
+        : !snapshots.empty() && snapshots.back().received_from == header.from_epoch && volume.is_unchanged_since(&snapshots.back());
+    if (volume.get_logical_blocks() != header.logical_blocks || !matching_base)
+    {
+        log(_log::LOG_ERROR, "Snapshot stream from epoch ", header.from_epoch, " does not apply to this snapshot volume\n");
+        throw InvalidSnapshotStream();
+    }
+
+    std::vector < char > contents(block_size);
+    const std::vector < char > zeros(block_size);
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    uint64_t records = 0;
+    for (uint64_t next_block = 0;; records++)
+    {
+        snapshot_stream_record_t record { };
+        take(reinterpret_cast<char *>(&record), sizeof(record), false);
+        if (record.header_checksum != record_header_checksum(record))
+        {
+            log(_log::LOG_ERROR, "Snapshot stream record ", records, " is damaged\n");
+            throw InvalidSnapshotStream();
+        }
+
+        if (record.kind == SNAPSHOT_STREAM_END)
+        {
+            const auto stream_digest = hasher.final();
+            if (record.block != records || std::memcmp(record.checksum, stream_digest.data(), stream_digest.size()) != 0)
+            {
+                log(_log::LOG_ERROR, "Snapshot stream does not match its end record\n");
+                throw InvalidSnapshotStream();
+            }
+            break;
+        }
+
+        hasher.update(reinterpret_cast<const char *>(&record), sizeof(record));
+        if ((record.kind != SNAPSHOT_STREAM_BLOCK && record.kind != SNAPSHOT_STREAM_ZEROS)
+            || record.block < next_block || record.block >= header.logical_blocks)
+        {
+            log(_log::LOG_ERROR, "Snapshot stream record ", records, " is out of order or place\n");
+            throw InvalidSnapshotStream();
+        }
+        next_block = record.block + 1;
+
+        if (record.kind == SNAPSHOT_STREAM_ZEROS)
+        {
+            std::memcpy(contents.data(), zeros.data(), block_size);
+            statistics.zero_blocks++;
+        }
+        else
+        {
+            take(contents.data(), block_size, true);
+            statistics.sent_blocks++;
+        }
+        checksum(algorithm, contents.data(), block_size, digest);
+        if (std::memcmp(digest, record.checksum, digest_length) != 0)
+        {
+            log(_log::LOG_ERROR, "Block ", record.block, " in the snapshot stream does not match its checksum\n");
+            throw InvalidSnapshotStream();
+        }
+
+        // copied on write, so what the stored volume refers to stays as it is until sync()
+        volume.write(record.block, contents.data());
+        statistics.changed_blocks++;
+    }
+
+    volume.create_snapshot(header.to_epoch);
+    volume.sync();
+    return statistics;
+}
@@ -0,0 +1,453 @@
+#include <snapshot_volume.h>
+#include <filesystem_head.h>
+#include <lazy_initializer.h>
+#include <checksum.h>
+#include <debug.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+void snapshot_volume::create(block_io & io, simplesnapfs_filesystem_head_t & head, block_allocator & allocator, const uint64_t logical_blocks,
+    const bool stored)
+{
+    if (head.dynamic_information.snapshot_volume_descriptor != 0 || logical_blocks == 0)
+    {
+        log(_log::LOG_ERROR, "Cannot create a snapshot volume of ", logical_blocks, " blocks here\n");
+        throw InvalidSnapshotVolume();
+    }
+
+    uint64_t block;
+    if (!allocator.allocate(block))
+    {
+        log(_log::LOG_ERROR, "No space left for a snapshot volume\n");
+        throw VolumeFull();
+    }
+
+    // as few map levels as reach every logical block
+    const uint32_t block_size = head.static_information.fs_block_size;
+    const uint64_t fanout = block_size / sizeof(block_pointer_t);
+    uint64_t levels = 1;
+    for (uint64_t reach = fanout; reach < logical_blocks; reach *= fanout) {
+        levels++;
+    }
+
+    const snapshot_descriptor_t descriptor {
+        .magic = SNAPSHOT_VOLUME_MAGIC,
+        .logical_blocks = logical_blocks,
+        .map_levels = levels,
+        .current_epoch = 1,
+        .live_root = { },
+        .snapshots = 0,
+        .last_table_block = 0,
+    };
+    std::vector < char > contents(block_size);
+    std::memcpy(contents.data(), &descriptor, sizeof(descriptor));
+    io.write_range((head.static_information.data_block_index + block) * block_size, block_size, contents.data());
+    head.dynamic_information.snapshot_volume_descriptor = block + 1;
+
+    // checksummed and stored with the head
+    if (stored) {
+        snapshot_volume(io, head, allocator).sync();
+    }
+}
+
+snapshot_volume::snapshot_volume(block_io & _io, simplesnapfs_filesystem_head_t & _head, block_allocator & _allocator)
+    :   io(_io),
+        head(_head),
+        allocator(_allocator),
+        tree(_io, _head),
+        block_size(_head.static_information.fs_block_size),
+        algorithm(static_cast<checksum_algorithm_t>(_head.static_information.checksum_algorithm)),
+        digest_length(checksum_digest_length(algorithm)),
+        fanout(block_size / sizeof(block_pointer_t)),
+        descriptor_block(_head.dynamic_information.snapshot_volume_descriptor - 1)
+{
+    // checksums written now would be zeroed by the initializer, and the tree rebuilt over them
+    if (lazy_initializer::is_needed(head))
+    {
+        log(_log::LOG_ERROR, "Snapshot volume used before lazy initialization finished\n");
+        throw InvalidSnapshotVolume();
+    }
+
+    if (head.dynamic_information.snapshot_volume_descriptor == 0) {
+        log(_log::LOG_ERROR, "Filesystem has no snapshot volume\n");
+        throw InvalidSnapshotVolume();
+    }
+
+    io.read_range(device_offset(descriptor_block + 1), sizeof(descriptor), reinterpret_cast<char *>(&descriptor));
+    uint64_t reach = 1;
+    for (uint64_t level = 0; level < descriptor.map_levels && reach < descriptor.logical_blocks; level++) {
+        reach *= fanout;
+    }
+    if (descriptor.magic != SNAPSHOT_VOLUME_MAGIC || descriptor.logical_blocks == 0
+        || descriptor.map_levels == 0 || descriptor.map_levels > 64 || reach < descriptor.logical_blocks)
+    {
+        log(_log::LOG_ERROR, "Snapshot volume descriptor is damaged\n");
+        throw InvalidSnapshotVolume();
+    }
+
+    // the table, read once from the newest block back; from here on it is only appended to
+    std::vector < char > table(block_size);
+    const uint64_t per_table_block = (block_size - sizeof(snapshot_table_header_t)) / sizeof(snapshot_t);
+    for (uint64_t table_block = descriptor.last_table_block; table_block != 0;)
+    {
+        io.read_range(device_offset(table_block), block_size, table.data());
+        snapshot_table_header_t table_header { };
+        std::memcpy(&table_header, table.data(), sizeof(table_header));
+        if (table_header.entries == 0 || table_header.entries > per_table_block
+            || snapshots.size() + table_header.entries > descriptor.snapshots)
+        {
+            log(_log::LOG_ERROR, "Snapshot table is damaged\n");
+            throw InvalidSnapshotVolume();
+        }
+
+        std::vector < snapshot_t > entries(table_header.entries);
+        std::memcpy(entries.data(), table.data() + sizeof(table_header), entries.size() * sizeof(snapshot_t));
+        snapshots.insert(snapshots.begin(), entries.begin(), entries.end());
+        table_block = table_header.previous;
+    }
+    if (snapshots.size() != descriptor.snapshots)
+    {
+        log(_log::LOG_ERROR, "Snapshot table holds ", snapshots.size(), " of ", descriptor.snapshots, " snapshots\n");
+        throw InvalidSnapshotVolume();
+    }
+}
+
+uint64_t snapshot_volume::device_offset(const uint64_t pointer_block) const
+{
+    return (head.static_information.data_block_index + pointer_block - 1) * block_size;
+}
+
+uint64_t snapshot_volume::allocate_block(const bool zero)
+{
+    uint64_t block;
+    if (!allocator.allocate(block))
+    {
+        log(_log::LOG_ERROR, "No space left in the snapshot volume\n");
+        throw VolumeFull();
+    }
+
+    if (zero)
+    {
+        const std::vector < char > zeros(block_size);
+        io.write_range(device_offset(block + 1), block_size, zeros.data());
+    }
+    dirty.insert(block);
+    statistics.allocated_blocks++;
+    return block + 1;
+}
+
+bool snapshot_volume::make_writable(block_pointer_t & pointer, const bool map_block)
+{
+    if (pointer.block != 0 && pointer.birth_epoch == descriptor.current_epoch && dirty.contains(pointer.block - 1)) {
+        return false;
+    }
+
+    if (pointer.block == 0) {
+        pointer.block = allocate_block(map_block);
+    }
+    else
+    {
+        // a snapshot or the stored volume holds on to the old block, the live volume moves on to a new one
+        const uint64_t copy = allocate_block(false);
+        if (map_block)
+        {
+            std::vector < char > contents(block_size);
+            io.read_range(device_offset(pointer.block), block_size, contents.data());
+            io.write_range(device_offset(copy), block_size, contents.data());
+            statistics.copied_map_blocks++;
+        } else {
+            statistics.copied_blocks++;
+        }
+
+        // born in this epoch, so once sync() stores the volume nothing refers to it
+        if (pointer.birth_epoch == descriptor.current_epoch) {
+            superseded.push_back(pointer.block - 1);
+        }
+        pointer.block = copy;
+    }
+
+    pointer.birth_epoch = descriptor.current_epoch;
+    return true;
+}
+
+uint64_t snapshot_volume::map_index(const uint64_t block, const uint64_t level) const
+{
+    uint64_t index = block;
+    for (uint64_t i = 0; i < level; i++) {
+        index /= fanout;
+    }
+    return index % fanout;
+}
+
+block_pointer_t snapshot_volume::lookup(const block_pointer_t & root, const uint64_t block)
+{
+    if (block >= descriptor.logical_blocks)
+    {
+        log(_log::LOG_ERROR, "Block ", block, " is beyond the ", descriptor.logical_blocks, " blocks of the volume\n");
+        throw InvalidSnapshotVolume();
+    }
+
+    block_pointer_t pointer = root;
+    for (uint64_t level = descriptor.map_levels; level-- > 0 && pointer.block != 0;) {
+        io.read_range(device_offset(pointer.block) + map_index(block, level) * sizeof(block_pointer_t),
+            sizeof(pointer), reinterpret_cast<char *>(&pointer));
+    }
+    return pointer;
+}
+
+void snapshot_volume::read_block(const block_pointer_t & pointer, char * buffer)
+{
+    if (pointer.block == 0) {
+        std::memset(buffer, 0, block_size);
+    } else {
+        io.read_range(device_offset(pointer.block), block_size, buffer);
+    }
+}
+
+void snapshot_volume::read(const uint64_t block, char * buffer)
+{
+    std::lock_guard lock(mutex);
+    read_block(lookup(descriptor.live_root, block), buffer);
+}
+
+void snapshot_volume::read(const snapshot_t & snapshot, const uint64_t block, char * buffer)
+{
+    std::lock_guard lock(mutex);
+    read_block(lookup(snapshot.root, block), buffer);
+}
+
+block_pointer_t snapshot_volume::locate(const uint64_t block)
+{
+    std::lock_guard lock(mutex);
+    return lookup(descriptor.live_root, block);
+}
+
+block_pointer_t snapshot_volume::locate(const snapshot_t & snapshot, const uint64_t block)
+{
+    std::lock_guard lock(mutex);
+    return lookup(snapshot.root, block);
+}
+
+void snapshot_volume::read_located(const block_pointer_t & pointer, char * buffer)
+{
+    read_block(pointer, buffer);
+}
+
+void snapshot_volume::stored_checksum(const block_pointer_t & pointer, char * digest)
+{
+    if (pointer.block == 0) {
+        std::memcpy(digest, zero_block_checksum(algorithm, block_size), digest_length);
+    } else {
+        io.read_range(head.static_information.data_block_checksum_blk_index * block_size + (pointer.block - 1) * digest_length,
+            digest_length, digest);
+    }
+}
+
+void snapshot_volume::read_map(const block_pointer_t & pointer, std::vector < char > & buffer)
+{
+    buffer.resize(block_size);
+    read_block(pointer, buffer.data());
+}
+
+void snapshot_volume::diff_map(const block_pointer_t & from, const block_pointer_t & to, const uint64_t level, const uint64_t first_block,
+    const std::function < void (uint64_t, const block_pointer_t &, const block_pointer_t &) > & changed)
+{
+    std::vector < char > from_map, to_map;
+    read_map(from, from_map);
+    read_map(to, to_map);
+
+    uint64_t span = 1;
+    for (uint64_t i = 0; i < level; i++) {
+        span *= fanout;
+    }
+    for (uint64_t index = 0; index < fanout && first_block + index * span < descriptor.logical_blocks; index++)
+    {
+        block_pointer_t from_pointer { }, to_pointer { };
+        std::memcpy(&from_pointer, from_map.data() + index * sizeof(block_pointer_t), sizeof(block_pointer_t));
+        std::memcpy(&to_pointer, to_map.data() + index * sizeof(block_pointer_t), sizeof(block_pointer_t));
+        if (from_pointer == to_pointer) {
+            continue;
+        }
+
+        if (level == 0) {
+            changed(first_block + index, from_pointer, to_pointer);
+        } else {
+            diff_map(from_pointer, to_pointer, level - 1, first_block + index * span, changed);
+        }
+    }
+}
+
+void snapshot_volume::diff(const snapshot_t * from, const snapshot_t * to,
+    const std::function < void (uint64_t block, const block_pointer_t & from, const block_pointer_t & to) > & changed)
+{
+    block_pointer_t from_root { }, to_root { };
+    {
+        std::lock_guard lock(mutex);
+        from_root = from == nullptr ? block_pointer_t { } : from->root;
+        to_root = to == nullptr ? descriptor.live_root : to->root;
+    }
+
+    if (from_root != to_root) {
+        diff_map(from_root, to_root, descriptor.map_levels - 1, 0, changed);
+    }
+}
+
+bool snapshot_volume::is_unchanged_since(const snapshot_t * snapshot)
+{
+    std::lock_guard lock(mutex);
+    return descriptor.live_root == (snapshot == nullptr ? block_pointer_t { } : snapshot->root);
+}
+
+void snapshot_volume::write(const uint64_t block, const char * data)
+{
+    std::lock_guard lock(mutex);
+    if (block >= descriptor.logical_blocks)
+    {
+        log(_log::LOG_ERROR, "Block ", block, " is beyond the ", descriptor.logical_blocks, " blocks of the volume\n");
+        throw InvalidSnapshotVolume();
+    }
+
+    // down the map, each block on the way made writable and its pointer stored in its parent
+    block_pointer_t pointer = descriptor.live_root;
+    make_writable(pointer, true);
+    descriptor.live_root = pointer;
+    for (uint64_t level = descriptor.map_levels; level-- > 0;)
+    {
+        const uint64_t parent = pointer.block;
+        const uint64_t offset = device_offset(parent) + map_index(block, level) * sizeof(block_pointer_t);
+        io.read_range(offset, sizeof(pointer), reinterpret_cast<char *>(&pointer));
+        if (make_writable(pointer, level != 0)) {
+            io.write_range(offset, sizeof(pointer), reinterpret_cast<const char *>(&pointer));
+        } else if (level == 0) {
+            statistics.in_place_writes++;
+        }
+    }
+
+    io.write_range(device_offset(pointer.block), block_size, data);
+    statistics.writes++;
+}
+
+uint64_t snapshot_volume::create_snapshot(const uint64_t received_from)
+{
+    std::lock_guard lock(mutex);
+    const snapshot_t snapshot {
+        .epoch = descriptor.current_epoch,
+        .root = descriptor.live_root,
+        .creation_unix_timestamp = static_cast<uint64_t>(std::chrono::duration_cast < std::chrono::seconds > (
+            std::chrono::system_clock::now().time_since_epoch()).count()),
+        .received_from = received_from,
+    };
+
+    // appended to the last table block, or to a new one linking back to it. A
+    // block the stored descriptor refers to is copied first, like map blocks
+    const uint64_t per_table_block = (block_size - sizeof(snapshot_table_header_t)) / sizeof(snapshot_t);
+    std::vector < char > table(block_size);
+    snapshot_table_header_t table_header { };
+    if (descriptor.last_table_block != 0)
+    {
+        io.read_range(device_offset(descriptor.last_table_block), block_size, table.data());
+        std::memcpy(&table_header, table.data(), sizeof(table_header));
+    }
+    if (descriptor.last_table_block == 0 || table_header.entries == per_table_block)
+    {
+        std::ranges::fill(table, 0);
+        table_header = { .previous = descriptor.last_table_block, .entries = 0 };
+        descriptor.last_table_block = allocate_block(false);
+    }
+    else if (!dirty.contains(descriptor.last_table_block - 1))
+    {
+        superseded.push_back(descriptor.last_table_block - 1);
+        descriptor.last_table_block = allocate_block(false);
+    }
+
+    std::memcpy(table.data() + sizeof(table_header) + table_header.entries * sizeof(snapshot_t), &snapshot, sizeof(snapshot));
+    table_header.entries++;
+    std::memcpy(table.data(), &table_header, sizeof(table_header));
+    io.write_range(device_offset(descriptor.last_table_block), block_size, table.data());
+
+    // what is live now belongs to the snapshot too, and is copied before it changes
+    descriptor.snapshots++;
+    descriptor.current_epoch++;
+    snapshots.push_back(snapshot);
+    return snapshot.epoch;
+}
+
+snapshot_t snapshot_volume::find_snapshot(const uint64_t epoch)
+{
+    std::lock_guard lock(mutex);
+    const auto snapshot = std::ranges::find(snapshots, epoch, &snapshot_t::epoch);
+    if (snapshot == snapshots.end())
+    {
+        log(_log::LOG_ERROR, "No snapshot of epoch ", epoch, "\n");
+        throw NoSuchSnapshot();
+    }
+    return *snapshot;
+}
+
+std::vector < snapshot_t > snapshot_volume::get_snapshots()
+{
+    std::lock_guard lock(mutex);
+    return snapshots;
+}
+
+void snapshot_volume::store_checksums(const std::set < uint64_t > & blocks)
+{
+    const auto & info = head.static_information;
+    std::vector < char > contents(block_size);
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    for (const uint64_t block : blocks)
+    {
+        io.read_range(device_offset(block + 1), block_size, contents.data());
+        checksum(algorithm, contents.data(), block_size, digest);
+        io.write_range(info.data_block_checksum_blk_index * block_size + block * digest_length, digest_length, digest);
+        io.write_range(info.redundancy_data_block_checksum_blk_index * block_size + block * digest_length, digest_length, digest);
+    }
+
+    // the tree above them, run by run
+    for (auto block = blocks.begin(); block != blocks.end();)
+    {
+        const uint64_t first = *block;
+        uint64_t count = 0;
+        while (block != blocks.end() && *block == first + count)
+        {
+            ++block;
+            count++;
+        }
+        tree.update(first, count);
+    }
+}
+
+void snapshot_volume::sync()
+{
+    std::lock_guard lock(mutex);
+
+    // everything the new descriptor refers to is on the device and allocated before it is stored
+    store_checksums(dirty);
+    dirty.clear();
+    allocator.flush();
+    io.sync();
+
+    io.write_range(device_offset(descriptor_block + 1), sizeof(descriptor), reinterpret_cast<const char *>(&descriptor));
+    store_checksums({ descriptor_block });
+    store_dynamic_information(io, head);
+    io.sync();
+
+    // the stored volume has moved on, only the next flush makes these free on the device
+    for (const uint64_t block : superseded) {
+        allocator.release(block, 1);
+    }
+    superseded.clear();
+}
+
+uint64_t snapshot_volume::get_current_epoch()
+{
+    std::lock_guard lock(mutex);
+    return descriptor.current_epoch;
+}
+
+snapshot_volume_statistics_t snapshot_volume::get_statistics()
+{
+    std::lock_guard lock(mutex);
+    return statistics;
+}
@@ -0,0 +1,58 @@
+#include <thread_pool.h>
+#include <algorithm>
+
+thread_pool::thread_pool(unsigned int threads)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+
+    workers.reserve(threads);
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back([this] { worker_main(); });
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+void thread_pool::worker_main()
+{
+    while (true)
+    {
+        std::packaged_task < void () > task;
+        {
+            std::unique_lock lock(mutex);
+            task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+std::future < void > thread_pool::submit(std::function < void () > task)
+{
+    std::packaged_task < void () > packaged(std::move(task));
+    auto future = packaged.get_future();
+    {
+        std::lock_guard lock(mutex);
+        tasks.push_back(std::move(packaged));
+    }
+    task_available.notify_one();
+    return future;
+}
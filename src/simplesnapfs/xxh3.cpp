@@ -0,0 +1,233 @@
+#include <checksum.h>
+#include <cstdint>
+#include <cstring>
+
+// XXH3 64 bit, seed 0 and the default secret, compatible with XXH3_64bits()
+// from the reference xxHash library. Scalar; the long input loop is laid out
+// so compilers can vectorize it.
+
+constexpr uint32_t PRIME32_1 = 0x9E3779B1U;
+constexpr uint32_t PRIME32_2 = 0x85EBCA77U;
+constexpr uint32_t PRIME32_3 = 0xC2B2AE3DU;
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+constexpr uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+constexpr uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+constexpr uint64_t stripe_length = 64;
+constexpr uint64_t secret_consume_rate = 8;
+constexpr uint64_t midsize_max = 240;
+
+alignas(64) static constexpr uint8_t default_secret[192] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+static uint32_t read32(const uint8_t * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint64_t read64(const uint8_t * p)
+{
+    return read32(p) | static_cast<uint64_t>(read32(p + 4)) << 32;
+}
+
+static uint64_t rotl64(const uint64_t value, const int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t mul128_fold64(const uint64_t lhs, const uint64_t rhs)
+{
+    const auto product = static_cast<uint128_t>(lhs) * rhs;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+static uint64_t xxh64_avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static uint64_t avalanche(uint64_t hash)
+{
+    hash ^= hash >> 37;
+    hash *= PRIME_MX1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static uint64_t rrmxmx(uint64_t hash, const uint64_t length)
+{
+    hash ^= rotl64(hash, 49) ^ rotl64(hash, 24);
+    hash *= PRIME_MX2;
+    hash ^= (hash >> 35) + length;
+    hash *= PRIME_MX2;
+    hash ^= hash >> 28;
+    return hash;
+}
+
+static uint64_t mix16(const uint8_t * input, const uint8_t * secret)
+{
+    return mul128_fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+static uint64_t hash_0_to_16(const uint8_t * input, const uint64_t length)
+{
+    const uint8_t * secret = default_secret;
+    if (length > 8)
+    {
+        const uint64_t low = read64(input) ^ (read64(secret + 24) ^ read64(secret + 32));
+        const uint64_t high = read64(input + length - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+        return avalanche(length + __builtin_bswap64(low) + high + mul128_fold64(low, high));
+    }
+
+    if (length >= 4)
+    {
+        const uint64_t combined = read32(input + length - 4) + (static_cast<uint64_t>(read32(input)) << 32);
+        return rrmxmx(combined ^ (read64(secret + 8) ^ read64(secret + 16)), length);
+    }
+
+    if (length > 0)
+    {
+        const uint32_t combined = static_cast<uint32_t>(input[0]) << 16 | static_cast<uint32_t>(input[length >> 1]) << 24
+            | input[length - 1] | static_cast<uint32_t>(length) << 8;
+        return xxh64_avalanche(combined ^ static_cast<uint64_t>(read32(secret) ^ read32(secret + 4)));
+    }
+
+    return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+}
+
+static uint64_t hash_17_to_128(const uint8_t * input, const uint64_t length)
+{
+    const uint8_t * secret = default_secret;
+    uint64_t acc = length * PRIME64_1;
+    if (length > 32)
+    {
+        if (length > 64)
+        {
+            if (length > 96)
+            {
+                acc += mix16(input + 48, secret + 96);
+                acc += mix16(input + length - 64, secret + 112);
+            }
+            acc += mix16(input + 32, secret + 64);
+            acc += mix16(input + length - 48, secret + 80);
+        }
+        acc += mix16(input + 16, secret + 32);
+        acc += mix16(input + length - 32, secret + 48);
+    }
+    acc += mix16(input, secret);
+    acc += mix16(input + length - 16, secret + 16);
+    return avalanche(acc);
+}
+
+static uint64_t hash_129_to_240(const uint8_t * input, const uint64_t length)
+{
+    const uint8_t * secret = default_secret;
+    uint64_t acc = length * PRIME64_1;
+    for (uint64_t i = 0; i < 8; i++) {
+        acc += mix16(input + 16 * i, secret + 16 * i);
+    }
+
+    acc = avalanche(acc);
+    for (uint64_t i = 8; i < length / 16; i++) {
+        acc += mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+    }
+
+    acc += mix16(input + length - 16, secret + 136 - 17);
+    return avalanche(acc);
+}
+
+static void accumulate_stripe(uint64_t * acc, const uint8_t * input, const uint8_t * secret)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        const uint64_t value = read64(input + 8 * i);
+        const uint64_t key = value ^ read64(secret + 8 * i);
+        acc[i ^ 1] += value;
+        acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+}
+
+static void scramble(uint64_t * acc, const uint8_t * secret)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t value = acc[i];
+        value ^= value >> 47;
+        value ^= read64(secret + 8 * i);
+        acc[i] = value * PRIME32_1;
+    }
+}
+
+static uint64_t hash_long(const uint8_t * input, const uint64_t length)
+{
+    alignas(64) uint64_t acc[8] = { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+    constexpr uint64_t stripes_per_block = (sizeof(default_secret) - stripe_length) / secret_consume_rate;
+    constexpr uint64_t block_length = stripe_length * stripes_per_block;
+    const uint64_t blocks = (length - 1) / block_length;
+
+    for (uint64_t block = 0; block < blocks; block++)
+    {
+        for (uint64_t stripe = 0; stripe < stripes_per_block; stripe++) {
+            accumulate_stripe(acc, input + block * block_length + stripe * stripe_length,
+                default_secret + stripe * secret_consume_rate);
+        }
+        scramble(acc, default_secret + sizeof(default_secret) - stripe_length);
+    }
+
+    // last partial block, then the last stripe (which may overlap it)
+    const uint64_t stripes = ((length - 1) - block_length * blocks) / stripe_length;
+    for (uint64_t stripe = 0; stripe < stripes; stripe++) {
+        accumulate_stripe(acc, input + blocks * block_length + stripe * stripe_length,
+            default_secret + stripe * secret_consume_rate);
+    }
+    accumulate_stripe(acc, input + length - stripe_length, default_secret + sizeof(default_secret) - stripe_length - 7);
+
+    uint64_t result = length * PRIME64_1;
+    for (int i = 0; i < 4; i++) {
+        result += mul128_fold64(acc[2 * i] ^ read64(default_secret + 11 + 16 * i),
+            acc[2 * i + 1] ^ read64(default_secret + 11 + 16 * i + 8));
+    }
+
+    return avalanche(result);
+}
+
+uint64_t xxh3_64(const char* _data, const uint64_t _dt_len)
+{
+    const auto * input = reinterpret_cast<const uint8_t *>(_data);
+    if (_dt_len <= 16) {
+        return hash_0_to_16(input, _dt_len);
+    }
+
+    if (_dt_len <= 128) {
+        return hash_17_to_128(input, _dt_len);
+    }
+
+    if (_dt_len <= midsize_max) {
+        return hash_129_to_240(input, _dt_len);
+    }
+
+    return hash_long(input, _dt_len);
+}
@@ -0,0 +1,216 @@
+#include <block_allocator.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "test_check.h"
+
+constexpr uint32_t block_size = 512;
+constexpr uint64_t data_blocks = 4 * ALLOCATION_GROUP_MIN_BLOCKS + 1000;
+constexpr uint64_t bitmap_blocks = (data_blocks + block_size * 8 - 1) / (block_size * 8);
+
+simplesnapfs_filesystem_head_t make_layout()
+{
+    simplesnapfs_filesystem_head_t head { };
+    auto & info = head.static_information;
+    info.fs_block_size = block_size;
+    info.checksum_algorithm = CHECKSUM_XXH3;
+    info.data_blocks = data_blocks;
+    info.data_block_bitmap_blk_index = 1;
+    info.data_block_bitmap_blocks = bitmap_blocks;
+    info.redundancy_data_block_bitmap_blk_index = 1 + bitmap_blocks;
+    info.redundancy_data_block_bitmap_blocks = bitmap_blocks;
+    info.data_block_bitmap_checksum_blk_index = 1 + 2 * bitmap_blocks;
+    info.data_block_bitmap_checksum_blocks = 1;
+    info.redundancy_data_block_bitmap_checksum_blk_index = 2 + 2 * bitmap_blocks;
+    info.redundancy_data_block_bitmap_checksum_blocks = 1;
+    info.fs_total_blocks = 3 + 2 * bitmap_blocks;
+    return head;
+}
+
+// an empty bitmap with valid checksums, as mkfs leaves it
+std::string format(const simplesnapfs_filesystem_head_t & head)
+{
+    const std::string path = CMAKE_BINARY_DIR "/allocation_group_test.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, static_cast<off_t>(head.static_information.fs_total_blocks * block_size)) == -1) {
+        throw CannotOpenFile();
+    }
+    close(fd);
+
+    block_io io(path, block_size);
+    const std::vector < char > empty(block_size);
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    checksum(CHECKSUM_XXH3, empty.data(), block_size, digest);
+    for (const uint64_t region : { head.static_information.data_block_bitmap_checksum_blk_index,
+                                   head.static_information.redundancy_data_block_bitmap_checksum_blk_index })
+    {
+        for (uint64_t block = 0; block < bitmap_blocks; block++) {
+            io.write_range(region * block_size + block * 8, 8, digest);
+        }
+    }
+    return path;
+}
+
+int main()
+{
+    try {
+        auto head = make_layout();
+        const auto path = format(head);
+
+        // never more groups than ALLOCATION_GROUP_MIN_BLOCKS allow
+        {
+            block_io io(path, block_size);
+            CHECK(block_allocator(io, head, 1).get_group_count() == 1);
+            CHECK(block_allocator(io, head, 100).get_group_count() == 4);
+            CHECK(block_allocator(io, head).get_group_count() >= 1);
+        }
+
+        // four groups of 36864 blocks (whole bitmap blocks), the last one of 21480
+        {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head, 4);
+            CHECK(allocator.get_group_count() == 4);
+            CHECK(allocator.get_free_blocks() == data_blocks);
+
+            // the hint picks the group, then fill that group up
+            uint64_t block, first;
+            CHECK(allocator.allocate(block, 40000) && block == 40000);
+            CHECK(allocator.allocate_run(3136, first, 36864) && first == 36864);
+            CHECK(allocator.allocate_run(33727, first, 40001) && first == 40001);
+            CHECK(allocator.get_stolen_allocations() == 0);
+
+            // a full group sends the allocation to the next one
+            CHECK(allocator.allocate(block, 50000) && block == 73728);
+            CHECK(allocator.get_stolen_allocations() == 1);
+
+            // runs stay within a group
+            CHECK(!allocator.allocate_run(36865, first));
+            CHECK(allocator.get_largest_free_extent() == 36864);
+
+            // a release across a group boundary
+            allocator.release(73000, 1000);
+            CHECK(allocator.is_allocated(72999) && !allocator.is_allocated(73000) && !allocator.is_allocated(73728));
+            CHECK(allocator.get_free_blocks() == data_blocks - 36865 + 729);
+            allocator.flush();
+        }
+
+        // the same bitmap, whatever the grouping
+        for (const unsigned int groups : { 1, 3 })
+        {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head, groups);
+            CHECK(allocator.get_free_blocks() == data_blocks - 36865 + 729);
+            CHECK(allocator.is_allocated(36864) && allocator.is_allocated(72999));
+            CHECK(!allocator.is_allocated(36863) && !allocator.is_allocated(73000));
+        }
+
+        // concurrent allocations never hand out a block twice
+        {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head, 4);
+            const uint64_t free_blocks = allocator.get_free_blocks();
+            constexpr int threads = 8;
+            constexpr int per_thread = 2000;
+            std::vector < std::vector < uint64_t > > allocated(threads);
+            std::vector < std::thread > workers;
+            for (int thread = 0; thread < threads; thread++)
+            {
+                workers.emplace_back([&, thread] {
+                    for (int i = 0; i < per_thread; i++)
+                    {
+                        uint64_t block;
+                        if (allocator.allocate(block)) {
+                            allocated[thread].push_back(block);
+                        }
+                    }
+                });
+            }
+            for (auto & worker : workers) {
+                worker.join();
+            }
+
+            std::vector < uint64_t > all;
+            for (const auto & blocks : allocated) {
+                all.insert(all.end(), blocks.begin(), blocks.end());
+            }
+            CHECK(all.size() == threads * per_thread);
+            std::ranges::sort(all);
+            CHECK(std::ranges::adjacent_find(all) == all.end());
+            CHECK(allocator.get_free_blocks() == free_blocks - all.size());
+
+            for (const auto block : all) {
+                allocator.release(block);
+            }
+            CHECK(allocator.get_free_blocks() == free_blocks);
+        }
+
+        // only changed bitmap blocks are written, damaged copies are written again on the next flush
+        {
+            const auto & info = head.static_information;
+            const uint64_t bitmap_block_bits = block_size * 8;
+            {
+                block_io io(path, block_size);
+                block_allocator allocator(io, head, 4);
+                CHECK(allocator.get_dirty_bitmap_blocks() == 0);
+
+                uint64_t first;
+                CHECK(allocator.allocate_run(2, first, 3 * bitmap_block_bits - 1) && first == 3 * bitmap_block_bits - 1);
+                CHECK(allocator.get_dirty_bitmap_blocks() == 2);
+                allocator.release(3 * bitmap_block_bits);
+                CHECK(allocator.get_dirty_bitmap_blocks() == 2);
+
+                // a block nobody touched, rewritten it would be good again
+                io.get_block(info.data_block_bitmap_blk_index + 20).writable_view()[0] ^= 1;
+                allocator.flush();
+                CHECK(allocator.get_dirty_bitmap_blocks() == 0);
+                CHECK(io.get_block(info.data_block_bitmap_blk_index + 20).view()[0] == 1);
+            }
+
+            {
+                block_io io(path, block_size);
+                block_allocator allocator(io, head, 4);
+                CHECK(allocator.is_allocated(3 * bitmap_block_bits - 1) && !allocator.is_allocated(3 * bitmap_block_bits));
+                CHECK(!allocator.is_allocated(20 * bitmap_block_bits));
+                CHECK(allocator.get_dirty_bitmap_blocks() == 1);
+                allocator.flush();
+                CHECK(io.get_block(info.data_block_bitmap_blk_index + 20).view()[0] == 0);
+            }
+
+            block_io io(path, block_size);
+            CHECK(block_allocator(io, head, 4).get_dirty_bitmap_blocks() == 0);
+        }
+
+        // nothing beyond the data region is looked up or released
+        {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head, 4);
+            uint32_t rejected = 0;
+            for (const auto & attempt : std::vector < std::function < void () > > {
+                    [&] { (void)allocator.is_allocated(data_blocks); },
+                    [&] { allocator.release(data_blocks - 1, 2); },
+                    [&] { allocator.release(UINT64_MAX, 2); } })
+            {
+                try {
+                    attempt();
+                } catch (BlockOutOfRange &) {
+                    rejected++;
+                }
+            }
+            CHECK(rejected == 3);
+            CHECK(allocator.get_dirty_bitmap_blocks() == 0);
+        }
+
+        unlink(path.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+#include <bitmap.h>
+#include <block_allocator.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <bit>
+#include <random>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "test_check.h"
+
+// what find_free_run() has to return, by brute force
+static bool naive_find_run(const std::vector < bool > & model, const uint64_t count, uint64_t & first, const uint64_t hint)
+{
+    const auto search = [&](const uint64_t from, const uint64_t to)
+    {
+        for (uint64_t position = from; position < to; position++)
+        {
+            uint64_t length = 0;
+            while (position + length < model.size() && length < count && !model[position + length]) {
+                length++;
+            }
+            if (length == count)
+            {
+                first = position;
+                return true;
+            }
+            position += length;
+        }
+        return false;
+    };
+
+    return search(hint, model.size()) || search(0, hint);
+}
+
+constexpr uint32_t block_size = 512;
+constexpr uint64_t data_blocks = 6000; // two bitmap blocks of 4096 bits
+
+simplesnapfs_filesystem_head_t make_layout()
+{
+    simplesnapfs_filesystem_head_t head { };
+    auto & info = head.static_information;
+    info.fs_block_size = block_size;
+    info.checksum_algorithm = CHECKSUM_XXH3;
+    info.data_blocks = data_blocks;
+    info.data_block_bitmap_blk_index = 1;
+    info.data_block_bitmap_blocks = 2;
+    info.redundancy_data_block_bitmap_blk_index = 3;
+    info.redundancy_data_block_bitmap_blocks = 2;
+    info.data_block_bitmap_checksum_blk_index = 5;
+    info.data_block_bitmap_checksum_blocks = 1;
+    info.redundancy_data_block_bitmap_checksum_blk_index = 6;
+    info.redundancy_data_block_bitmap_checksum_blocks = 1;
+    info.fs_total_blocks = 7;
+    return head;
+}
+
+// an empty bitmap with valid checksums, as mkfs leaves it
+std::string format(const simplesnapfs_filesystem_head_t & head)
+{
+    const std::string path = CMAKE_BINARY_DIR "/bitmap_test.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, static_cast<off_t>(head.static_information.fs_total_blocks * block_size)) == -1) {
+        throw CannotOpenFile();
+    }
+    close(fd);
+
+    block_io io(path, block_size);
+    const std::vector < char > empty(block_size);
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    checksum(CHECKSUM_XXH3, empty.data(), block_size, digest);
+    for (const uint64_t region : { 5, 6 }) {
+        for (uint64_t block = 0; block < 2; block++) {
+            io.write_range(region * block_size + block * 8, 8, digest);
+        }
+    }
+    return path;
+}
+
+int main()
+{
+    log(_log::LOG_NORMAL, "Bitmap SIMD accelerated: ", (bitmap_is_simd_accelerated() ? "Yes" : "No"), "\n");
+
+    std::mt19937_64 random(42);
+
+    // fast counting against a plain popcount, odd lengths reach the scalar tail
+    for (const uint64_t words : { 0, 1, 3, 4, 5, 1021 })
+    {
+        std::vector < uint64_t > data(words);
+        uint64_t set_bits = 0;
+        for (auto & word : data)
+        {
+            word = random() & random();
+            set_bits += std::popcount(word);
+        }
+        CHECK(count_free_bits(data.data(), words) == words * 64 - set_bits);
+    }
+
+    // random set/clear against a model, sizes around word and summary boundaries
+    for (const uint64_t blocks : { 1, 63, 64, 65, 4099, 300000 })
+    {
+        bitmap map(blocks);
+        std::vector < bool > model(blocks);
+        CHECK(map.get_free_blocks() == blocks);
+
+        for (int round = 0; round < (blocks > 10000 ? 60 : 400); round++)
+        {
+            const uint64_t first = random() % blocks;
+            const uint64_t count = 1 + random() % std::min < uint64_t > (blocks - first, round % 4 == 0 ? 5000 : 70);
+            const bool allocate = random() % 3 != 0;
+            if (allocate) {
+                map.set(first, count);
+            } else {
+                map.clear(first, count);
+            }
+            for (uint64_t block = first; block < first + count; block++) {
+                model[block] = allocate;
+            }
+
+            CHECK(map.get_free_blocks() == static_cast<uint64_t>(std::ranges::count(model, false)));
+            const uint64_t probe = random() % blocks;
+            CHECK(map.is_allocated(probe) == model[probe]);
+
+            const uint64_t hint = random() % blocks;
+            uint64_t found = 0, expected = 0;
+            const bool has_free = naive_find_run(model, 1, expected, hint);
+            CHECK(map.find_free(found, hint) == has_free);
+            CHECK(!has_free || found == expected);
+
+            for (const uint64_t run : { 2, 7, 64, 65, 200 })
+            {
+                const bool has_run = naive_find_run(model, run, expected, hint);
+                CHECK(map.find_free_run(run, found, hint) == has_run);
+                CHECK(!has_run || found == expected);
+            }
+        }
+
+        // the on-disk form, padding bits stay clear
+        std::vector < char > bytes((blocks + 7) / 8);
+        map.store(bytes.data());
+        bitmap loaded(blocks);
+        loaded.load(bytes.data());
+        CHECK(loaded.get_free_blocks() == map.get_free_blocks());
+        for (uint64_t block = 0; block < blocks; block++) {
+            CHECK(loaded.is_allocated(block) == model[block]);
+        }
+        if (blocks % 8 != 0) {
+            CHECK((static_cast<uint8_t>(bytes.back()) >> (blocks % 8)) == 0);
+        }
+
+        // any part of it, zero filled past the end
+        for (const uint64_t offset : { uint64_t { 0 }, bytes.size() / 2, bytes.size() - 1 })
+        {
+            std::vector < char > part(bytes.size() - offset + 9, 1);
+            map.store(part.data(), offset, part.size());
+            CHECK(std::equal(bytes.begin() + static_cast<int64_t>(offset), bytes.end(), part.begin()));
+            CHECK(std::all_of(part.end() - 9, part.end(), [](const char byte) { return byte == 0; }));
+        }
+
+        // full, then nothing is found
+        map.set(0, blocks);
+        uint64_t block;
+        CHECK(map.get_free_blocks() == 0);
+        CHECK(!map.find_free(block));
+        CHECK(!map.find_free_run(2, block));
+    }
+
+    try {
+        auto head = make_layout();
+        const auto path = format(head);
+
+        {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head);
+            CHECK(allocator.get_free_blocks() == data_blocks);
+
+            uint64_t block, first;
+            CHECK(allocator.allocate(block) && block == 0);
+            CHECK(allocator.allocate(block, 100) && block == 100);
+            CHECK(allocator.allocate_run(5000, first) && first == 101);
+            CHECK(!allocator.allocate_run(1000, first));
+            CHECK(allocator.allocate_run(898, first) && first == 5101);
+            allocator.release(200, 10);
+            CHECK(allocator.get_free_blocks() == data_blocks - 1 - 1 - 5000 - 898 + 10);
+            allocator.flush();
+        }
+
+        // what was flushed is loaded again, from the redundancy copy if need be
+        for (const bool damage : { false, true })
+        {
+            if (damage)
+            {
+                block_io io(path, block_size);
+                io.get_block(head.static_information.data_block_bitmap_blk_index + 1).writable_view()[1] ^= 1;
+            }
+
+            block_io io(path, block_size);
+            block_allocator allocator(io, head);
+            CHECK(allocator.get_free_blocks() == data_blocks - 1 - 1 - 5000 - 898 + 10);
+            CHECK(allocator.is_allocated(5998) && !allocator.is_allocated(5999));
+            CHECK(!allocator.is_allocated(205) && allocator.is_allocated(210));
+        }
+
+        // free extents: 1 to 99, 200 to 209 and 5999
+        {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head);
+            uint64_t first;
+            CHECK(allocator.get_largest_free_extent() == 99);
+            CHECK(allocator.allocate_extent(10, first) && first == 200);
+            CHECK(allocator.allocate_extent(1, first) && first == 5999);
+            CHECK(allocator.allocate_extent(40, first, free_extent_tree::NEXT_FIT) && first == 1);
+            CHECK(allocator.allocate_extent(40, first, free_extent_tree::NEXT_FIT) && first == 41);
+            CHECK(!allocator.allocate_extent(20, first));
+            CHECK(allocator.get_free_blocks() == 19);
+        }
+
+        // no good copy left
+        {
+            block_io io(path, block_size);
+            io.get_block(head.static_information.redundancy_data_block_bitmap_blk_index + 1).writable_view()[1] ^= 1;
+        }
+
+        bool rejected = false;
+        try {
+            block_io io(path, block_size);
+            block_allocator allocator(io, head);
+        } catch (CorruptedBitmap &) {
+            rejected = true;
+        }
+        CHECK(rejected);
+        unlink(path.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
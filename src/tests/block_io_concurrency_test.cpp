@@ -0,0 +1,261 @@
+#include <block_io.h>
+#include <buffer_cache.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "test_check.h"
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t block_count = 512;
+constexpr uint32_t thread_count = 8;
+constexpr uint64_t blocks_per_thread = block_count / thread_count;
+constexpr uint32_t rounds = 16;
+
+std::string make_image()
+{
+    const std::string path = CMAKE_BINARY_DIR "/block_io_concurrency_test.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, block_size * block_count) == -1) {
+        throw CannotOpenFile();
+    }
+    close(fd);
+    return path;
+}
+
+// every block carries the thread owning it and the round it was last written in
+uint64_t stamp(const uint64_t block, const uint32_t round)
+{
+    return (block << 32) | round;
+}
+
+int main()
+{
+    try {
+        const auto path = make_image();
+
+        {
+            // a quarter of the image fits, so threads keep evicting each other's blocks
+            block_io io(path, block_size, { .cache_size = block_count / 4 * block_size, .cache_shards = 8 });
+            std::atomic < uint64_t > mismatches = 0;
+            std::atomic < bool > writers_done = false;
+
+            std::vector < std::thread > writers;
+            for (uint32_t thread = 0; thread < thread_count; thread++)
+            {
+                writers.emplace_back([&, thread]
+                {
+                    std::vector < char > pattern(block_size), readback(block_size);
+                    const uint64_t first = thread * blocks_per_thread;
+                    for (uint32_t round = 0; round < rounds; round++)
+                    {
+                        for (uint64_t block = first; block < first + blocks_per_thread; block++)
+                        {
+                            const uint64_t value = stamp(block, round);
+                            for (uint64_t i = 0; i < block_size; i += sizeof(value)) {
+                                std::memcpy(pattern.data() + i, &value, sizeof(value));
+                            }
+                            io.get_block(block).write(pattern.data(), block_size, 0);
+                        }
+
+                        for (uint64_t block = first; block < first + blocks_per_thread; block++)
+                        {
+                            io.get_block(block).read(readback.data(), block_size, 0);
+                            uint64_t value;
+                            std::memcpy(&value, readback.data() + block_size - sizeof(value), sizeof(value));
+                            if (value != stamp(block, round)) {
+                                mismatches++;
+                            }
+                        }
+                    }
+                });
+            }
+
+            // writeback racing the writers
+            std::thread syncer([&]
+            {
+                while (!writers_done) {
+                    io.sync();
+                    std::this_thread::yield();
+                }
+            });
+
+            for (auto & writer : writers) {
+                writer.join();
+            }
+            writers_done = true;
+            syncer.join();
+
+            CHECK(mismatches == 0);
+            CHECK(io.get_cache_statistics().evictions != 0);
+            CHECK(io.get_cache_statistics().dirty_evictions != 0);
+        }
+
+        // a miss reads the device without the shard lock: a hit on the same shard is served
+        // meanwhile, and a lookup of the loading block waits for it rather than loading it twice
+        {
+            buffer_cache cache(block_size, 64 * block_size, 1, 64, [](const buffer_cache::buffer_t &) { });
+            auto & cached = cache.get_pinned(1, [](buffer_cache::buffer_t & fresh) { std::memset(fresh.data, 1, block_size); });
+            buffer_cache::unpin(cached);
+
+            std::promise < void > release;
+            auto released = release.get_future().share();
+            std::atomic < uint32_t > loads = 0;
+            const auto slow_loader = [&](buffer_cache::buffer_t & fresh)
+            {
+                loads++;
+                released.wait();
+                std::memset(fresh.data, 2, block_size);
+            };
+
+            auto miss = std::async(std::launch::async, [&] { return &cache.get_pinned(2, slow_loader); });
+            while (loads == 0) {
+                std::this_thread::yield();
+            }
+            auto same_block = std::async(std::launch::async, [&] { return &cache.get_pinned(2, slow_loader); });
+            auto hit = std::async(std::launch::async, [&] { return &cache.get_pinned(1, nullptr); });
+            const bool hit_served = hit.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+            const bool same_block_waited = same_block.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout;
+
+            // released before checking, a failed check would otherwise leave the loaders blocked
+            release.set_value();
+            CHECK(hit_served && hit.get()->data[0] == 1);
+            CHECK(same_block_waited);
+            CHECK(miss.get()->data[0] == 2 && same_block.get()->data[0] == 2);
+            CHECK(loads == 1);
+        }
+
+        // a dirty victim is written back without the shard lock: a hit on the shard is served
+        // meanwhile, and a lookup of the victim waits for it to reach the device, then reads it back
+        {
+            std::promise < void > release;
+            auto released = release.get_future().share();
+            std::atomic < uint32_t > writebacks = 0;
+            std::vector < char > device(block_size);
+            buffer_cache cache(block_size, 8 * block_size, 1, 64, [&](const buffer_cache::buffer_t & victim)
+            {
+                writebacks++;
+                released.wait();
+                std::memcpy(device.data(), victim.data, block_size);
+            });
+            const auto loader = [](buffer_cache::buffer_t & fresh) { std::memset(fresh.data, 1, block_size); };
+
+            auto & dirty = cache.get_pinned(0, loader);
+            std::memset(dirty.data, 2, block_size);
+            cache.mark_dirty(dirty);
+            buffer_cache::unpin(dirty);
+            for (uint64_t block = 1; block < 8; block++) {
+                buffer_cache::unpin(cache.get_pinned(block, loader));
+            }
+
+            auto evicting = std::async(std::launch::async, [&] { return &cache.get_pinned(8, loader); });
+            while (writebacks == 0) {
+                std::this_thread::yield();
+            }
+            auto hit = std::async(std::launch::async, [&] { return &cache.get_pinned(1, nullptr); });
+            auto victim = std::async(std::launch::async, [&]
+            {
+                return &cache.get_pinned(0, [&](buffer_cache::buffer_t & fresh) { std::memcpy(fresh.data, device.data(), block_size); });
+            });
+            const bool hit_served = hit.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+            const bool victim_waited = victim.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout;
+
+            // released before checking, a failed check would otherwise leave the writeback blocked
+            release.set_value();
+            auto * served = hit.get();
+            auto * reloaded = victim.get();
+            CHECK(hit_served && served->data[0] == 1);
+            CHECK(victim_waited);
+            CHECK(reloaded->data[0] == 2 && writebacks == 1);
+            buffer_cache::unpin(*served);
+            buffer_cache::unpin(*evicting.get());
+            buffer_cache::unpin(*reloaded);
+            CHECK(cache.get_dirty_buffers() == 0 && cache.get_statistics().dirty_evictions == 1);
+        }
+
+        // invalidation leaves pinned buffers to their holders as they are, and discards
+        // what loads in flight bring in: the next lookup reads the device again
+        {
+            buffer_cache cache(block_size, 64 * block_size, 1, 64, [](const buffer_cache::buffer_t &) { });
+            std::atomic < char > device_contents = 1;
+            std::promise < void > release;
+            auto released = release.get_future().share();
+            std::atomic < uint32_t > loads = 0;
+            const auto slow_loader = [&](buffer_cache::buffer_t & fresh)
+            {
+                const char contents = device_contents;
+                loads++;
+                released.wait();
+                std::memset(fresh.data, contents, block_size);
+            };
+
+            release.set_value();
+            auto & held = cache.get_pinned(1, slow_loader);
+            auto * reserved = cache.reserve(3);
+            CHECK(reserved != nullptr);
+
+            std::promise < void > release_miss;
+            auto miss_released = release_miss.get_future().share();
+            auto miss = std::async(std::launch::async, [&]
+            {
+                return &cache.get_pinned(2, [&](buffer_cache::buffer_t & fresh)
+                {
+                    const char contents = device_contents;
+                    loads++;
+                    miss_released.wait();
+                    std::memset(fresh.data, contents, block_size);
+                });
+            });
+            while (loads != 2) {
+                std::this_thread::yield();
+            }
+
+            device_contents = 2;
+            cache.invalidate(0, 4);
+            release_miss.set_value();
+            std::memset(reserved->data, 1, block_size);
+            cache.complete_reservation(*reserved, true);
+
+            auto * reloaded = miss.get();
+            CHECK(held.data[0] == 1 && held.data[block_size - 1] == 1);
+            CHECK(reloaded->data[0] == 2 && loads == 3);
+            auto & prefetched = cache.get_pinned(3, slow_loader);
+            CHECK(prefetched.data[0] == 2 && loads == 4);
+            buffer_cache::unpin(held);
+            buffer_cache::unpin(*reloaded);
+            buffer_cache::unpin(prefetched);
+
+            auto & fresh = cache.get_pinned(1, slow_loader);
+            CHECK(fresh.data[0] == 2 && loads == 5);
+            buffer_cache::unpin(fresh);
+            CHECK(cache.size() == 3);
+        }
+
+        // the final state of every block made it to the image
+        {
+            block_io io(path, block_size);
+            std::vector < char > readback(block_size);
+            for (uint64_t block = 0; block < block_count; block++)
+            {
+                io.get_block(block).read(readback.data(), block_size, 0);
+                for (uint64_t i = 0; i < block_size; i += sizeof(uint64_t))
+                {
+                    uint64_t value;
+                    std::memcpy(&value, readback.data() + i, sizeof(value));
+                    CHECK(value == stamp(block, rounds - 1));
+                }
+            }
+        }
+
+        unlink(path.c_str());
+        return EXIT_SUCCESS;
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, "Unexpected error: ", e.what(), "\n");
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,248 @@
+#include <block_io.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "test_check.h"
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t block_count = 64;
+
+std::string make_image()
+{
+    const std::string path = CMAKE_BINARY_DIR "/block_io_test.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, block_size * block_count) == -1) {
+        throw CannotOpenFile();
+    }
+    close(fd);
+    return path;
+}
+
+int main()
+{
+    try {
+        const auto path = make_image();
+        std::vector < char > pattern(block_size), readback(block_size);
+
+        {
+            // 8 blocks worth of cache, way below the image size. No flusher, so
+            // only eviction and sync() write anything
+            block_io io(path, block_size, { .cache_size = 8 * block_size, .background_writeback = false });
+            CHECK(io.get_total_blocks() == block_count);
+
+            for (uint64_t i = 0; i < block_count; i++)
+            {
+                std::memset(pattern.data(), static_cast<int>(i), block_size);
+                io.get_block(i).write(pattern.data(), block_size, 0);
+            }
+
+            // memory stays bounded, overflowing dirty blocks were written back on eviction
+            auto statistics = io.get_cache_statistics();
+            CHECK(statistics.evictions >= block_count - 8);
+            CHECK(statistics.dirty_evictions >= block_count - 8);
+
+            // most recent block is still resident
+            io.get_block(block_count - 1).read(readback.data(), block_size, 0);
+            CHECK(io.get_cache_statistics().hits == statistics.hits + 1);
+
+            // the 8 resident dirty blocks are consecutive and go out as a single write
+            io.sync();
+            CHECK(io.get_io_statistics().writeback_blocks == 8);
+            CHECK(io.get_io_statistics().writeback_syscalls == 1);
+            CHECK(io.get_io_statistics().syscalls_saved == 7);
+
+            // read-only pass leaves nothing dirty
+            const auto before_read_pass = io.get_cache_statistics();
+            for (uint64_t i = 0; i < block_count; i++)
+            {
+                io.get_block(i).read(readback.data(), block_size, 0);
+                CHECK(readback[0] == static_cast<char>(i));
+            }
+            CHECK(io.get_cache_statistics().dirty_evictions == before_read_pass.dirty_evictions);
+
+            // a pinned handle survives a full sweep of the cache and keeps its address
+            auto pinned = io.get_block(0);
+            const auto pinned_view = pinned.view();
+            for (uint64_t i = 1; i < block_count; i++) {
+                io.get_block(i).read(readback.data(), block_size, 0);
+            }
+            auto copy = pinned;
+            CHECK(copy.view().data() == pinned_view.data());
+            copy.writable_view()[0] = 'P';
+            CHECK(pinned_view[0] == 'P');
+        }
+
+        block_io io(path, block_size);
+        for (uint64_t i = 0; i < block_count; i++)
+        {
+            io.get_block(i).read(readback.data(), block_size, 0);
+            std::memset(pattern.data(), static_cast<int>(i), block_size);
+            if (i == 0) {
+                pattern[0] = 'P';
+            }
+            CHECK(std::memcmp(pattern.data(), readback.data(), block_size) == 0);
+        }
+
+        // memory mapped, 16 blocks per chunk and two chunks mapped at once
+        {
+            block_io mapped(path, block_size, {
+                .memory_mapped = true,
+                .mmap_chunk_size = 16 * block_size,
+                .mmap_window_size = 32 * block_size,
+                .access_pattern = ACCESS_SEQUENTIAL });
+            CHECK(mapped.is_memory_mapped());
+
+            auto pinned = mapped.get_block(5);
+            const auto pinned_view = pinned.view();
+            for (uint64_t i = 0; i < block_count; i++)
+            {
+                auto block = mapped.get_block(i);
+                CHECK(block.view()[0] == (i == 0 ? 'P' : static_cast<char>(i)));
+                block.writable_view()[2] = 'M';
+            }
+
+            // the pinned chunk was never remapped, everything else was
+            CHECK(pinned.view().data() == pinned_view.data());
+            CHECK(mapped.get_mapping_statistics().maps >= block_count / 16);
+            CHECK(mapped.get_mapping_statistics().unmaps >= block_count / 16 - 2);
+            mapped.advise(0, block_count, ACCESS_WILLNEED);
+            mapped.sync();
+            CHECK(mapped.get_mapping_statistics().msyncs >= 1);
+        }
+
+        {
+            block_io reopened(path, block_size);
+            for (uint64_t i = 0; i < block_count; i++)
+            {
+                reopened.get_block(i).read(readback.data(), block_size, 0);
+                CHECK(readback[2] == 'M');
+            }
+        }
+
+        // background writeback: expired blocks leave memory without sync()
+        {
+            block_io io(path, block_size, { .cache_size = 64 * block_size,
+                .dirty_expire_ms = 10, .writeback_interval_ms = 5 });
+            io.get_block(5).writable_view()[3] = 'E';
+            CHECK(io.get_dirty_blocks() == 1);
+
+            for (int i = 0; i < 200 && io.get_dirty_blocks() != 0; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            CHECK(io.get_dirty_blocks() == 0);
+            CHECK(io.get_io_statistics().background_blocks == 1);
+
+            // the data made it to the device, not just out of the dirty set
+            const int raw = open(path.c_str(), O_RDONLY);
+            CHECK(raw != -1);
+            CHECK(pread(raw, readback.data(), block_size, 5 * block_size) == block_size);
+            close(raw);
+            CHECK(readback[3] == 'E');
+        }
+
+        // writers running into the dirty limit are throttled, the dirty set stays bounded
+        {
+            block_io io(path, block_size, { .cache_size = 64 * block_size,
+                .dirty_background_bytes = 2 * block_size, .dirty_bytes = 4 * block_size });
+            uint64_t most_dirty = 0;
+            for (uint64_t i = 0; i < block_count; i++)
+            {
+                io.get_block(i).writable_view()[4] = 'T';
+                most_dirty = std::max(most_dirty, io.get_dirty_blocks());
+            }
+            CHECK(io.get_io_statistics().throttled_writes != 0);
+            CHECK(io.get_io_statistics().background_blocks != 0);
+            CHECK(most_dirty < block_count / 2);
+        }
+
+        // byte ranges across block boundaries, uncached runs are read with one request
+        {
+            std::vector < char > range(10 * block_size + 100), range_readback(range.size());
+            for (size_t i = 0; i < range.size(); i++) {
+                range[i] = static_cast<char>(i % 251);
+            }
+
+            const uint64_t offset = 20 * block_size + 50;
+            {
+                block_io io(path, block_size, { .cache_size = 64 * block_size });
+                CHECK(io.write_range(offset, range.size(), range.data()) == range.size());
+            }
+
+            block_io io(path, block_size, { .cache_size = 64 * block_size, .readahead_size = 0 });
+            CHECK(io.read_range(offset, range.size(), range_readback.data()) == range.size());
+            CHECK(range == range_readback);
+            CHECK(io.get_io_statistics().range_read_blocks == 11);
+            CHECK(io.get_io_statistics().range_read_syscalls == 1);
+
+            // cached now, nothing goes to the device again
+            CHECK(io.read_range(offset, range.size(), range_readback.data()) == range.size());
+            CHECK(io.get_io_statistics().range_read_syscalls == 1);
+
+            // sub-block addressing of single blocks
+            CHECK(io.get_block(20).read(readback.data(), 10, 50) == 10);
+            CHECK(std::memcmp(readback.data(), range.data(), 10) == 0);
+            CHECK(io.get_block(20).read(readback.data(), block_size, block_size - 4) == 4);
+
+            // clipped at the end of the device
+            CHECK(io.read_range(block_count * block_size - 8, 64, readback.data()) == 8);
+            CHECK(io.write_range(block_count * block_size, 64, readback.data()) == 0);
+
+            // staged range, changes are stored back on destruction
+            {
+                auto blocks = io.get_blocks(21, 4);
+                CHECK(!blocks.is_zero_copy());
+                CHECK(std::memcmp(blocks.view().data(), range.data() + block_size - 50, 4 * block_size) == 0);
+                blocks.writable_view()[block_size] = 'R';
+            }
+            io.get_block(22).read(readback.data(), 1, 0);
+            CHECK(readback[0] == 'R');
+        }
+
+        // mapped ranges inside one chunk point straight into the mapping
+        {
+            block_io mapped(path, block_size, { .memory_mapped = true, .mmap_chunk_size = 16 * block_size });
+            auto blocks = mapped.get_blocks(16, 16);
+            CHECK(blocks.is_zero_copy());
+            CHECK(blocks.view()[6 * block_size] == 'R');
+            CHECK(!mapped.get_blocks(15, 2).is_zero_copy());
+            CHECK(mapped.read_range(22 * block_size, 1, readback.data()) == 1 && readback[0] == 'R');
+        }
+
+        // same data through O_DIRECT, buffers come out of the aligned pool
+        const int probe = open(path.c_str(), O_RDWR | O_DIRECT);
+        if (probe != -1)
+        {
+            close(probe);
+            {
+                block_io direct(path, block_size, { .cache_size = 8 * block_size, .direct_io = true });
+                CHECK(direct.is_direct_io());
+                CHECK(block_size % direct.get_logical_sector_size() == 0);
+
+                auto block = direct.get_block(3);
+                CHECK(reinterpret_cast<uintptr_t>(block.view().data()) % direct.get_logical_sector_size() == 0);
+                CHECK(block.view()[0] == 3);
+                block.writable_view()[1] = 'D';
+            }
+
+            block_io reopened(path, block_size);
+            reopened.get_block(3).read(readback.data(), block_size, 0);
+            CHECK(readback[0] == 3 && readback[1] == 'D');
+        }
+        else
+        {
+            log(_log::LOG_NORMAL, "O_DIRECT is not supported on ", path, ", skipping\n");
+        }
+
+        unlink(path.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include <checksum.h>
+#include <debug.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <span>
+#include <algorithm>
+#include "test_check.h"
+
+static std::string to_hex(const char * data, const uint64_t length)
+{
+    constexpr char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (uint64_t i = 0; i < length; i++)
+    {
+        hex += digits[static_cast<uint8_t>(data[i]) >> 4];
+        hex += digits[static_cast<uint8_t>(data[i]) & 0xF];
+    }
+    return hex;
+}
+
+// input pattern of the official BLAKE3 test vectors
+static std::vector < char > test_input(const uint64_t length)
+{
+    std::vector < char > input(length);
+    for (uint64_t i = 0; i < length; i++) {
+        input[i] = static_cast<char>(i % 251);
+    }
+    return input;
+}
+
+int main()
+{
+    log(_log::LOG_NORMAL, "CRC32C hardware accelerated: ", (crc32c_is_hardware_accelerated() ? "Yes" : "No"), "\n");
+
+    // reference values, lengths chosen to cover every code path of each algorithm
+    CHECK(crc32c("123456789", 9) == 0xE3069283);
+    CHECK(crc32c("", 0) == 0);
+    CHECK(xxh3_64("", 0) == 0x2D06800538D394C2ULL);
+
+    const struct {
+        uint64_t length;
+        uint64_t xxh3;
+        uint32_t crc32c;
+        const char * blake3;
+    } vectors[] = {
+        { 0, 0x2d06800538d394c2ULL, 0x00000000, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+        { 1, 0xc44bdff4074eecdbULL, 0x527d5351, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+        { 241, 0x02e8cd95421c6d02ULL, 0x54fe7516, "749b36ae651c22e8567db692a6876e0ca4fd3daeb7aa8fa3ab2f642ccc69a8f6" },
+        { 1025, 0xe95c42288f28186eULL, 0xc8d03add, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+        { 102400, 0x1428e17f1cac2837ULL, 0x7957da17, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+    };
+
+    for (const auto & vector : vectors)
+    {
+        const auto input = test_input(vector.length);
+        CHECK(xxh3_64(input.data(), input.size()) == vector.xxh3);
+        CHECK(crc32c(input.data(), input.size()) == vector.crc32c);
+        const auto blake3 = blake3sum(input.data(), input.size());
+        CHECK(to_hex(blake3.data(), blake3.size()) == vector.blake3);
+
+        // a running CRC gives the same result as one pass
+        const uint64_t half = vector.length / 2;
+        CHECK(crc32c(input.data() + half, input.size() - half, crc32c(input.data(), half)) == vector.crc32c);
+    }
+
+    // on-disk form through the dispatcher
+    const auto input = test_input(4096);
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    for (const auto algorithm : { CHECKSUM_SHA512, CHECKSUM_CRC32C, CHECKSUM_XXH3, CHECKSUM_BLAKE3 })
+    {
+        checksum_algorithm_t parsed;
+        CHECK(checksum_algorithm_from_name(checksum_algorithm_name(algorithm), parsed) && parsed == algorithm);
+        CHECK(checksum_digest_length(algorithm) != 0 && checksum_digest_length(algorithm) <= CHECKSUM_MAX_DIGEST_LENGTH);
+        checksum(algorithm, input.data(), input.size(), digest);
+    }
+
+    checksum(CHECKSUM_CRC32C, "123456789", 9, digest);
+    CHECK(to_hex(digest, 4) == "839206e3");
+    checksum(CHECKSUM_SHA512, input.data(), input.size(), digest);
+    CHECK(std::memcmp(digest, sha512sum(input.data(), input.size()).data(), 64) == 0);
+    CHECK(checksum_digest_length(static_cast<checksum_algorithm_t>(42)) == 0);
+
+    // incremental hashing, the hasher starts over after final()
+    {
+        const auto expected = sha512sum(input.data(), input.size());
+        sha512_hasher hasher;
+        for (uint64_t offset = 0; offset < input.size(); offset += 1000) {
+            hasher.update(input.data() + offset, std::min < uint64_t > (1000, input.size() - offset));
+        }
+        CHECK(hasher.final() == expected);
+        CHECK(hasher.update(input.data(), input.size()).final() == expected);
+
+        // several hashers alive at once on one thread do not share state
+        sha512_hasher other;
+        other.update(input.data(), 10);
+        CHECK(hasher.update(input.data(), input.size()).final() == expected);
+        CHECK(other.final() == sha512sum(input.data(), 10));
+    }
+
+    // batches, small ones on the calling thread and large ones spread over threads
+    for (const uint64_t blocks : { 3, 4096 })
+    {
+        const auto data = test_input(blocks * 4096);
+        std::vector < std::span < const char > > buffers;
+        for (uint64_t block = 0; block < blocks; block++) {
+            buffers.emplace_back(data.data() + block * 4096, 4096 - block % 64);
+        }
+
+        const auto digests = sha512sum_batch(buffers);
+        CHECK(digests.size() == blocks);
+        for (uint64_t block = 0; block < blocks; block++) {
+            CHECK(digests[block] == sha512sum(buffers[block].data(), buffers[block].size()));
+        }
+    }
+    CHECK(sha512sum_batch({ }).empty());
+
+    return EXIT_SUCCESS;
+}
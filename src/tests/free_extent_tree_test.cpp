@@ -0,0 +1,104 @@
+#include <free_extent_tree.h>
+#include <bitmap.h>
+#include <debug.h>
+#include <random>
+#include <vector>
+#include "test_check.h"
+
+// the maximal free runs, straight from the bitmap
+static std::vector < std::pair < uint64_t, uint64_t > > free_runs(const bitmap & map)
+{
+    std::vector < std::pair < uint64_t, uint64_t > > runs;
+    map.for_each_free_run(0, map.size(), [&](const uint64_t first, const uint64_t length) { runs.emplace_back(first, length); });
+    return runs;
+}
+
+int main()
+{
+    std::mt19937_64 random(7);
+
+    // kept in sync by reporting every change, or by invalidating what changed behind its back
+    {
+        constexpr uint64_t blocks = 100000;
+        bitmap map(blocks);
+        free_extent_tree extents(map, 4096);
+        CHECK(extents.get_extents() == 1 && extents.get_largest_extent() == blocks);
+
+        for (int round = 0; round < 500; round++)
+        {
+            const uint64_t first = random() % blocks;
+            const uint64_t count = 1 + random() % std::min < uint64_t > (blocks - first, round % 5 == 0 ? 20000 : 300);
+            const bool allocate = random() % 3 != 0;
+            if (allocate) {
+                map.set(first, count);
+            } else {
+                map.clear(first, count);
+            }
+
+            if (round % 7 == 0) {
+                extents.invalidate(first, count);
+            } else if (allocate) {
+                extents.allocated(first, count);
+            } else {
+                extents.released(first, count);
+            }
+
+            if (round % 10 == 0) {
+                CHECK(extents.get_all_extents() == free_runs(map));
+            }
+        }
+        CHECK(extents.get_all_extents() == free_runs(map));
+
+        // whatever is found is free, and is then taken out
+        for (const auto fit : { free_extent_tree::BEST_FIT, free_extent_tree::NEXT_FIT })
+        {
+            for (const uint64_t count : { 1, 17, 300 })
+            {
+                uint64_t first;
+                if (!extents.find(count, first, fit)) {
+                    continue;
+                }
+                for (uint64_t block = first; block < first + count; block++) {
+                    CHECK(!map.is_allocated(block));
+                }
+                map.set(first, count);
+                extents.allocated(first, count);
+            }
+        }
+        CHECK(extents.get_all_extents() == free_runs(map));
+    }
+
+    // best fit takes the smallest hole large enough, next fit goes on where it stopped
+    {
+        bitmap map(1000);
+        map.set(0, 1000);
+        map.clear(100, 10);
+        map.clear(300, 5);
+        map.clear(500, 7);
+        map.clear(800, 200);
+        free_extent_tree extents(map, 128);
+
+        uint64_t first;
+        CHECK(extents.find(6, first) && first == 500);
+        CHECK(extents.find(5, first) && first == 300);
+        CHECK(extents.find(8, first) && first == 100);
+        CHECK(extents.find(11, first) && first == 800);
+        CHECK(!extents.find(201, first));
+        CHECK(extents.get_largest_extent() == 200);
+
+        // next fit goes on after the previous find, wrapping around at the end
+        for (const uint64_t expected : { 100, 500, 800, 100 }) {
+            CHECK(extents.find(7, first, free_extent_tree::NEXT_FIT) && first == expected);
+        }
+
+        // and picks up right behind an allocation, keeping sequential ones contiguous
+        map.set(800, 50);
+        extents.allocated(800, 50);
+        CHECK(extents.find(50, first, free_extent_tree::NEXT_FIT) && first == 850);
+        map.set(850, 50);
+        extents.allocated(850, 50);
+        CHECK(extents.find(50, first, free_extent_tree::NEXT_FIT) && first == 900);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+#include <io_engine.h>
+#include <io_uring_engine.h>
+#include <block_io.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+#include "test_check.h"
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t block_count = 256;
+
+int exercise_engine(io_engine & engine)
+{
+    std::vector < std::vector < char > > blocks(block_count, std::vector < char > (block_size));
+    uint64_t completed = 0;
+
+    // queue everything first, much deeper than the ring
+    for (uint64_t i = 0; i < block_count; i++)
+    {
+        std::memset(blocks[i].data(), static_cast<int>(i), block_size);
+        engine.submit_writev(i * block_size, { { .iov_base = blocks[i].data(), .iov_len = block_size } },
+            [&completed](const int64_t result) { if (result == block_size) completed++; });
+    }
+    engine.wait_all();
+    CHECK(completed == block_count);
+    CHECK(engine.fsync() == 0);
+
+    // read back through futures, two blocks per request
+    std::vector < char > readback(block_size * block_count);
+    std::vector < std::future < int64_t > > futures;
+    for (uint64_t i = 0; i < block_count; i += 2)
+    {
+        futures.push_back(engine.readv_async(i * block_size, {
+            { .iov_base = readback.data() + i * block_size, .iov_len = block_size },
+            { .iov_base = readback.data() + (i + 1) * block_size, .iov_len = block_size } }));
+    }
+    engine.wait_all();
+    for (auto & future : futures) {
+        CHECK(future.get() == 2 * block_size);
+    }
+
+    for (uint64_t i = 0; i < block_count; i++) {
+        CHECK(std::memcmp(readback.data() + i * block_size, blocks[i].data(), block_size) == 0);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// while set, io_uring_enter() calls submitting entries fail with this errno
+static std::atomic < int > refused_submissions = 0;
+
+// takes the place of the C library's syscall(), which the engine reaches io_uring
+// through. Waiting for completions is left alone, so only submissions fail
+extern "C" long syscall(const long number, ...) noexcept
+{
+    va_list arguments;
+    va_start(arguments, number);
+    long argument[6];
+    for (auto & value : argument) {
+        value = va_arg(arguments, long);
+    }
+    va_end(arguments);
+
+    if (number == __NR_io_uring_enter && argument[1] != 0 && refused_submissions != 0)
+    {
+        errno = refused_submissions;
+        return -1;
+    }
+    static const auto next = reinterpret_cast<long (*)(long, ...)>(dlsym(RTLD_NEXT, "syscall"));
+    return next(number, argument[0], argument[1], argument[2], argument[3], argument[4], argument[5]);
+}
+
+int main()
+{
+    try {
+        const std::string path = CMAKE_BINARY_DIR "/io_engine_test.img";
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        CHECK(fd != -1 && ftruncate(fd, block_size * block_count) == 0);
+
+        sync_io_engine sync_engine(fd);
+        CHECK(exercise_engine(sync_engine) == EXIT_SUCCESS);
+
+        if (io_uring_engine::is_supported())
+        {
+            io_uring_engine uring_engine(fd, 16);
+            CHECK(exercise_engine(uring_engine) == EXIT_SUCCESS);
+
+            // a refused submission completes the queued requests with the error rather than
+            // leaving them to nobody, and the ring is usable again afterwards
+            std::vector < char > block(block_size);
+            std::vector < int64_t > results;
+            for (uint64_t i = 0; i < 3; i++) {
+                uring_engine.submit_writev(i * block_size, { { .iov_base = block.data(), .iov_len = block_size } },
+                    [&results](const int64_t result) { results.push_back(result); });
+            }
+            auto promise = std::make_shared < std::promise < int64_t > >();
+            auto future = promise->get_future();
+            uring_engine.submit_writev(3 * block_size, { { .iov_base = block.data(), .iov_len = block_size } },
+                [promise](const int64_t result) { promise->set_value(result); });
+
+            refused_submissions = EIO;
+            bool refused = false;
+            try {
+                uring_engine.flush();
+            } catch (IoEngineSubmissionFailed &) {
+                refused = true;
+            }
+            refused_submissions = 0;
+
+            CHECK(refused && results.size() == 3 && uring_engine.in_flight() == 0);
+            CHECK(std::ranges::all_of(results, [](const int64_t result) { return result == -EIO; }));
+            CHECK(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready && future.get() == -EIO);
+            CHECK(exercise_engine(uring_engine) == EXIT_SUCCESS);
+        }
+        else
+        {
+            log(_log::LOG_NORMAL, "io_uring is not supported by this kernel, skipping\n");
+        }
+
+        close(fd);
+
+        // block_io behaves the same on top of either engine
+        for (const auto type : { IO_ENGINE_SYNC, IO_ENGINE_AUTO })
+        {
+            std::vector < char > buffer(block_size);
+            {
+                block_io io(path, block_size, { .io_engine = type });
+                for (uint64_t i = 0; i < block_count; i++)
+                {
+                    std::memset(buffer.data(), static_cast<int>(i + type), block_size);
+                    io.get_block(i).write(buffer.data(), block_size, 0);
+                }
+            }
+
+            block_io io(path, block_size, { .io_engine = type });
+            for (uint64_t i = 0; i < block_count; i++)
+            {
+                io.get_block(i).read(buffer.data(), block_size, 0);
+                CHECK(buffer[block_size - 1] == static_cast<char>(i + type));
+            }
+        }
+
+        unlink(path.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
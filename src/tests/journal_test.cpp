@@ -0,0 +1,287 @@
+#include <journal.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "test_check.h"
+#include "test_image.h"
+
+constexpr uint32_t block_size = 512;
+constexpr uint64_t home_blocks = 256;
+
+// only what the journal looks at: blocks 1 to 256 to change, then the journaling buffer
+simplesnapfs_filesystem_head_t journal_layout(const uint64_t journal_blocks)
+{
+    simplesnapfs_filesystem_head_t head { };
+    auto & info = head.static_information;
+    info.fs_block_size = block_size;
+    info.checksum_algorithm = CHECKSUM_XXH3;
+    info.journaling_buffer_blk_index = 1 + home_blocks;
+    info.journaling_buffer_blocks = journal_blocks;
+    info.fs_total_blocks = info.journaling_buffer_blk_index + journal_blocks;
+    return head;
+}
+
+// the image as a crash would leave it: what reached the file, none of what block_io still caches
+std::string crash_copy(const std::string & path)
+{
+    const std::string copy = path + ".crashed";
+    std::ifstream source(path, std::ios::binary);
+    std::ofstream destination(copy, std::ios::binary | std::ios::trunc);
+    destination << source.rdbuf();
+    return copy;
+}
+
+void overwrite(const std::string & path, const uint64_t offset, const std::vector < char > & data)
+{
+    const int fd = open(path.c_str(), O_RDWR);
+    if (fd == -1 || pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset)) != static_cast<ssize_t>(data.size())) {
+        throw WriteFailed();
+    }
+    close(fd);
+}
+
+bool holds(block_io & io, const uint64_t block, const std::vector < char > & expected)
+{
+    std::vector < char > contents(block_size);
+    io.read_range(block * block_size, block_size, contents.data());
+    return contents == expected;
+}
+
+int main()
+{
+    try {
+        const auto head = journal_layout(129);
+
+        // committed blocks reach their homes, partial writes keep the rest of the block
+        {
+            const auto path = create_image("journal_test.img", head.static_information.fs_total_blocks, block_size);
+            block_io io(path, block_size);
+            io.write_range(3 * block_size, block_size, pattern(3, block_size).data());
+            journal fs_journal(io, head, { .commit_interval = std::chrono::microseconds(0) });
+
+            auto transaction = fs_journal.begin();
+            CHECK(transaction.write(1, pattern(1, block_size).data(), block_size) == block_size);
+            CHECK(transaction.write(3, "changed", 7, 100) == 7);
+            CHECK(transaction.write(3, "clipped", 7, block_size - 2) == 2);
+            CHECK(transaction.size() == 2);
+            fs_journal.commit(std::move(transaction));
+
+            auto expected = pattern(3, block_size);
+            std::memcpy(expected.data() + 100, "changed", 7);
+            std::memcpy(expected.data() + block_size - 2, "cl", 2);
+            CHECK(holds(io, 1, pattern(1, block_size)) && holds(io, 3, expected));
+            CHECK(fs_journal.get_used_blocks() == 3);
+
+            // more targets than fit behind the header spill into a second descriptor block
+            auto large = fs_journal.begin();
+            for (uint64_t block = 10; block < 70; block++) {
+                large.write(block, pattern(block, block_size).data(), block_size);
+            }
+            fs_journal.commit(std::move(large));
+            CHECK(fs_journal.get_used_blocks() == 3 + 2 + 60);
+
+            const auto statistics = fs_journal.get_statistics();
+            CHECK(statistics.transactions == 2 && statistics.records == 2 && statistics.journaled_blocks == 62);
+
+            // one too many for the log
+            auto too_large = fs_journal.begin();
+            for (uint64_t block = 1; block <= 127; block++) {
+                too_large.write(block, pattern(block, block_size).data(), block_size);
+            }
+            bool rejected = false;
+            try {
+                fs_journal.commit(std::move(too_large));
+            } catch (TransactionTooLarge &) {
+                rejected = true;
+            }
+            CHECK(rejected);
+
+            fs_journal.checkpoint();
+            CHECK(fs_journal.get_used_blocks() == 0 && fs_journal.get_statistics().checkpoints == 1);
+            unlink(path.c_str());
+        }
+
+        // concurrent transactions share records and flushes
+        {
+            const auto path = create_image("journal_test.img", head.static_information.fs_total_blocks, block_size);
+            block_io io(path, block_size);
+            constexpr int threads = 8;
+            constexpr int per_thread = 25;
+            {
+                journal fs_journal(io, head, { .commit_interval = std::chrono::milliseconds(20) });
+                std::vector < std::thread > workers;
+                for (int thread = 0; thread < threads; thread++)
+                {
+                    workers.emplace_back([&, thread] {
+                        for (int i = 0; i < per_thread; i++)
+                        {
+                            const uint64_t block = 1 + thread * per_thread + i;
+                            auto transaction = fs_journal.begin();
+                            transaction.write(block, pattern(block, block_size).data(), block_size);
+                            fs_journal.commit(std::move(transaction));
+                        }
+                    });
+                }
+                for (auto & worker : workers) {
+                    worker.join();
+                }
+
+                const auto statistics = fs_journal.get_statistics();
+                log(_log::LOG_NORMAL, "Group commit: ", statistics.transactions, " transactions in ",
+                    statistics.records, " records, ", statistics.flushes, " flushes\n");
+                CHECK(statistics.transactions == threads * per_thread);
+                CHECK(statistics.records < statistics.transactions / 4);
+                CHECK(statistics.flushes < statistics.transactions / 4);
+            }
+
+            for (uint64_t block = 1; block <= threads * per_thread; block++) {
+                CHECK(holds(io, block, pattern(block, block_size)));
+            }
+
+            // closed cleanly, opening finds nothing with a single block read
+            const auto statistics = journal(io, head).get_statistics();
+            CHECK(statistics.replayed_records == 0 && statistics.replay_read_bytes == block_size);
+            unlink(path.c_str());
+        }
+
+        // a crash before the home locations were written: replayed on the next open,
+        // up to the first torn record
+        {
+            const auto path = create_image("journal_test.img", head.static_information.fs_total_blocks, block_size);
+            std::string crashed;
+            {
+                block_io io(path, block_size);
+                journal fs_journal(io, head, { .commit_interval = std::chrono::microseconds(0) });
+                for (uint64_t block = 1; block <= 5; block++)
+                {
+                    auto transaction = fs_journal.begin();
+                    transaction.write(block, pattern(block, block_size).data(), block_size);
+                    fs_journal.commit(std::move(transaction));
+                }
+                crashed = crash_copy(path);
+            }
+
+            // whatever made it home is lost again, and the last record is torn
+            overwrite(crashed, block_size, std::vector < char > (5 * block_size));
+            const uint64_t last_record = head.static_information.journaling_buffer_blk_index + 1 + 4 * 2;
+            overwrite(crashed, (last_record + 1) * block_size + 7, { 'x' });
+
+            {
+                block_io io(crashed, block_size);
+                journal fs_journal(io, head);
+                CHECK(fs_journal.get_statistics().replayed_records == 4);
+                CHECK(fs_journal.get_used_blocks() == 0);
+                for (uint64_t block = 1; block <= 4; block++) {
+                    CHECK(holds(io, block, pattern(block, block_size)));
+                }
+                CHECK(holds(io, 5, std::vector < char > (block_size)));
+            }
+
+            // replayed once only
+            block_io io(crashed, block_size);
+            CHECK(journal(io, head).get_statistics().replayed_records == 0);
+            unlink(path.c_str());
+            unlink(crashed.c_str());
+        }
+
+        // read in pieces smaller than some records, every block written home once with its newest image
+        {
+            const auto path = create_image("journal_test.img", head.static_information.fs_total_blocks, block_size);
+            std::string crashed;
+            {
+                block_io io(path, block_size);
+                journal fs_journal(io, head, { .commit_interval = std::chrono::microseconds(0) });
+                for (uint64_t round = 0; round < 20; round++)
+                {
+                    auto transaction = fs_journal.begin();
+                    transaction.write(1 + round % 3, pattern(round, block_size).data(), block_size);
+                    fs_journal.commit(std::move(transaction));
+                }
+                auto large = fs_journal.begin();
+                for (uint64_t block = 10; block < 70; block++) {
+                    large.write(block, pattern(block, block_size).data(), block_size);
+                }
+                fs_journal.commit(std::move(large));
+                crashed = crash_copy(path);
+            }
+            overwrite(crashed, block_size, std::vector < char > (70 * block_size));
+
+            block_io io(crashed, block_size);
+            journal fs_journal(io, head, { .recovery_read_size = 4 * block_size, .recovery_threads = 3 });
+            const auto statistics = fs_journal.get_statistics();
+            CHECK(statistics.replayed_records == 21 && statistics.replayed_blocks == 3 + 60);
+            for (uint64_t round = 17; round < 20; round++) {
+                CHECK(holds(io, 1 + round % 3, pattern(round, block_size)));
+            }
+            for (uint64_t block = 10; block < 70; block++) {
+                CHECK(holds(io, block, pattern(block, block_size)));
+            }
+            unlink(path.c_str());
+            unlink(crashed.c_str());
+        }
+
+        // a small log wraps around, checkpointing as it goes, and records across its end replay
+        {
+            const auto small = journal_layout(33);
+            const auto path = create_image("journal_test.img", small.static_information.fs_total_blocks, block_size);
+            std::string crashed;
+            {
+                block_io io(path, block_size);
+                journal fs_journal(io, small, { .commit_interval = std::chrono::microseconds(0) });
+                for (uint64_t round = 0; round < 50; round++)
+                {
+                    auto transaction = fs_journal.begin();
+                    transaction.write(1 + round % 20, pattern(round, block_size).data(), block_size);
+                    transaction.write(100 + round % 7, pattern(round + 1000, block_size).data(), block_size);
+                    fs_journal.commit(std::move(transaction));
+                }
+                CHECK(fs_journal.get_statistics().checkpoints >= 4);
+                crashed = crash_copy(path);
+            }
+
+            block_io io(crashed, small.static_information.fs_block_size);
+            journal fs_journal(io, small);
+            CHECK(fs_journal.get_statistics().replayed_records > 0);
+            for (uint64_t round = 30; round < 50; round++) {
+                CHECK(holds(io, 1 + round % 20, pattern(round, block_size)));
+            }
+            for (uint64_t round = 43; round < 50; round++) {
+                CHECK(holds(io, 100 + round % 7, pattern(round + 1000, block_size)));
+            }
+            unlink(path.c_str());
+            unlink(crashed.c_str());
+        }
+
+        // a damaged superblock is not taken for an empty log
+        {
+            const auto path = create_image("journal_test.img", head.static_information.fs_total_blocks, block_size);
+            {
+                block_io io(path, block_size);
+                journal::format(io, head);
+            }
+            overwrite(path, head.static_information.journaling_buffer_blk_index * block_size + 20, { 'x' });
+
+            bool rejected = false;
+            try {
+                block_io io(path, block_size);
+                journal fs_journal(io, head);
+            } catch (CorruptedJournal &) {
+                rejected = true;
+            }
+            CHECK(rejected);
+            unlink(path.c_str());
+        }
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
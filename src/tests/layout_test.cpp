@@ -0,0 +1,102 @@
+#include <layout.h>
+#include <merkle_tree.h>
+#include <debug.h>
+#include <algorithm>
+#include <vector>
+#include "test_check.h"
+
+// regions in on-disk order, start and length
+static std::vector < std::pair < uint64_t, uint64_t > > regions_of(const simplesnapfs_filesystem_head_t & head)
+{
+    const auto & info = head.static_information;
+    return {
+        { info.data_block_bitmap_blk_index, info.data_block_bitmap_blocks },
+        { info.redundancy_data_block_bitmap_blk_index, info.redundancy_data_block_bitmap_blocks },
+        { info.data_block_bitmap_checksum_blk_index, info.data_block_bitmap_checksum_blocks },
+        { info.redundancy_data_block_bitmap_checksum_blk_index, info.redundancy_data_block_bitmap_checksum_blocks },
+        { info.data_block_index, info.data_blocks },
+        { info.data_block_checksum_blk_index, info.data_block_checksum_blocks },
+        { info.redundancy_data_block_checksum_blk_index, info.redundancy_data_block_checksum_blocks },
+        { info.data_block_checksum_tree_blk_index, info.data_block_checksum_tree_blocks },
+        { info.journaling_buffer_blk_index, info.journaling_buffer_blocks },
+        { info.fs_static_data_backup_blk_index, 4 },
+    };
+}
+
+int main()
+{
+    std::vector < uint32_t > block_sizes;
+    for (uint32_t block_size = 512; block_size <= 64 * 1024 * 1024; block_size *= 2) {
+        block_sizes.push_back(block_size);
+    }
+
+    try {
+        for (const auto block_size : block_sizes)
+        {
+            for (const auto algorithm : { CHECKSUM_SHA512, CHECKSUM_CRC32C })
+            {
+                for (const uint64_t alignment : { 1, 8, 256 })
+                {
+                    const layout_configuration_t configuration {
+                        .block_size = block_size, .checksum_algorithm = algorithm,
+                        .journal_ratio = alignment == 8 ? 10u : LAYOUT_DEFAULT_JOURNAL_RATIO,
+                        .reserved_percent = alignment == 8 ? 5u : 0u, .alignment = alignment };
+                    const uint64_t minimum = layout_blocks_needed(1, configuration);
+                    const uint32_t digest_length = checksum_digest_length(algorithm);
+
+                    for (const uint64_t block_count : { minimum + 20, uint64_t { 100000 }, uint64_t { 12345678 },
+                                                        (uint64_t { 1 } << 50) / block_size, (uint64_t { 1 } << 62) / block_size })
+                    {
+                        const auto head = plan_layout(block_count, configuration, "layout");
+                        const auto & info = head.static_information;
+                        const uint64_t usable = block_count - block_count * configuration.reserved_percent / 100;
+
+                        // regions in order, aligned, not overlapping, within what is usable
+                        uint64_t position = 1;
+                        for (const auto & [first, blocks] : regions_of(head))
+                        {
+                            CHECK(first >= position && first % alignment == 0 && blocks != 0);
+                            position = first + blocks;
+                        }
+                        CHECK(position == info.utilized_blocks && info.utilized_blocks <= usable);
+                        CHECK(info.fs_total_blocks == block_count && info.fs_block_size == block_size);
+
+                        // every region large enough for what it holds
+                        CHECK(info.data_block_bitmap_blocks * block_size * 8 >= info.data_blocks);
+                        CHECK(info.data_block_bitmap_checksum_blocks * (block_size / digest_length) >= info.data_block_bitmap_blocks);
+                        CHECK(info.data_block_checksum_blocks * (block_size / digest_length) >= info.data_blocks);
+                        CHECK(info.data_block_checksum_tree_blocks
+                            == merkle_tree::blocks_needed(info.data_block_checksum_blocks, block_size, digest_length));
+                        CHECK(info.journaling_buffer_blocks * configuration.journal_ratio >= info.data_blocks);
+
+                        // and no room left for one more data block
+                        CHECK(layout_blocks_needed(info.data_blocks, configuration) == info.utilized_blocks);
+                        CHECK(layout_blocks_needed(info.data_blocks + 1, configuration) > usable);
+                    }
+
+                    // too small
+                    bool rejected = false;
+                    try {
+                        (void)plan_layout(minimum - 1, { .block_size = block_size, .checksum_algorithm = algorithm, .alignment = alignment });
+                    } catch (InvalidLayout &) {
+                        rejected = true;
+                    }
+                    CHECK(rejected);
+                }
+            }
+        }
+
+        // the journal ratio is honoured, about one journal block per ratio data blocks
+        for (const uint64_t ratio : { 1, 50, 1000 })
+        {
+            const auto head = plan_layout(1000000, { .journal_ratio = ratio });
+            const auto & info = head.static_information;
+            CHECK(info.journaling_buffer_blocks == (info.data_blocks + ratio - 1) / ratio);
+        }
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+#include <lazy_initializer.h>
+#include <filesystem_head.h>
+#include <scrub.h>
+#include <merkle_tree.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <debug.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "test_check.h"
+#include "test_image.h"
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t data_blocks = 4096;
+constexpr uint64_t journal_blocks = 64;
+
+// what mkfs --lazy leaves: an empty bitmap, and whatever was on the device everywhere it did not write
+std::string format(const simplesnapfs_filesystem_head_t & head)
+{
+    const auto & info = head.static_information;
+    const auto path = create_image("lazy_initializer_test.img", info.fs_total_blocks, block_size);
+    block_io io(path, block_size);
+    const std::vector < char > garbage((info.fs_dynamic_data_backup_blk_index - info.data_block_checksum_blk_index) * block_size, '\xab');
+    io.write_range(info.data_block_checksum_blk_index * block_size, garbage.size(), garbage.data());
+
+    const std::vector < char > empty(block_size);
+    char digest[CHECKSUM_MAX_DIGEST_LENGTH];
+    checksum(CHECKSUM_SHA512, empty.data(), block_size, digest);
+    for (const uint64_t copy : { info.data_block_bitmap_checksum_blk_index, info.redundancy_data_block_bitmap_checksum_blk_index }) {
+        io.write_range(copy * block_size, 64, digest);
+    }
+    auto stored = head;
+    store_dynamic_information(io, stored);
+    return path;
+}
+
+bool is_zero(block_io & io, const uint64_t first_block, const uint64_t blocks)
+{
+    std::vector < char > data(blocks * block_size);
+    io.read_range(first_block * block_size, data.size(), data.data());
+    return std::ranges::all_of(data, [](const char byte) { return byte == 0; });
+}
+
+int main()
+{
+    try {
+        auto layout = make_layout(block_size, data_blocks, CHECKSUM_SHA512, journal_blocks);
+        layout.dynamic_information.fs_dynamically_set_flags.lazy_initialization = 1;
+        const auto & info = layout.static_information;
+        const auto path = format(layout);
+
+        // zeroing drops cached copies, dirty ones included, and discarded blocks read back as zeros here
+        {
+            block_io io(path, block_size);
+            io.get_block(info.data_block_index).write("data", 4, 0);
+            io.get_block(info.journaling_buffer_blk_index + 1).write("dirty", 5, 0);
+            io.zero_blocks(info.journaling_buffer_blk_index, 2);
+            CHECK(is_zero(io, info.journaling_buffer_blk_index, 2));
+            CHECK(io.discard_blocks(info.data_block_index, 1));
+            CHECK(is_zero(io, info.data_block_index, 1));
+            io.sync();
+            CHECK(is_zero(io, info.journaling_buffer_blk_index, 2));
+            CHECK(!is_zero(io, info.journaling_buffer_blk_index + 2, 1));
+        }
+
+        // until initialized only the bitmap is scrubbed
+        {
+            block_io io(path, block_size);
+            const auto result = scrubber(io).run();
+            CHECK(result.bitmap_blocks_checked == 1 && result.data_blocks_checked == 0);
+            CHECK(result.checksum_errors == 0 && result.tree_errors == 0);
+        }
+
+        {
+            block_io io(path, block_size);
+            auto head = load_filesystem_head(io);
+            CHECK(lazy_initializer::is_needed(head));
+
+            lazy_initializer initializer(io, head);
+            CHECK(!initializer.is_done());
+            CHECK(initializer.get_total_blocks() == 2 * info.data_block_checksum_blocks
+                + info.data_block_checksum_tree_blocks + journal_blocks);
+
+            // a writer gets its piece zeroed first
+            initializer.ensure_initialized(info.journaling_buffer_blk_index + 10);
+            CHECK(is_zero(io, info.journaling_buffer_blk_index, journal_blocks));
+            CHECK(initializer.get_zeroed_blocks() == journal_blocks);
+            io.get_block(info.journaling_buffer_blk_index + 10).write("record", 6, 0);
+
+            // but nothing may write the checksum regions before they are done, a later run would zero them again
+            bool refused = false;
+            try {
+                initializer.ensure_initialized(info.data_block_checksum_blk_index);
+            } catch (LazyInitializationConflict &) {
+                refused = true;
+            }
+            CHECK(refused && initializer.get_zeroed_blocks() == journal_blocks);
+
+            // nor may a snapshot volume have stored checksums there already
+            auto with_volume = head;
+            with_volume.dynamic_information.snapshot_volume_descriptor = 1;
+            refused = false;
+            try {
+                lazy_initializer conflicting(io, with_volume);
+            } catch (LazyInitializationConflict &) {
+                refused = true;
+            }
+            CHECK(refused);
+
+            initializer.start();
+            initializer.wait();
+            CHECK(initializer.is_done() && initializer.get_zeroed_blocks() == initializer.get_total_blocks());
+            CHECK(!is_zero(io, info.journaling_buffer_blk_index + 10, 1));
+        }
+
+        // the head says so, the tree is there and the whole filesystem scrubs clean
+        {
+            block_io io(path, block_size);
+            auto head = load_filesystem_head(io);
+            CHECK(!lazy_initializer::is_needed(head));
+            CHECK(is_zero(io, info.data_block_checksum_blk_index, 2 * info.data_block_checksum_blocks));
+            CHECK(merkle_tree(io, head).verify() == 0);
+
+            const auto result = scrubber(io).run();
+            CHECK(result.checksum_errors == 0 && result.tree_errors == 0 && result.bitmap_errors == 0);
+
+            // nothing left to do
+            lazy_initializer initializer(io, head);
+            CHECK(initializer.is_done());
+        }
+
+        unlink(path.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#include <merkle_tree.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <debug.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "test_check.h"
+#include "test_image.h"
+
+constexpr uint32_t block_size = 512;
+
+// only what the tree looks at: the head, the data block checksum region and the tree.
+// 512 byte blocks with SHA-512 slots give a fanout of 8 and three levels for 2048 data blocks
+simplesnapfs_filesystem_head_t tree_layout(const uint64_t data_blocks)
+{
+    const uint64_t checksum_blocks = data_blocks * 64 / block_size;
+    simplesnapfs_filesystem_head_t head { };
+    auto & info = head.static_information;
+    info.fs_block_size = block_size;
+    info.checksum_algorithm = CHECKSUM_SHA512;
+    info.data_blocks = data_blocks;
+    info.data_block_checksum_blk_index = 1;
+    info.data_block_checksum_blocks = checksum_blocks;
+    info.data_block_checksum_tree_blk_index = 1 + checksum_blocks;
+    info.data_block_checksum_tree_blocks = merkle_tree::blocks_needed(checksum_blocks, block_size, 64);
+    info.fs_total_blocks = info.data_block_checksum_tree_blk_index + info.data_block_checksum_tree_blocks;
+    return head;
+}
+
+// the same checksums in every image
+std::string checksummed_image(const std::string & name, const simplesnapfs_filesystem_head_t & head)
+{
+    const auto path = create_image(name, head.static_information.fs_total_blocks, block_size);
+    block_io io(path, block_size);
+    std::vector < char > checksums(head.static_information.data_block_checksum_blocks * block_size);
+    for (uint64_t block = 0; block < head.static_information.data_blocks; block++)
+    {
+        const auto digest = sha512sum(reinterpret_cast<const char *>(&block), sizeof(block));
+        std::memcpy(checksums.data() + block * 64, digest.data(), 64);
+    }
+    io.write_range(block_size, checksums.size(), checksums.data());
+    return path;
+}
+
+// give a data block a new checksum slot, as writing it would
+void rewrite_slot(block_io & io, const simplesnapfs_filesystem_head_t & head, const uint64_t data_block)
+{
+    const auto digest = sha512sum("changed", 7 + data_block % 2);
+    io.write_range(head.static_information.data_block_checksum_blk_index * block_size + data_block * 64, 64, digest.data());
+}
+
+int main()
+{
+    try {
+        CHECK(merkle_tree::blocks_needed(1, 4096, 64) == 1);
+        CHECK(merkle_tree::blocks_needed(64, 4096, 64) == 1);
+        CHECK(merkle_tree::blocks_needed(65, 4096, 64) == 3);
+        CHECK(merkle_tree::blocks_needed(256, 512, 64) == 32 + 4 + 1);
+
+        auto head_a = tree_layout(2048), head_b = tree_layout(2048);
+        const auto path_a = checksummed_image("merkle_tree_test_a.img", head_a);
+        const auto path_b = checksummed_image("merkle_tree_test_b.img", head_b);
+        block_io io_a(path_a, block_size), io_b(path_b, block_size);
+        merkle_tree tree_a(io_a, head_a), tree_b(io_b, head_b);
+        tree_a.build();
+        tree_b.build();
+
+        // identical images
+        CHECK(tree_a.get_levels() == 3);
+        CHECK(tree_a.verify() == 0);
+        CHECK(std::memcmp(tree_a.root().data(), tree_b.root().data(), 64) == 0);
+        CHECK(tree_a.diff(tree_b).empty());
+
+        // updating the paths of changed slots leaves the same tree as rebuilding it
+        for (const uint64_t block : { 5, 6, 7, 1000 }) {
+            rewrite_slot(io_b, head_b, block);
+        }
+        tree_b.update(5, 3);
+        tree_b.update(1000);
+        CHECK(tree_b.verify() == 0);
+        CHECK(std::memcmp(tree_a.root().data(), tree_b.root().data(), 64) != 0);
+        CHECK(tree_b.verify_block(5) && tree_b.verify_block(1000));
+
+        const auto ranges = tree_a.diff(tree_b);
+        CHECK(ranges.size() == 2);
+        CHECK((ranges[0] == merkle_tree::range_t { 5, 3 }));
+        CHECK((ranges[1] == merkle_tree::range_t { 1000, 1 }));
+        CHECK(tree_b.diff(tree_a) == ranges);
+
+        // a slot changed behind the tree's back shows on its path, and only there
+        rewrite_slot(io_b, head_b, 1500);
+        CHECK(!tree_b.verify_block(1500));
+        CHECK(tree_b.verify_block(5));
+        CHECK(tree_b.verify() == tree_b.get_levels() + 1);
+        CHECK(tree_b.verify(true) != 0);
+        CHECK(tree_b.verify() == 0);
+        CHECK(tree_b.verify_block(1500));
+
+        // a damaged node
+        io_a.get_block(head_a.static_information.data_block_checksum_tree_blk_index + 3).writable_view()[70] ^= 1;
+        CHECK(tree_a.verify() == 1);
+        CHECK(!tree_a.verify_block(3 * 8 * 8 + 8));
+        CHECK(tree_a.verify(true) == 1);
+        CHECK(tree_a.verify() == 0);
+
+        // trees over regions of a different size cannot be compared
+        auto head_c = tree_layout(1024);
+        const auto path_c = checksummed_image("merkle_tree_test_c.img", head_c);
+        {
+            block_io io_c(path_c, block_size);
+            merkle_tree tree_c(io_c, head_c);
+            tree_c.build();
+
+            bool rejected = false;
+            try {
+                (void)tree_a.diff(tree_c);
+            } catch (IncompatibleChecksumTree &) {
+                rejected = true;
+            }
+            CHECK(rejected);
+        }
+
+        // a tree over zeros built without reading them is the tree built from them,
+        // for full, partial and single block levels
+        for (const uint64_t data_blocks : { 2048, 1000, 8 })
+        {
+            auto head = tree_layout(data_blocks);
+            const auto path = create_image("merkle_tree_test_empty.img", head.static_information.fs_total_blocks, block_size);
+            block_io io(path, block_size);
+            merkle_tree tree(io, head);
+            tree.build_empty();
+            CHECK(tree.verify() == 0);
+            unlink(path.c_str());
+        }
+
+        unlink(path_a.c_str());
+        unlink(path_b.c_str());
+        unlink(path_c.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#include <block_io.h>
+#include <readahead.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+#include "test_check.h"
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t block_count = 1024;
+
+std::string make_image()
+{
+    const std::string path = CMAKE_BINARY_DIR "/readahead_test.img";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, block_size * block_count) == -1) {
+        throw CannotOpenFile();
+    }
+
+    // every block starts with its own number
+    for (uint64_t block = 0; block < block_count; block++)
+    {
+        if (pwrite(fd, &block, sizeof(block), static_cast<off_t>(block * block_size)) != sizeof(block)) {
+            throw CannotOpenFile();
+        }
+    }
+    close(fd);
+    return path;
+}
+
+int main()
+{
+    try {
+        // sequential stream: confirmed on the third access, window doubles up to the limit
+        {
+            readahead_tracker tracker(1000, 4, 32, 16);
+            CHECK(tracker.access(10).count == 0);
+            CHECK(tracker.access(11).count == 0);
+            auto window = tracker.access(12);
+            CHECK(window.first == 13 && window.stride == 1 && window.count == 4);
+
+            // nothing new until half of the window is consumed
+            CHECK(tracker.access(13).count == 0);
+            window = tracker.access(15);
+            CHECK(window.count == 0);   // not a continuation, starts a stream of its own
+
+            readahead_tracker doubling(1000, 4, 32, 16);
+            uint64_t last_window = 0;
+            uint64_t next = 0;
+            for (uint64_t block = 0; block < 200; block++)
+            {
+                if (const auto w = doubling.access(block); w.count != 0)
+                {
+                    CHECK(w.first == next || next == 0);
+                    CHECK(w.count >= last_window);
+                    CHECK(w.count <= 32);
+                    last_window = w.count;
+                    next = w.first + w.count;
+                }
+            }
+            CHECK(last_window == 32);
+        }
+
+        // strided stream, and the device end bounds the window
+        {
+            readahead_tracker tracker(100, 4, 32, 16);
+            tracker.access(70);
+            tracker.access(78);
+            auto window = tracker.access(86);
+            CHECK(window.first == 94 && window.stride == 8 && window.count == 1);
+        }
+
+        // backwards scans are streams too
+        {
+            readahead_tracker tracker(100, 4, 32, 16);
+            tracker.access(50);
+            tracker.access(49);
+            auto window = tracker.access(48);
+            CHECK(window.first == 47 && window.stride == -1 && window.count == 4);
+        }
+
+        // two interleaved scans are tracked separately
+        {
+            readahead_tracker tracker(10000, 4, 32, 16);
+            uint64_t windows = 0;
+            for (uint64_t i = 0; i < 64; i++)
+            {
+                windows += tracker.access(100 + i).count != 0;
+                windows += tracker.access(5000 + i).count != 0;
+            }
+            CHECK(windows >= 4);
+            CHECK(tracker.get_statistics().random_accesses == 2);
+        }
+
+        // random access never prefetches
+        {
+            readahead_tracker tracker(1000000, 4, 32, 16);
+            std::mt19937_64 random(42);
+            for (int i = 0; i < 10000; i++) {
+                tracker.access(random() % 1000000);
+            }
+            CHECK(tracker.get_statistics().windows == 0);
+        }
+
+        const auto path = make_image();
+
+        // sequential scan through block_io is mostly served by readahead
+        for (const auto engine : { IO_ENGINE_SYNC, IO_ENGINE_AUTO })
+        {
+            block_io io(path, block_size, { .cache_size = 256 * block_size, .io_engine = engine });
+            for (uint64_t block = 0; block < block_count; block++)
+            {
+                uint64_t stored = 0;
+                io.get_block(block).read(reinterpret_cast<char *>(&stored), sizeof(stored), 0);
+                CHECK(stored == block);
+            }
+
+            const auto statistics = io.get_readahead_statistics();
+            CHECK(statistics.windows != 0);
+            CHECK(statistics.blocks_loaded != 0);
+            CHECK(statistics.hits + 8 >= block_count);
+            CHECK(io.get_cache_statistics().misses <= 8);
+        }
+
+        // readahead can be turned off
+        {
+            block_io io(path, block_size, { .cache_size = 256 * block_size, .readahead_size = 0 });
+            for (uint64_t block = 0; block < 64; block++) {
+                io.get_block(block);
+            }
+            CHECK(io.get_readahead_statistics().windows == 0);
+            CHECK(io.get_cache_statistics().misses == 64);
+        }
+
+        unlink(path.c_str());
+        return EXIT_SUCCESS;
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, "Unexpected error: ", e.what(), "\n");
+        return EXIT_FAILURE;
+    }
+}
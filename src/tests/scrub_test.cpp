@@ -0,0 +1,192 @@
+#include <scrub.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <merkle_tree.h>
+#include <filesystem_head.h>
+#include <debug.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "test_check.h"
+#include "test_image.h"
+
+constexpr uint32_t block_size = 4096;
+constexpr uint64_t data_blocks = 256;
+
+// every third data block is allocated
+constexpr bool allocated(const uint64_t block) { return block % 3 == 0; }
+
+std::string format(const checksum_algorithm_t algorithm)
+{
+    auto head = make_layout(block_size, data_blocks, algorithm);
+    const auto & info = head.static_information;
+    const uint32_t digest_length = checksum_digest_length(algorithm);
+
+    const auto path = create_image("scrub_test.img", info.fs_total_blocks, block_size);
+    block_io io(path, block_size);
+    std::vector < char > bitmap(block_size), block(block_size), checksums(data_blocks * digest_length);
+    for (uint64_t i = 0; i < data_blocks; i++)
+    {
+        if (!allocated(i)) {
+            continue;
+        }
+
+        bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | 1 << (i % 8));
+        std::memset(block.data(), static_cast<int>(i), block_size);
+        io.write_range((info.data_block_index + i) * block_size, block_size, block.data());
+        checksum(algorithm, block.data(), block_size, checksums.data() + i * digest_length);
+    }
+
+    char bitmap_checksum[CHECKSUM_MAX_DIGEST_LENGTH];
+    checksum(algorithm, bitmap.data(), block_size, bitmap_checksum);
+    for (const uint64_t copy : { info.data_block_bitmap_blk_index, info.redundancy_data_block_bitmap_blk_index }) {
+        io.write_range(copy * block_size, block_size, bitmap.data());
+    }
+    for (const uint64_t copy : { info.data_block_bitmap_checksum_blk_index, info.redundancy_data_block_bitmap_checksum_blk_index }) {
+        io.write_range(copy * block_size, digest_length, bitmap_checksum);
+    }
+    for (const uint64_t copy : { info.data_block_checksum_blk_index, info.redundancy_data_block_checksum_blk_index }) {
+        io.write_range(copy * block_size, checksums.size(), checksums.data());
+    }
+
+    merkle_tree(io, head).build();
+    store_dynamic_information(io, head);
+    return path;
+}
+
+int main()
+{
+    try {
+        uint64_t allocated_blocks = 0;
+        for (uint64_t i = 0; i < data_blocks; i++) {
+            allocated_blocks += allocated(i);
+        }
+
+        for (const auto algorithm : { CHECKSUM_SHA512, CHECKSUM_CRC32C, CHECKSUM_XXH3 })
+        {
+            const auto path = format(algorithm);
+            const auto head = make_layout(block_size, data_blocks, algorithm);
+            const auto & info = head.static_information;
+            const uint32_t digest_length = checksum_digest_length(algorithm);
+
+            // clean filesystem, read in pieces of 16 blocks
+            {
+                block_io io(path, block_size);
+                uint64_t progress_reports = 0;
+                scrubber scrub(io, { .hashing_threads = 3, .read_size = 16 * block_size,
+                    .progress = [&](const scrub_statistics_t &) { progress_reports++; } });
+                const auto result = scrub.run();
+                CHECK(result.bitmap_blocks_checked == 1);
+                CHECK(result.data_blocks_checked == allocated_blocks);
+                CHECK(result.data_blocks_total == allocated_blocks);
+                CHECK(result.bitmap_errors + result.checksum_errors + result.unrecoverable_blocks == 0);
+                CHECK(progress_reports >= data_blocks / 16);
+            }
+
+            // a bad checksum slot, a bad bitmap copy and a bad data block
+            {
+                block_io io(path, block_size);
+                io.get_block(info.data_block_checksum_blk_index).writable_view()[3 * digest_length] ^= 1;
+                io.get_block(info.redundancy_data_block_bitmap_blk_index).writable_view()[1] ^= 1;
+                io.get_block(info.data_block_index + 6).writable_view()[100] ^= 1;
+            }
+
+            {
+                block_io io(path, block_size);
+                const auto report = scrubber(io).run();
+                CHECK(report.checksum_errors == 1);
+                CHECK(report.tree_errors == 0);
+                CHECK(report.bitmap_errors == 1);
+                CHECK(report.unrecoverable_blocks == 1);
+                CHECK(report.repaired == 0);
+
+                const auto repair = scrubber(io, { .repair = true }).run();
+                CHECK(repair.repaired == 2);
+            }
+
+            // only the data block without a good copy is left
+            {
+                block_io io(path, block_size);
+                const auto result = scrubber(io).run();
+                CHECK(result.checksum_errors == 0);
+                CHECK(result.bitmap_errors == 0);
+                CHECK(result.unrecoverable_blocks == 1);
+            }
+
+            // a damaged checksum tree node is rebuilt from the checksum region
+            {
+                block_io io(path, block_size);
+                io.get_block(info.data_block_checksum_tree_blk_index).writable_view()[0] ^= 1;
+                CHECK(scrubber(io).run().tree_errors == 1);
+                CHECK(scrubber(io, { .repair = true }).run().repaired == 1);
+                CHECK(scrubber(io).run().tree_errors == 0);
+            }
+
+            unlink(path.c_str());
+        }
+
+        // reading is held back to the rate limit
+        {
+            const auto path = format(CHECKSUM_CRC32C);
+            block_io io(path, block_size);
+            constexpr uint64_t rate_limit = 4 * 1024 * 1024;
+            const auto result = scrubber(io, { .read_size = 8 * block_size, .rate_limit = rate_limit }).run();
+            CHECK(result.elapsed_seconds >= 0.9 * static_cast<double>(result.bytes_read) / rate_limit);
+            unlink(path.c_str());
+        }
+
+        // damaged dynamic information is taken from its backup, but not when that is damaged too
+        {
+            const auto path = format(CHECKSUM_CRC32C);
+            const auto layout = make_layout(block_size, data_blocks, CHECKSUM_CRC32C);
+            const uint64_t root_offset = offsetof(simplesnapfs_filesystem_head_t, dynamic_information)
+                + offsetof(simplesnapfs_filesystem_head_t::_dynamic_information, data_block_checksum_tree_root);
+            {
+                block_io io(path, block_size);
+                io.get_block(0).writable_view()[root_offset] ^= 1;
+            }
+
+            {
+                block_io io(path, block_size);
+                const auto result = scrubber(io, { .repair = true }).run();
+                CHECK(result.tree_errors == 0 && result.repaired == 0);
+                io.get_block(layout.static_information.fs_dynamic_data_backup_blk_index).writable_view()[root_offset - offsetof(simplesnapfs_filesystem_head_t, dynamic_information)] ^= 1;
+            }
+
+            bool rejected = false;
+            try {
+                block_io io(path, block_size);
+                scrubber scrub(io);
+            } catch (InvalidFilesystemHead &) {
+                rejected = true;
+            }
+            CHECK(rejected);
+            unlink(path.c_str());
+        }
+
+        // not a filesystem
+        {
+            const auto path = format(CHECKSUM_CRC32C);
+            {
+                block_io io(path, block_size);
+                io.get_block(0).writable_view()[0] ^= 1;
+            }
+
+            bool rejected = false;
+            try {
+                block_io io(path, block_size);
+                scrubber scrub(io);
+            } catch (InvalidFilesystemHead &) {
+                rejected = true;
+            }
+            CHECK(rejected);
+            unlink(path.c_str());
+        }
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# mkfs.simplesnapfs, send.simplesnapfs and receive.simplesnapfs end to end: a
+# snapshot of the volume mkfs made goes into a second filesystem, once only.
+# Arguments: the directory holding the tools, and one for the images
+set -e
+tools="$1"
+sender="$2/send_receive_test_sender.img"
+receiver="$2/send_receive_test_receiver.img"
+stream="$2/send_receive_test.stream"
+trap 'rm -f "$sender" "$receiver" "$stream"' EXIT
+
+truncate -s 0 "$sender" "$receiver"
+truncate -s 16M "$sender" "$receiver"
+"$tools/mkfs.simplesnapfs" -d "$sender" -C crc32c -S 4096 > /dev/null
+"$tools/mkfs.simplesnapfs" -d "$receiver" -C crc32c > /dev/null
+
+# nothing to send from without a volume
+if "$tools/send.simplesnapfs" -d "$receiver" -s > "$stream" 2> /dev/null; then
+    echo "Sent from a filesystem without a snapshot volume" >&2
+    exit 1
+fi
+
+"$tools/send.simplesnapfs" -d "$sender" -s > "$stream"
+"$tools/receive.simplesnapfs" -d "$receiver" < "$stream"
+"$tools/send.simplesnapfs" -d "$receiver" -l | grep -q "^Epoch 1, .*, received as epoch 1$"
+
+if "$tools/receive.simplesnapfs" -d "$receiver" < "$stream" > /dev/null 2>&1; then
+    echo "The same stream was received twice" >&2
+    exit 1
+fi
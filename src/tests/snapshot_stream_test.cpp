@@ -0,0 +1,196 @@
+#include <snapshot_stream.h>
+#include <snapshot_volume.h>
+#include <filesystem_head.h>
+#include <block_allocator.h>
+#include <scrub.h>
+#include <checksum.h>
+#include <debug.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "test_check.h"
+#include "test_image.h"
+
+constexpr uint32_t block_size = 512;
+constexpr uint64_t device_blocks = 8192;
+constexpr uint64_t logical_blocks = 1000;
+
+// the volumes on both images read the same, live and in their newest snapshots
+bool same_contents(const std::string & sender, const std::string & receiver)
+{
+    block_io sender_io(sender, block_size), receiver_io(receiver, block_size);
+    auto sender_head = load_filesystem_head(sender_io), receiver_head = load_filesystem_head(receiver_io);
+    block_allocator sender_allocator(sender_io, sender_head), receiver_allocator(receiver_io, receiver_head);
+    snapshot_volume sent(sender_io, sender_head, sender_allocator), received(receiver_io, receiver_head, receiver_allocator);
+    const auto sent_snapshot = sent.get_snapshots().back(), received_snapshot = received.get_snapshots().back();
+    if (received_snapshot.received_from != sent_snapshot.epoch) {
+        return false;
+    }
+
+    std::vector < char > expected(block_size), contents(block_size);
+    for (uint64_t block = 0; block < logical_blocks; block++)
+    {
+        sent.read(sent_snapshot, block, expected.data());
+        received.read(received_snapshot, block, contents.data());
+        if (contents != expected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    try {
+        for (const auto algorithm : { CHECKSUM_SHA512, CHECKSUM_XXH3 })
+        {
+            const auto sender = format_filesystem("snapshot_stream_test_sender.img", device_blocks, { .block_size = block_size, .checksum_algorithm = algorithm });
+            const auto receiver = format_filesystem("snapshot_stream_test_receiver.img", device_blocks, { .block_size = block_size, .checksum_algorithm = algorithm });
+            std::stringstream full, incremental;
+
+            // a full stream creates the receiver's volume
+            uint64_t first_epoch;
+            {
+                block_io io(sender, block_size);
+                auto head = load_filesystem_head(io);
+                block_allocator allocator(io, head);
+                snapshot_volume::create(io, head, allocator, logical_blocks);
+                snapshot_volume volume(io, head, allocator);
+                for (uint64_t block = 0; block < 200; block += 2) {
+                    volume.write(block, pattern(block, block_size).data());
+                }
+                volume.write(500, std::vector < char > (block_size).data());
+                first_epoch = volume.create_snapshot();
+                volume.sync();
+
+                const auto first = volume.find_snapshot(first_epoch);
+                const auto statistics = send_snapshot_stream(volume, nullptr, &first, full);
+                CHECK(statistics.changed_blocks == 101 && statistics.sent_blocks == 100);
+                CHECK(statistics.unchanged_blocks == 1 && statistics.zero_blocks == 0);
+            }
+            // a cut full stream leaves the receiver without the volume it would have made
+            {
+                const std::string whole = full.str();
+                std::stringstream cut(whole.substr(0, whole.size() / 2));
+                bool rejected = false;
+                try {
+                    block_io io(receiver, block_size);
+                    receive_snapshot_stream(io, cut);
+                } catch (InvalidSnapshotStream &) {
+                    rejected = true;
+                }
+                CHECK(rejected);
+                block_io io(receiver, block_size);
+                CHECK(load_filesystem_head(io).dynamic_information.snapshot_volume_descriptor == 0);
+            }
+
+            {
+                block_io io(receiver, block_size);
+                const auto statistics = receive_snapshot_stream(io, full);
+                CHECK(statistics.sent_blocks == 100);
+            }
+            CHECK(same_contents(sender, receiver));
+
+            // only what changed goes in the incremental one: new blocks, a block
+            // rewritten with its old contents left out, a zeroed block without contents
+            uint64_t second_epoch;
+            {
+                block_io io(sender, block_size);
+                auto head = load_filesystem_head(io);
+                block_allocator allocator(io, head);
+                snapshot_volume volume(io, head, allocator);
+                for (uint64_t block = 300; block < 310; block++) {
+                    volume.write(block, pattern(block, block_size).data());
+                }
+                volume.write(10, pattern(10, block_size).data());
+                volume.write(12, std::vector < char > (block_size).data());
+                second_epoch = volume.create_snapshot();
+                volume.sync();
+
+                const auto first = volume.find_snapshot(first_epoch), second = volume.find_snapshot(second_epoch);
+                const auto statistics = send_snapshot_stream(volume, &first, &second, incremental);
+                CHECK(statistics.changed_blocks == 12 && statistics.sent_blocks == 10);
+                CHECK(statistics.unchanged_blocks == 1 && statistics.zero_blocks == 1);
+                CHECK(statistics.stream_bytes < 12 * (block_size + sizeof(snapshot_stream_record_t)) + sizeof(snapshot_stream_header_t));
+            }
+
+            // a damaged copy is rejected before anything is stored
+            {
+                std::string damaged = incremental.str();
+                damaged[damaged.size() / 2] ^= 1;
+                std::stringstream stream(damaged);
+                bool rejected = false;
+                try {
+                    block_io io(receiver, block_size);
+                    receive_snapshot_stream(io, stream);
+                } catch (InvalidSnapshotStream &) {
+                    rejected = true;
+                }
+                CHECK(rejected);
+            }
+
+            {
+                block_io io(receiver, block_size);
+                const auto statistics = receive_snapshot_stream(io, incremental);
+                CHECK(statistics.sent_blocks == 10 && statistics.zero_blocks == 1);
+            }
+            CHECK(same_contents(sender, receiver));
+
+            // the same stream again no longer applies
+            {
+                std::stringstream again(incremental.str());
+                bool rejected = false;
+                try {
+                    block_io io(receiver, block_size);
+                    receive_snapshot_stream(io, again);
+                } catch (InvalidSnapshotStream &) {
+                    rejected = true;
+                }
+                CHECK(rejected);
+            }
+
+            // the live volume goes out with the checksums of what it holds, synced or not
+            {
+                std::stringstream live;
+                {
+                    block_io io(sender, block_size);
+                    auto head = load_filesystem_head(io);
+                    block_allocator allocator(io, head);
+                    snapshot_volume volume(io, head, allocator);
+                    volume.write(20, pattern(1020, block_size).data());
+                    volume.write(700, pattern(700, block_size).data());
+                    const auto second = volume.find_snapshot(second_epoch);
+                    const auto statistics = send_snapshot_stream(volume, &second, nullptr, live);
+                    CHECK(statistics.changed_blocks == 2 && statistics.sent_blocks == 2);
+                }
+
+                block_io io(receiver, block_size);
+                const auto statistics = receive_snapshot_stream(io, live);
+                CHECK(statistics.sent_blocks == 2);
+                auto head = load_filesystem_head(io);
+                block_allocator allocator(io, head);
+                snapshot_volume volume(io, head, allocator);
+                std::vector < char > contents(block_size);
+                volume.read(20, contents.data());
+                CHECK(contents == pattern(1020, block_size));
+                volume.read(700, contents.data());
+                CHECK(contents == pattern(700, block_size));
+            }
+
+            {
+                block_io io(receiver, block_size);
+                const auto result = scrubber(io).run();
+                CHECK(result.bitmap_errors + result.checksum_errors + result.tree_errors + result.unrecoverable_blocks == 0);
+            }
+
+            unlink(sender.c_str());
+            unlink(receiver.c_str());
+        }
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
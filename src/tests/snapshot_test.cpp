@@ -0,0 +1,159 @@
+#include <snapshot_volume.h>
+#include <filesystem_head.h>
+#include <block_allocator.h>
+#include <scrub.h>
+#include <debug.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "test_check.h"
+#include "test_image.h"
+
+constexpr uint32_t block_size = 512;
+constexpr uint64_t device_blocks = 8192;
+constexpr uint64_t logical_blocks = 1000;
+
+int main()
+{
+    try {
+        const auto path = format_filesystem("snapshot_test.img", device_blocks, { .block_size = block_size, .checksum_algorithm = CHECKSUM_XXH3 });
+        const std::vector < char > zeros(block_size);
+        std::vector < char > contents(block_size);
+        uint64_t first_epoch, second_epoch;
+
+        {
+            block_io io(path, block_size);
+            auto head = load_filesystem_head(io);
+            block_allocator allocator(io, head);
+            snapshot_volume::create(io, head, allocator, logical_blocks);
+            snapshot_volume volume(io, head, allocator);
+            CHECK(volume.get_logical_blocks() == logical_blocks && volume.get_map_levels() == 2);
+
+            // unwritten blocks are holes
+            volume.read(7, contents.data());
+            CHECK(contents == zeros && volume.locate(7).block == 0);
+
+            // rewrites within an epoch stay where they are
+            for (uint64_t block = 0; block < 100; block++) {
+                volume.write(block, pattern(block, block_size).data());
+            }
+            const auto located = volume.locate(5);
+            volume.write(5, pattern(500, block_size).data());
+            CHECK(volume.locate(5) == located);
+            CHECK(volume.get_statistics().in_place_writes == 1 && volume.get_statistics().copied_blocks == 0);
+
+            // a snapshot costs at most its table block, however much was written
+            const uint64_t free_blocks = allocator.get_free_blocks();
+            first_epoch = volume.create_snapshot();
+            CHECK(free_blocks - allocator.get_free_blocks() <= 1);
+            CHECK(volume.get_current_epoch() == first_epoch + 1);
+
+            // the first overwrite after it moves the block and copies its map path, the second does not
+            const auto before = volume.get_statistics();
+            volume.write(5, pattern(1005, block_size).data());
+            const auto after_first = volume.get_statistics();
+            CHECK(after_first.copied_blocks == before.copied_blocks + 1);
+            CHECK(after_first.copied_map_blocks == before.copied_map_blocks + 2);
+            CHECK(volume.locate(5) != located);
+            volume.write(5, pattern(2005, block_size).data());
+            const auto after_second = volume.get_statistics();
+            CHECK(after_second.copied_blocks == after_first.copied_blocks);
+            CHECK(after_second.copied_map_blocks == after_first.copied_map_blocks);
+            CHECK(after_second.in_place_writes == after_first.in_place_writes + 1);
+
+            // the snapshot still reads what was there, holes included
+            const auto snapshot = volume.find_snapshot(first_epoch);
+            volume.read(snapshot, 5, contents.data());
+            CHECK(contents == pattern(500, block_size));
+            CHECK(volume.locate(snapshot, 5) == located);
+            volume.write(900, pattern(900, block_size).data());
+            volume.read(snapshot, 900, contents.data());
+            CHECK(contents == zeros);
+            volume.read(5, contents.data());
+            CHECK(contents == pattern(2005, block_size));
+
+            second_epoch = volume.create_snapshot();
+            volume.write(6, pattern(1006, block_size).data());
+            volume.sync();
+        }
+
+        // everything survives reopening, with valid checksums
+        {
+            block_io io(path, block_size);
+            auto head = load_filesystem_head(io);
+            block_allocator allocator(io, head);
+            snapshot_volume volume(io, head, allocator);
+            CHECK(volume.get_snapshots().size() == 2 && volume.get_current_epoch() == second_epoch + 1);
+
+            const auto first = volume.find_snapshot(first_epoch), second = volume.find_snapshot(second_epoch);
+            volume.read(first, 5, contents.data());
+            CHECK(contents == pattern(500, block_size));
+            volume.read(second, 5, contents.data());
+            CHECK(contents == pattern(2005, block_size));
+            volume.read(second, 6, contents.data());
+            CHECK(contents == pattern(6, block_size));
+            volume.read(6, contents.data());
+            CHECK(contents == pattern(1006, block_size));
+            volume.read(second, 900, contents.data());
+            CHECK(contents == pattern(900, block_size));
+
+            bool rejected = false;
+            try {
+                (void)volume.find_snapshot(second_epoch + 10);
+            } catch (NoSuchSnapshot &) {
+                rejected = true;
+            }
+            CHECK(rejected);
+        }
+
+        // what was not synced is gone after reopening, though it all reached the device:
+        // nothing the stored volume refers to was written over, table blocks included
+        {
+            block_io io(path, block_size);
+            auto head = load_filesystem_head(io);
+            block_allocator allocator(io, head);
+            snapshot_volume volume(io, head, allocator);
+            volume.write(6, pattern(3006, block_size).data());
+            volume.write(950, pattern(950, block_size).data());
+            (void)volume.create_snapshot();
+            volume.write(5, pattern(3005, block_size).data());
+            io.sync();
+        }
+        {
+            block_io io(path, block_size);
+            auto head = load_filesystem_head(io);
+            block_allocator allocator(io, head);
+            snapshot_volume volume(io, head, allocator);
+            CHECK(volume.get_snapshots().size() == 2 && volume.get_current_epoch() == second_epoch + 1);
+            volume.read(6, contents.data());
+            CHECK(contents == pattern(1006, block_size));
+            volume.read(5, contents.data());
+            CHECK(contents == pattern(2005, block_size));
+            volume.read(950, contents.data());
+            CHECK(contents == zeros);
+
+            // blocks the live volume moves away from go back to the allocator once synced
+            const uint64_t free_blocks = allocator.get_free_blocks();
+            volume.write(6, pattern(4006, block_size).data());
+            CHECK(allocator.get_free_blocks() == free_blocks - 3);
+            volume.sync();
+            CHECK(allocator.get_free_blocks() == free_blocks);
+            volume.read(6, contents.data());
+            CHECK(contents == pattern(4006, block_size));
+        }
+
+        {
+            block_io io(path, block_size);
+            const auto result = scrubber(io).run();
+            CHECK(result.data_blocks_checked > 100);
+            CHECK(result.bitmap_errors + result.checksum_errors + result.tree_errors + result.unrecoverable_blocks == 0);
+        }
+
+        unlink(path.c_str());
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <debug.h>
+#include <cstdlib>
+
+// fail the test, from main() or a helper returning an exit status, naming the check and where it is
+#define CHECK(expr) \
+    if (!(expr)) { log(_log::LOG_ERROR, "Check failed: ", #expr, " (", __FILE__, ":", __LINE__, ")\n"); return EXIT_FAILURE; }
+
+#endif //TEST_CHECK_H
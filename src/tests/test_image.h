@@ -0,0 +1,124 @@
+#ifndef TEST_IMAGE_H
+#define TEST_IMAGE_H
+
+#include <filesystem_head.h>
+#include <merkle_tree.h>
+#include <block_io.h>
+#include <checksum.h>
+#include <journal.h>
+#include <layout.h>
+#include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Images and block contents shared by the tests, so they are all formatted the
+// same way and in step with mkfs.
+
+// a sparse image of this many blocks in the build directory, reading as zeros
+inline std::string create_image(const std::string & name, const uint64_t blocks, const uint32_t block_size)
+{
+    const std::string path = CMAKE_BINARY_DIR "/" + name;
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, static_cast<off_t>(blocks * block_size)) == -1) {
+        throw CannotOpenFile();
+    }
+    close(fd);
+    return path;
+}
+
+// a block of contents telling the seed apart from its neighbours
+inline std::vector < char > pattern(const uint64_t seed, const uint32_t block_size)
+{
+    std::vector < char > block(block_size);
+    for (uint32_t i = 0; i < block_size; i++) {
+        block[i] = static_cast<char>(seed * 31 + i);
+    }
+    return block;
+}
+
+// Hand made layout, far smaller than plan_layout() makes one: head, bitmap and
+// its checksums, data, data checksums, each redundant, then the checksum tree,
+// the journal when it has blocks and the dynamic head backup. The static
+// information is checksummed, the dynamic information left empty.
+inline simplesnapfs_filesystem_head_t make_layout(const uint32_t block_size, const uint64_t data_blocks,
+    const checksum_algorithm_t algorithm, const uint64_t journal_blocks = 0)
+{
+    const uint32_t digest_length = checksum_digest_length(algorithm);
+    const uint64_t bitmap_blocks = (data_blocks + block_size * 8ULL - 1) / (block_size * 8ULL);
+    const uint64_t bitmap_checksum_blocks = (bitmap_blocks * digest_length + block_size - 1) / block_size;
+    const uint64_t checksum_blocks = (data_blocks * digest_length + block_size - 1) / block_size;
+    simplesnapfs_filesystem_head_t head { };
+    auto & info = head.static_information;
+    info.fs_identification_number = FILESYSTEM_MAGIC_NUMBER;
+    info.redundancy_fs_identification_number = FILESYSTEM_MAGIC_NUMBER;
+    info.fs_block_size = block_size;
+    info.checksum_algorithm = algorithm;
+    info.data_block_bitmap_blk_index = 1;
+    info.data_block_bitmap_blocks = bitmap_blocks;
+    info.redundancy_data_block_bitmap_blk_index = info.data_block_bitmap_blk_index + bitmap_blocks;
+    info.redundancy_data_block_bitmap_blocks = bitmap_blocks;
+    info.data_block_bitmap_checksum_blk_index = info.redundancy_data_block_bitmap_blk_index + bitmap_blocks;
+    info.data_block_bitmap_checksum_blocks = bitmap_checksum_blocks;
+    info.redundancy_data_block_bitmap_checksum_blk_index = info.data_block_bitmap_checksum_blk_index + bitmap_checksum_blocks;
+    info.redundancy_data_block_bitmap_checksum_blocks = bitmap_checksum_blocks;
+    info.data_block_index = info.redundancy_data_block_bitmap_checksum_blk_index + bitmap_checksum_blocks;
+    info.data_blocks = data_blocks;
+    info.data_block_checksum_blk_index = info.data_block_index + data_blocks;
+    info.data_block_checksum_blocks = checksum_blocks;
+    info.redundancy_data_block_checksum_blk_index = info.data_block_checksum_blk_index + checksum_blocks;
+    info.redundancy_data_block_checksum_blocks = checksum_blocks;
+    info.data_block_checksum_tree_blk_index = info.redundancy_data_block_checksum_blk_index + checksum_blocks;
+    info.data_block_checksum_tree_blocks = merkle_tree::blocks_needed(checksum_blocks, block_size, digest_length);
+    if (journal_blocks != 0)
+    {
+        info.journaling_buffer_blk_index = info.data_block_checksum_tree_blk_index + info.data_block_checksum_tree_blocks;
+        info.journaling_buffer_blocks = journal_blocks;
+    }
+    info.fs_dynamic_data_backup_blk_index = info.data_block_checksum_tree_blk_index + info.data_block_checksum_tree_blocks + journal_blocks;
+    info.fs_dynamic_data_backup_checksum_blk_index = info.fs_dynamic_data_backup_blk_index + 1;
+    info.fs_total_blocks = info.utilized_blocks = info.fs_dynamic_data_backup_checksum_blk_index + 1;
+
+    const auto static_checksum = sha512sum(reinterpret_cast<const char *>(&info), sizeof(info));
+    std::memcpy(head.checksum_filed.static_information_checksum, static_checksum.data(), 64);
+    return head;
+}
+
+// A filesystem as mkfs leaves it without lazy initialization: an empty bitmap
+// with valid checksums in both copies, zeroed data block checksums under an
+// empty tree, an empty journal, and the head with its backups.
+inline std::string format_filesystem(const std::string & name, const uint64_t device_blocks, const layout_configuration_t & configuration)
+{
+    auto head = plan_layout(device_blocks, configuration, name);
+    const auto & info = head.static_information;
+    const uint32_t block_size = info.fs_block_size;
+    const auto algorithm = static_cast<checksum_algorithm_t>(info.checksum_algorithm);
+    const auto path = create_image(name, device_blocks, block_size);
+
+    block_io io(path, block_size);
+    const uint32_t digest_length = checksum_digest_length(algorithm);
+    std::vector < char > bitmap_checksums(info.data_block_bitmap_blocks * digest_length);
+    for (uint64_t offset = 0; offset < bitmap_checksums.size(); offset += digest_length) {
+        std::memcpy(bitmap_checksums.data() + offset, zero_block_checksum(algorithm, block_size), digest_length);
+    }
+    for (const uint64_t region : { info.data_block_bitmap_checksum_blk_index, info.redundancy_data_block_bitmap_checksum_blk_index }) {
+        io.write_range(region * block_size, bitmap_checksums.size(), bitmap_checksums.data());
+    }
+    merkle_tree(io, head).build_empty();
+    journal::format(io, head);
+
+    const auto static_checksum = sha512sum(reinterpret_cast<const char *>(&info), sizeof(info));
+    std::memcpy(head.checksum_filed.static_information_checksum, static_checksum.data(), 64);
+    std::vector < char > backup(block_size), backup_checksum(block_size);
+    std::memcpy(backup.data(), &info, sizeof(info));
+    const auto backup_digest = sha512sum(backup.data(), block_size);
+    std::memcpy(backup_checksum.data(), backup_digest.data(), backup_digest.size());
+    io.write_range(info.fs_static_data_backup_blk_index * block_size, block_size, backup.data());
+    io.write_range(info.fs_static_data_backup_checksum_blk_index * block_size, block_size, backup_checksum.data());
+    store_dynamic_information(io, head);
+    return path;
+}
+
+#endif //TEST_IMAGE_H
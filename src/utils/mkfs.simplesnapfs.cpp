@@ -7,6 +7,16 @@
 #include <checksum.h>
 #include <cstring>
 #include <block_io.h>
+#include <merkle_tree.h>
+#include <algorithm>
+#include <layout.h>
+#include <thread_pool.h>
+#include <journal.h>
+#include <block_allocator.h>
+#include <snapshot_volume.h>
+#include <atomic>
+#include <functional>
+#include <future>
 
 #define PACKAGE_VERSION "0.0.1"
 #define PACKAGE_FULLNAME "Simple Snapshot Filesystem Formatting Tool"
@@ -14,7 +24,8 @@
 #define KBYTES(n) (1024 * n)
 #define MBYTES(n) (1024 * KBYTES(n))
 
-constexpr char empty_buffer [MBYTES(64)] { 0 };
+// metadata regions are zeroed this much at a time, one piece per worker
+#define ZEROING_PIECE_SIZE (1024ULL * MBYTES(1))
 
 void output_version(std::ostream & identifier)
 {
@@ -31,181 +42,69 @@ void output_help(const char * cmdline_name, std::ostream & identifier)
         "   --label,-L  [label]     Device label, optional.\n"
         "   --device,-d [device]    Specify the device to format.\n"
         "   --block_size,-B [block size]    Specify the block size.\n"
+        "   --direct,-D     Bypass the kernel page cache (O_DIRECT).\n"
+        "   --mmap,-M       Access the device through a memory mapping.\n"
+        "   --checksum,-C [algorithm]   Data block checksum: sha512 (default), crc32c, xxh3 or blake3.\n"
+        "   --lazy,-l       Leave the checksum regions and the journal to be zeroed after the first mount.\n"
+        "   --nodiscard,-N  Do not discard the data region.\n"
+        "   --journal_ratio,-J [ratio]  Data blocks per journal block, 50 by default.\n"
+        "   --reserved,-R [percent]     Space left unused at the end of the device, 0 by default.\n"
+        "   --alignment,-A [bytes]      Align every region to this (stripe or erase block size), a multiple of the block size.\n"
+        "   --snapshot_volume,-S [blocks]   Create a snapshot volume of this many blocks, to send snapshots from.\n"
         );
 }
 
-uint64_t cal_blk(const uint64_t elements, const uint64_t elements_one_block_occupy) {
-    return (elements / elements_one_block_occupy) + ((elements % elements_one_block_occupy == 0) ? 0 : 1);
-}
-
-uint64_t get_current_unix_timestamp()
+// run one step of formatting, reporting how long it took and how fast its bytes went by.
+// The step returns a note for the report, empty if it has none
+void timed_phase(const std::string & description, const uint64_t bytes, const std::function < std::string () > & phase)
 {
-    // Get current time since epoch in seconds
-    return std::chrono::duration_cast<std::chrono::seconds>(
-               std::chrono::system_clock::now().time_since_epoch()
-           ).count();
+    log(_log::LOG_NORMAL, description, "...");
+    const auto started = std::chrono::steady_clock::now();
+    const std::string note = phase();
+    const double seconds = std::chrono::duration < double > (std::chrono::steady_clock::now() - started).count();
+    if (bytes == 0 || seconds <= 0) {
+        _log::output_to_stream(std::cout, "done (", seconds, " s", note, ").\n");
+        return;
+    }
+    const double throughput = static_cast<double>(bytes) / MBYTES(1) / seconds;
+    _log::output_to_stream(std::cout, "done (", seconds, " s, ", throughput, " MiB/s", note, ").\n");
 }
 
-class limited_stack
+// zero runs of blocks, cut into ZEROING_PIECE_SIZE pieces zeroed side by side.
+// True if the device did all of it
+bool zero_regions(block_io & io, thread_pool & pool, const std::vector < std::pair < uint64_t, uint64_t > > & regions)
 {
-private:
-    std::array<uint64_t, 32> elements{}; // Fixed-size array to hold the last 32 elements
-    size_t size;                       // Tracks the number of elements currently in the stack
-    size_t next_index;                 // Index where the next push will be inserted
-
-public:
-    explicit limited_stack() : size(0), next_index(0) {}
-
-    // Push function: Adds an element to the stack
-    void push(const uint64_t value)
+    const uint64_t piece_blocks = std::max < uint64_t > (ZEROING_PIECE_SIZE / io.get_block_size(), 1);
+    std::vector < std::future < void > > pieces;
+    std::atomic < bool > offloaded = true;
+    for (const auto & [first_block, blocks] : regions)
     {
-        elements[next_index] = value;     // Insert the element at the current index
-        next_index = (next_index + 1) % 32; // Wrap around if we reach the end of the array
-        if (size < 32) {
-            size++; // Increase size only until we reach 32
+        for (uint64_t block = 0; block < blocks; block += piece_blocks)
+        {
+            pieces.emplace_back(pool.submit([&io, &offloaded, first = first_block + block, count = std::min(piece_blocks, blocks - block)] {
+                if (!io.zero_blocks(first, count)) {
+                    offloaded = false;
+                }
+            }));
         }
     }
 
-    // Search function: Checks if an element is present in the stack
-    [[nodiscard]] bool is_present(const uint64_t value) const
-    {
-        for (size_t i = 0; i < size; i++) {
-            if (elements[i] == value) {
-                return true; // Element found
-            }
-        }
-        return false; // Element not found
+    for (auto & piece : pieces) {
+        piece.get();
     }
-};
+    return offloaded;
+}
 
-// Function to calculate the unknown variables
-simplesnapfs_filesystem_head_t make_head(const uint32_t block_size, const uint64_t block_count, const char * label)
+// a copy of part of the head in a block of its own, and the SHA-512 of that block in the next one
+void write_head_backup(block_io & io, const uint64_t backup_block, const uint64_t checksum_block, const void * part, const uint64_t length)
 {
-    const uint64_t allowed_attempts = block_count;
-
-    if (block_count < 74) {
-        log(_log::LOG_ERROR, "Provided blocks are too few (", block_count, " blocks)! At least 74 blocks are needed to initialize the filesystem.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    limited_stack total_utilized_block_history;
-    // Estimating journaling_blocks initially
-    uint64_t estimated_journaling_blocks = (block_count - 5) / 51; // Basic estimate, adjust as needed
-    bool force_stop = false;
-
-    auto fs_inode_info_level = [](const uint16_t _block_size) -> uint32_t {
-        if (_block_size == 512) return 0;
-        else if (_block_size == 1024 || _block_size == 2048) return 1;
-        else return 3;
-    };
-
-    for (uint64_t attempt = 0; attempt < allowed_attempts; attempt++)
-    {
-        // Calculate dependent variables based on the current estimate
-        uint64_t data_blocks = 50 * estimated_journaling_blocks;
-        uint64_t data_block_bitmap_blocks = cal_blk(data_blocks, 8 * block_size);
-        uint64_t data_blk_bitmap_checksum_filed_blocks = cal_blk(data_block_bitmap_blocks, block_size / (512 / 8));
-        uint64_t data_blk_checksum_blocks = cal_blk(data_blocks, block_size / (512 / 8));
-
-        uint64_t logic_blocks = 2 * (data_block_bitmap_blocks + data_blk_bitmap_checksum_filed_blocks + data_blk_checksum_blocks) + data_blocks;
-        uint64_t utility_blocks = estimated_journaling_blocks + 5;
-
-        if (total_utilized_block_history.is_present(logic_blocks + utility_blocks) &&
-            (logic_blocks + utility_blocks < block_count))
-        {
-            force_stop = true;
-        }
-
-        total_utilized_block_history.push(logic_blocks + utility_blocks);
-
-        // Check if we match the block count
-        if (force_stop || utility_blocks + logic_blocks == block_count)
-        {
-            // Calculate base indexes for different sections to avoid redundant calculations
-            uint64_t filesystem_head = 1;
-            uint64_t data_bitmap_start = filesystem_head;
-            uint64_t redundancy_data_bitmap_start = data_bitmap_start + data_block_bitmap_blocks;
-            uint64_t data_bitmap_checksum_start = redundancy_data_bitmap_start + data_block_bitmap_blocks;
-            uint64_t redundancy_data_bitmap_checksum_start = data_bitmap_checksum_start + data_blk_bitmap_checksum_filed_blocks;
-            uint64_t data_blocks_start = redundancy_data_bitmap_checksum_start + data_blk_bitmap_checksum_filed_blocks;
-            uint64_t data_checksum_start = data_blocks_start + data_blocks;
-            uint64_t redundancy_data_checksum_start = data_checksum_start + data_blk_checksum_blocks;
-            uint64_t journaling_buffer_start = redundancy_data_checksum_start + data_blk_checksum_blocks;
-            uint64_t fs_static_backup_start = journaling_buffer_start + estimated_journaling_blocks;
-            uint64_t fs_static_backup_checksum_start = fs_static_backup_start + 1;
-            uint64_t fs_dynamic_backup_start = fs_static_backup_checksum_start + 1;
-            uint64_t fs_dynamic_backup_checksum_start = fs_dynamic_backup_start + 1;
-
-            simplesnapfs_filesystem_head_t head = {
-                .static_information = {
-                    .fs_identification_number = FILESYSTEM_MAGIC_NUMBER,
-
-                    .fs_total_blocks = block_count,
-                    .fs_block_size = block_size,
-                    .logic_blocks = logic_blocks,
-                    .utility_blocks = utility_blocks,
-                    .utilized_blocks = logic_blocks + utility_blocks,
-
-                    .filesystem_head_blk_index = 0,
-
-                    .data_block_bitmap_blk_index = data_bitmap_start,
-                    .data_block_bitmap_blocks = data_block_bitmap_blocks,
-
-                    .redundancy_data_block_bitmap_blk_index = redundancy_data_bitmap_start,
-                    .redundancy_data_block_bitmap_blocks = data_block_bitmap_blocks,
-
-                    .data_block_bitmap_checksum_blk_index = data_bitmap_checksum_start,
-                    .data_block_bitmap_checksum_blocks = data_blk_bitmap_checksum_filed_blocks,
-
-                    .redundancy_data_block_bitmap_checksum_blk_index = redundancy_data_bitmap_checksum_start,
-                    .redundancy_data_block_bitmap_checksum_blocks = data_blk_bitmap_checksum_filed_blocks,
-
-                    .data_block_index = data_blocks_start,
-                    .data_blocks = data_blocks,
-
-                    .data_block_checksum_blk_index = data_checksum_start,
-                    .data_block_checksum_blocks = data_blk_checksum_blocks,
-
-                    .redundancy_data_block_checksum_blk_index = redundancy_data_checksum_start,
-                    .redundancy_data_block_checksum_blocks = data_blk_checksum_blocks,
-
-                    .journaling_buffer_blk_index = journaling_buffer_start,
-                    .journaling_buffer_blocks = estimated_journaling_blocks,
-
-                    .fs_static_data_backup_blk_index = fs_static_backup_start,
-                    .fs_static_data_backup_checksum_blk_index = fs_static_backup_checksum_start,
-                    .fs_dynamic_data_backup_blk_index = fs_dynamic_backup_start,
-                    .fs_dynamic_data_backup_checksum_blk_index = fs_dynamic_backup_checksum_start,
-
-                    .fs_creation_unix_timestamp = get_current_unix_timestamp(),
-
-                    .inode_configuration_flag = {
-                        .inode_info_level = fs_inode_info_level(block_size),
-                    },
-
-                    .redundancy_fs_identification_number = FILESYSTEM_MAGIC_NUMBER
-                },
-
-                .dynamic_information = { }
-            };
-
-            strncpy(head.static_information.fs_label, label,
-                    std::min(sizeof(head.static_information.fs_label), strlen(label))
-                );
-
-            return head;
-        }
-
-        // Adjust journaling_blocks based on whether we're over or under the target
-        if (utility_blocks + logic_blocks < block_count) {
-            estimated_journaling_blocks++; // Increase to match
-        } else {
-            estimated_journaling_blocks--; // Decrease to match
-        }
-    }
-
-    log(_log::LOG_ERROR, "Calculation failed within the allowed attempts.\n");
-    exit(EXIT_FAILURE);
+    const uint32_t block_size = io.get_block_size();
+    std::vector < char > backup(block_size), backup_checksum(block_size);
+    std::memcpy(backup.data(), part, length);
+    const auto digest = sha512sum(backup.data(), block_size);
+    std::memcpy(backup_checksum.data(), digest.data(), digest.size());
+    io.write_range(backup_block * block_size, block_size, backup.data());
+    io.write_range(checksum_block * block_size, block_size, backup_checksum.data());
 }
 
 void block_size_sanity_check(const uint32_t block_size)
@@ -241,13 +140,31 @@ int main(int argc, char ** argv)
         {"device",  required_argument, nullptr, 'd'},
         {"label",   required_argument, nullptr, 'L'},
         {"block_size", required_argument, nullptr, 'B'},
+        {"direct",  no_argument,       nullptr, 'D'},
+        {"mmap",    no_argument,       nullptr, 'M'},
+        {"checksum", required_argument, nullptr, 'C'},
+        {"lazy",    no_argument,       nullptr, 'l'},
+        {"nodiscard", no_argument,     nullptr, 'N'},
+        {"journal_ratio", required_argument, nullptr, 'J'},
+        {"reserved", required_argument, nullptr, 'R'},
+        {"alignment", required_argument, nullptr, 'A'},
+        {"snapshot_volume", required_argument, nullptr, 'S'},
         {nullptr,   0,                 nullptr,  0 }  // End of options
     };
-    auto arguments = parse_arguments(argc, argv, options, "vhd:L:B:");
+    auto arguments = parse_arguments(argc, argv, options, "vhd:L:B:DMC:lNJ:R:A:S:");
 
     // flags:
     std::string device, label;
     unsigned int block_size = 4096;
+    bool direct_io = false;
+    bool memory_mapped = false;
+    checksum_algorithm_t checksum_algorithm = CHECKSUM_SHA512;
+    bool lazy_initialization = false;
+    bool discard = true;
+    uint64_t journal_ratio = LAYOUT_DEFAULT_JOURNAL_RATIO;
+    uint32_t reserved_percent = 0;
+    uint64_t alignment = 0;
+    uint64_t snapshot_volume_blocks = 0;
 
     for (auto arg = arguments.begin(); arg != arguments.end(); ++arg)
     {
@@ -268,6 +185,36 @@ int main(int argc, char ** argv)
         } else if (*arg == "-B") {
             arg += 1;
             block_size = strtol(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-D") {
+            direct_io = true;
+        } else if (*arg == "-M") {
+            memory_mapped = true;
+        } else if (*arg == "-C") {
+            arg += 1;
+            if (!checksum_algorithm_from_name(*arg, checksum_algorithm)) {
+                log(_log::LOG_ERROR, "Unknown checksum algorithm: ", *arg, "\n");
+                return EXIT_FAILURE;
+            }
+        } else if (*arg == "-l") {
+            lazy_initialization = true;
+        } else if (*arg == "-N") {
+            discard = false;
+        } else if (*arg == "-J") {
+            arg += 1;
+            journal_ratio = strtoull(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-R") {
+            arg += 1;
+            reserved_percent = strtoul(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-A") {
+            arg += 1;
+            alignment = strtoull(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-S") {
+            arg += 1;
+            snapshot_volume_blocks = strtoull(arg->c_str(), nullptr, 10);
+            if (snapshot_volume_blocks == 0) {
+                log(_log::LOG_ERROR, "Invalid snapshot volume size: ", *arg, "\n");
+                return EXIT_FAILURE;
+            }
         } else {
             log(_log::LOG_ERROR, "Unrecognized option: ", *arg, "\n");
             output_help(argv[0], std::cerr);
@@ -282,17 +229,51 @@ int main(int argc, char ** argv)
 
     block_size_sanity_check(block_size);
 
+    if (alignment % block_size != 0) {
+        log(_log::LOG_ERROR, "Alignment ", alignment, " is not a multiple of the block size\n");
+        return EXIT_FAILURE;
+    }
+
+    // the volume lives in the data region, which is not usable before lazy initialization is done
+    if (lazy_initialization && snapshot_volume_blocks != 0) {
+        log(_log::LOG_ERROR, "A snapshot volume cannot be created on a lazily initialized filesystem\n");
+        return EXIT_FAILURE;
+    }
+
     log(_log::LOG_NORMAL, "Proceeding with the following setup:\n");
     log(_log::LOG_NORMAL, "Label:       ", (label.empty() ? "None" : label), "\n");
     log(_log::LOG_NORMAL, "Block size:  ", block_size, "\n");
     log(_log::LOG_NORMAL, "Device path: ", device, "\n");
-
+    log(_log::LOG_NORMAL, "Direct I/O:  ", (direct_io ? "Yes" : "No"), "\n");
+    log(_log::LOG_NORMAL, "Mapped I/O:  ", (memory_mapped ? "Yes" : "No"), "\n");
+    log(_log::LOG_NORMAL, "Checksum:    ", checksum_algorithm_name(checksum_algorithm),
+        (checksum_algorithm == CHECKSUM_CRC32C && crc32c_is_hardware_accelerated() ? " (hardware accelerated)" : ""), "\n");
+    log(_log::LOG_NORMAL, "Lazy init:   ", (lazy_initialization ? "Yes" : "No"), "\n");
+    log(_log::LOG_NORMAL, "Discard:     ", (discard ? "Yes" : "No"), "\n");
+    log(_log::LOG_NORMAL, "Journal:     1 block per ", journal_ratio, " data blocks\n");
+    log(_log::LOG_NORMAL, "Reserved:    ", reserved_percent, "%\n");
+    log(_log::LOG_NORMAL, "Alignment:   ", (alignment == 0 ? block_size : alignment), " bytes\n");
+    log(_log::LOG_NORMAL, "Snapshots:   ", (snapshot_volume_blocks == 0 ? std::string("No volume")
+        : "Volume of " + std::to_string(snapshot_volume_blocks) + " blocks"), "\n");
+
+    const auto format_started = std::chrono::steady_clock::now();
     log(_log::LOG_NORMAL, "Opening device...");
-    block_io io(device, block_size);
+    block_io io(device, block_size, { .direct_io = direct_io, .memory_mapped = memory_mapped });
     _log::output_to_stream(std::cout, "done.\n");
 
     log(_log::LOG_NORMAL, "Calculating filesystem layout...");
-    auto head = make_head(block_size, io.get_total_blocks(), label.c_str());
+    simplesnapfs_filesystem_head_t head;
+    try {
+        head = plan_layout(io.get_total_blocks(), {
+            .block_size = block_size,
+            .checksum_algorithm = checksum_algorithm,
+            .journal_ratio = journal_ratio,
+            .reserved_percent = reserved_percent,
+            .alignment = std::max < uint64_t > (alignment / block_size, 1),
+        }, label);
+    } catch (InvalidLayout &) {
+        return EXIT_FAILURE;
+    }
 
     // Output results
     _log::output_to_stream(std::cout, "done.\n");
@@ -307,8 +288,9 @@ int main(int argc, char ** argv)
     log(_log::LOG_NORMAL, "  │    ├────── Data Block Bitmap Checksum Blocks = ", head.static_information.data_block_bitmap_checksum_blocks, "\n");
     log(_log::LOG_NORMAL, "  │    ├────── Redundancy Data Block Bitmap Checksum Blocks = ", head.static_information.redundancy_data_block_bitmap_checksum_blocks, "\n");
     log(_log::LOG_NORMAL, "  │    ├────── Data Blocks = ", head.static_information.data_blocks, "\n");
-    log(_log::LOG_NORMAL, "  │    ├────── Data Block Sha512sum Checksum Blocks = ", head.static_information.data_block_checksum_blocks, "\n");
-    log(_log::LOG_NORMAL, "  │    └────── Redundancy Data Block Checksum Sha512sum Blocks = ", head.static_information.redundancy_data_block_checksum_blocks, "\n");
+    log(_log::LOG_NORMAL, "  │    ├────── Data Block Checksum Blocks = ", head.static_information.data_block_checksum_blocks, "\n");
+    log(_log::LOG_NORMAL, "  │    ├────── Redundancy Data Block Checksum Blocks = ", head.static_information.redundancy_data_block_checksum_blocks, "\n");
+    log(_log::LOG_NORMAL, "  │    └────── Data Block Checksum Tree Blocks = ", head.static_information.data_block_checksum_tree_blocks, "\n");
     log(_log::LOG_NORMAL, "  └────┬─ Utility Blocks = ", head.static_information.utility_blocks, "\n");
     log(_log::LOG_NORMAL, "       ├────── Filesystem Head Static Backup Blocks = 5", "\n");
     log(_log::LOG_NORMAL, "       └────── Journaling Buffer Blocks = ", head.static_information.journaling_buffer_blocks, "\n");
@@ -331,6 +313,8 @@ int main(int argc, char ** argv)
     log(_log::LOG_NORMAL, "  ├──────────────────────────────────┤ \n");
     log(_log::LOG_NORMAL, "  │  DATA BLOCK CHECKSUM REDUNDANCY  │ * ", head.static_information.redundancy_data_block_checksum_blocks, " block(s)\n");
     log(_log::LOG_NORMAL, "  ├──────────────────────────────────┤ \n");
+    log(_log::LOG_NORMAL, "  │     DATA BLOCK CHECKSUM TREE     │ * ", head.static_information.data_block_checksum_tree_blocks, " block(s)\n");
+    log(_log::LOG_NORMAL, "  ├──────────────────────────────────┤ \n");
     log(_log::LOG_NORMAL, "  │         JOURNALING BUFFER        │ * ", head.static_information.journaling_buffer_blocks, " block(s)\n");
     log(_log::LOG_NORMAL, "  ├──────────────────────────────────┤ \n");
     log(_log::LOG_NORMAL, "  │   FILESYSTEM STATIC DATA BACKUP  │ * 1 block\n");
@@ -343,70 +327,114 @@ int main(int argc, char ** argv)
     log(_log::LOG_NORMAL, "  └──────────────────────────────────┘ \n");
     log(_log::LOG_NORMAL, "─────────────────────────────────────────────────────────────────────────────────────────────\n");
 
-    log(_log::LOG_NORMAL, "Generating checksum for head...");
-    auto static_checksum = sha512sum((const char*)&head.static_information, sizeof(head.static_information));
-    auto dynamic_checksum = sha512sum((const char*)&head.dynamic_information, sizeof(head.dynamic_information));
-    std::memcpy(head.checksum_filed.static_information_checksum, static_checksum.data(), 64);
-    std::memcpy(head.checksum_filed.dynamic_information_checksum, dynamic_checksum.data(), 64);
-    _log::output_to_stream(std::cout, "done.\n");
-
-    log(_log::LOG_NORMAL, "As of now, filesystem header is now constructed.\n");
-
-    log(_log::LOG_NORMAL, "─────────────────────────────────────────────────────────────────────────────────────────────\n");
-    log(_log::LOG_NORMAL, "Writing filesystem head...");
-    io.get_block(0).write(empty_buffer, block_size, 0);
-    io.get_block(0).write((const char*)&head, sizeof(head), 0);
-    _log::output_to_stream(std::cout, "done.\n");
+    const auto & info = head.static_information;
+    thread_pool pool;
 
-    log(_log::LOG_NORMAL, "Clearing bitmap and bitmap redundancy...");
-    constexpr uint64_t bitmap_starting_block = 1 /* filesystem head */;
-    const uint64_t bitmap_and_redundancy_blocks =
-        head.static_information.data_block_bitmap_blocks +
-        head.static_information.redundancy_data_block_bitmap_blocks +
-        head.static_information.data_block_bitmap_checksum_blocks +
-        head.static_information.redundancy_data_block_bitmap_checksum_blocks;
-    for (uint64_t current_block = bitmap_starting_block; current_block <= bitmap_and_redundancy_blocks; current_block++) {
-        io.get_block(current_block).write(empty_buffer, block_size, 0);
+    // free data blocks are never read, the device may as well forget them
+    if (discard)
+    {
+        timed_phase("Discarding data blocks", info.data_blocks * block_size, [&] {
+            return std::string(io.discard_blocks(info.data_block_index, info.data_blocks) ? "" : ", not supported by the device");
+        });
     }
-    _log::output_to_stream(std::cout, "done.\n");
 
-    log(_log::LOG_NORMAL, "Clearing data block checksum and data block checksum redundancy...");
-    const uint64_t skipped_blocks_for_emptying_blk_checksum_and_redundancy = head.static_information.data_block_checksum_blk_index;
-    const uint64_t data_block_checksum_block_and_redundancy_and_journaling =
-        head.static_information.data_block_checksum_blocks +
-        head.static_information.redundancy_data_block_checksum_blocks +
-        head.static_information.journaling_buffer_blocks;
-    for (uint64_t current_block = skipped_blocks_for_emptying_blk_checksum_and_redundancy;
-        current_block <= skipped_blocks_for_emptying_blk_checksum_and_redundancy + data_block_checksum_block_and_redundancy_and_journaling;
-        current_block++)
+    // the regions are independent of one another, so they are zeroed side by side
+    constexpr uint64_t bitmap_starting_block = 1 /* filesystem head */;
+    std::vector < std::pair < uint64_t, uint64_t > > regions {
+        { bitmap_starting_block, info.data_block_bitmap_blocks + info.redundancy_data_block_bitmap_blocks
+                                 + info.data_block_bitmap_checksum_blocks + info.redundancy_data_block_bitmap_checksum_blocks },
+    };
+    if (lazy_initialization)
     {
-        io.get_block(current_block).write(empty_buffer, block_size, 0);
+        // zeroed and given their tree by lazy_initializer once mounted
+        log(_log::LOG_NORMAL, "Data block checksums, checksum tree and journal are left for lazy initialization.\n");
+        head.dynamic_information.fs_dynamically_set_flags.lazy_initialization = 1;
+    } else {
+        // the tree is written whole by build_empty(), it needs no zeroing
+        regions.emplace_back(info.data_block_checksum_blk_index, info.data_block_checksum_blocks + info.redundancy_data_block_checksum_blocks);
+        regions.emplace_back(info.journaling_buffer_blk_index, info.journaling_buffer_blocks);
     }
-    _log::output_to_stream(std::cout, "done.\n");
 
-    log(_log::LOG_NORMAL, "Writing filesystem static head backup...");
-    std::vector < char > static_block(block_size), static_fs_head_block_checksum_for_write(block_size);
-    io.get_block(head.static_information.fs_static_data_backup_blk_index).write(empty_buffer, block_size, 0);
-    io.get_block(head.static_information.fs_static_data_backup_blk_index).write((const char*)&head.static_information, sizeof(head.static_information), 0);
+    uint64_t zeroed_blocks = 0;
+    for (const auto & region : regions) {
+        zeroed_blocks += region.second;
+    }
+    timed_phase("Zeroing metadata regions on " + std::to_string(pool.size()) + " threads", zeroed_blocks * block_size, [&] {
+        return std::string(zero_regions(io, pool, regions) ? ", zeroed by the device" : "");
+    });
+
+    // the cleared bitmap blocks need valid checksums, in both copies, all the same
+    const uint32_t digest_length = checksum_digest_length(checksum_algorithm);
+    std::vector < char > bitmap_checksums(info.data_block_bitmap_blocks * digest_length);
+    timed_phase("Writing bitmap checksums", 2 * bitmap_checksums.size(), [&] {
+        const char * zero_digest = zero_block_checksum(checksum_algorithm, block_size);
+        for (uint64_t offset = 0; offset < bitmap_checksums.size(); offset += digest_length) {
+            std::memcpy(bitmap_checksums.data() + offset, zero_digest, digest_length);
+        }
+        io.write_range(info.data_block_bitmap_checksum_blk_index * block_size, bitmap_checksums.size(), bitmap_checksums.data());
+        io.write_range(info.redundancy_data_block_bitmap_checksum_blk_index * block_size, bitmap_checksums.size(), bitmap_checksums.data());
+        return std::string();
+    });
 
-    // read the block for checksum:
-    io.get_block(head.static_information.fs_static_data_backup_blk_index).read(static_block.data(), block_size, 0);
-    auto static_fs_head_block_checksum = sha512sum(static_block.data(), block_size);
-    std::memcpy(static_fs_head_block_checksum_for_write.data(), static_fs_head_block_checksum.data(), 64);
-    io.get_block(head.static_information.fs_static_data_backup_checksum_blk_index).write(static_fs_head_block_checksum_for_write.data(), block_size, 0);
-    _log::output_to_stream(std::cout, "done.\n");
+    // the root goes into the head, so the tree is built before the head is sealed
+    if (!lazy_initialization)
+    {
+        timed_phase("Building data block checksum tree", info.data_block_checksum_tree_blocks * block_size, [&] {
+            merkle_tree(io, head).build_empty();
+            return std::string();
+        });
+    }
 
-    log(_log::LOG_NORMAL, "Writing filesystem dynamic head backup...");
-    std::vector < char > dynamic_block(block_size), dynamic_fs_head_block_checksum_for_write(block_size);
-    io.get_block(head.static_information.fs_dynamic_data_backup_blk_index).write(empty_buffer, block_size, 0);
-    io.get_block(head.static_information.fs_dynamic_data_backup_blk_index).write((const char*)&head.dynamic_information, sizeof(head.dynamic_information), 0);
+    // an empty log with an identity of its own, so nothing left on the device is ever replayed
+    timed_phase("Writing journal superblock", block_size, [&] {
+        journal::format(io, head);
+        return std::string();
+    });
+
+    timed_phase("Writing filesystem head and backups", 5ULL * block_size, [&] {
+        auto static_checksum = sha512sum((const char*)&head.static_information, sizeof(head.static_information));
+        auto dynamic_checksum = sha512sum((const char*)&head.dynamic_information, sizeof(head.dynamic_information));
+        std::memcpy(head.checksum_filed.static_information_checksum, static_checksum.data(), 64);
+        std::memcpy(head.checksum_filed.dynamic_information_checksum, dynamic_checksum.data(), 64);
+
+        std::vector < char > head_block(block_size);
+        std::memcpy(head_block.data(), &head, sizeof(head));
+        io.write_range(0, block_size, head_block.data());
+        write_head_backup(io, info.fs_static_data_backup_blk_index, info.fs_static_data_backup_checksum_blk_index,
+            &head.static_information, sizeof(head.static_information));
+        write_head_backup(io, info.fs_dynamic_data_backup_blk_index, info.fs_dynamic_data_backup_checksum_blk_index,
+            &head.dynamic_information, sizeof(head.dynamic_information));
+        return std::string();
+    });
+
+    timed_phase("Flushing changes to device", 0, [&] {
+        io.sync();
+        return std::string();
+    });
+
+    // made on the finished filesystem, storing it syncs the device and the head again
+    if (snapshot_volume_blocks != 0)
+    {
+        try {
+            timed_phase("Creating snapshot volume", block_size, [&] {
+                block_allocator allocator(io, head);
+                snapshot_volume::create(io, head, allocator, snapshot_volume_blocks);
+                return std::string();
+            });
+        } catch (fs_error_t &) {
+            return EXIT_FAILURE;
+        }
+    }
 
-    // read the block for checksum:
-    io.get_block(head.static_information.fs_dynamic_data_backup_blk_index).read(dynamic_block.data(), block_size, 0);
-    auto dynamic_fs_head_block_checksum = sha512sum(dynamic_block.data(), block_size);
-    std::memcpy(dynamic_fs_head_block_checksum_for_write.data(), dynamic_fs_head_block_checksum.data(), 64);
-    io.get_block(head.static_information.fs_dynamic_data_backup_checksum_blk_index).write(dynamic_fs_head_block_checksum_for_write.data(), block_size, 0);
-    _log::output_to_stream(std::cout, "done.\n");
+    if (!io.is_memory_mapped())
+    {
+        const auto io_statistics = io.get_io_statistics();
+        log(_log::LOG_NORMAL, "Blocks written: ", io_statistics.writeback_blocks,
+            ", write calls: ", io_statistics.writeback_syscalls,
+            ", write calls saved by coalescing: ", io_statistics.syscalls_saved,
+            ", written in the background: ", io_statistics.background_blocks, "\n");
+    }
 
+    log(_log::LOG_NORMAL, "Formatted in ", std::chrono::duration < double > (std::chrono::steady_clock::now() - format_started).count(), " s\n");
     return 0;
 }
@@ -0,0 +1,83 @@
+#include <utility.h>
+#include <cstdint>
+#include <unistd.h>
+#include <debug.h>
+#include <simplesnapfs.h>
+#include <block_io.h>
+#include <snapshot_stream.h>
+#include <iostream>
+#include <chrono>
+
+#define PACKAGE_VERSION "0.0.1"
+#define PACKAGE_FULLNAME "Simple Snapshot Filesystem Snapshot Receiving Tool"
+
+#define MBYTES(n) (1024 * 1024 * n)
+
+void output_version(std::ostream & identifier)
+{
+    _log::output_to_stream(identifier, PACKAGE_FULLNAME, " ", PACKAGE_VERSION, "\n");
+}
+
+void output_help(const char * cmdline_name, std::ostream & identifier)
+{
+    output_version(identifier);
+    _log::output_to_stream(identifier, cmdline_name, " [OPTIONS [PARAMETERS]...] < stream\n",
+        "   --version,-V    Output version.\n"
+        "   --help,-h       Output this help message.\n"
+        "   --device,-d [device]    Specify the device to receive into, formatted by mkfs.simplesnapfs.\n"
+        );
+}
+
+int main(int argc, char ** argv)
+{
+    const option options[] = {
+        {"version", no_argument,       nullptr, 'v'},
+        {"help",    no_argument,       nullptr, 'h'},
+        {"device",  required_argument, nullptr, 'd'},
+        {nullptr,   0,                 nullptr,  0 }  // End of options
+    };
+    auto arguments = parse_arguments(argc, argv, options, "vhd:");
+
+    std::string device;
+
+    for (auto arg = arguments.begin(); arg != arguments.end(); ++arg)
+    {
+        if (*arg == "-h") {
+            output_help(argv[0], std::cout);
+            return EXIT_SUCCESS;
+        } else if (*arg == "-v") {
+            output_version(std::cout);
+            return EXIT_SUCCESS;
+        } else if (*arg == "-d") {
+            arg += 1;
+            device = *arg;
+        } else {
+            log(_log::LOG_ERROR, "Unrecognized option: ", *arg, "\n");
+            output_help(argv[0], std::cerr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (device.empty()) {
+        log(_log::LOG_ERROR, "You have to provide a device path!\n");
+        return EXIT_FAILURE;
+    }
+    if (isatty(STDIN_FILENO)) {
+        log(_log::LOG_ERROR, "Refusing to read a snapshot stream from a terminal, redirect it!\n");
+        return EXIT_FAILURE;
+    }
+
+    try {
+        block_io io(device, read_block_size(device));
+        const auto started = std::chrono::steady_clock::now();
+        const auto statistics = receive_snapshot_stream(io, std::cin);
+        const double seconds = std::chrono::duration < double > (std::chrono::steady_clock::now() - started).count();
+        log(_log::LOG_NORMAL, "Received ", statistics.changed_blocks, " changed blocks, ", statistics.sent_blocks, " with contents, ",
+            statistics.zero_blocks, " zeros; ", statistics.stream_bytes / MBYTES(1), " MiB in ", seconds, " s\n");
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#include <utility.h>
+#include <cstdint>
+#include <debug.h>
+#include <simplesnapfs.h>
+#include <scrub.h>
+#include <filesystem_head.h>
+#include <lazy_initializer.h>
+#include <chrono>
+
+#define PACKAGE_VERSION "0.0.1"
+#define PACKAGE_FULLNAME "Simple Snapshot Filesystem Scrubbing Tool"
+
+#define MBYTES(n) (1024 * 1024 * n)
+
+void output_version(std::ostream & identifier)
+{
+    _log::output_to_stream(identifier, PACKAGE_FULLNAME, " ", PACKAGE_VERSION, "\n");
+}
+
+void output_help(const char * cmdline_name, std::ostream & identifier)
+{
+    output_version(identifier);
+    _log::output_to_stream(identifier, cmdline_name, " [OPTIONS [PARAMETERS]...]\n",
+        "   --version,-V    Output version.\n"
+        "   --help,-h       Output this help message.\n"
+        "   --device,-d [device]    Specify the device to scrub.\n"
+        "   --repair,-r     Rewrite bad copies from the good ones (default: only report).\n"
+        "   --threads,-j [threads]  Hashing threads, one per CPU by default.\n"
+        "   --rate,-l [MiB/s]       Limit the read rate, unlimited by default.\n"
+        "   --initialize,-i Finish the initialization of a lazily formatted filesystem first.\n"
+        );
+}
+
+int main(int argc, char ** argv)
+{
+    const option options[] = {
+        {"version", no_argument,       nullptr, 'v'},
+        {"help",    no_argument,       nullptr, 'h'},
+        {"device",  required_argument, nullptr, 'd'},
+        {"repair",  no_argument,       nullptr, 'r'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"rate",    required_argument, nullptr, 'l'},
+        {"initialize", no_argument,    nullptr, 'i'},
+        {nullptr,   0,                 nullptr,  0 }  // End of options
+    };
+    auto arguments = parse_arguments(argc, argv, options, "vhd:rj:l:i");
+
+    std::string device;
+    scrub_configuration_t configuration { };
+    bool initialize = false;
+
+    for (auto arg = arguments.begin(); arg != arguments.end(); ++arg)
+    {
+        if (*arg == "-h") {
+            output_help(argv[0], std::cout);
+            return EXIT_SUCCESS;
+        } else if (*arg == "-v") {
+            output_version(std::cout);
+            return EXIT_SUCCESS;
+        } else if (*arg == "-d") {
+            arg += 1;
+            device = *arg;
+        } else if (*arg == "-r") {
+            configuration.repair = true;
+        } else if (*arg == "-j") {
+            arg += 1;
+            configuration.hashing_threads = strtoul(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-l") {
+            arg += 1;
+            configuration.rate_limit = strtoull(arg->c_str(), nullptr, 10) * MBYTES(1);
+        } else if (*arg == "-i") {
+            initialize = true;
+        } else {
+            log(_log::LOG_ERROR, "Unrecognized option: ", *arg, "\n");
+            output_help(argv[0], std::cerr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (device.empty()) {
+        log(_log::LOG_ERROR, "You have to provide a device path!\n");
+        return EXIT_FAILURE;
+    }
+
+    try {
+        block_io io(device, read_block_size(device));
+
+        if (initialize)
+        {
+            auto head = load_filesystem_head(io);
+            if (lazy_initializer::is_needed(head))
+            {
+                log(_log::LOG_NORMAL, "Initializing checksum regions, checksum tree and journal...");
+                const auto started = std::chrono::steady_clock::now();
+                lazy_initializer initializer(io, head);
+                initializer.start();
+                initializer.wait();
+                _log::output_to_stream(std::cout, "done (", initializer.get_total_blocks(), " blocks in ",
+                    std::chrono::duration < double > (std::chrono::steady_clock::now() - started).count(), " s).\n");
+            }
+        }
+
+        // one line per percent of the data region at most
+        uint64_t last_percent = UINT64_MAX;
+        configuration.progress = [&](const scrub_statistics_t & progress)
+        {
+            const uint64_t percent = progress.data_blocks_total == 0 ? 100
+                : progress.data_blocks_checked * 100 / progress.data_blocks_total;
+            if (percent == last_percent) {
+                return;
+            }
+            last_percent = percent;
+
+            const double throughput = progress.elapsed_seconds > 0
+                ? static_cast<double>(progress.bytes_read) / MBYTES(1) / progress.elapsed_seconds : 0;
+            log(_log::LOG_NORMAL, "Scrubbed ", progress.data_blocks_checked, "/", progress.data_blocks_total,
+                " allocated blocks (", percent, "%), ", throughput, " MiB/s\n");
+        };
+
+        scrubber scrub(io, configuration);
+        log(_log::LOG_NORMAL, "Scrubbing ", device, " (checksum: ",
+            checksum_algorithm_name(static_cast<checksum_algorithm_t>(scrub.get_head().static_information.checksum_algorithm)),
+            ")...\n");
+        const auto result = scrub.run();
+
+        log(_log::LOG_NORMAL, "Bitmap blocks checked: ", result.bitmap_blocks_checked,
+            ", data blocks checked: ", result.data_blocks_checked, ", read: ", result.bytes_read / MBYTES(1),
+            " MiB in ", result.elapsed_seconds, " s\n");
+        log(_log::LOG_NORMAL, "Bitmap errors: ", result.bitmap_errors, ", checksum errors: ", result.checksum_errors,
+            ", checksum tree errors: ", result.tree_errors, ", unrecoverable blocks: ", result.unrecoverable_blocks, ", repaired: ", result.repaired, "\n");
+
+        if (result.unrecoverable_blocks != 0) {
+            return EXIT_FAILURE;
+        }
+        if (!configuration.repair && result.bitmap_errors + result.checksum_errors + result.tree_errors != 0) {
+            return EXIT_FAILURE;
+        }
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
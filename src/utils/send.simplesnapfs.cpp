@@ -0,0 +1,146 @@
+#include <utility.h>
+#include <cstdint>
+#include <unistd.h>
+#include <debug.h>
+#include <simplesnapfs.h>
+#include <block_io.h>
+#include <block_allocator.h>
+#include <filesystem_head.h>
+#include <snapshot_volume.h>
+#include <snapshot_stream.h>
+#include <iostream>
+#include <chrono>
+
+#define PACKAGE_VERSION "0.0.1"
+#define PACKAGE_FULLNAME "Simple Snapshot Filesystem Snapshot Sending Tool"
+
+#define MBYTES(n) (1024 * 1024 * n)
+
+// the stream goes to stdout, so everything else goes to stderr
+void output_version(std::ostream & identifier)
+{
+    _log::output_to_stream(identifier, PACKAGE_FULLNAME, " ", PACKAGE_VERSION, "\n");
+}
+
+void output_help(const char * cmdline_name, std::ostream & identifier)
+{
+    output_version(identifier);
+    _log::output_to_stream(identifier, cmdline_name, " [OPTIONS [PARAMETERS]...] > stream\n",
+        "   --version,-V    Output version.\n"
+        "   --help,-h       Output this help message.\n"
+        "   --device,-d [device]    Specify the device to send from.\n"
+        "   --from,-f [epoch]       Send only what changed since this snapshot, which the receiver holds.\n"
+        "   --to,-t [epoch]         Snapshot to send, the live volume by default.\n"
+        "   --snapshot,-s   Snapshot the live volume and send that snapshot.\n"
+        "   --list,-l       List the snapshots instead.\n"
+        );
+}
+
+int main(int argc, char ** argv)
+{
+    const option options[] = {
+        {"version",  no_argument,       nullptr, 'v'},
+        {"help",     no_argument,       nullptr, 'h'},
+        {"device",   required_argument, nullptr, 'd'},
+        {"from",     required_argument, nullptr, 'f'},
+        {"to",       required_argument, nullptr, 't'},
+        {"snapshot", no_argument,       nullptr, 's'},
+        {"list",     no_argument,       nullptr, 'l'},
+        {nullptr,    0,                 nullptr,  0 }  // End of options
+    };
+    auto arguments = parse_arguments(argc, argv, options, "vhd:f:t:sl");
+
+    std::string device;
+    uint64_t from_epoch = 0, to_epoch = 0;
+    bool take_snapshot = false, list = false;
+
+    for (auto arg = arguments.begin(); arg != arguments.end(); ++arg)
+    {
+        if (*arg == "-h") {
+            output_help(argv[0], std::cerr);
+            return EXIT_SUCCESS;
+        } else if (*arg == "-v") {
+            output_version(std::cerr);
+            return EXIT_SUCCESS;
+        } else if (*arg == "-d") {
+            arg += 1;
+            device = *arg;
+        } else if (*arg == "-f") {
+            arg += 1;
+            from_epoch = strtoull(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-t") {
+            arg += 1;
+            to_epoch = strtoull(arg->c_str(), nullptr, 10);
+        } else if (*arg == "-s") {
+            take_snapshot = true;
+        } else if (*arg == "-l") {
+            list = true;
+        } else {
+            log(_log::LOG_ERROR, "Unrecognized option: ", *arg, "\n");
+            output_help(argv[0], std::cerr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (device.empty()) {
+        log(_log::LOG_ERROR, "You have to provide a device path!\n");
+        return EXIT_FAILURE;
+    }
+    if (take_snapshot && to_epoch != 0) {
+        log(_log::LOG_ERROR, "Either send a new snapshot or an existing one!\n");
+        return EXIT_FAILURE;
+    }
+    if (!list && isatty(STDOUT_FILENO)) {
+        log(_log::LOG_ERROR, "Refusing to write a snapshot stream to a terminal, redirect it!\n");
+        return EXIT_FAILURE;
+    }
+
+    try {
+        block_io io(device, read_block_size(device));
+        auto head = load_filesystem_head(io);
+        if (head.dynamic_information.snapshot_volume_descriptor == 0)
+        {
+            log(_log::LOG_ERROR, "No snapshot volume on ", device, ", format it with mkfs.simplesnapfs --snapshot_volume\n");
+            return EXIT_FAILURE;
+        }
+        block_allocator allocator(io, head);
+        snapshot_volume volume(io, head, allocator);
+
+        if (list)
+        {
+            for (const auto & snapshot : volume.get_snapshots()) {
+                const std::string origin = snapshot.received_from == 0 ? std::string()
+                    : ", received as epoch " + std::to_string(snapshot.received_from);
+                _log::output_to_stream(std::cout, "Epoch ", snapshot.epoch, ", taken at ", snapshot.creation_unix_timestamp, origin, "\n");
+            }
+            return EXIT_SUCCESS;
+        }
+
+        if (take_snapshot)
+        {
+            to_epoch = volume.create_snapshot();
+            volume.sync();
+        }
+
+        snapshot_t from { }, to { };
+        if (from_epoch != 0) {
+            from = volume.find_snapshot(from_epoch);
+        }
+        if (to_epoch != 0) {
+            to = volume.find_snapshot(to_epoch);
+        }
+
+        const auto started = std::chrono::steady_clock::now();
+        const auto statistics = send_snapshot_stream(volume, from_epoch == 0 ? nullptr : &from, to_epoch == 0 ? nullptr : &to, std::cout);
+        const double seconds = std::chrono::duration < double > (std::chrono::steady_clock::now() - started).count();
+        _log::output_to_stream(std::cerr, "Sent ", to_epoch == 0 ? std::string("the live volume") : "epoch " + std::to_string(to_epoch),
+            from_epoch == 0 ? std::string() : " since epoch " + std::to_string(from_epoch), ": ",
+            statistics.changed_blocks, " changed blocks, ", statistics.sent_blocks, " sent, ", statistics.zero_blocks, " zeros, ",
+            statistics.unchanged_blocks, " unchanged; ", statistics.stream_bytes / MBYTES(1), " MiB in ", seconds, " s\n");
+    } catch (fs_error_t & e) {
+        log(_log::LOG_ERROR, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,4 +1,8 @@
 #include <utility.h>
+#include <debug.h>
+#include <simplesnapfs.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 std::vector<std::string> parse_arguments(int argc, char** argv, const option long_options[], const char* short_options)
 {
@@ -36,3 +40,24 @@ std::vector<std::string> parse_arguments(int argc, char** argv, const option lon
 
     return arguments;
 }
+
+uint32_t read_block_size(const std::string & device)
+{
+    simplesnapfs_filesystem_head_t head { };
+    const int fd = open(device.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        log(_log::LOG_ERROR, "Error opening file: ", device, "\n");
+        throw CannotOpenFile();
+    }
+
+    const auto bytes_read = pread(fd, &head, sizeof(head), 0);
+    close(fd);
+    if (bytes_read != sizeof(head) || head.static_information.fs_identification_number != FILESYSTEM_MAGIC_NUMBER)
+    {
+        log(_log::LOG_ERROR, "No SimpleSnapFS found on ", device, "\n");
+        throw InvalidFilesystemHead();
+    }
+
+    return head.static_information.fs_block_size;
+}